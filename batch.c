@@ -0,0 +1,44 @@
+#include "batch.h"
+#include "markov_port.h"
+#include "leaky_bucket_port.h"
+#include "plc_port.h"
+#include "silence_port.h"
+#include "stage_port.h"
+#include "fanout_port.h"
+#define THIS_FILE   "batch.c"
+
+typedef pj_status_t (*em_put_frames_cb)(pjmedia_port *port,
+        const pjmedia_frame frames[], unsigned count);
+
+static const struct {
+    pj_uint32_t       signature;
+    em_put_frames_cb  put_frames;
+} batch_ports[] = {
+    { PJMEDIA_MARKOV_PORT_SIGNATURE, &pjmedia_markov_port_put_frames },
+    { PJMEDIA_LEAKY_BUCKET_PORT_SIGNATURE,
+        &pjmedia_leaky_bucket_port_put_frames },
+    { PJMEDIA_PLC_PORT_SIGNATURE, &pjmedia_plc_port_put_frames },
+    { PJMEDIA_SILENCE_PORT_SIGNATURE, &pjmedia_silence_port_put_frames },
+    { PJMEDIA_STAGE_PORT_SIGNATURE, &pjmedia_stage_port_put_frames },
+    { PJMEDIA_FANOUT_PORT_SIGNATURE, &pjmedia_fanout_port_put_frames },
+};
+
+
+PJ_DEF(pj_status_t) em_port_put_frames(pjmedia_port *port,
+        const pjmedia_frame frames[], unsigned count)
+{
+    pj_status_t status;
+    unsigned i;
+
+    PJ_ASSERT_RETURN(port && (frames || !count), PJ_EINVAL);
+    for (i=0; i<PJ_ARRAY_SIZE(batch_ports); i++)
+        if (port->info.signature == batch_ports[i].signature)
+            return (*batch_ports[i].put_frames)(port, frames, count);
+    /* not aware of batches */
+    for (i=0; i<count; i++) {
+        status = pjmedia_port_put_frame(port, &frames[i]);
+        if (status != PJ_SUCCESS)
+            return status;
+    }
+    return PJ_SUCCESS;
+}
@@ -0,0 +1,82 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <pjlib.h>
+#include <pjlib-util.h>
+#include <pjmedia.h>
+
+/* frames passed to a port in one call at most */
+#define EM_BATCH_MAX        32
+
+/*
+ * Batched put_frame. The ports of the channel (markov, leaky bucket, plc
+ * and silence), the stage and fan-out ports take an array of frames in one
+ * call and pass their output downstream in arrays too, so the signature
+ * check, the indirect call and the per-call bookkeeping are paid once per
+ * batch. Any other port gets the frames one by one through
+ * pjmedia_port_put_frame. When the call returns, every frame has been
+ * processed just as if it was put alone (a stage port has just queued them).
+ */
+PJ_DECL(pj_status_t) em_port_put_frames(pjmedia_port *port,
+        const pjmedia_frame frames[], unsigned count);
+
+
+/* output of a port, collected till it's pushed downstream at once */
+typedef struct em_batch {
+    pjmedia_port     *dn_port;
+    unsigned          count;
+    pjmedia_frame     frames[EM_BATCH_MAX];
+} em_batch;
+
+PJ_INLINE(void) em_batch_init(em_batch *b, pjmedia_port *dn_port)
+{
+    b->dn_port = dn_port;
+    b->count = 0;
+}
+
+PJ_INLINE(pj_status_t) em_batch_flush(em_batch *b)
+{
+    unsigned count = b->count;
+    if (!count)
+        return PJ_SUCCESS;
+    b->count = 0;
+    return em_port_put_frames(b->dn_port, b->frames, count);
+}
+
+/* next frame to be filled by the caller, the batch is flushed if it's full;
+   the frame is pushed downstream by em_batch_flush */
+PJ_INLINE(pj_status_t) em_batch_next(em_batch *b, pjmedia_frame **p_frame)
+{
+    if (b->count == EM_BATCH_MAX) {
+        pj_status_t status = em_batch_flush(b);
+        if (status != PJ_SUCCESS)
+            return status;
+    }
+    *p_frame = &b->frames[b->count++];
+    return PJ_SUCCESS;
+}
+
+/* queue a copy of the frame header, the payload isn't copied */
+PJ_INLINE(pj_status_t) em_batch_add(em_batch *b, const pjmedia_frame *frame)
+{
+    pjmedia_frame *f;
+    pj_status_t status = em_batch_next(b, &f);
+    if (status != PJ_SUCCESS)
+        return status;
+    *f = *frame;
+    return PJ_SUCCESS;
+}
+
+/* queue an empty frame */
+PJ_INLINE(pj_status_t) em_batch_add_none(em_batch *b)
+{
+    pjmedia_frame *f;
+    pj_status_t status = em_batch_next(b, &f);
+    if (status != PJ_SUCCESS)
+        return status;
+    pj_bzero(f, sizeof(*f));
+    f->type = PJMEDIA_FRAME_TYPE_NONE;
+    return PJ_SUCCESS;
+}
+
+#endif	/* __BATCH_H__ */
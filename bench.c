@@ -0,0 +1,467 @@
+/*
+ * Microbenchmarks of the ports. Every port is driven by synthetic packets
+ * and followed by a sink which discards frames, codec is a null one which
+ * passes 16 bit PCM as is, so neither codec nor disk cost is measured.
+ * Heap allocations are counted by wrapping malloc (see Makefile).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pjlib.h>
+#include <pjlib-util.h>
+#include <pjmedia.h>
+#include "markov_port.h"
+#include "leaky_bucket_port.h"
+#include "plc_port.h"
+#include "silence_port.h"
+#include "delay_port.h"
+#include "batch.h"
+#include "em_rand.h"
+
+#define THIS_FILE   "bench.c"
+#define SIGNATURE   PJMEDIA_PORT_SIGNATURE('B', 'S', 'N', 'K')
+#define MAX_FPP     10
+#define MASK_SIZE   4096    /* loss pattern is repeated */
+
+extern char *optarg;
+extern int optind;
+
+/* heap allocations, counted by the wrappers below */
+static pj_uint64_t allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    allocs++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    allocs++;
+    return __real_realloc(ptr, size);
+}
+
+
+typedef struct bench_options {
+    unsigned          packets;
+    unsigned          fpp;
+    unsigned          samples_per_frame;  /* of one frame, not packet */
+    unsigned          clock_rate;
+    double            loss_pct;
+    const char       *delay_spec;
+    unsigned          batch;              /* packets put at once */
+} bench_options;
+
+
+/* null codec: packet is fpp frames of 16 bit PCM */
+
+typedef struct null_codec {
+    pjmedia_codec     base;
+    unsigned          samples_per_frame;
+} null_codec;
+
+static pj_status_t nc_parse(pjmedia_codec *codec, void *pkt,
+        pj_size_t pkt_size, const pj_timestamp *ts, unsigned *frame_cnt,
+        pjmedia_frame frames[])
+{
+    null_codec *nc = (null_codec*)codec;
+    pj_size_t frame_size = nc->samples_per_frame * sizeof(pj_int16_t);
+    unsigned i, count = (unsigned)(pkt_size / frame_size);
+    if (count > *frame_cnt)
+        count = *frame_cnt;
+    for (i=0; i<count; i++) {
+        frames[i].type = PJMEDIA_FRAME_TYPE_AUDIO;
+        frames[i].buf = (char*)pkt + i*frame_size;
+        frames[i].size = frame_size;
+        frames[i].timestamp.u64 = ts->u64 + i*nc->samples_per_frame;
+    }
+    *frame_cnt = count;
+    return PJ_SUCCESS;
+}
+
+static pj_status_t nc_copy(pjmedia_codec *codec,
+        const struct pjmedia_frame *input, unsigned out_size,
+        struct pjmedia_frame *output)
+{
+    PJ_UNUSED_ARG(codec);
+    PJ_ASSERT_RETURN(input->size <= out_size, PJ_ETOOSMALL);
+    pj_memcpy(output->buf, input->buf, input->size);
+    output->size = input->size;
+    output->type = PJMEDIA_FRAME_TYPE_AUDIO;
+    return PJ_SUCCESS;
+}
+
+static pj_status_t nc_recover(pjmedia_codec *codec, unsigned out_size,
+        struct pjmedia_frame *output)
+{
+    null_codec *nc = (null_codec*)codec;
+    pj_size_t frame_size = nc->samples_per_frame * sizeof(pj_int16_t);
+    PJ_ASSERT_RETURN(frame_size <= out_size, PJ_ETOOSMALL);
+    pj_bzero(output->buf, frame_size);
+    output->size = frame_size;
+    output->type = PJMEDIA_FRAME_TYPE_AUDIO;
+    return PJ_SUCCESS;
+}
+
+static pjmedia_codec_op null_codec_op = {
+    NULL, NULL, NULL, NULL,
+    &nc_parse,
+    &nc_copy,       /* encode */
+    &nc_copy,       /* decode */
+    &nc_recover
+};
+
+/* makes plc port conceal on its own */
+static pjmedia_codec_op null_codec_op_no_plc = {
+    NULL, NULL, NULL, NULL,
+    &nc_parse,
+    &nc_copy,       /* encode */
+    &nc_copy,       /* decode */
+    NULL
+};
+
+static pjmedia_codec *null_codec_create(pj_pool_t *pool,
+        unsigned samples_per_frame, pj_bool_t has_plc)
+{
+    null_codec *nc = PJ_POOL_ZALLOC_T(pool, null_codec);
+    nc->base.op = has_plc ? &null_codec_op : &null_codec_op_no_plc;
+    nc->base.codec_data = nc;
+    nc->samples_per_frame = samples_per_frame;
+    return &nc->base;
+}
+
+
+/* sink: discards everything */
+
+static pj_status_t sink_put_frame(pjmedia_port *this_port,
+        const pjmedia_frame *frame)
+{
+    PJ_UNUSED_ARG(frame);
+    PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
+    return PJ_SUCCESS;
+}
+
+static pj_status_t sink_get_frame(pjmedia_port *this_port,
+        pjmedia_frame *frame)
+{
+    PJ_UNUSED_ARG(this_port);
+    PJ_UNUSED_ARG(frame);
+    return PJ_EINVALIDOP;
+}
+
+static pj_status_t sink_on_destroy(pjmedia_port *this_port)
+{
+    PJ_UNUSED_ARG(this_port);
+    return PJ_SUCCESS;
+}
+
+static pjmedia_port *sink_create(pj_pool_t *pool, const bench_options *opt,
+        unsigned samples_per_frame)
+{
+    const pj_str_t name = { "sink", 4 };
+    pjmedia_port *port = PJ_POOL_ZALLOC_T(pool, pjmedia_port);
+    pjmedia_port_info_init(&port->info, &name, SIGNATURE, opt->clock_rate,
+            1, 16, samples_per_frame);
+    port->put_frame = &sink_put_frame;
+    port->get_frame = &sink_get_frame;
+    port->on_destroy = &sink_on_destroy;
+    return port;
+}
+
+
+/*
+ * One benchmark: ports are created by setup from the last to the first,
+ * packets are put into the first one. Packets are encoded (fpp frames) or
+ * decoded ones (single frame) and are lost (type NONE) in loss_pct of cases,
+ * unless the first port makes losses itself.
+ */
+typedef struct bench {
+    const char       *name;
+    pj_bool_t         decoded;    /* input is a decoded frame */
+    pj_bool_t         lossless;   /* input is never lost */
+    pj_status_t     (*setup)(pj_pool_factory *pf, pj_pool_t *pool,
+            const bench_options *opt, pjmedia_port **ports,
+            unsigned *port_count);
+} bench;
+
+
+static pj_status_t setup_markov(pj_pool_factory *pf, pj_pool_t *pool,
+        const bench_options *opt, pjmedia_port **ports, unsigned *port_count)
+{
+    PJ_UNUSED_ARG(pf);
+    ports[0] = sink_create(pool, opt, opt->samples_per_frame*opt->fpp);
+    *port_count = 2;
+    return pjmedia_markov_port_create(pool, ports[0], opt->loss_pct,
+            opt->loss_pct, 1, 0, 0, &ports[1]);
+}
+
+static pj_status_t setup_leaky(pj_pool_factory *pf, pj_pool_t *pool,
+        const bench_options *opt, pjmedia_port **ports, unsigned *port_count)
+{
+    ports[0] = sink_create(pool, opt, opt->samples_per_frame*opt->fpp);
+    *port_count = 2;
+    return pjmedia_leaky_bucket_port_create(pf, ports[0], 50, 16, 0, 0,
+            &ports[1]);
+}
+
+static pj_status_t setup_delay(pj_pool_factory *pf, pj_pool_t *pool,
+        const bench_options *opt, pjmedia_port **ports, unsigned *port_count)
+{
+    em_delay_model *model;
+    pj_status_t status;
+    ports[0] = sink_create(pool, opt, opt->samples_per_frame*opt->fpp);
+    *port_count = 2;
+    status = em_delay_model_parse(pool, opt->delay_spec, &model);
+    if (status != PJ_SUCCESS)
+        return status;
+    return pjmedia_delay_port_create(pf, ports[0], model, 1, 0, &ports[1]);
+}
+
+static pj_status_t setup_plc(pj_pool_factory *pf, pj_pool_t *pool,
+        const bench_options *opt, pjmedia_port **ports, unsigned *port_count)
+{
+    PJ_UNUSED_ARG(pf);
+    ports[0] = sink_create(pool, opt, opt->samples_per_frame);
+    *port_count = 2;
+    return pjmedia_plc_port_create(pool, ports[0],
+            null_codec_create(pool, opt->samples_per_frame, PJ_TRUE),
+            opt->fpp, EM_PLC_SMART, &ports[1]);
+}
+
+static pj_status_t setup_wsola(pj_pool_factory *pf, pj_pool_t *pool,
+        const bench_options *opt, pjmedia_port **ports, unsigned *port_count)
+{
+    PJ_UNUSED_ARG(pf);
+    ports[0] = sink_create(pool, opt, opt->samples_per_frame);
+    *port_count = 2;
+    return pjmedia_plc_port_create(pool, ports[0],
+            null_codec_create(pool, opt->samples_per_frame, PJ_FALSE),
+            opt->fpp, EM_PLC_SMART, &ports[1]);
+}
+
+static pj_status_t setup_silence(pj_pool_factory *pf, pj_pool_t *pool,
+        const bench_options *opt, pjmedia_port **ports, unsigned *port_count)
+{
+    PJ_UNUSED_ARG(pf);
+    ports[0] = sink_create(pool, opt, opt->samples_per_frame);
+    *port_count = 2;
+    return pjmedia_silence_port_create(pool, ports[0], 0, &ports[1]);
+}
+
+/* the chain of emulator, without codec and output file */
+static pj_status_t setup_chain(pj_pool_factory *pf, pj_pool_t *pool,
+        const bench_options *opt, pjmedia_port **ports, unsigned *port_count)
+{
+    pj_status_t status;
+    ports[0] = sink_create(pool, opt, opt->samples_per_frame);
+    *port_count = 5;
+    status = pjmedia_silence_port_create(pool, ports[0], 0, &ports[1]);
+    if (status == PJ_SUCCESS)
+        status = pjmedia_plc_port_create(pool, ports[1],
+                null_codec_create(pool, opt->samples_per_frame, PJ_TRUE),
+                opt->fpp, EM_PLC_SMART, &ports[2]);
+    if (status == PJ_SUCCESS)
+        status = pjmedia_leaky_bucket_port_create(pf, ports[2], 50, 16, 0,
+                0, &ports[3]);
+    if (status == PJ_SUCCESS)
+        status = pjmedia_markov_port_create(pool, ports[3], opt->loss_pct,
+                opt->loss_pct, 1, 0, 0, &ports[4]);
+    return status;
+}
+
+static const bench benches[] = {
+    { "markov",  PJ_FALSE, PJ_TRUE,  &setup_markov },
+    { "leaky",   PJ_FALSE, PJ_FALSE, &setup_leaky },
+    { "delay",   PJ_FALSE, PJ_FALSE, &setup_delay },
+    { "plc",     PJ_FALSE, PJ_FALSE, &setup_plc },
+    { "wsola",   PJ_FALSE, PJ_FALSE, &setup_wsola },
+    { "silence", PJ_TRUE,  PJ_FALSE, &setup_silence },
+    { "chain",   PJ_FALSE, PJ_TRUE,  &setup_chain },
+};
+
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static pj_status_t bench_run(pj_pool_factory *pf, const bench *b,
+        const bench_options *opt)
+{
+    pj_pool_t *pool;
+    pjmedia_port *ports[8];
+    unsigned port_count = 0, i;
+    unsigned packet_samples = opt->samples_per_frame *
+        (b->decoded ? 1 : opt->fpp);
+    pj_uint8_t *lost;
+    pj_int16_t *payload;
+    pjmedia_frame frames[EM_BATCH_MAX];
+    unsigned pending = 0;
+    pj_uint64_t allocs_before;
+    double start, elapsed;
+    em_rand rand;
+    pj_status_t status;
+
+    pool = pj_pool_create(pf, "bench", 4000, 4000, NULL);
+    status = b->setup(pf, pool, opt, ports, &port_count);
+    if (status != PJ_SUCCESS) {
+        PJ_LOG(1, (THIS_FILE, "%s: can't create ports", b->name));
+        pj_pool_release(pool);
+        return status;
+    }
+
+    /* input is a sine, loss pattern is drawn in advance */
+    payload = (pj_int16_t*)pj_pool_alloc(pool,
+            packet_samples * sizeof(pj_int16_t));
+    for (i=0; i<packet_samples; i++)
+        payload[i] = (pj_int16_t)(8000 * sin(2 * M_PI * 440 * i /
+                    opt->clock_rate));
+    lost = (pj_uint8_t*)pj_pool_zalloc(pool, MASK_SIZE);
+    em_rand_init(&rand, 1, 0);
+    for (i=0; !b->lossless && i<MASK_SIZE; i++)
+        lost[i] = em_rand_uniform(&rand) * 100 < opt->loss_pct;
+
+    allocs_before = allocs;
+    start = now_ns();
+    for (i=0; i<opt->packets; i++) {
+        pj_bool_t is_lost = lost[i % MASK_SIZE];
+        pjmedia_frame *frame = &frames[pending++];
+        if (b->decoded) {
+            /* lost frame is concealed by plc, which doesn't know its
+               timestamp */
+            frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+            frame->timestamp.u64 = is_lost ? 0 :
+                (pj_uint64_t)i * packet_samples;
+        } else {
+            frame->type = is_lost ? PJMEDIA_FRAME_TYPE_NONE :
+                PJMEDIA_FRAME_TYPE_AUDIO;
+            frame->timestamp.u64 = (pj_uint64_t)i * packet_samples;
+        }
+        frame->buf = payload;
+        frame->size = packet_samples * sizeof(pj_int16_t);
+        if (pending < opt->batch && i + 1 < opt->packets)
+            continue;
+        /* a batch of one is the plain put_frame */
+        status = pending == 1 ?
+            pjmedia_port_put_frame(ports[port_count-1], frames) :
+            em_port_put_frames(ports[port_count-1], frames, pending);
+        pending = 0;
+        if (status != PJ_SUCCESS) {
+            PJ_LOG(1, (THIS_FILE, "%s: put_frame failed", b->name));
+            break;
+        }
+    }
+    elapsed = now_ns() - start;
+    if (status == PJ_SUCCESS)
+        printf("%-10s %12.1f %14.0f %14.4f\n", b->name,
+                elapsed / opt->packets, opt->packets * 1e9 / elapsed,
+                (double)(allocs - allocs_before) / opt->packets);
+
+    for (i=port_count; i>0; i--)
+        pjmedia_port_destroy(ports[i-1]);
+    pj_pool_release(pool);
+    return status;
+}
+
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n|--packets <n>] [-f|--fpp <fpp>]\n"
+                    "          [-s|--samples <samples per frame>] "
+                    "[-r|--rate <Hz>]\n"
+                    "          [-l|--loss <lost_pct>] [--delay <spec>]\n"
+                    "          [-b|--batch <packets>] [bench ...]\n", name);
+    unsigned i;
+    fprintf(stderr, "Benchmarks:");
+    for (i=0; i<PJ_ARRAY_SIZE(benches); i++)
+        fprintf(stderr, " %s", benches[i].name);
+    fprintf(stderr, "\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    const struct pj_getopt_option longopts[] = {
+        {"packets", required_argument, NULL, 'n'},
+        {"fpp", required_argument, NULL, 'f'},
+        {"samples", required_argument, NULL, 's'},
+        {"rate", required_argument, NULL, 'r'},
+        {"loss", required_argument, NULL, 'l'},
+        {"delay", required_argument, NULL, 'd'},
+        {"batch", required_argument, NULL, 'b'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    pj_caching_pool cp;
+    bench_options opt;
+    pj_status_t status = PJ_SUCCESS;
+    unsigned i;
+    int ch;
+
+    opt.packets = 1000000;
+    opt.fpp = 1;
+    opt.samples_per_frame = 160;
+    opt.clock_rate = 8000;
+    opt.loss_pct = 5;
+    opt.delay_spec = "uniform:20,80";
+    opt.batch = 1;
+    while ((ch = getopt_long(argc, argv, "n:f:s:r:l:d:b:h", longopts,
+                    NULL)) != -1) {
+        switch (ch) {
+            case 'n': opt.packets = atoi(optarg); break;
+            case 'f': opt.fpp = atoi(optarg); break;
+            case 's': opt.samples_per_frame = atoi(optarg); break;
+            case 'r': opt.clock_rate = atoi(optarg); break;
+            case 'l': opt.loss_pct = atof(optarg); break;
+            case 'd': opt.delay_spec = optarg; break;
+            case 'b': opt.batch = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (!opt.packets || !opt.fpp || opt.fpp > MAX_FPP ||
+            !opt.samples_per_frame ||
+            !opt.clock_rate || opt.loss_pct < 0 || opt.loss_pct > 100 ||
+            !opt.batch || opt.batch > EM_BATCH_MAX) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    pj_log_set_level(1);
+    pj_init();
+    pj_caching_pool_init(&cp, &pj_pool_factory_default_policy, 0);
+    printf("%u packets, fpp %u, %u samples per frame, %u Hz, loss %.2f%%, "
+            "batch %u\n", opt.packets, opt.fpp, opt.samples_per_frame,
+            opt.clock_rate, opt.loss_pct, opt.batch);
+    printf("%-10s %12s %14s %14s\n", "port", "ns/packet", "packets/s",
+            "allocs/packet");
+    for (i=0; i<PJ_ARRAY_SIZE(benches); i++) {
+        int j;
+        pj_bool_t selected = optind >= argc;
+        for (j=optind; j<argc; j++)
+            if (strcmp(argv[j], benches[i].name) == 0)
+                selected = PJ_TRUE;
+        if (selected && bench_run(&cp.factory, &benches[i], &opt) !=
+                PJ_SUCCESS)
+            status = 1;
+    }
+    pj_caching_pool_destroy(&cp);
+    pj_shutdown();
+    return status;
+}
@@ -0,0 +1,195 @@
+#include <math.h>
+#include "cng.h"
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#define THIS_FILE   "cng.c"
+#define POWER_MIN   1.0         /* per sample, -90 dBFS */
+#define FLOOR_RISE  1.01        /* per update while above the floor */
+#define NOISE_RATIO 4.0         /* frames within 6 dB of the floor are noise */
+#define SMOOTHING   0.25        /* weight of a new frame in the shape */
+#define WHITE_NOISE 1.001       /* -30 dB added to keep the filter stable */
+#define SQRT3       1.7320508075688772
+
+
+PJ_DEF(void) em_cng_init(em_cng *cng, pj_uint32_t seed)
+{
+    unsigned i;
+
+    pj_bzero(cng, sizeof(em_cng));
+    for (i=0; i<EM_CNG_LANES; i++) {
+        /* spread the seed over the lanes, xorshift can't leave zero */
+        pj_uint32_t s = seed + (i + 1) * 0x9E3779B9u;
+        s = (s ^ (s >> 16)) * 0x85EBCA6Bu;
+        s = (s ^ (s >> 13)) * 0xC2B2AE35u;
+        s ^= s >> 16;
+        cng->state[i] = s ? s : 0x2545F491u;
+    }
+    cng->lpc[0] = 1.0f;
+}
+
+
+PJ_DEF(void) em_cng_update(em_cng *cng, const pj_int16_t *samples,
+        unsigned count)
+{
+    float x[EM_CNG_MAX_SAMPLES];
+    double power;
+    unsigned i, k;
+
+    if (count > EM_CNG_MAX_SAMPLES)
+        count = EM_CNG_MAX_SAMPLES;
+    if (count <= EM_CNG_ORDER)
+        return;
+    for (i=0; i<count; i++)
+        x[i] = samples[i];
+
+    {
+        double r[EM_CNG_ORDER + 1];
+        for (k=0; k<=EM_CNG_ORDER; k++) {
+            float acc = 0;
+            for (i=k; i<count; i++)
+                acc += x[i] * x[i - k];
+            r[k] = (double)acc / count;
+        }
+        power = r[0] > POWER_MIN ? r[0] : POWER_MIN;
+
+        /* minimum tracking: follows drops at once, rises slowly */
+        if (!cng->has_floor || power < cng->floor)
+            cng->floor = power;
+        else
+            cng->floor *= FLOOR_RISE;
+
+        if (!cng->has_floor) {
+            for (k=0; k<=EM_CNG_ORDER; k++)
+                cng->corr[k] = r[k];
+        } else if (power <= cng->floor * NOISE_RATIO) {
+            for (k=0; k<=EM_CNG_ORDER; k++)
+                cng->corr[k] += (r[k] - cng->corr[k]) * SMOOTHING;
+        }
+    }
+    cng->has_floor = PJ_TRUE;
+    cng->dirty = PJ_TRUE;
+}
+
+
+/* Levinson-Durbin, A(z) = 1 + lpc[1] z^-1 + ... */
+static void update_filter(em_cng *cng)
+{
+    double a[EM_CNG_ORDER + 1], prev[EM_CNG_ORDER + 1];
+    double r0 = cng->corr[0] * WHITE_NOISE;
+    double err = r0;
+    unsigned i, j;
+
+    pj_bzero(a, sizeof(a));
+    a[0] = 1.0;
+    if (r0 > 0) {
+        for (i=1; i<=EM_CNG_ORDER; i++) {
+            double acc = cng->corr[i], k;
+            for (j=1; j<i; j++)
+                acc += a[j] * cng->corr[i - j];
+            k = -acc / err;
+            if (k >= 1.0 || k <= -1.0)
+                break;
+            pj_memcpy(prev, a, sizeof(a));
+            for (j=1; j<i; j++)
+                a[j] = prev[j] + k * prev[i - j];
+            a[i] = k;
+            err *= 1.0 - k * k;
+        }
+    }
+    for (i=0; i<=EM_CNG_ORDER; i++)
+        cng->lpc[i] = (float)a[i];
+    /* the filter has power gain r0/err on white noise */
+    cng->gain = (float)sqrt(r0 > 0 ? cng->floor * err / r0 : cng->floor);
+    cng->dirty = PJ_FALSE;
+}
+
+
+/* uniform white noise of unit power, all lanes a step at a time */
+static void white_noise(em_cng *cng, float *dst, unsigned count)
+{
+    const float scale = (float)(SQRT3 / 2147483648.0);
+    unsigned i = 0;
+#if defined(__AVX2__)
+    __m256i s = _mm256_loadu_si256((const __m256i*)cng->state);
+    __m256 m = _mm256_set1_ps(scale);
+    for (; i<count; i+=8) {
+        s = _mm256_xor_si256(s, _mm256_slli_epi32(s, 13));
+        s = _mm256_xor_si256(s, _mm256_srli_epi32(s, 17));
+        s = _mm256_xor_si256(s, _mm256_slli_epi32(s, 5));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(s), m));
+    }
+    _mm256_storeu_si256((__m256i*)cng->state, s);
+#elif defined(__SSE2__)
+    __m128i s0 = _mm_loadu_si128((const __m128i*)cng->state);
+    __m128i s1 = _mm_loadu_si128((const __m128i*)(cng->state + 4));
+    __m128 m = _mm_set1_ps(scale);
+    for (; i<count; i+=8) {
+        s0 = _mm_xor_si128(s0, _mm_slli_epi32(s0, 13));
+        s1 = _mm_xor_si128(s1, _mm_slli_epi32(s1, 13));
+        s0 = _mm_xor_si128(s0, _mm_srli_epi32(s0, 17));
+        s1 = _mm_xor_si128(s1, _mm_srli_epi32(s1, 17));
+        s0 = _mm_xor_si128(s0, _mm_slli_epi32(s0, 5));
+        s1 = _mm_xor_si128(s1, _mm_slli_epi32(s1, 5));
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(s0), m));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(s1), m));
+    }
+    _mm_storeu_si128((__m128i*)cng->state, s0);
+    _mm_storeu_si128((__m128i*)(cng->state + 4), s1);
+#else
+    for (; i<count; i+=EM_CNG_LANES) {
+        unsigned l;
+        for (l=0; l<EM_CNG_LANES; l++) {
+            pj_uint32_t s = cng->state[l];
+            s ^= s << 13;
+            s ^= s >> 17;
+            s ^= s << 5;
+            cng->state[l] = s;
+            dst[i + l] = (float)(pj_int32_t)s * scale;
+        }
+    }
+#endif
+}
+
+
+/* a block of at most EM_CNG_MAX_SAMPLES */
+static void generate(em_cng *cng, pj_int16_t *samples, unsigned count)
+{
+    float *y = cng->out + EM_CNG_ORDER;
+    unsigned i, j;
+
+    /* the buffer holds whole steps of all lanes */
+    white_noise(cng, y, (count + EM_CNG_LANES - 1) & ~(EM_CNG_LANES - 1));
+    for (i=0; i<count; i++) {
+        float acc = y[i] * cng->gain;
+        for (j=1; j<=EM_CNG_ORDER; j++)
+            acc -= cng->lpc[j] * y[(int)i - (int)j];
+        y[i] = acc;
+        if (acc > 32767.0f)
+            samples[i] = 32767;
+        else if (acc < -32768.0f)
+            samples[i] = -32768;
+        else
+            samples[i] = (pj_int16_t)lrintf(acc);
+    }
+    pj_memmove(cng->out, y + count - EM_CNG_ORDER,
+            EM_CNG_ORDER * sizeof(float));
+}
+
+
+PJ_DEF(void) em_cng_generate(em_cng *cng, pj_int16_t *samples,
+        unsigned count)
+{
+    if (!cng->has_floor) {
+        pj_bzero(samples, count * sizeof(pj_int16_t));
+        return;
+    }
+    if (cng->dirty)
+        update_filter(cng);
+    while (count) {
+        unsigned n = count < EM_CNG_MAX_SAMPLES ? count : EM_CNG_MAX_SAMPLES;
+        generate(cng, samples, n);
+        samples += n;
+        count -= n;
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef __CNG_H__
+#define __CNG_H__
+
+#include <pjlib.h>
+
+#define EM_CNG_ORDER        10      /* of the spectral envelope */
+#define EM_CNG_LANES        8       /* independent generators */
+#define EM_CNG_MAX_SAMPLES  512     /* generated at once, taken by update */
+
+/*
+ * Comfort noise: white noise from EM_CNG_LANES xorshift generators run in
+ * parallel, shaped by an all-pole filter estimated with LPC from the
+ * received frames and scaled to the background level. The level is a
+ * floor of the frame power, so speech doesn't make noise loud, and only
+ * the frames close to it update the spectral shape.
+ */
+typedef struct em_cng {
+    pj_uint32_t       state[EM_CNG_LANES];
+    double            corr[EM_CNG_ORDER + 1];    /* smoothed, per sample */
+    double            floor;      /* background power per sample */
+    pj_bool_t         has_floor;
+    pj_bool_t         dirty;      /* corr changed since the filter */
+    float             lpc[EM_CNG_ORDER + 1];
+    float             gain;
+    /* filter history followed by the samples being generated */
+    float             out[EM_CNG_ORDER + EM_CNG_MAX_SAMPLES];
+} em_cng;
+
+PJ_DECL(void) em_cng_init(em_cng *cng, pj_uint32_t seed);
+
+/* takes a received frame (up to EM_CNG_MAX_SAMPLES of it) into the level
+   and shape estimation */
+PJ_DECL(void) em_cng_update(em_cng *cng, const pj_int16_t *samples,
+        unsigned count);
+
+/* silence till the first update */
+PJ_DECL(void) em_cng_generate(em_cng *cng, pj_int16_t *samples,
+        unsigned count);
+
+#endif	/* __CNG_H__ */
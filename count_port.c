@@ -0,0 +1,88 @@
+#include "count_port.h"
+#define SIGNATURE   PJMEDIA_PORT_SIGNATURE('C', 'N', 'T', 'P')
+#define THIS_FILE   "count_port.c"
+
+struct count_port
+{
+    pjmedia_port	  base;
+    em_plc_statistics stats;
+};
+
+
+static pj_status_t cp_put_frame(pjmedia_port *this_port,
+				const pjmedia_frame *frame);
+static pj_status_t cp_get_frame(pjmedia_port *this_port,
+				pjmedia_frame *frame);
+static pj_status_t cp_on_destroy(pjmedia_port *this_port);
+
+
+PJ_DEF(pj_status_t) pjmedia_count_port_create(pj_pool_t *pool,
+        unsigned clock_rate, unsigned channel_count,
+        unsigned samples_per_frame, unsigned bits_per_sample,
+        pjmedia_port **p_port)
+{
+    const pj_str_t count = { "count", 5 };
+    struct count_port *cp;
+
+    PJ_ASSERT_RETURN(pool && p_port, PJ_EINVAL);
+
+    /* Create the port itself */
+    cp = PJ_POOL_ZALLOC_T(pool, struct count_port);
+
+    pjmedia_port_info_init(&cp->base.info, &count, SIGNATURE,
+			   clock_rate, channel_count, bits_per_sample,
+			   samples_per_frame);
+
+    /* More init */
+    cp->base.get_frame = &cp_get_frame;
+    cp->base.put_frame = &cp_put_frame;
+    cp->base.on_destroy = &cp_on_destroy;
+    cp->stats.received = 0;
+    cp->stats.lost = 0;
+    cp->stats.total = 0;
+
+    /* Done */
+    *p_port = &cp->base;
+
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_count_port_get_statistics(
+        const pjmedia_port *port, em_plc_statistics *stats)
+{
+    struct count_port *cp = (struct count_port*)port;
+    PJ_ASSERT_RETURN(port->info.signature == SIGNATURE, PJ_EINVAL);
+    pj_memcpy(stats, &cp->stats, sizeof(em_plc_statistics));
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t cp_put_frame( pjmedia_port *this_port,
+				 const pjmedia_frame *frame)
+{
+    struct count_port *cp = (struct count_port*)this_port;
+    PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
+    if (frame->type == PJMEDIA_FRAME_TYPE_NONE)
+        cp->stats.lost++;
+    else
+        cp->stats.received++;
+    cp->stats.total++;
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t cp_get_frame( pjmedia_port *this_port,
+				 pjmedia_frame *frame)
+{
+    PJ_UNUSED_ARG(this_port);
+    PJ_UNUSED_ARG(frame);
+    return PJ_EINVALIDOP;
+}
+
+
+static pj_status_t cp_on_destroy(pjmedia_port *this_port)
+{
+    PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
+    return PJ_SUCCESS;
+}
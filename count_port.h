@@ -0,0 +1,22 @@
+#ifndef __COUNT_PORT_H__
+#define __COUNT_PORT_H__
+
+#include <pjlib.h>
+#include <pjlib-util.h>
+#include <pjmedia.h>
+#include "plc_port.h"
+
+/*
+ * Sink which only counts received and lost packets, in place of the PLC
+ * port when the decoded signal is not needed. Statistics are the same as
+ * the ones of the PLC port.
+ */
+PJ_DECL(pj_status_t) pjmedia_count_port_create(pj_pool_t *pool,
+        unsigned clock_rate, unsigned channel_count,
+        unsigned samples_per_frame, unsigned bits_per_sample,
+        pjmedia_port **p_port);
+
+PJ_DECL(pj_status_t) pjmedia_count_port_get_statistics(
+        const pjmedia_port *port, em_plc_statistics *stats);
+
+#endif	/* __COUNT_PORT_H__ */
@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <math.h>
+#include "delay_port.h"
+#include "em_log.h"
+#include "em_rand.h"
+#define SIGNATURE   PJMEDIA_PORT_SIGNATURE('D', 'E', 'L', 'Y')
+#define THIS_FILE   "delay_port.c"
+#define INIT_CAPACITY 64
+#define MAX_DELAY_MS  3600000.0     /* heavy tails are cut at one hour */
+#define SEED_SALT   0x64656c6179ULL /* delays must not repeat the loss stream */
+
+enum delay_kind {
+    DELAY_CONST,
+    DELAY_UNIFORM,
+    DELAY_PARETO,
+    DELAY_HIST
+};
+
+struct em_delay_model
+{
+    enum delay_kind   kind;
+    double            a;          /* const: delay, uniform/pareto: min  */
+    double            b;          /* uniform: max, pareto: shape        */
+    unsigned          count;      /* hist: number of bins               */
+    double           *value;      /* hist: delay of the bin             */
+    double           *cumulative; /* hist: sum of weights up to the bin */
+};
+
+/*
+ * Packets in flight are kept in a binary min-heap ordered by arrival time
+ * (and by the order of sending for equal times), so every packet costs
+ * O(log n) whatever the delay is. Every heap item owns a payload buffer,
+ * the buffers are swapped along with items.
+ */
+struct delay_item
+{
+    pj_uint64_t        arrival;
+    pj_uint64_t        order;
+    pjmedia_frame      frame;
+};
+
+struct delay_port
+{
+    pjmedia_port	   base;
+    pjmedia_port	  *dn_port;
+    const em_delay_model *model;
+    em_rand            rand;
+    double             samples_per_ms;
+    struct delay_item *heap;
+    pj_size_t          count;
+    pj_size_t          capacity;
+    pj_size_t          max_frame_size;
+    pj_uint64_t        order;         /* counter of packets put */
+    pj_uint64_t        last_arrival;  /* arrival of the last audio frame put */
+    pj_uint64_t        max_order;     /* latest sent packet passed downstream */
+    pj_uint64_t        reordered;
+    pj_pool_t         *pool;
+};
+
+
+static pj_status_t dp_put_frame(pjmedia_port *this_port,
+				const pjmedia_frame *frame);
+static pj_status_t dp_get_frame(pjmedia_port *this_port,
+				pjmedia_frame *frame);
+static pj_status_t dp_on_destroy(pjmedia_port *this_port);
+
+
+static pj_status_t dp_load_hist(pj_pool_t *pool, const char *filename,
+        em_delay_model *model)
+{
+    double value, weight, sum = 0;
+    unsigned n = 0, i;
+    char line[256];
+    FILE *fd;
+
+    fd = fopen(filename, "r");
+    if (!fd) {
+        fprintf(stderr, "Can't open delay histogram file %s\n", filename);
+        return PJ_ENOTFOUND;
+    }
+    /* first pass counts the bins, second one reads them */
+    while (fgets(line, sizeof(line), fd))
+        if (sscanf(line, "%lf %lf", &value, &weight) == 2)
+            n++;
+    if (n == 0) {
+        fprintf(stderr, "%s: no \"<delay> <weight>\" lines found\n", filename);
+        fclose(fd);
+        return PJ_EINVAL;
+    }
+    model->value = (double*)pj_pool_calloc(pool, n, sizeof(double));
+    model->cumulative = (double*)pj_pool_calloc(pool, n, sizeof(double));
+    rewind(fd);
+    i = 0;
+    while (i < n && fgets(line, sizeof(line), fd)) {
+        if (sscanf(line, "%lf %lf", &value, &weight) != 2)
+            continue;
+        if (value < 0 || weight < 0) {
+            fprintf(stderr, "%s: delays and weights must not be negative\n",
+                    filename);
+            fclose(fd);
+            return PJ_EINVAL;
+        }
+        sum += weight;
+        model->value[i] = value;
+        model->cumulative[i] = sum;
+        i++;
+    }
+    fclose(fd);
+    if (sum <= 0) {
+        fprintf(stderr, "%s: sum of weights must be positive\n", filename);
+        return PJ_EINVAL;
+    }
+    model->count = i;
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) em_delay_model_parse(pj_pool_t *pool, const char *spec,
+        em_delay_model **p_model)
+{
+    em_delay_model *model;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(pool && spec && p_model, PJ_EINVAL);
+
+    model = PJ_POOL_ZALLOC_T(pool, em_delay_model);
+    if (strncmp(spec, "const:", 6) == 0) {
+        model->kind = DELAY_CONST;
+        if (sscanf(spec + 6, "%lf", &model->a) != 1 || model->a < 0)
+            goto err;
+    } else if (strncmp(spec, "uniform:", 8) == 0) {
+        model->kind = DELAY_UNIFORM;
+        if (sscanf(spec + 8, "%lf,%lf", &model->a, &model->b) != 2 ||
+                model->a < 0 || model->b < model->a)
+            goto err;
+    } else if (strncmp(spec, "pareto:", 7) == 0) {
+        model->kind = DELAY_PARETO;
+        if (sscanf(spec + 7, "%lf,%lf", &model->a, &model->b) != 2 ||
+                model->a < 0 || model->b <= 0)
+            goto err;
+    } else if (strncmp(spec, "hist:", 5) == 0) {
+        model->kind = DELAY_HIST;
+        status = dp_load_hist(pool, spec + 5, model);
+        if (status != PJ_SUCCESS)
+            return status;
+    } else {
+        goto err;
+    }
+    PJ_LOG(5, (THIS_FILE, "delay model: %s", spec));
+    *p_model = model;
+    return PJ_SUCCESS;
+
+err:
+    fprintf(stderr, "Wrong delay distribution: %s\n", spec);
+    return PJ_EINVAL;
+}
+
+
+/* random delay in milliseconds */
+static double dp_sample(struct delay_port *dp)
+{
+    const em_delay_model *model = dp->model;
+    double u, d;
+    unsigned lo, hi;
+
+    switch (model->kind) {
+        case DELAY_CONST:
+            return model->a;
+        case DELAY_UNIFORM:
+            return model->a + (model->b - model->a) *
+                em_rand_uniform(&dp->rand);
+        case DELAY_PARETO:
+            /* inverse transform, 1-u is in (0, 1] */
+            u = 1.0 - em_rand_uniform(&dp->rand);
+            d = model->a / pow(u, 1.0 / model->b);
+            return d < MAX_DELAY_MS ? d : MAX_DELAY_MS;
+        case DELAY_HIST:
+            /* first bin whose cumulative weight exceeds u */
+            u = em_rand_uniform(&dp->rand) * model->cumulative[model->count-1];
+            lo = 0;
+            hi = model->count - 1;
+            while (lo < hi) {
+                unsigned mid = (lo + hi) / 2;
+                if (model->cumulative[mid] > u)
+                    hi = mid;
+                else
+                    lo = mid + 1;
+            }
+            return model->value[lo];
+    }
+    return 0;
+}
+
+
+static pj_status_t dp_grow(struct delay_port *dp)
+{
+    pj_size_t capacity = dp->capacity ? dp->capacity * 2 : INIT_CAPACITY;
+    struct delay_item *heap;
+    pj_uint8_t *payload;
+    pj_size_t i;
+
+    heap = (struct delay_item*)pj_pool_calloc(dp->pool, capacity,
+            sizeof(struct delay_item));
+    payload = (pj_uint8_t*)pj_pool_alloc(dp->pool,
+            (capacity - dp->capacity) * dp->max_frame_size);
+    if (!heap || !payload)
+        return PJ_ENOMEM;
+    if (dp->capacity)
+        pj_memcpy(heap, dp->heap, dp->capacity * sizeof(struct delay_item));
+    for (i=dp->capacity; i<capacity; i++)
+        heap[i].frame.buf = payload + (i - dp->capacity) * dp->max_frame_size;
+    dp->heap = heap;
+    dp->capacity = capacity;
+    PJ_LOG(5, (THIS_FILE, "%u packets in flight, heap extended",
+                (unsigned)dp->count));
+    return PJ_SUCCESS;
+}
+
+
+PJ_INLINE(pj_bool_t) dp_less(const struct delay_item *a,
+        const struct delay_item *b)
+{
+    return a->arrival < b->arrival ||
+        (a->arrival == b->arrival && a->order < b->order);
+}
+
+
+PJ_INLINE(void) dp_swap(struct delay_item *a, struct delay_item *b)
+{
+    struct delay_item tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+
+static void dp_sift_up(struct delay_port *dp, pj_size_t i)
+{
+    while (i > 0) {
+        pj_size_t parent = (i - 1) / 2;
+        if (!dp_less(&dp->heap[i], &dp->heap[parent]))
+            break;
+        dp_swap(&dp->heap[i], &dp->heap[parent]);
+        i = parent;
+    }
+}
+
+
+static void dp_sift_down(struct delay_port *dp, pj_size_t i)
+{
+    for (;;) {
+        pj_size_t l = 2*i + 1, r = l + 1, min = i;
+        if (l < dp->count && dp_less(&dp->heap[l], &dp->heap[min]))
+            min = l;
+        if (r < dp->count && dp_less(&dp->heap[r], &dp->heap[min]))
+            min = r;
+        if (min == i)
+            break;
+        dp_swap(&dp->heap[i], &dp->heap[min]);
+        i = min;
+    }
+}
+
+
+/* pass downstream every packet arrived before ts (all of them if NULL) */
+static pj_status_t dp_release_till(struct delay_port *dp,
+        const pj_timestamp *ts)
+{
+    pj_status_t status;
+    while (dp->count && (!ts || dp->heap[0].arrival <= ts->u64)) {
+        struct delay_item *top = &dp->heap[0];
+        if (top->frame.type == PJMEDIA_FRAME_TYPE_AUDIO) {
+            if (top->order < dp->max_order)
+                dp->reordered++;
+            else
+                dp->max_order = top->order;
+        }
+        EM_LOG(6, (THIS_FILE, "push frame to dn port: sz=%u, ts=%llu",
+                    top->frame.size/sizeof(pj_uint16_t),
+                    top->frame.timestamp.u64));
+        status = pjmedia_port_put_frame(dp->dn_port, &top->frame);
+        if (status != PJ_SUCCESS)
+            return status;
+        /* the released buffer goes to the spare part of the heap */
+        dp_swap(top, &dp->heap[--dp->count]);
+        dp_sift_down(dp, 0);
+    }
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_delay_port_create(pj_pool_factory *pool_factory,
+        pjmedia_port *dn_port, const em_delay_model *model, pj_uint64_t seed,
+        unsigned stream, pjmedia_port **p_port)
+{
+    const pj_str_t name = { "delay", 5 };
+    struct delay_port *dp;
+    pj_pool_t *pool;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(pool_factory && dn_port && model && p_port, PJ_EINVAL);
+
+    /* Create own memory pool: heap grows with the number of packets in
+       flight */
+    pool = pj_pool_create(pool_factory, "delay", 4000, 4000, NULL);
+
+    /* Create the port itself */
+    dp = PJ_POOL_ZALLOC_T(pool, struct delay_port);
+
+    pjmedia_port_info_init(&dp->base.info, &name, SIGNATURE,
+			   dn_port->info.clock_rate,
+			   dn_port->info.channel_count,
+			   dn_port->info.bits_per_sample,
+			   dn_port->info.samples_per_frame);
+
+    /* More init */
+    dp->dn_port = dn_port;
+    dp->model = model;
+    em_rand_init(&dp->rand, seed ^ SEED_SALT, stream);
+    dp->samples_per_ms = dn_port->info.clock_rate / 1000.0;
+    dp->max_frame_size = dn_port->info.bytes_per_frame;
+    dp->pool = pool;
+    status = dp_grow(dp);
+    if (status != PJ_SUCCESS) {
+        pj_pool_release(pool);
+        return status;
+    }
+    dp->base.get_frame = &dp_get_frame;
+    dp->base.put_frame = &dp_put_frame;
+    dp->base.on_destroy = &dp_on_destroy;
+
+    /* Done */
+    *p_port = &dp->base;
+
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t dp_put_frame( pjmedia_port *this_port,
+				 const pjmedia_frame *frame)
+{
+    struct delay_port *dp = (struct delay_port*)this_port;
+    struct delay_item *item;
+    pj_status_t status;
+    void *buf;
+    PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
+    EM_LOG(6, (THIS_FILE, "packet: sz=%d ts=%llu",
+                frame->size/sizeof(pj_uint16_t), frame->timestamp.u64));
+
+    if (frame->type == PJMEDIA_FRAME_TYPE_AUDIO) {
+        PJ_ASSERT_RETURN(frame->size <= dp->max_frame_size, PJ_ETOOBIG);
+        /* everything arrived before this packet is sent goes first */
+        status = dp_release_till(dp, &frame->timestamp);
+        if (status != PJ_SUCCESS)
+            return status;
+    }
+    if (dp->count == dp->capacity) {
+        status = dp_grow(dp);
+        if (status != PJ_SUCCESS)
+            return status;
+    }
+
+    item = &dp->heap[dp->count];
+    buf = item->frame.buf;
+    pj_memcpy(&item->frame, frame, sizeof(pjmedia_frame));
+    item->frame.buf = buf;
+    item->order = dp->order++;
+    if (frame->type == PJMEDIA_FRAME_TYPE_AUDIO) {
+        item->arrival = frame->timestamp.u64 +
+            (pj_uint64_t)(dp_sample(dp) * dp->samples_per_ms + 0.5);
+        item->frame.timestamp.u64 = item->arrival;
+        pj_memcpy(buf, frame->buf, frame->size);
+        dp->last_arrival = item->arrival;
+        EM_LOG(6, (THIS_FILE, "packet delayed till ts=%llu", item->arrival));
+    } else {
+        /* lost packet has no time, keep its place after the previous one */
+        item->frame.size = 0;
+        item->arrival = dp->last_arrival;
+    }
+    dp_sift_up(dp, dp->count++);
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t dp_get_frame( pjmedia_port *this_port,
+				 pjmedia_frame *frame)
+{
+    PJ_UNUSED_ARG(this_port);
+    PJ_UNUSED_ARG(frame);
+    return PJ_EINVALIDOP;
+}
+
+
+
+static pj_status_t dp_on_destroy(pjmedia_port *this_port)
+{
+    pj_status_t status;
+    struct delay_port *dp = (struct delay_port*)this_port;
+    PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
+    status = dp_release_till(dp, NULL);
+    if (status != PJ_SUCCESS)
+        return status;
+    PJ_LOG(5, (THIS_FILE, "%llu packets reordered",
+                (unsigned long long)dp->reordered));
+    pj_pool_release(dp->pool);
+    return PJ_SUCCESS;
+}
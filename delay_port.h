@@ -0,0 +1,32 @@
+#ifndef __DELAY_PORT_H__
+#define __DELAY_PORT_H__
+
+#include <pjlib.h>
+#include <pjlib-util.h>
+#include <pjmedia.h>
+
+/* Distribution of the network delay. Read-only once parsed, may be shared
+   by ports. */
+typedef struct em_delay_model em_delay_model;
+
+/*
+ * Parse delay distribution, all values are in milliseconds:
+ *
+ *   const:<d>               every packet is delayed by d
+ *   uniform:<min>,<max>     uniformly distributed in [min, max)
+ *   pareto:<min>,<shape>    Pareto distribution with scale min
+ *   hist:<file>             lines "<delay> <weight>" of empirical histogram
+ */
+PJ_DECL(pj_status_t) em_delay_model_parse(pj_pool_t *pool, const char *spec,
+        em_delay_model **p_model);
+
+/*
+ * Delays every audio frame by a random value and passes frames downstream
+ * in the order of arrival, with the arrival time as a timestamp. Empty
+ * frames follow the packet sent before them.
+ */
+PJ_DECL(pj_status_t) pjmedia_delay_port_create(pj_pool_factory *pool_factory,
+        pjmedia_port *dn_port, const em_delay_model *model, pj_uint64_t seed,
+        unsigned stream, pjmedia_port **p_port);
+
+#endif	/* __DELAY_PORT_H__ */
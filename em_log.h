@@ -0,0 +1,21 @@
+#ifndef __EM_LOG_H__
+#define __EM_LOG_H__
+
+#include <pjlib.h>
+
+/*
+ * Logging of the per-packet path. Messages above EM_LOG_MAX_LEVEL are not
+ * compiled at all, the rest don't evaluate their arguments unless the log
+ * level is high enough. Build with EM_LOG_MAX_LEVEL=6 to trace every packet.
+ */
+#ifndef EM_LOG_MAX_LEVEL
+#   define EM_LOG_MAX_LEVEL     5
+#endif
+
+#define EM_LOG(level, arg) \
+    do { \
+        if ((level) <= EM_LOG_MAX_LEVEL && (level) <= pj_log_get_level()) \
+            PJ_LOG(level, arg); \
+    } while (0)
+
+#endif	/* __EM_LOG_H__ */
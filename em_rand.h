@@ -0,0 +1,58 @@
+#ifndef __EM_RAND_H__
+#define __EM_RAND_H__
+
+#include <math.h>
+#include <pjlib.h>
+
+/*
+ * Counter-based random streams: n-th value of a stream is a function of
+ * (seed, stream, n) only, so every port owns its stream and results do not
+ * depend on how ports are scheduled between threads.
+ */
+typedef struct em_rand {
+    pj_uint64_t       key;
+    pj_uint64_t       counter;
+} em_rand;
+
+#define EM_RAND_GOLDEN      0x9e3779b97f4a7c15ULL
+#define EM_RAND_INFINITE    ((pj_uint64_t)-1)
+
+/* splitmix64 finalizer */
+PJ_INLINE(pj_uint64_t) em_rand_mix(pj_uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+PJ_INLINE(void) em_rand_init(em_rand *r, pj_uint64_t seed, pj_uint64_t stream)
+{
+    r->key = em_rand_mix(seed + EM_RAND_GOLDEN) ^
+        em_rand_mix(~stream * EM_RAND_GOLDEN);
+    r->counter = 0;
+}
+
+PJ_INLINE(pj_uint64_t) em_rand_next(em_rand *r)
+{
+    return em_rand_mix(r->key + (++r->counter) * EM_RAND_GOLDEN);
+}
+
+/* uniform double in [0, 1) */
+PJ_INLINE(double) em_rand_uniform(em_rand *r)
+{
+    return (em_rand_next(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* number of failures before the first success, success probability is q */
+PJ_INLINE(pj_uint64_t) em_rand_geometric(em_rand *r, double q)
+{
+    double k;
+    if (q >= 1.0)
+        return 0;
+    if (q <= 0.0)
+        return EM_RAND_INFINITE;
+    k = floor(log(1.0 - em_rand_uniform(r)) / log(1.0 - q));
+    return k >= 1.8e19 ? EM_RAND_INFINITE : (pj_uint64_t)k;
+}
+
+#endif	/* __EM_RAND_H__ */
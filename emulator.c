@@ -7,15 +7,30 @@
 #include <time.h>
 #include <pjmedia-codec/speex.h>
 
+#include "emulator.h"
 #include "markov_port.h"
 #include "plc_port.h"
 #include "silence_port.h"
 #include "leaky_bucket_port.h"
+#include "workers.h"
+#include "sweep.h"
+#include "packet_cache.h"
+#include "trace_port.h"
+#include "delay_port.h"
+#include "pipe_port.h"
+#include "map_port.h"
+#include "pacer.h"
+#include "relay.h"
+#include "multicall.h"
+#include "repeat.h"
+#include "stats.h"
+#include "em_log.h"
+#include "events.h"
+#include "batch.h"
+#include "stage_port.h"
+#include "fanout_port.h"
 
-#define MAX_FPP 10
 #define THIS_FILE   "emulator.c"
-#define em_set(x)   ((x)>=0)
-#define em_unset(x) ((x)<0)
 
 extern const pj_uint16_t pjmedia_codec_amrnb_bitrates[8];
 extern const pj_uint16_t pjmedia_codec_amrwb_bitrates[9];
@@ -41,11 +56,42 @@ unsigned log_level;
 unsigned codec_bitrate;
 pj_bool_t list_codecs;
 em_plc_mode plc_mode;
+em_plc_mode plc_modes[EM_PLC_MODE_COUNT]; /* plc_mode is the first one */
+unsigned plc_count;
 pj_size_t bucket_size;
 unsigned sent_delay;
 double bits_per_second;
 double packets_per_second;
 pj_bool_t show_stats;
+em_stats_format stats_format;
+char *events_file;
+unsigned events_size;
+char *decode_events_file;
+char *sweep_file;
+unsigned jobs;
+char *packet_cache_dir;
+pj_uint64_t seed;
+pj_bool_t seed_set;
+unsigned markov_options;
+char *loss_model_file;
+char *trace_file;
+pj_uint32_t trace_ssrc;
+pj_bool_t trace_ssrc_set;
+unsigned trace_late_ms;
+unsigned trace_clock;
+char *delay_spec;
+pj_bool_t raw_output;
+unsigned raw_clock_rate;
+pj_bool_t realtime;
+pj_bool_t quality;
+pj_bool_t stats_only;
+pj_bool_t pipeline;
+char *relay_listen;
+char *relay_dest;
+unsigned call_count;
+em_schedule schedule;
+unsigned repeat_count;
+double ci_width;
 
 enum {
     EM_P00 = 1,
@@ -58,12 +104,38 @@ enum {
     EM_LOG,
     EM_LOG_LEVEL,
     EM_LIST_CODECS,
+    EM_SWEEP,
+    EM_PACKET_CACHE,
+    EM_SEED,
+    EM_LOSS_RUNS,
+    EM_LOSS_MODEL,
+    EM_TRACE,
+    EM_TRACE_SSRC,
+    EM_TRACE_LATE,
+    EM_TRACE_CLOCK,
+    EM_DELAY,
+    EM_RAW,
+    EM_RAW_RATE,
+    EM_REALTIME,
+    EM_RELAY,
+    EM_RELAY_TO,
+    EM_CALLS,
+    EM_SCHEDULE,
+    EM_QUALITY,
+    EM_STATS_ONLY,
+    EM_STATS_FORMAT,
+    EM_EVENTS,
+    EM_EVENTS_SIZE,
+    EM_DECODE_EVENTS,
+    EM_REPEAT,
+    EM_CI_WIDTH,
+    EM_PIPELINE,
 } option_name;
 
 #ifdef PJMEDIA_SPEEX_HAS_VBR
-char shortopts[] = "i:c:q:Q:b:f:l:o:p:h";
+char shortopts[] = "i:c:q:Q:b:f:l:o:p:j:h";
 #else
-char shortopts[] = "i:c:q:b:f:l:o:p:h";
+char shortopts[] = "i:c:q:b:f:l:o:p:j:h";
 #endif
 const struct pj_getopt_option longopts[] = {
     /* encoder options */
@@ -85,16 +157,43 @@ const struct pj_getopt_option longopts[] = {
     {"bw", required_argument, (int*)&option_name, (int)EM_BANDWIDTH},
     {"bandwidth", required_argument, (int*)&option_name, (int)EM_BANDWIDTH},
     {"sent-delay", required_argument, (int*)&option_name, (int)EM_SENT_DELAY},
+    {"seed", required_argument, (int*)&option_name, (int)EM_SEED},
+    {"loss-runs", no_argument, (int*)&option_name, (int)EM_LOSS_RUNS},
+    {"loss-model", required_argument, (int*)&option_name, (int)EM_LOSS_MODEL},
+    {"trace", required_argument, (int*)&option_name, (int)EM_TRACE},
+    {"trace-ssrc", required_argument, (int*)&option_name, (int)EM_TRACE_SSRC},
+    {"trace-late", required_argument, (int*)&option_name, (int)EM_TRACE_LATE},
+    {"trace-clock", required_argument, (int*)&option_name, (int)EM_TRACE_CLOCK},
+    {"delay", required_argument, (int*)&option_name, (int)EM_DELAY},
+    {"calls", required_argument, (int*)&option_name, (int)EM_CALLS},
+    {"schedule", required_argument, (int*)&option_name, (int)EM_SCHEDULE},
 
     /* decoder options */
     {"output-file", required_argument, NULL, 'o'},
+    {"raw", no_argument, (int*)&option_name, (int)EM_RAW},
+    {"raw-rate", required_argument, (int*)&option_name, (int)EM_RAW_RATE},
     {"plc", required_argument, NULL, 'p'},
 
     /* miscellaneous options */
     {"show-stats", no_argument, (int*)&option_name, (int)EM_SHOW_STATS},
+    {"stats-format", required_argument, (int*)&option_name, (int)EM_STATS_FORMAT},
+    {"realtime", no_argument, (int*)&option_name, (int)EM_REALTIME},
+    {"quality", no_argument, (int*)&option_name, (int)EM_QUALITY},
+    {"stats-only", no_argument, (int*)&option_name, (int)EM_STATS_ONLY},
+    {"pipeline", no_argument, (int*)&option_name, (int)EM_PIPELINE},
+    {"relay", required_argument, (int*)&option_name, (int)EM_RELAY},
+    {"relay-to", required_argument, (int*)&option_name, (int)EM_RELAY_TO},
     {"log", required_argument, (int*)&option_name, (int)EM_LOG},
     {"log-level", required_argument, (int*)&option_name, (int)EM_LOG_LEVEL},
+    {"events", required_argument, (int*)&option_name, (int)EM_EVENTS},
+    {"events-size", required_argument, (int*)&option_name, (int)EM_EVENTS_SIZE},
+    {"decode-events", required_argument, (int*)&option_name, (int)EM_DECODE_EVENTS},
     {"list-codecs", no_argument, (int*)&option_name, (int)EM_LIST_CODECS},
+    {"sweep", required_argument, (int*)&option_name, (int)EM_SWEEP},
+    {"jobs", required_argument, NULL, 'j'},
+    {"packet-cache", required_argument, (int*)&option_name, (int)EM_PACKET_CACHE},
+    {"repeat", required_argument, (int*)&option_name, (int)EM_REPEAT},
+    {"ci-width", required_argument, (int*)&option_name, (int)EM_CI_WIDTH},
     {"help", no_argument, NULL, 'h'},
 
     /* end */
@@ -107,8 +206,7 @@ static void log_tofile(int level, const char *data, int len)
 {
     PJ_CHECK_STACK();
     PJ_UNUSED_ARG(level);
-    PJ_UNUSED_ARG(len);
-    fprintf(log_fd, "%s", data);
+    fwrite(data, 1, len, log_fd);
 }
 
 static void err(const char *op, pj_status_t status)
@@ -127,6 +225,109 @@ static void err(const char *op, pj_status_t status)
 		    } \
 		    while (0)
 
+/* the same, but whatever is created is released at on_return */
+#define CHECK_GOTO(op) do { \
+			status = op; \
+			if (status != PJ_SUCCESS) { \
+			    err(#op, status); \
+			    goto on_return; \
+			} \
+		    } \
+		    while (0)
+
+
+PJ_DEF(pj_status_t) em_markov_params(double p00, double p10, double lost_pct,
+        double burst_ratio, double *p_p00, double *p_p10)
+{
+    if (em_set(p10) && em_set(p00)){
+        if (em_set(lost_pct) || em_set(burst_ratio))
+            return PJ_EINVAL;
+    } else if (em_set(lost_pct)) {
+        if (em_unset(burst_ratio)){
+            p10 = p00 = lost_pct;
+        } else if (em_set(p00) || em_set(p10)) {
+            return PJ_EINVAL;
+        } else {
+            p10 = lost_pct / burst_ratio;
+            /*
+            p00 = 100 * (1.0 - p10/lost_pct) + p10;
+            p00 = 100 - 100/burst_ratio + lost_pct/burst_ratio;
+            */
+            p00 = 100.0 - (100.0 - lost_pct)/burst_ratio;
+        }
+    } else if ( em_unset(p10) && em_unset(p00) &&
+            em_unset(lost_pct) && em_unset(burst_ratio) ) {
+        p10 = p00 = 0.00;
+    } else {
+        return PJ_EINVAL;
+    }
+    *p_p00 = p00;
+    *p_p10 = p10;
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) em_parse_bandwidth(const char *value,
+        double *bits_per_second, double *packets_per_second)
+{
+    int rlen = strlen(value);
+    double rate;
+    if (rlen <= 3)
+        return PJ_EINVAL;
+    rate = atof(value);
+    if (value[rlen-4] == 'k' || value[rlen-4] == 'K')
+        rate *= 1024;
+    else if (value[rlen-4] == 'm' || value[rlen-4] == 'M')
+        rate *= 1024*1024;
+    if (strcmp(&value[rlen-3], "bps") == 0) {
+        *bits_per_second = rate;
+        *packets_per_second = 0;
+    } else if (strcmp(&value[rlen-3], "pps") == 0) {
+        *packets_per_second = rate;
+        *bits_per_second = 0;
+    } else {
+        return PJ_EINVAL;
+    }
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) em_parse_plc_mode(const char *value, em_plc_mode *mode)
+{
+    switch (value[0]){
+        case 'e': *mode = EM_PLC_EMPTY; break;
+        case 'r': *mode = EM_PLC_REPEAT; break;
+        case 'n': *mode = EM_PLC_NOISE; break;
+        case 's': *mode = EM_PLC_SMART; break;
+        default:
+            return PJ_EINVAL;
+    }
+    return PJ_SUCCESS;
+}
+
+
+/* comma separated modes, every one may be given once; "all" means all */
+static pj_status_t parse_plc_modes(const char *value)
+{
+    pj_bool_t seen[EM_PLC_MODE_COUNT] = { PJ_FALSE };
+    em_plc_mode mode;
+
+    if (strcmp(value, "all") == 0) {
+        for (plc_count=0; plc_count<EM_PLC_MODE_COUNT; plc_count++)
+            plc_modes[plc_count] = (em_plc_mode)plc_count;
+        return PJ_SUCCESS;
+    }
+    plc_count = 0;
+    for (; value; value = strchr(value, ',') ? strchr(value, ',') + 1 :
+            NULL) {
+        if (em_parse_plc_mode(value, &mode) != PJ_SUCCESS || seen[mode])
+            return PJ_EINVAL;
+        seen[mode] = PJ_TRUE;
+        plc_modes[plc_count++] = mode;
+    }
+    return PJ_SUCCESS;
+}
+
 
 pj_status_t parse_args(int argc, const char *argv[])
 {
@@ -151,6 +352,8 @@ pj_status_t parse_args(int argc, const char *argv[])
     log_level = 1;
     log_file = NULL;
     plc_mode = EM_PLC_EMPTY;
+    plc_modes[0] = plc_mode;
+    plc_count = 1;
     list_codecs = PJ_FALSE;
     bucket_size = 50; /* 1s */
     sent_delay = 16; /* 10 times more than needed */
@@ -158,6 +361,35 @@ pj_status_t parse_args(int argc, const char *argv[])
     packets_per_second = 0;
     codec_bitrate = 0;
     show_stats = PJ_FALSE;
+    stats_format = EM_STATS_TEXT;
+    events_file = NULL;
+    events_size = 1<<20;
+    decode_events_file = NULL;
+    sweep_file = NULL;
+    jobs = 0;
+    packet_cache_dir = NULL;
+    seed = 0;
+    seed_set = PJ_FALSE;
+    markov_options = 0;
+    loss_model_file = NULL;
+    trace_file = NULL;
+    trace_ssrc = 0;
+    trace_ssrc_set = PJ_FALSE;
+    trace_late_ms = 0;
+    trace_clock = 0;
+    delay_spec = NULL;
+    raw_output = PJ_FALSE;
+    raw_clock_rate = 8000;
+    realtime = PJ_FALSE;
+    quality = PJ_FALSE;
+    stats_only = PJ_FALSE;
+    pipeline = PJ_FALSE;
+    relay_listen = NULL;
+    relay_dest = NULL;
+    call_count = 0;
+    schedule = EM_SCHEDULE_FIFO;
+    repeat_count = 0;
+    ci_width = 0;
 
     int ch;
     while ( (ch=getopt_long(argc, argv, shortopts, longopts, NULL)) != -1 ) {
@@ -205,15 +437,14 @@ pj_status_t parse_args(int argc, const char *argv[])
                 output_file = strdup(optarg);
                 break;
             case 'p':
-                switch (optarg[0]){
-                    case 'e': plc_mode = EM_PLC_EMPTY; break;
-                    case 'r': plc_mode = EM_PLC_REPEAT; break;
-                    case 'n': plc_mode = EM_PLC_NOISE; break;
-                    case 's': plc_mode = EM_PLC_SMART; break;
-                    default:
-                        fprintf(stderr, "Unknown argument for PLC: %s\n", optarg);
-                        goto err;
+                if (parse_plc_modes(optarg) != PJ_SUCCESS) {
+                    fprintf(stderr, "Unknown argument for PLC: %s\n", optarg);
+                    goto err;
                 }
+                plc_mode = plc_modes[0];
+                break;
+            case 'j':
+                jobs = atoi(optarg);
                 break;
             case 'h':
                 if (execlp("man", "man", "emulator", NULL)) {
@@ -246,30 +477,14 @@ pj_status_t parse_args(int argc, const char *argv[])
                     case EM_BUCKET_SIZE:
                         bucket_size = atoi(optarg);
                         break;
-                    case EM_BANDWIDTH: {
-                        int rlen = strlen(optarg);
-                        if (rlen > 3 && strcmp(&optarg[rlen-3], "bps") == 0) {
-                            bits_per_second = atof(optarg);
-                            if (optarg[rlen-4] == 'k' || optarg[rlen-4] == 'K')
-                                bits_per_second *= 1024;
-                            else if (optarg[rlen-4] == 'm' || optarg[rlen-4] == 'M')
-                                bits_per_second *= 1024*1024;
-                            packets_per_second = 0;
-                            sent_delay = 0;
-                        } else if (rlen > 3 && strcmp(&optarg[rlen-3], "pps") == 0) {
-                            packets_per_second = atof(optarg);
-                            if (optarg[rlen-4] == 'k' || optarg[rlen-4] == 'K')
-                                packets_per_second *= 1024;
-                            else if (optarg[rlen-4] == 'm' || optarg[rlen-4] == 'M')
-                                packets_per_second *= 1024*1024;
-                            sent_delay = 0;
-                            bits_per_second = 0;
-                        } else {
+                    case EM_BANDWIDTH:
+                        if (em_parse_bandwidth(optarg, &bits_per_second,
+                                    &packets_per_second) != PJ_SUCCESS) {
                             fprintf(stderr, "Bandwidth value must ends with "
                                     "\"bps\" or \"pps\" \n");
                             goto err;
                         }
-                        }
+                        sent_delay = 0;
                         break;
                     case EM_SENT_DELAY:
                         sent_delay = atoi(optarg);
@@ -279,6 +494,26 @@ pj_status_t parse_args(int argc, const char *argv[])
                     case EM_SHOW_STATS:
                         show_stats = PJ_TRUE;
                         break;
+                    case EM_EVENTS:
+                        events_file = strdup(optarg);
+                        break;
+                    case EM_EVENTS_SIZE:
+                        events_size = atoi(optarg);
+                        if (events_size == 0)
+                            goto err;
+                        break;
+                    case EM_DECODE_EVENTS:
+                        decode_events_file = strdup(optarg);
+                        break;
+                    case EM_STATS_FORMAT:
+                        if (em_parse_stats_format(optarg, &stats_format) !=
+                                PJ_SUCCESS) {
+                            fprintf(stderr, "Unknown statistics format: %s\n",
+                                    optarg);
+                            goto err;
+                        }
+                        show_stats = PJ_TRUE;
+                        break;
                     case EM_LOG:
                         log_file = strdup(optarg);
                         break;
@@ -288,10 +523,112 @@ pj_status_t parse_args(int argc, const char *argv[])
                             fprintf(stderr, "Log level must be in [0..6]\n");
                             goto err;
                         }
+                        if (log_level > EM_LOG_MAX_LEVEL)
+                            fprintf(stderr, "Per-packet log messages above "
+                                    "level %d are not compiled in, rebuild "
+                                    "with LOG_MAX_LEVEL=6\n",
+                                    EM_LOG_MAX_LEVEL);
                         break;
                     case EM_LIST_CODECS:
                         list_codecs = PJ_TRUE;
                         break;
+                    case EM_SWEEP:
+                        sweep_file = strdup(optarg);
+                        break;
+                    case EM_PACKET_CACHE:
+                        packet_cache_dir = strdup(optarg);
+                        break;
+                    case EM_SEED:
+                        seed = strtoull(optarg, NULL, 0);
+                        seed_set = PJ_TRUE;
+                        break;
+                    case EM_LOSS_RUNS:
+                        markov_options |= PJMEDIA_MARKOV_RUN_LENGTH;
+                        break;
+                    case EM_LOSS_MODEL:
+                        loss_model_file = strdup(optarg);
+                        break;
+                    case EM_TRACE:
+                        trace_file = strdup(optarg);
+                        break;
+                    case EM_TRACE_SSRC:
+                        trace_ssrc = (pj_uint32_t)strtoul(optarg, NULL, 0);
+                        trace_ssrc_set = PJ_TRUE;
+                        break;
+                    case EM_TRACE_LATE:
+                        trace_late_ms = atoi(optarg);
+                        break;
+                    case EM_TRACE_CLOCK:
+                        trace_clock = atoi(optarg);
+                        if (trace_clock == 0) {
+                            fprintf(stderr, "RTP clock rate must be "
+                                    "positive\n");
+                            goto err;
+                        }
+                        break;
+                    case EM_DELAY:
+                        delay_spec = strdup(optarg);
+                        break;
+                    case EM_RAW:
+                        raw_output = PJ_TRUE;
+                        break;
+                    case EM_REALTIME:
+                        realtime = PJ_TRUE;
+                        break;
+                    case EM_QUALITY:
+                        quality = PJ_TRUE;
+                        break;
+                    case EM_STATS_ONLY:
+                        stats_only = PJ_TRUE;
+                        break;
+                    case EM_PIPELINE:
+                        pipeline = PJ_TRUE;
+                        break;
+                    case EM_RELAY:
+                        relay_listen = strdup(optarg);
+                        break;
+                    case EM_RELAY_TO:
+                        relay_dest = strdup(optarg);
+                        break;
+                    case EM_CALLS:
+                        call_count = atoi(optarg);
+                        if (call_count == 0) {
+                            fprintf(stderr, "number of calls must be "
+                                    "positive\n");
+                            goto err;
+                        }
+                        break;
+                    case EM_SCHEDULE:
+                        if (em_parse_schedule(optarg, &schedule) !=
+                                PJ_SUCCESS) {
+                            fprintf(stderr, "Unknown argument for schedule: "
+                                    "%s\n", optarg);
+                            goto err;
+                        }
+                        break;
+                    case EM_REPEAT:
+                        repeat_count = atoi(optarg);
+                        if (repeat_count < 2) {
+                            fprintf(stderr, "number of repetitions must be "
+                                    "at least 2\n");
+                            goto err;
+                        }
+                        break;
+                    case EM_CI_WIDTH:
+                        ci_width = atof(optarg);
+                        if (ci_width <= 0) {
+                            fprintf(stderr, "interval width must be "
+                                    "positive\n");
+                            goto err;
+                        }
+                        break;
+                    case EM_RAW_RATE:
+                        raw_clock_rate = atoi(optarg);
+                        if (raw_clock_rate == 0) {
+                            fprintf(stderr, "raw PCM rate must be positive\n");
+                            goto err;
+                        }
+                        break;
                     default:
                         fprintf(stderr, "Unknown argument : %d\n", option_name);
                         goto err;
@@ -303,10 +640,90 @@ pj_status_t parse_args(int argc, const char *argv[])
         }
 
     }
-    if (list_codecs)
+    if (list_codecs || decode_events_file)
         return PJ_SUCCESS;
-    if (!input_file || !output_file || !codec_name)
+    if (events_file && (relay_listen || call_count || sweep_file ||
+                repeat_count)) {
+        fprintf(stderr, "Events can be recorded in a single run only\n");
+        goto err;
+    }
+    if (relay_listen || relay_dest) {
+        if (!relay_listen || !relay_dest)
+            goto err;
+        if (sweep_file || trace_file || delay_spec || realtime ||
+                packet_cache_dir || call_count || quality || stats_only) {
+            fprintf(stderr, "Relay mode can't be used along with sweep, "
+                    "trace, delay, real-time, calls, quality, stats-only "
+                    "and packet cache options\n");
+            goto err;
+        }
+    } else if (!input_file ||
+            (!output_file && !quality && !stats_only && !repeat_count) ||
+            (!codec_name && !sweep_file))
+        goto err;
+    if (ci_width > 0 && !repeat_count) {
+        fprintf(stderr, "Interval width is used with --repeat only\n");
+        goto err;
+    }
+    if (repeat_count && (output_file || sweep_file || call_count ||
+                relay_listen || realtime || trace_file ||
+                strcmp(input_file, "-") == 0)) {
+        fprintf(stderr, "Repetitions write no output file and can't be "
+                "used along with sweep, calls, relay, real-time, trace and "
+                "standard input\n");
+        goto err;
+    }
+    if (stats_only && (output_file || quality || call_count)) {
+        fprintf(stderr, "Nothing is decoded in stats-only mode, so output "
+                "file, quality and calls can't be used\n");
+        goto err;
+    }
+    if (plc_count > 1 && (relay_listen || call_count || sweep_file ||
+                repeat_count || stats_only ||
+                (output_file && strcmp(output_file, "-") == 0))) {
+        fprintf(stderr, "Several PLC modes can't be used along with relay, "
+                "calls, sweep, repeat, stats-only and standard output\n");
+        goto err;
+    }
+    if (pipeline && (relay_listen || call_count || realtime ||
+                events_file)) {
+        fprintf(stderr, "Pipeline can't be used along with relay, calls, "
+                "real-time and events\n");
         goto err;
+    }
+    if ((relay_listen || call_count) && stats_format != EM_STATS_TEXT) {
+        fprintf(stderr, "Statistics format can't be set in relay and "
+                "calls modes\n");
+        goto err;
+    }
+    if (call_count && (!output_file || quality)) {
+        fprintf(stderr, "Several calls need output file and can't be "
+                "scored\n");
+        goto err;
+    }
+    /* without output file the statistics are the only result */
+    if ((quality || stats_only) && !output_file)
+        show_stats = PJ_TRUE;
+    if (sweep_file && (strcmp(input_file, "-") == 0 ||
+                (output_file && strcmp(output_file, "-") == 0))) {
+        fprintf(stderr, "Standard input and output can't be used in "
+                "sweep mode\n");
+        goto err;
+    }
+    if (sweep_file && realtime) {
+        fprintf(stderr, "Real-time mode can't be used in sweep mode\n");
+        goto err;
+    }
+    if (call_count && (sweep_file || trace_file || realtime ||
+                packet_cache_dir || strcmp(output_file, "-") == 0)) {
+        fprintf(stderr, "Several calls can't be used along with sweep, "
+                "trace, real-time, packet cache and standard output\n");
+        goto err;
+    }
+    if (packet_cache_dir && strcmp(input_file, "-") == 0) {
+        fprintf(stderr, "Packet cache can't be used with standard input\n");
+        goto err;
+    }
     /* set up logging facility */
     if (log_file) {
         log_fd = fopen(log_file, "a");
@@ -376,32 +793,22 @@ pj_status_t parse_args(int argc, const char *argv[])
             goto err;
         }
     }
+    if (loss_model_file && (em_set(markov_p00) || em_set(markov_p10) ||
+                em_set(lost_pct) || em_set(burst_ratio))) {
+        fprintf(stderr, "Loss model file can't be used along with "
+                "p.. variables\n");
+        goto err;
+    }
+    if (trace_file && (loss_model_file || em_set(markov_p00) ||
+                em_set(markov_p10) || em_set(lost_pct) ||
+                em_set(burst_ratio))) {
+        fprintf(stderr, "Trace file can't be used along with loss model "
+                "or p.. variables\n");
+        goto err;
+    }
     /* check and set up loss rates (given from G.107 p.9) */
-    if (em_set(markov_p10) && em_set(markov_p00)){
-        if (em_set(lost_pct) || em_set(burst_ratio)){
-            fprintf(stderr, "Incompatible p.. variables. "
-                "You must set up one or two\n");
-            goto err;
-        }
-    } else if (em_set(lost_pct)) {
-        if (em_unset(burst_ratio)){
-            markov_p10 = markov_p00 = lost_pct;
-        } else if (em_set(markov_p00) || em_set(markov_p10)) {
-            fprintf(stderr, "Incompatible p.. variables. "
-                "You must set up one or two\n");
-            goto err;
-        } else {
-            markov_p10 = lost_pct / burst_ratio;
-            /*
-            markov_p00 = 100 * (1.0 - markov_p10/lost_pct) + markov_p10;
-            markov_p00 = 100 - 100/burst_ratio + lost_pct/burst_ratio;
-            */
-            markov_p00 = 100.0 - (100.0 - lost_pct)/burst_ratio;
-        }
-    } else if ( em_unset(markov_p10) && em_unset(markov_p00) &&
-            em_unset(lost_pct) && em_unset(burst_ratio) ) {
-        markov_p10 = markov_p00 = 0.00;
-    } else {
+    if (em_markov_params(markov_p00, markov_p10, lost_pct, burst_ratio,
+                &markov_p00, &markov_p10) != PJ_SUCCESS) {
         fprintf(stderr, "Incompatible p.. variables. "
                 "You must set up one or two\n");
         goto err;
@@ -413,8 +820,10 @@ pj_status_t parse_args(int argc, const char *argv[])
     return  PJ_SUCCESS;
 
 err:
-    fprintf(stderr, "Usage: %s -i|--input-file <filename1.wav>\n", argv[0]);
-    fprintf(stderr, "          -o|--output-file <filename2.wav>\n");
+    fprintf(stderr, "Usage: %s -i|--input-file <filename1.wav>|-\n", argv[0]);
+    fprintf(stderr, "          -o|--output-file <filename2.wav>|-\n");
+    fprintf(stderr, "             --raw\n");
+    fprintf(stderr, "             --raw-rate <Hz>\n");
     fprintf(stderr, "          -c|--codec <CODEC_NAME>\n");
     fprintf(stderr, "          -b|--bitrate <CODEC_BITRATE> \n"
                     "               (see man for acceptable values)\n");
@@ -423,55 +832,54 @@ err:
     fprintf(stderr, "             --p10 <lost_pct>\n");
     fprintf(stderr, "             --burst-ratio <ratio>\n");
     fprintf(stderr, "          -f|--fpp <fpp>\n");
-    fprintf(stderr, "          -p|--plc empty|repeat|smart|noise\n");
+    fprintf(stderr, "          -p|--plc empty|repeat|smart|noise[,...]|all\n");
     fprintf(stderr, "          -q|--speex-quality <value>\n");
 #ifdef PJMEDIA_SPEEX_HAS_VBR
     fprintf(stderr, "          -Q|--speex-vbr-quality <value>\n");
 #endif
     fprintf(stderr, "             --log <filename.log>\n");
     fprintf(stderr, "             --log-level <0..6>\n");
+    fprintf(stderr, "             --events <events.bin>\n");
+    fprintf(stderr, "             --events-size <n>\n");
     fprintf(stderr, "             --bucket-size <n>\n");
     fprintf(stderr, "             --sent-delay <n>\n");
+    fprintf(stderr, "             --seed <n>\n");
+    fprintf(stderr, "             --loss-runs\n");
+    fprintf(stderr, "             --loss-model <matrix.txt>\n");
+    fprintf(stderr, "             --trace <capture.pcap|capture.rtpdump>\n");
+    fprintf(stderr, "             --trace-ssrc <ssrc>\n");
+    fprintf(stderr, "             --trace-late <ms>\n");
+    fprintf(stderr, "             --trace-clock <Hz>\n");
     fprintf(stderr, "        --bw|--bandwidth Abps|Bpps\n");
+    fprintf(stderr, "             --delay const:<ms>|uniform:<min>,<max>|"
+                    "pareto:<min>,<shape>|hist:<file>\n");
+    fprintf(stderr, "             --calls <n>\n");
+    fprintf(stderr, "             --schedule fifo|fair\n");
     fprintf(stderr, "             --show-stats\n");
+    fprintf(stderr, "             --stats-format text|json|csv\n");
+    fprintf(stderr, "             --realtime\n");
+    fprintf(stderr, "             --quality\n");
+    fprintf(stderr, "             --stats-only\n");
+    fprintf(stderr, "             --pipeline\n");
+    fprintf(stderr, "             --sweep <grid.txt>\n");
+    fprintf(stderr, "          -j|--jobs <n>\n");
+    fprintf(stderr, "             --packet-cache <dir>\n");
+    fprintf(stderr, "             --repeat <n>\n");
+    fprintf(stderr, "             --ci-width <width>\n");
+    fprintf(stderr, "OR                       \n");
+    fprintf(stderr, "       %s --relay [host:]port --relay-to host:port "
+                    "[channel options]\n", argv[0]);
     fprintf(stderr, "OR                       \n");
     fprintf(stderr, "       %s --list-codecs\n", argv[0]);
+    fprintf(stderr, "OR                       \n");
+    fprintf(stderr, "       %s --decode-events <events.bin>\n", argv[0]);
     return 1;
 }
 
 
-int main(int argc, const char *argv[])
+static pj_status_t init_codecs(pjmedia_endpt *med_endpt)
 {
-    pj_caching_pool cp;
-    pj_pool_t *pool;
-    pjmedia_codec_mgr *cm;
-    pjmedia_codec *codec;
-    pjmedia_endpt *med_endpt;
-    pjmedia_port *rec_file_port = NULL, *play_file_port = NULL,
-        *markov_port = NULL, *leaky_bucket_port = NULL,
-        *silence_port = NULL, *plc_port = NULL;
-    pjmedia_master_port *master_port = NULL;
     pj_status_t status;
-    pjmedia_frame pcm_frame, frame, out_frames[MAX_FPP];
-    const pjmedia_codec_info *codec_info;
-    pjmedia_codec_param codec_param;
-    pj_str_t tmp;
-    void *pcm_buf = NULL, *buf = NULL, *tmp_buf = NULL;
-    unsigned codec_count = 1;
-    pj_size_t buf_size = 0, real_buf_size = 0;
-    int packet_lost = 0;
-    pj_timestamp read_ts;
-    pj_uint32_t total_bytes = 0; /* transmitted throught network interface (raw) */
-
-    status = parse_args(argc, argv);
-    if (status != PJ_SUCCESS)
-        return status;
-    pj_log_set_level(log_level);
-    status = pj_init();
-    pj_srand((unsigned int)time(NULL));
-    pj_caching_pool_init(&cp, &pj_pool_factory_default_policy, 0);
-    pool = pj_pool_create(&cp.factory, "emulator", 4000, 4000, NULL);
-    CHECK (pjmedia_endpt_create(&cp.factory, NULL, 1, &med_endpt));
 #if PJMEDIA_HAS_G711_CODEC
     CHECK (pjmedia_codec_g711_init(med_endpt));
 #endif
@@ -497,6 +905,677 @@ int main(int argc, const char *argv[])
 #if PJMEDIA_HAS_INTEL_IPP
     CHECK (pjmedia_codec_ipp_init(med_endpt));
 #endif
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) em_alloc_codec(const em_context *ctx,
+        const em_scenario *sc, pj_pool_t *pool, pjmedia_codec **p_codec,
+        pjmedia_codec_param *codec_param)
+{
+    pjmedia_codec_mgr *cm = ctx->codec_mgr;
+    const pjmedia_codec_info *codec_info;
+    unsigned codec_count = 1;
+    pjmedia_codec *codec;
+    pj_str_t tmp;
+    pj_status_t status;
+
+    /* codec manager is not supposed to be used from several threads */
+    if (ctx->codec_mutex)
+        pj_mutex_lock(ctx->codec_mutex);
+    status = pjmedia_codec_mgr_find_codecs_by_id(cm,
+            pj_cstr(&tmp, sc->codec_name), &codec_count, &codec_info, NULL);
+    if (status == PJ_SUCCESS)
+        status = pjmedia_codec_mgr_get_default_param(cm, codec_info,
+                codec_param);
+    if (status == PJ_SUCCESS)
+        status = pjmedia_codec_mgr_alloc_codec(cm, codec_info, &codec);
+    if (ctx->codec_mutex)
+        pj_mutex_unlock(ctx->codec_mutex);
+    if (status != PJ_SUCCESS) {
+        err("pjmedia_codec_mgr_alloc_codec", status);
+        return status;
+    }
+
+    codec_param->setting.vad = 0;
+    codec_param->setting.cng = 0;
+    if (sc->plc_mode != EM_PLC_SMART)
+        codec_param->setting.plc = 0;
+    if (sc->codec_bitrate > 0)
+        codec_param->info.avg_bps = sc->codec_bitrate;
+
+    CHECK_GOTO(codec->op->init(codec, pool));
+    CHECK_GOTO(codec->op->open(codec, codec_param));
+    PJ_LOG(5, (THIS_FILE, "created codec: clock_rate=%u, "
+                "frm_ptime=%u, enc_ptime=%u, pcm_bits_per_sample=%u, pt=%u",
+                (unsigned)codec_param->info.clock_rate,
+                (unsigned)codec_param->info.frm_ptime,
+                (unsigned)codec_param->info.enc_ptime,
+                (unsigned)codec_param->info.pcm_bits_per_sample,
+                (unsigned)codec_param->info.pt
+               ));
+    *p_codec = codec;
+    return PJ_SUCCESS;
+
+on_return:
+    /* the codec is not open, so it's given back without close() */
+    if (ctx->codec_mutex)
+        pj_mutex_lock(ctx->codec_mutex);
+    pjmedia_codec_mgr_dealloc_codec(cm, codec);
+    if (ctx->codec_mutex)
+        pj_mutex_unlock(ctx->codec_mutex);
+    return status;
+}
+
+
+PJ_DEF(void) em_dealloc_codec(const em_context *ctx, pjmedia_codec *codec)
+{
+    codec->op->close(codec);
+    if (ctx->codec_mutex)
+        pj_mutex_lock(ctx->codec_mutex);
+    pjmedia_codec_mgr_dealloc_codec(ctx->codec_mgr, codec);
+    if (ctx->codec_mutex)
+        pj_mutex_unlock(ctx->codec_mutex);
+}
+
+
+PJ_DEF(pj_status_t) em_convert_port(pj_pool_t *pool, pjmedia_port *port,
+        unsigned clock_rate, unsigned channel_count, pjmedia_port **p_port)
+{
+    pj_status_t status = PJ_SUCCESS;
+
+    *p_port = port;
+    /* channels are converted at the rate of the file */
+    if (port->info.channel_count != channel_count)
+        status = pjmedia_stereo_port_create(pool, *p_port, channel_count, 0,
+                p_port);
+    if (status == PJ_SUCCESS && (*p_port)->info.clock_rate != clock_rate)
+        status = pjmedia_resample_port_create(pool, *p_port, clock_rate, 0,
+                p_port);
+    if (status != PJ_SUCCESS) {
+        err("em_convert_port", status);
+        return status;
+    }
+    if (*p_port != port)
+        PJ_LOG(4, (THIS_FILE, "%u Hz, %u channels converted to %u Hz, "
+                    "%u channels", port->info.clock_rate,
+                    port->info.channel_count, clock_rate, channel_count));
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) em_create_input_port(pj_pool_t *pool,
+        const em_scenario *sc, const pjmedia_codec_param *codec_param,
+        pjmedia_port **p_file_port, pjmedia_port **p_port)
+{
+    unsigned ptime = codec_param->info.frm_ptime * sc->fpp;
+    pj_status_t status;
+
+    if (strcmp(sc->input_file, "-") == 0)
+        status = pjmedia_pipe_reader_port_create(pool, STDIN_FILENO, ptime,
+                sc->raw_clock_rate, p_file_port);
+    else {
+        /* mapped file gives frames without copies, pjmedia player reads
+           formats other than 16 bit PCM */
+        status = pjmedia_map_reader_port_create(pool, sc->input_file, ptime,
+                p_file_port);
+        if (status != PJ_SUCCESS)
+            status = pjmedia_wav_player_port_create(pool, sc->input_file,
+                    ptime, PJMEDIA_FILE_NO_LOOP, 0, p_file_port);
+    }
+    if (status != PJ_SUCCESS)
+        return status;
+    return em_convert_port(pool, *p_file_port, codec_param->info.clock_rate,
+            codec_param->info.channel_cnt, p_port);
+}
+
+
+/* decoding end of the chain, one per PLC mode */
+struct em_branch
+{
+    pjmedia_codec    *decoder;
+    pjmedia_port     *rec_file_port;
+    pjmedia_port     *output_port;
+    pjmedia_port     *write_stage;    /* with the pipeline only */
+    pjmedia_port     *quality_port;
+    pjmedia_port     *silence_port;
+    pjmedia_port     *plc_port;
+    pjmedia_port     *decode_stage;   /* with the pipeline only */
+    pjmedia_port     *head;           /* the channel puts packets here */
+};
+
+
+/* plc -> silence -> [quality] -> output of the scenario (or null port) */
+static pj_status_t em_create_branch(pj_pool_t *pool, const em_scenario *sc,
+        pjmedia_port *input_port, pjmedia_port *play_file_port,
+        pj_bool_t views, struct em_branch *br)
+{
+    pjmedia_port *write_port;
+    pj_status_t status;
+
+    if (!sc->output_file)
+        ; /* only the quality is of interest */
+    else if (strcmp(sc->output_file, "-") == 0)
+        CHECK(pjmedia_pipe_writer_port_create(pool, STDOUT_FILENO,
+                play_file_port->info.clock_rate,
+                play_file_port->info.channel_count,
+                play_file_port->info.samples_per_frame/sc->fpp,
+                play_file_port->info.bits_per_sample,
+                (sc->raw_output ? PJMEDIA_PIPE_RAW : 0) |
+                (sc->realtime ? PJMEDIA_PIPE_FLUSH : 0),
+                &br->rec_file_port));
+    else
+        /* output is as long as input, so the file is allocated at once */
+        CHECK(pjmedia_map_writer_port_create(pool, sc->output_file,
+                play_file_port->info.clock_rate,
+                play_file_port->info.channel_count,
+                play_file_port->info.samples_per_frame/sc->fpp,
+                play_file_port->info.bits_per_sample,
+                views ? pjmedia_map_reader_get_data_size(play_file_port) : 0,
+                &br->rec_file_port));
+    if (br->rec_file_port)
+        CHECK(em_convert_port(pool, br->rec_file_port,
+                input_port->info.clock_rate, input_port->info.channel_count,
+                &br->output_port));
+    /* the writer converts and writes the output on its own */
+    write_port = br->output_port;
+    if (br->output_port && sc->pipeline) {
+        CHECK(pjmedia_stage_port_create(pool, br->output_port,
+                    EM_STAGE_FRAMES, &br->write_stage));
+        write_port = br->write_stage;
+    }
+    if (!write_port && !sc->quality) {
+        /* repetitions keep the statistics only, the signal is dropped */
+        CHECK(pjmedia_null_port_create(pool, input_port->info.clock_rate,
+                input_port->info.channel_count,
+                input_port->info.samples_per_frame/sc->fpp,
+                input_port->info.bits_per_sample, &br->output_port));
+        write_port = br->output_port;
+    }
+    if (sc->quality)
+        CHECK(pjmedia_quality_port_create(pool, write_port,
+                input_port->info.clock_rate,
+                input_port->info.channel_count,
+                input_port->info.samples_per_frame/sc->fpp,
+                input_port->info.bits_per_sample, &br->quality_port));
+    CHECK(pjmedia_silence_port_create(pool,
+                br->quality_port ? br->quality_port : write_port, 0,
+                &br->silence_port));
+    CHECK(pjmedia_plc_port_create(pool, br->silence_port, br->decoder,
+                sc->fpp, sc->plc_mode, &br->plc_port));
+    br->head = br->plc_port;
+    if (sc->pipeline) {
+        CHECK(pjmedia_stage_port_create(pool, br->plc_port, EM_STAGE_FRAMES,
+                    &br->decode_stage));
+        br->head = br->decode_stage;
+    }
+    return PJ_SUCCESS;
+}
+
+
+/* stops the thread of a stage, the port is forgotten even if it failed */
+static pj_status_t em_destroy_stage(pjmedia_port **p_stage)
+{
+    pj_status_t status = PJ_SUCCESS;
+    if (*p_stage) {
+        status = pjmedia_port_destroy(*p_stage);
+        *p_stage = NULL;
+    }
+    return status;
+}
+
+
+/* the same reference for the quality port of every mode */
+static pj_status_t em_put_reference(struct em_branch *branches,
+        unsigned count, const pjmedia_frame *frame)
+{
+    pj_status_t status;
+    unsigned i;
+    for (i=0; i<count; i++) {
+        status = pjmedia_quality_port_put_reference(branches[i].quality_port,
+                frame);
+        if (status != PJ_SUCCESS)
+            return status;
+    }
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) em_run_scenario(const em_context *ctx,
+        const em_scenario *sc, em_result *res)
+{
+    return em_run_fanout(ctx, sc, 1, res);
+}
+
+
+PJ_DEF(pj_status_t) em_run_fanout(const em_context *ctx,
+        const em_scenario sc[], unsigned count, em_result res[])
+{
+    pj_pool_t *pool;
+    pjmedia_codec *codec;
+    pjmedia_port *play_file_port = NULL, *input_port = NULL,
+        *loss_port = NULL, *leaky_bucket_port = NULL, *delay_port = NULL,
+        *fanout_port = NULL, *count_port = NULL;
+    /* heads of the stages with the pipeline, the main thread reads and
+       encodes */
+    pjmedia_port *channel_stage = NULL;
+    pjmedia_port *channel_port, *decode_port;
+    pjmedia_port **heads = NULL;
+    struct em_branch *branches = NULL;
+    pj_status_t status;
+    pjmedia_frame pcm_frame, frame, frames[EM_BATCH_MAX];
+    unsigned batch, pending = 0, i;
+    pjmedia_codec_param codec_param;
+    void *pcm_buf = NULL;
+    pj_uint8_t *buf = NULL; /* a packet per frame of the batch */
+    pj_size_t buf_size = 0;
+    em_packet_cache *cache_reader = NULL, *cache_writer = NULL;
+    em_pacer pacer;
+    pj_timestamp read_ts;
+    pj_uint64_t total_bytes = 0; /* transmitted throught network interface (raw) */
+    pj_size_t synth_size = 0;    /* size of every packet, if it isn't encoded */
+    pj_bool_t views;
+
+    PJ_ASSERT_RETURN(ctx && sc && count && res, PJ_EINVAL);
+    PJ_ASSERT_RETURN(count == 1 || !sc->stats_only, PJ_EINVAL);
+
+    pool = pj_pool_create(ctx->pool_factory, "scenario", 4000, 4000, NULL);
+    status = em_alloc_codec(ctx, sc, pool, &codec, &codec_param);
+    if (status != PJ_SUCCESS) {
+        pj_pool_release(pool);
+        return status;
+    }
+
+    /* the channel works in the codec's format, the output file is in the
+       format of the input one */
+    CHECK_GOTO(em_create_input_port(pool, sc, &codec_param, &play_file_port,
+                &input_port));
+    /* frames of mapped input are used in place if need no conversion */
+    views = input_port == play_file_port &&
+        pjmedia_map_reader_port_check(play_file_port);
+    buf_size = input_port->info.bytes_per_frame;
+    pcm_buf = pj_pool_zalloc(pool, buf_size);
+    buf = (pj_uint8_t*)pj_pool_zalloc(pool, EM_BATCH_MAX * buf_size);
+    PJ_LOG(5, (THIS_FILE, "created buffer with size %u",
+                (unsigned)buf_size));
+
+    CHECK_GOTO( ( buf && pcm_buf ? PJ_SUCCESS : -1) );
+    if (sc->stats_only) {
+        /* channel ports are terminated right away, nothing is decoded */
+        CHECK_GOTO(pjmedia_count_port_create(pool,
+                input_port->info.clock_rate,
+                input_port->info.channel_count,
+                input_port->info.samples_per_frame,
+                input_port->info.bits_per_sample, &count_port));
+        /* packets of constant bitrate codecs are of known size, so there
+           is no need to encode them */
+        if ((codec_param.info.avg_bps == codec_param.info.max_bps) &&
+                sc->codec_bitrate == 0 &&
+                (codec_param.info.avg_bps * codec_param.info.frm_ptime) %
+                8000 == 0)
+            synth_size = (pj_size_t)codec_param.info.avg_bps *
+                codec_param.info.frm_ptime / 8000 * sc->fpp;
+        PJ_LOG(5, (THIS_FILE, "stats only, packet size %u",
+                    (unsigned)synth_size));
+        decode_port = count_port;
+    } else {
+        branches = (struct em_branch*)pj_pool_calloc(pool, count,
+                sizeof(struct em_branch));
+        heads = (pjmedia_port**)pj_pool_calloc(pool, count,
+                sizeof(pjmedia_port*));
+        CHECK_GOTO( ( branches && heads ? PJ_SUCCESS : PJ_ENOMEM) );
+        for (i=0; i<count; i++) {
+            /* decoders of other modes and threads have state of their own,
+               the encoder stays with the main thread */
+            branches[i].decoder = codec;
+            if (count > 1 || sc->pipeline)
+                CHECK_GOTO(em_alloc_codec(ctx, &sc[i], pool,
+                            &branches[i].decoder, &codec_param));
+            CHECK_GOTO(em_create_branch(pool, &sc[i], input_port,
+                        play_file_port, views, &branches[i]));
+            heads[i] = branches[i].head;
+        }
+        /* every mode decodes the same packets */
+        decode_port = heads[0];
+        if (count > 1) {
+            CHECK_GOTO(pjmedia_fanout_port_create(pool, heads, count,
+                        &fanout_port));
+            decode_port = fanout_port;
+        }
+    }
+    if (sc->delay_model)
+        CHECK_GOTO(pjmedia_delay_port_create(ctx->pool_factory, decode_port,
+                    sc->delay_model, sc->seed, sc->stream, &delay_port));
+    CHECK_GOTO(pjmedia_leaky_bucket_port_create(ctx->pool_factory,
+                delay_port ? delay_port : decode_port,
+                sc->bucket_size,
+                sc->sent_delay,
+                (unsigned)sc->bits_per_second,
+                (unsigned)sc->packets_per_second,
+                &leaky_bucket_port));
+    if (sc->trace_file)
+        CHECK_GOTO(pjmedia_trace_port_create(pool, leaky_bucket_port,
+                    sc->trace_file, sc->trace_ssrc_set ? &sc->trace_ssrc : NULL,
+                    sc->trace_late_ms, sc->trace_clock, &loss_port));
+    else if (sc->loss_model)
+        CHECK_GOTO(pjmedia_loss_model_port_create(pool, leaky_bucket_port,
+                    sc->loss_model, sc->seed, sc->stream, &loss_port));
+    else
+        CHECK_GOTO(pjmedia_markov_port_create(pool, leaky_bucket_port,
+                    sc->markov_p10, sc->markov_p00, sc->seed, sc->stream,
+                    sc->markov_options, &loss_port));
+    channel_port = loss_port;
+    if (sc->pipeline) {
+        CHECK_GOTO(pjmedia_stage_port_create(pool, loss_port, EM_STAGE_FRAMES,
+                    &channel_stage));
+        channel_port = channel_stage;
+    }
+    if (ctx->packet_cache_dir) {
+        em_packet_cache_key key;
+        key.input_hash = sc->input_hash;
+        key.codec_name = sc->codec_name;
+        key.codec_bitrate = sc->codec_bitrate;
+        key.speex_quality = ctx->speex_quality;
+        key.fpp = sc->fpp;
+        status = em_packet_cache_open(pool, ctx->packet_cache_dir, &key,
+                &cache_reader);
+        if (status == PJ_SUCCESS && em_packet_cache_samples_per_frame(
+                    cache_reader) != input_port->info.samples_per_frame) {
+            em_packet_cache_close(cache_reader, PJ_FALSE);
+            cache_reader = NULL;
+        }
+        if (!cache_reader && !synth_size)
+            CHECK_GOTO(em_packet_cache_create(pool, ctx->packet_cache_dir, &key,
+                        input_port->info.samples_per_frame,
+                        &cache_writer));
+    }
+    /* frames of ptime*fpp are paced by the clock, not by the CPU */
+    if (sc->realtime)
+        em_pacer_init(&pacer, (unsigned)(
+                    (pj_uint64_t)input_port->info.samples_per_frame *
+                    1000000 / input_port->info.channel_count /
+                    input_port->info.clock_rate));
+    /* packets are put into the channel in batches, one by one if the
+       output is to be heard in time */
+    batch = sc->realtime ? 1 : EM_BATCH_MAX;
+    read_ts.u64 = 0;
+    for(;;){
+        if (sc->realtime)
+            em_pacer_wait(&pacer);
+        if (cache_reader) {
+            /* encoded stream is already known, skip reading and encoding */
+            if (em_packet_cache_read(cache_reader, &frame) != PJ_SUCCESS)
+                break;
+            frame.timestamp.u64 = read_ts.u64;
+            if (sc->quality) {
+                /* reference is needed anyway */
+                pcm_frame.buf = pcm_buf;
+                pcm_frame.size = buf_size;
+                if ((views ?
+                        pjmedia_map_reader_get_view(input_port, &pcm_frame) :
+                        pjmedia_port_get_frame(input_port, &pcm_frame)) ==
+                        PJ_SUCCESS)
+                    CHECK_GOTO(em_put_reference(branches, count, &pcm_frame));
+            }
+        } else {
+            pcm_frame.buf = pcm_buf;
+            pcm_frame.size = buf_size;
+            status = views ?
+                pjmedia_map_reader_get_view(input_port, &pcm_frame) :
+                pjmedia_port_get_frame(input_port, &pcm_frame);
+            if (status != PJ_SUCCESS ||
+                    pcm_frame.type == PJMEDIA_FRAME_TYPE_NONE)
+                break;
+            pcm_frame.timestamp.u64 = read_ts.u64;
+            if (sc->quality)
+                CHECK_GOTO(em_put_reference(branches, count, &pcm_frame));
+            EM_LOG(6, (THIS_FILE, "pcm packet: sz=%d ts=%llu",
+                    pcm_frame.size/sizeof(pj_uint16_t),
+                    pcm_frame.timestamp.u64));
+            frame.buf = buf + pending * buf_size;
+            frame.size = buf_size;
+            if (synth_size) {
+                /* only the size of the packet matters */
+                frame.type = PJMEDIA_FRAME_TYPE_AUDIO;
+                frame.size = synth_size;
+            } else
+                CHECK_GOTO(codec->op->encode(codec, &pcm_frame, buf_size,
+                            &frame));
+            frame.timestamp = pcm_frame.timestamp;
+            if (cache_writer)
+                CHECK_GOTO(em_packet_cache_write(cache_writer, &frame));
+        }
+        EM_LOG(6, (THIS_FILE, "encoded packet: sz=%d ts=%llu",
+                frame.size/sizeof(pj_uint16_t), frame.timestamp.u64));
+        frames[pending++] = frame;
+        if (pending == batch) {
+            CHECK_GOTO(em_port_put_frames(channel_port, frames, pending));
+            pending = 0;
+        }
+        read_ts.u64 += input_port->info.samples_per_frame;
+        total_bytes += frame.size;
+    }
+    CHECK_GOTO(em_port_put_frames(channel_port, frames, pending));
+    /* ports of a stage are touched only when it's over */
+    CHECK_GOTO(em_destroy_stage(&channel_stage));
+    if (cache_reader) {
+        em_packet_cache_close(cache_reader, PJ_FALSE);
+        cache_reader = NULL;
+    }
+    if (cache_writer) {
+        em_packet_cache *writer = cache_writer;
+        cache_writer = NULL;
+        CHECK_GOTO(em_packet_cache_close(writer, PJ_TRUE));
+    }
+    res->sample_length = (double)read_ts.u64 / input_port->info.clock_rate;
+    if (sc->trace_file)
+        pjmedia_trace_port_get_runs(loss_port, &res->loss_bursts,
+                &res->loss_gaps);
+    else if (sc->loss_model)
+        pjmedia_loss_model_port_get_runs(loss_port, &res->loss_bursts,
+                &res->loss_gaps);
+    else
+        pjmedia_markov_port_get_runs(loss_port, &res->loss_bursts,
+                &res->loss_gaps);
+    pjmedia_leaky_bucket_port_get_statistics(leaky_bucket_port, &res->bucket);
+    /* what is destroyed here is forgotten, the rest goes at on_return */
+    pjmedia_port_destroy(loss_port);
+    loss_port = NULL;
+    pjmedia_port_destroy(leaky_bucket_port);
+    leaky_bucket_port = NULL;
+    if (delay_port) {
+        pjmedia_port_destroy(delay_port);
+        delay_port = NULL;
+    }
+    if (fanout_port) {
+        pjmedia_port_destroy(fanout_port);
+        fanout_port = NULL;
+    }
+    for (i=0; branches && i<count; i++)
+        CHECK_GOTO(em_destroy_stage(&branches[i].decode_stage));
+
+    res->total_bytes = total_bytes;
+    res->expected_bps = codec_param.info.avg_bps;
+    res->seed = sc->seed;
+    res->realtime = sc->realtime;
+    if (sc->realtime)
+        em_pacer_get_statistics(&pacer, &res->pacing);
+    /* the channel is the same for every mode */
+    for (i=1; i<count; i++)
+        res[i] = res[0];
+
+    if (count_port) {
+        pj_bzero(&res->silence, sizeof(res->silence));
+        res->scored = PJ_FALSE;
+        pjmedia_count_port_get_statistics(count_port, &res->stats);
+    }
+    for (i=0; branches && i<count; i++) {
+        struct em_branch *br = &branches[i];
+        pjmedia_plc_port_get_statistics(br->plc_port, &res[i].stats);
+        pjmedia_silence_port_get_statistics(br->silence_port,
+                &res[i].silence);
+        pjmedia_port_destroy(br->plc_port);
+        br->plc_port = NULL;
+        pjmedia_port_destroy(br->silence_port);
+        br->silence_port = NULL;
+        CHECK_GOTO(em_destroy_stage(&br->write_stage));
+        res[i].scored = br->quality_port != NULL;
+        if (br->quality_port)
+            CHECK_GOTO(pjmedia_quality_port_get_statistics(br->quality_port,
+                        &res[i].quality));
+    }
+    status = PJ_SUCCESS;
+
+on_return:
+    if (cache_reader)
+        em_packet_cache_close(cache_reader, PJ_FALSE);
+    if (cache_writer)
+        em_packet_cache_close(cache_writer, PJ_FALSE);
+    /* in the order of the chain, a port may pass frames downstream when
+       it's destroyed; threads of the stages are stopped before anything
+       after them is gone */
+    em_destroy_stage(&channel_stage);
+    if (loss_port)
+        pjmedia_port_destroy(loss_port);
+    if (leaky_bucket_port)
+        pjmedia_port_destroy(leaky_bucket_port);
+    if (delay_port)
+        pjmedia_port_destroy(delay_port);
+    if (fanout_port)
+        pjmedia_port_destroy(fanout_port);
+    if (count_port)
+        pjmedia_port_destroy(count_port);
+    for (i=0; branches && i<count; i++) {
+        struct em_branch *br = &branches[i];
+        em_destroy_stage(&br->decode_stage);
+        if (br->plc_port)
+            pjmedia_port_destroy(br->plc_port);
+        if (br->silence_port)
+            pjmedia_port_destroy(br->silence_port);
+        if (br->quality_port)
+            pjmedia_port_destroy(br->quality_port);
+        em_destroy_stage(&br->write_stage);
+        /* the converter destroys the file */
+        if (br->output_port)
+            pjmedia_port_destroy(br->output_port);
+        else if (br->rec_file_port)
+            pjmedia_port_destroy(br->rec_file_port);
+        if (br->decoder && br->decoder != codec)
+            em_dealloc_codec(ctx, br->decoder);
+    }
+    if (input_port)
+        pjmedia_port_destroy(input_port);
+    else if (play_file_port)
+        pjmedia_port_destroy(play_file_port);
+    em_dealloc_codec(ctx, codec);
+    pj_pool_release(pool);
+    return status;
+}
+
+
+static void print_stats(FILE *fd, const em_result *res)
+{
+    const em_plc_statistics *stats = &res->stats;
+    fprintf(fd,
+            "Emulation statistics\n"
+            "          sample total length: %.2f seconds\n"
+            "           total packets sent: %llu\n"
+            "                 packets lost: %llu\n"
+            "             packets received: %llu\n",
+        res->sample_length,
+        (unsigned long long)stats->total, (unsigned long long)stats->lost,
+        (unsigned long long)stats->received);
+    /* nothing was sent when the input is shorter than a packet */
+    if (stats->total && res->sample_length > 0)
+        fprintf(fd,
+            "           avg bits per frame: %llu\n"
+            "             expected avg bps: %u\n"
+            "                 real avg bps: %.2f\n"
+            "                 loss percent: %.2f\n",
+            (unsigned long long)(res->total_bytes * 8 / stats->total),
+            res->expected_bps,
+            res->total_bytes * 8 / res->sample_length,
+            100.0 * stats->lost/stats->total);
+    else
+        fprintf(fd,
+            "           avg bits per frame: n/a\n"
+            "             expected avg bps: %u\n"
+            "                 real avg bps: n/a\n"
+            "                 loss percent: n/a\n",
+            res->expected_bps);
+    fprintf(fd,
+            "          channel loss bursts: mean %.2f, max %llu packets\n"
+            "    packets dropped by bucket: %llu\n"
+            "               queueing delay: p50 %llu, p95 %llu, p99 %llu, "
+                "max %llu ms\n"
+            "              silence padding: %llu samples\n"
+            "                  random seed: %llu\n",
+        em_hist_mean(&res->loss_bursts),
+        (unsigned long long)res->loss_bursts.max,
+        (unsigned long long)res->bucket.dropped,
+        (unsigned long long)em_hist_percentile(&res->bucket.delay_ms, 50),
+        (unsigned long long)em_hist_percentile(&res->bucket.delay_ms, 95),
+        (unsigned long long)em_hist_percentile(&res->bucket.delay_ms, 99),
+        (unsigned long long)res->bucket.delay_ms.max,
+        (unsigned long long)res->silence.padding_samples,
+        (unsigned long long)res->seed);
+    if (res->realtime) {
+        const em_pacer_statistics *pacing = &res->pacing;
+        fprintf(fd,
+            "                 frame period: %u us\n"
+            "             scheduling delay: mean %.1f us, p99 %u us, "
+                "max %u us\n"
+            "           frame process time: mean %.1f us, max %u us\n"
+            "                     overruns: %llu of %llu frames\n",
+            pacing->period_us,
+            pacing->late_mean_us, pacing->late_p99_us, pacing->late_max_us,
+            pacing->busy_mean_us, pacing->busy_max_us,
+            (unsigned long long)pacing->overruns,
+            (unsigned long long)pacing->frames);
+    }
+    if (res->scored) {
+        const em_quality_statistics *quality = &res->quality;
+        fprintf(fd,
+            "                          SNR: %.2f dB\n"
+            "                segmental SNR: %.2f dB\n"
+            "        log-spectral distance: %.2f dB\n"
+            "                 output delay: %.2f ms\n"
+            "              compared length: %.2f seconds (%u active "
+                "segments)\n",
+            quality->snr_db, quality->segsnr_db, quality->lsd_db,
+            quality->delay_ms, quality->length, quality->segments);
+    }
+}
+
+
+int main(int argc, const char *argv[])
+{
+    pj_caching_pool cp;
+    pj_pool_t *pool;
+    pjmedia_codec_mgr *cm;
+    pjmedia_endpt *med_endpt;
+    pj_status_t status;
+    pjmedia_codec_param codec_param;
+    em_context ctx;
+    em_scenario sc;
+    em_scenario plc_sc[EM_PLC_MODE_COUNT]; /* sc with every PLC mode */
+    em_result res[EM_PLC_MODE_COUNT];
+    unsigned i;
+
+    status = parse_args(argc, argv);
+    if (status != PJ_SUCCESS)
+        return status;
+    pj_log_set_level(log_level);
+    if (decode_events_file)
+        return em_events_decode(decode_events_file, stdout);
+    status = pj_init();
+    if (!seed_set)
+        seed = (pj_uint64_t)time(NULL);
+    pj_srand((unsigned int)seed);
+    pj_caching_pool_init(&cp, &pj_pool_factory_default_policy, 0);
+    pool = pj_pool_create(&cp.factory, "emulator", 4000, 4000, NULL);
+    CHECK (pjmedia_endpt_create(&cp.factory, NULL, 1, &med_endpt));
+    CHECK (init_codecs(med_endpt));
     cm = pjmedia_endpt_get_codec_mgr(med_endpt);
     CHECK( (cm ? PJ_SUCCESS : -1) );
     if (list_codecs) {
@@ -516,115 +1595,137 @@ int main(int argc, const char *argv[])
         }
         exit (0);
     }
-    CHECK (pjmedia_codec_mgr_find_codecs_by_id(cm,
-            pj_cstr(&tmp, codec_name), &codec_count, &codec_info, NULL) );
-    CHECK (pjmedia_codec_mgr_get_default_param(cm, codec_info, &codec_param));
-    codec_param.setting.vad = 0;
-    codec_param.setting.cng = 0;
-    if (plc_mode != EM_PLC_SMART)
-        codec_param.setting.plc = 0;
-    if (codec_bitrate > 0)
-        codec_param.info.avg_bps = codec_bitrate;
-
-    CHECK (pjmedia_codec_mgr_alloc_codec(cm, codec_info, &codec));
-    CHECK (codec->op->init(codec, pool) );
-    CHECK (codec->op->open(codec, &codec_param));
-    PJ_LOG(5, (THIS_FILE, "created codec: clock_rate=%u, "
-                "frm_ptime=%u, enc_ptime=%u, pcm_bits_per_sample=%u, pt=%u",
-                (unsigned)codec_param.info.frm_ptime,
-                (unsigned)codec_param.info.enc_ptime,
-                (unsigned)codec_param.info.pcm_bits_per_sample,
-                (unsigned)codec_param.info.pt
-               ));
 
-    CHECK (pjmedia_wav_player_port_create(pool, input_file,
-            codec_param.info.frm_ptime*fpp, PJMEDIA_FILE_NO_LOOP, 0,
-            &play_file_port));
-    buf_size = play_file_port->info.bytes_per_frame;
-    pcm_buf = pj_pool_zalloc(pool, buf_size);
-    buf = pj_pool_zalloc(pool, buf_size);
-    PJ_LOG(5, (THIS_FILE, "created buffer with size %u",
-                (unsigned)play_file_port->info.bytes_per_frame
-               ));
+    ctx.pool_factory = &cp.factory;
+    ctx.codec_mgr = cm;
+    ctx.codec_mutex = NULL;
+    ctx.packet_cache_dir = packet_cache_dir;
+#ifdef PJMEDIA_SPEEX_HAS_VBR
+    ctx.speex_quality = em_set(speex_vbr_quality) ? speex_vbr_quality :
+        speex_quality;
+#else
+    ctx.speex_quality = speex_quality;
+#endif
 
-    tmp_buf = pj_pool_zalloc(pool, buf_size/fpp);
-    CHECK( ( buf && pcm_buf && tmp_buf ? PJ_SUCCESS : -1) );
-    CHECK(pjmedia_wav_writer_port_create(pool, output_file,
-            play_file_port->info.clock_rate,
-            play_file_port->info.channel_count,
-            play_file_port->info.samples_per_frame/fpp,
-            play_file_port->info.bits_per_sample, 0, 0, &rec_file_port));
-    CHECK(pjmedia_silence_port_create(pool, rec_file_port, 0, &silence_port));
-    CHECK(pjmedia_plc_port_create(pool, silence_port, codec, fpp, plc_mode,
-                &plc_port));
-    CHECK(pjmedia_leaky_bucket_port_create(&cp.factory, plc_port, bucket_size,
-                sent_delay,
-                (unsigned)bits_per_second,
-                (unsigned)packets_per_second,
-                &leaky_bucket_port));
-    CHECK(pjmedia_markov_port_create(pool, leaky_bucket_port, markov_p10,
-                markov_p00, &markov_port));
-    #if 0
-    status = pjmedia_master_port_create(pool, play_file_port, rec_file_port,
-            0, &master_port);
-    status = pjmedia_master_port_start(master_port);
-    while (!stop) {
-        status = pj_thread_sleep(10);
-    }
-    status = pjmedia_master_port_destroy(master_port, PJ_TRUE);
-    #endif
-    read_ts.u64 = 0;
-    for(;;){
-        int i;
-        unsigned cnt = MAX_FPP;
-        double lost_threshold = 0;
-
-        pcm_frame.buf = pcm_buf;
-        pcm_frame.size = buf_size;
-        status = pjmedia_port_get_frame(play_file_port, &pcm_frame);
-        if (status != PJ_SUCCESS || pcm_frame.type == PJMEDIA_FRAME_TYPE_NONE)
-            break;
-        pcm_frame.timestamp.u64 = read_ts.u64;
-        PJ_LOG(6, (THIS_FILE, "pcm packet: sz=%d ts=%llu",
-                pcm_frame.size/sizeof(pj_uint16_t), pcm_frame.timestamp.u64));
-        frame.buf = buf;
-        frame.size = buf_size;
-        CHECK (codec->op->encode(codec, &pcm_frame, buf_size, &frame));
-        frame.timestamp = pcm_frame.timestamp;
-        PJ_LOG(6, (THIS_FILE, "encoded packet: sz=%d ts=%llu",
-                frame.size/sizeof(pj_uint16_t), frame.timestamp.u64));
-        CHECK(pjmedia_port_put_frame(markov_port, &frame));
-        read_ts.u64 += play_file_port->info.samples_per_frame;
-        total_bytes += frame.size;
+    sc.input_file = input_file;
+    sc.input_hash = 0;
+    if (packet_cache_dir)
+        CHECK (em_packet_cache_hash_file(input_file, &sc.input_hash));
+    sc.output_file = output_file;
+    sc.raw_output = raw_output;
+    sc.raw_clock_rate = raw_clock_rate;
+    sc.realtime = realtime;
+    sc.quality = quality;
+    sc.stats_only = stats_only;
+    sc.pipeline = pipeline;
+    sc.codec_name = codec_name;
+    sc.codec_bitrate = codec_bitrate;
+    sc.fpp = fpp;
+    sc.plc_mode = plc_mode;
+    sc.markov_p00 = markov_p00;
+    sc.markov_p10 = markov_p10;
+    sc.markov_options = markov_options;
+    sc.loss_model = NULL;
+    if (loss_model_file) {
+        em_loss_model *model;
+        CHECK (em_loss_model_load(pool, loss_model_file, &model));
+        sc.loss_model = model;
+    }
+    sc.trace_file = trace_file;
+    sc.trace_ssrc = trace_ssrc;
+    sc.trace_ssrc_set = trace_ssrc_set;
+    sc.trace_late_ms = trace_late_ms;
+    sc.trace_clock = trace_clock;
+    sc.delay_model = NULL;
+    if (delay_spec) {
+        em_delay_model *model;
+        CHECK (em_delay_model_parse(pool, delay_spec, &model));
+        sc.delay_model = model;
+    }
+    sc.seed = seed;
+    sc.stream = 0;
+    sc.bucket_size = bucket_size;
+    sc.sent_delay = sent_delay;
+    sc.bits_per_second = bits_per_second;
+    sc.packets_per_second = packets_per_second;
+
+    if (relay_listen) {
+        em_relay_statistics rstats;
+        status = em_relay_run(&ctx, &sc, relay_listen, relay_dest, jobs,
+                &rstats);
+        if (status == PJ_SUCCESS && show_stats)
+            printf(
+                "Relay statistics\n"
+                "                        flows: %llu\n"
+                "             packets received: %llu\n"
+                "            packets forwarded: %llu\n"
+                "                 packets lost: %llu\n"
+                "                 RTCP packets: %llu\n"
+                "              ignored packets: %llu\n"
+                "                  send errors: %llu\n",
+                (unsigned long long)rstats.flows,
+                (unsigned long long)rstats.received,
+                (unsigned long long)rstats.forwarded,
+                (unsigned long long)rstats.lost,
+                (unsigned long long)rstats.rtcp,
+                (unsigned long long)rstats.ignored,
+                (unsigned long long)rstats.send_errors);
+    } else if (call_count) {
+        CHECK (pj_mutex_create_simple(pool, "codec_mgr", &ctx.codec_mutex));
+        status = em_multicall_run(&ctx, &sc, call_count, schedule, jobs,
+                stdout);
+    } else if (repeat_count) {
+        CHECK (pj_mutex_create_simple(pool, "codec_mgr", &ctx.codec_mutex));
+        status = em_repeat_run(&ctx, &sc, repeat_count, ci_width, jobs,
+                stats_format, stdout);
+    } else if (sweep_file) {
+        CHECK (pj_mutex_create_simple(pool, "codec_mgr", &ctx.codec_mutex));
+        status = em_sweep_run(&ctx, &sc, sweep_file, jobs, stats_format,
+                stdout);
+    } else {
+        /* standard output may carry the audio */
+        FILE *stats_fd = output_file && strcmp(output_file, "-") == 0 ?
+            stderr : stdout;
+        if (events_file)
+            CHECK (em_events_start(pool, events_size));
+        /* the channel is run once for all modes, out.wav -> out-empty.wav,
+           out-repeat.wav, ... */
+        for (i=0; i<plc_count; i++) {
+            plc_sc[i] = sc;
+            plc_sc[i].plc_mode = plc_modes[i];
+            if (plc_count > 1 && output_file) {
+                int prefix_len = (int)strlen(output_file);
+                if (prefix_len > 4 &&
+                        strcasecmp(&output_file[prefix_len-4], ".wav") == 0)
+                    prefix_len -= 4;
+                plc_sc[i].output_file = pj_pool_alloc(pool, prefix_len + 16);
+                sprintf((char*)plc_sc[i].output_file, "%.*s-%s.wav",
+                        prefix_len, output_file,
+                        em_plc_mode_name(plc_modes[i]));
+            }
+        }
+        status = em_run_fanout(&ctx, plc_sc, plc_count, res);
+        if (events_file)
+            em_events_dump(events_file);
+        if (status == PJ_SUCCESS && show_stats) {
+            if (stats_format == EM_STATS_CSV)
+                em_stats_print_csv_header(stats_fd);
+            for (i=0; i<plc_count; i++) {
+                if (stats_format == EM_STATS_JSON)
+                    em_stats_print_json(stats_fd, -1, &plc_sc[i], &res[i]);
+                else if (stats_format == EM_STATS_CSV)
+                    em_stats_print_csv(stats_fd, &plc_sc[i], &res[i]);
+                else {
+                    if (plc_count > 1)
+                        fprintf(stats_fd, "%sPLC %s\n", i ? "\n" : "",
+                                em_plc_mode_name(plc_modes[i]));
+                    print_stats(stats_fd, &res[i]);
+                }
+            }
+        }
     }
-    pjmedia_port_destroy(play_file_port);
-    pjmedia_port_destroy(markov_port);
-    pjmedia_port_destroy(leaky_bucket_port);
-    if (show_stats){
-        em_plc_statistics stats;
-        double sample_length = (double)read_ts.u64 / play_file_port->info.clock_rate;
-        pjmedia_plc_port_get_statistics(plc_port, &stats);
-        printf(
-                "Emulation statistics\n"
-                "          sample total length: %.2f seconds\n"
-                "           total packets sent: %u\n"
-                "                 packets lost: %u\n"
-                "             packets received: %u\n"
-                "           avg bits per frame: %u\n"
-                "             expected avg bps: %u\n"
-                "                 real avg bps: %.2f\n"
-                "                 loss percent: %.2f\n",
-            sample_length,
-            stats.total, stats.lost, stats.received,
-            total_bytes * 8 / stats.total,
-            codec_param.info.avg_bps,
-            total_bytes * 8 / sample_length,
-            100.0 * stats.lost/stats.total);
-    }
-    pjmedia_port_destroy(plc_port);
-    pjmedia_port_destroy(silence_port);
-    pjmedia_port_destroy(rec_file_port);
     if (log_fd != stderr){
         fclose(log_fd);
     }
+    return status;
 }
@@ -1 +1,124 @@
-/* stub */
+#ifndef __EMULATOR_H__
+#define __EMULATOR_H__
+
+#include <pjlib.h>
+#include <pjlib-util.h>
+#include <pjmedia.h>
+#include "plc_port.h"
+#include "silence_port.h"
+#include "leaky_bucket_port.h"
+#include "loss_model_port.h"
+#include "delay_port.h"
+#include "pacer.h"
+#include "quality_port.h"
+#include "count_port.h"
+
+#define MAX_FPP 10
+#define em_set(x)   ((x)>=0)
+#define em_unset(x) ((x)<0)
+
+/* everything shared by all scenarios running in this process */
+typedef struct em_context {
+    pj_pool_factory   *pool_factory;
+    pjmedia_codec_mgr *codec_mgr;
+    pj_mutex_t        *codec_mutex; /* NULL if scenarios run one at a time */
+    const char        *packet_cache_dir; /* NULL if encoded packets are not cached */
+    double             speex_quality;
+} em_context;
+
+/* one point of the emulation: encoder, channel and decoder options */
+typedef struct em_scenario {
+    const char       *input_file;     /* "-" means standard input */
+    pj_uint64_t       input_hash;     /* used only with packet cache */
+    const char       *output_file;    /* "-" means standard output, NULL none */
+    pj_bool_t         raw_output;     /* headerless PCM on standard output */
+    unsigned          raw_clock_rate; /* of headerless PCM on standard input */
+    pj_bool_t         realtime;       /* pace frames by the wall clock */
+    pj_bool_t         quality;        /* compare output with input inline */
+    pj_bool_t         stats_only;     /* count packets, decode nothing */
+    pj_bool_t         pipeline;       /* channel, decoder and writer run on
+                                         their own threads */
+    const char       *codec_name;
+    unsigned          codec_bitrate;
+    unsigned          fpp;
+    em_plc_mode       plc_mode;
+    double            markov_p00;
+    double            markov_p10;
+    unsigned          markov_options;
+    const em_loss_model *loss_model;  /* replaces markov chain if set */
+    const char       *trace_file;     /* replaces both of them if set */
+    pj_uint32_t       trace_ssrc;
+    pj_bool_t         trace_ssrc_set;
+    unsigned          trace_late_ms;
+    unsigned          trace_clock;    /* RTP clock of the capture, 0 if
+                                         known from the payload type */
+    const em_delay_model *delay_model; /* no delay stage if NULL */
+    pj_uint64_t       seed;
+    unsigned          stream;         /* random stream of this scenario */
+    pj_size_t         bucket_size;
+    unsigned          sent_delay;
+    double            bits_per_second;
+    double            packets_per_second;
+} em_scenario;
+
+typedef struct em_result {
+    em_plc_statistics stats;
+    pj_uint64_t       seed;
+    double            sample_length;  /* seconds */
+    pj_uint64_t       total_bytes;    /* transmitted throught network interface (raw) */
+    unsigned          expected_bps;
+    pj_bool_t         realtime;
+    em_pacer_statistics pacing;       /* set in real-time mode only */
+    em_hist           loss_bursts;    /* channel losses, in packets */
+    em_hist           loss_gaps;
+    em_leaky_bucket_statistics bucket;
+    em_silence_statistics silence;    /* zero in stats-only mode */
+    pj_bool_t         scored;
+    em_quality_statistics quality;    /* set if scored only */
+} em_result;
+
+
+PJ_DECL(pj_status_t) em_markov_params(double p00, double p10, double lost_pct,
+        double burst_ratio, double *p_p00, double *p_p10);
+
+PJ_DECL(pj_status_t) em_parse_bandwidth(const char *value,
+        double *bits_per_second, double *packets_per_second);
+
+PJ_DECL(pj_status_t) em_parse_plc_mode(const char *value, em_plc_mode *mode);
+
+/* allocate and open codec of the scenario, thread safe */
+PJ_DECL(pj_status_t) em_alloc_codec(const em_context *ctx,
+        const em_scenario *sc, pj_pool_t *pool, pjmedia_codec **p_codec,
+        pjmedia_codec_param *codec_param);
+
+PJ_DECL(void) em_dealloc_codec(const em_context *ctx, pjmedia_codec *codec);
+
+/*
+ * Wraps port into stereo and resample ports as needed to get and put frames
+ * of clock_rate and channel_count. Destroying the result destroys port too.
+ */
+PJ_DECL(pj_status_t) em_convert_port(pj_pool_t *pool, pjmedia_port *port,
+        unsigned clock_rate, unsigned channel_count, pjmedia_port **p_port);
+
+/*
+ * WAV file, or standard input if input file is "-", of any clock rate and
+ * channel count: p_file_port is the file itself, p_port gives frames of
+ * fpp codec frames in the codec's clock rate and channel count.
+ */
+PJ_DECL(pj_status_t) em_create_input_port(pj_pool_t *pool,
+        const em_scenario *sc, const pjmedia_codec_param *codec_param,
+        pjmedia_port **p_file_port, pjmedia_port **p_port);
+
+PJ_DECL(pj_status_t) em_run_scenario(const em_context *ctx,
+        const em_scenario *sc, em_result *res);
+
+/*
+ * Runs the channel of sc[0] once and decodes the same packets by count
+ * scenarios which differ in PLC mode and output file only, each with its
+ * own decoder; res[i] is the result of sc[i]. Can't be used in stats-only
+ * mode if count is more than one.
+ */
+PJ_DECL(pj_status_t) em_run_fanout(const em_context *ctx,
+        const em_scenario sc[], unsigned count, em_result res[]);
+
+#endif	/* __EMULATOR_H__ */
@@ -0,0 +1,139 @@
+#include <string.h>
+#include <errno.h>
+#include "events.h"
+#define THIS_FILE   "events.c"
+#define MAGIC       "EMEVT01"
+#define READ_EVENTS 4096
+
+/*
+ * Dump layout (host byte order, like the packet cache):
+ *
+ *   struct events_header
+ *   count * em_event, the oldest first
+ */
+struct events_header
+{
+    char              magic[8];
+    pj_uint64_t       count;      /* events in the dump */
+    pj_uint64_t       recorded;   /* events recorded, older ones are lost */
+};
+
+em_event_ring *em_events = NULL;
+
+static const char *port_names[] = {
+    "?", "markov", "leaky", "plc", "silence"
+};
+
+static const char *action_names[] = {
+    "?", "pass", "lose", "queue", "drop", "decode", "conceal", "pad"
+};
+
+
+PJ_DEF(pj_status_t) em_events_start(pj_pool_t *pool, unsigned capacity)
+{
+    em_event_ring *ring;
+    pj_uint64_t size = 1;
+
+    PJ_ASSERT_RETURN(pool && capacity, PJ_EINVAL);
+    while (size < capacity)
+        size <<= 1;
+    ring = PJ_POOL_ZALLOC_T(pool, em_event_ring);
+    ring->events = (em_event*)pj_pool_calloc(pool, (pj_size_t)size,
+            sizeof(em_event));
+    if (!ring->events)
+        return PJ_ENOMEM;
+    ring->mask = size - 1;
+    ring->head = 0;
+    em_events = ring;
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) em_events_dump(const char *filename)
+{
+    em_event_ring *ring = em_events;
+    struct events_header hdr;
+    pj_uint64_t first, capacity;
+    FILE *fd;
+    pj_bool_t ok;
+
+    PJ_ASSERT_RETURN(ring && filename, PJ_EINVAL);
+    em_events = NULL;
+    capacity = ring->mask + 1;
+    first = ring->head > capacity ? ring->head - capacity : 0;
+
+    fd = fopen(filename, "wb");
+    if (!fd) {
+        PJ_LOG(1, (THIS_FILE, "can't create %s", filename));
+        return PJ_STATUS_FROM_OS(errno);
+    }
+    pj_bzero(&hdr, sizeof(hdr));
+    pj_memcpy(hdr.magic, MAGIC, sizeof(MAGIC));
+    hdr.count = ring->head - first;
+    hdr.recorded = ring->head;
+    ok = fwrite(&hdr, sizeof(hdr), 1, fd) == 1;
+    /* the ring is written in two parts if it has wrapped */
+    if (ok && hdr.count) {
+        pj_size_t start = (pj_size_t)(first & ring->mask);
+        pj_size_t tail = (pj_size_t)(hdr.count < capacity - start ?
+                hdr.count : capacity - start);
+        ok = fwrite(&ring->events[start], sizeof(em_event), tail, fd) ==
+            tail;
+        if (ok && tail < hdr.count)
+            ok = fwrite(ring->events, sizeof(em_event),
+                    (pj_size_t)hdr.count - tail, fd) ==
+                (pj_size_t)hdr.count - tail;
+    }
+    if (fclose(fd) != 0)
+        ok = PJ_FALSE;
+    if (!ok) {
+        PJ_LOG(1, (THIS_FILE, "can't write %s", filename));
+        return PJ_EUNKNOWN;
+    }
+    PJ_LOG(4, (THIS_FILE, "%llu of %llu events written to %s",
+                (unsigned long long)hdr.count,
+                (unsigned long long)hdr.recorded, filename));
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) em_events_decode(const char *filename, FILE *out)
+{
+    struct events_header hdr;
+    em_event events[READ_EVENTS];
+    pj_uint64_t index;
+    pj_size_t count, i;
+    FILE *fd;
+
+    PJ_ASSERT_RETURN(filename && out, PJ_EINVAL);
+    fd = fopen(filename, "rb");
+    if (!fd) {
+        PJ_LOG(1, (THIS_FILE, "can't open %s", filename));
+        return PJ_STATUS_FROM_OS(errno);
+    }
+    if (fread(&hdr, sizeof(hdr), 1, fd) != 1 ||
+            memcmp(hdr.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        PJ_LOG(1, (THIS_FILE, "%s is not an events dump", filename));
+        fclose(fd);
+        return PJ_EINVAL;
+    }
+    /* index of the event since the start of the run */
+    index = hdr.recorded - hdr.count;
+    fprintf(out, "# %llu events, %llu recorded\n"
+            "# index port action ts size\n",
+            (unsigned long long)hdr.count,
+            (unsigned long long)hdr.recorded);
+    while ((count = fread(events, sizeof(em_event), READ_EVENTS, fd)) > 0) {
+        for (i=0; i<count; i++, index++) {
+            const em_event *ev = &events[i];
+            fprintf(out, "%llu %s %s %llu %u\n", (unsigned long long)index,
+                    port_names[ev->port < PJ_ARRAY_SIZE(port_names) ?
+                        ev->port : 0],
+                    action_names[ev->action < PJ_ARRAY_SIZE(action_names) ?
+                        ev->action : 0],
+                    (unsigned long long)ev->ts, ev->size);
+        }
+    }
+    fclose(fd);
+    return PJ_SUCCESS;
+}
@@ -0,0 +1,70 @@
+#ifndef __EVENTS_H__
+#define __EVENTS_H__
+
+#include <stdio.h>
+#include <pjlib.h>
+
+/* ports which record events */
+enum {
+    EM_EV_MARKOV = 1,
+    EM_EV_LEAKY,
+    EM_EV_PLC,
+    EM_EV_SILENCE
+};
+
+/* what happened to the packet */
+enum {
+    EM_EV_PASS = 1,     /* passed downstream as is */
+    EM_EV_LOSE,         /* lost by the channel, size is 0 */
+    EM_EV_QUEUE,        /* queued, ts is the departure time */
+    EM_EV_DROP,         /* dropped, bucket is full */
+    EM_EV_DECODE,       /* decoded, size is of the packet */
+    EM_EV_CONCEAL,      /* concealed, size is the PLC mode */
+    EM_EV_PAD           /* silence inserted, size is in samples */
+};
+
+typedef struct em_event {
+    pj_uint64_t       ts;         /* timestamp of the frame, in samples */
+    pj_uint32_t       size;
+    pj_uint16_t       port;
+    pj_uint16_t       action;
+} em_event;
+
+/*
+ * Binary ring of the last events of the run. Recording an event is a
+ * store of 16 bytes, so it may be left on in any build; the ring is
+ * dumped to a file at the end and decoded with em_events_decode. There is
+ * one ring per process, it's not supposed to be used from several threads.
+ */
+typedef struct em_event_ring {
+    em_event         *events;
+    pj_uint64_t       mask;       /* capacity - 1, capacity is a power of 2 */
+    pj_uint64_t       head;       /* events recorded so far */
+} em_event_ring;
+
+extern em_event_ring *em_events;
+
+PJ_INLINE(void) em_event_add(unsigned port, unsigned action, pj_uint64_t ts,
+        pj_size_t size)
+{
+    em_event_ring *ring = em_events;
+    em_event *ev;
+    if (!ring)
+        return;
+    ev = &ring->events[ring->head++ & ring->mask];
+    ev->ts = ts;
+    ev->size = (pj_uint32_t)size;
+    ev->port = (pj_uint16_t)port;
+    ev->action = (pj_uint16_t)action;
+}
+
+/* start recording the last capacity events (rounded up to a power of 2) */
+PJ_DECL(pj_status_t) em_events_start(pj_pool_t *pool, unsigned capacity);
+
+/* write the recorded events, the oldest first, and stop recording */
+PJ_DECL(pj_status_t) em_events_dump(const char *filename);
+
+/* print events of the dump as text */
+PJ_DECL(pj_status_t) em_events_decode(const char *filename, FILE *out);
+
+#endif	/* __EVENTS_H__ */
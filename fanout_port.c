@@ -0,0 +1,99 @@
+#include "fanout_port.h"
+#include "batch.h"
+#define SIGNATURE   PJMEDIA_FANOUT_PORT_SIGNATURE
+#define THIS_FILE   "fanout_port.c"
+
+struct fanout_port
+{
+    pjmedia_port      base;
+    pjmedia_port    **dn_ports;
+    unsigned          count;
+};
+
+
+static pj_status_t fp_put_frame(pjmedia_port *this_port,
+				const pjmedia_frame *frame);
+static pj_status_t fp_get_frame(pjmedia_port *this_port,
+				pjmedia_frame *frame);
+static pj_status_t fp_on_destroy(pjmedia_port *this_port);
+
+
+PJ_DEF(pj_status_t) pjmedia_fanout_port_create(pj_pool_t *pool,
+        pjmedia_port *const dn_ports[], unsigned count,
+        pjmedia_port **p_port)
+{
+    const pj_str_t fanout = { "fanout", 6 };
+    struct fanout_port *fp;
+    unsigned i;
+
+    PJ_ASSERT_RETURN(pool && dn_ports && count && p_port, PJ_EINVAL);
+
+    /* Create the port itself */
+    fp = PJ_POOL_ZALLOC_T(pool, struct fanout_port);
+    pjmedia_port_info_init(&fp->base.info, &fanout, SIGNATURE,
+			   dn_ports[0]->info.clock_rate,
+			   dn_ports[0]->info.channel_count,
+			   dn_ports[0]->info.bits_per_sample,
+			   dn_ports[0]->info.samples_per_frame);
+
+    /* More init */
+    fp->dn_ports = (pjmedia_port**)pj_pool_calloc(pool, count,
+            sizeof(pjmedia_port*));
+    if (!fp->dn_ports)
+        return PJ_ENOMEM;
+    for (i=0; i<count; i++) {
+        PJ_ASSERT_RETURN(dn_ports[i], PJ_EINVAL);
+        fp->dn_ports[i] = dn_ports[i];
+    }
+    fp->count = count;
+    fp->base.get_frame = &fp_get_frame;
+    fp->base.put_frame = &fp_put_frame;
+    fp->base.on_destroy = &fp_on_destroy;
+
+    /* Done */
+    *p_port = &fp->base;
+
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_fanout_port_put_frames(pjmedia_port *port,
+        const pjmedia_frame frames[], unsigned count)
+{
+    struct fanout_port *fp = (struct fanout_port*)port;
+    pj_status_t status;
+    unsigned i;
+
+    PJ_ASSERT_RETURN(port && (frames || !count), PJ_EINVAL);
+    PJ_ASSERT_RETURN(port->info.signature == SIGNATURE, PJ_EINVAL);
+    /* the whole array goes to one port after another */
+    for (i=0; i<fp->count; i++) {
+        status = em_port_put_frames(fp->dn_ports[i], frames, count);
+        if (status != PJ_SUCCESS)
+            return status;
+    }
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t fp_put_frame( pjmedia_port *this_port,
+				 const pjmedia_frame *frame)
+{
+    return pjmedia_fanout_port_put_frames(this_port, frame, 1);
+}
+
+
+static pj_status_t fp_get_frame( pjmedia_port *this_port,
+				 pjmedia_frame *frame)
+{
+    PJ_UNUSED_ARG(this_port);
+    PJ_UNUSED_ARG(frame);
+    return PJ_EINVALIDOP;
+}
+
+
+static pj_status_t fp_on_destroy(pjmedia_port *this_port)
+{
+    PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
+    return PJ_SUCCESS;
+}
@@ -0,0 +1,24 @@
+#ifndef __FANOUT_PORT_H__
+#define __FANOUT_PORT_H__
+
+#include <pjlib.h>
+#include <pjlib-util.h>
+#include <pjmedia.h>
+
+#define PJMEDIA_FANOUT_PORT_SIGNATURE \
+    PJMEDIA_PORT_SIGNATURE('F', 'A', 'N', 'P')
+
+/*
+ * Puts every frame into each of count dn_ports in turn, so they all see the
+ * same packets. Frames are passed as is and must not be changed by the
+ * ports. Destroying the port doesn't destroy dn_ports.
+ */
+PJ_DECL(pj_status_t) pjmedia_fanout_port_create(pj_pool_t *pool,
+        pjmedia_port *const dn_ports[], unsigned count,
+        pjmedia_port **p_port);
+
+/* the frames one after another, see em_port_put_frames */
+PJ_DECL(pj_status_t) pjmedia_fanout_port_put_frames(pjmedia_port *port,
+        const pjmedia_frame frames[], unsigned count);
+
+#endif	/* __FANOUT_PORT_H__ */
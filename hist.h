@@ -0,0 +1,93 @@
+#ifndef __HIST_H__
+#define __HIST_H__
+
+#include <pjlib.h>
+
+#define EM_HIST_SIZE        256
+
+/*
+ * Histogram of non-negative values: EM_HIST_SIZE bins of bin_width, the
+ * last one counts everything beyond. Count, sum and maximum are exact.
+ */
+typedef struct em_hist {
+    unsigned          bin_width;
+    pj_uint64_t       count;
+    pj_uint64_t       sum;
+    pj_uint64_t       max;
+    pj_uint64_t       bins[EM_HIST_SIZE];
+} em_hist;
+
+PJ_INLINE(void) em_hist_init(em_hist *h, unsigned bin_width)
+{
+    pj_bzero(h, sizeof(em_hist));
+    h->bin_width = bin_width ? bin_width : 1;
+}
+
+PJ_INLINE(void) em_hist_add(em_hist *h, pj_uint64_t value)
+{
+    pj_uint64_t bin = value / h->bin_width;
+    h->bins[bin < EM_HIST_SIZE ? bin : EM_HIST_SIZE - 1]++;
+    h->count++;
+    h->sum += value;
+    if (value > h->max)
+        h->max = value;
+}
+
+PJ_INLINE(double) em_hist_mean(const em_hist *h)
+{
+    return h->count ? (double)h->sum / h->count : 0.0;
+}
+
+/* upper bound of the bin holding the pct percentile, never above maximum */
+PJ_INLINE(pj_uint64_t) em_hist_percentile(const em_hist *h, double pct)
+{
+    double need = h->count * pct / 100.0;
+    pj_uint64_t seen = 0, upper;
+    unsigned i;
+    for (i=0; i<EM_HIST_SIZE - 1; i++) {
+        seen += h->bins[i];
+        if (seen > 0 && seen >= need) {
+            upper = (pj_uint64_t)(i + 1) * h->bin_width - 1;
+            return upper < h->max ? upper : h->max;
+        }
+    }
+    return h->max;
+}
+
+
+/* lengths of loss bursts and of gaps between them, in packets */
+typedef struct em_runs {
+    pj_bool_t         lost;       /* state of the current run */
+    pj_uint64_t       length;     /* of the current run */
+    em_hist           bursts;
+    em_hist           gaps;
+} em_runs;
+
+PJ_INLINE(void) em_runs_init(em_runs *r)
+{
+    r->lost = PJ_FALSE;
+    r->length = 0;
+    em_hist_init(&r->bursts, 1);
+    em_hist_init(&r->gaps, 1);
+}
+
+PJ_INLINE(void) em_runs_add(em_runs *r, pj_bool_t lost)
+{
+    if (r->length && lost != r->lost) {
+        em_hist_add(r->lost ? &r->bursts : &r->gaps, r->length);
+        r->length = 0;
+    }
+    r->lost = lost;
+    r->length++;
+}
+
+/* histograms with the current run counted as finished */
+PJ_INLINE(void) em_runs_get(const em_runs *r, em_hist *bursts, em_hist *gaps)
+{
+    *bursts = r->bursts;
+    *gaps = r->gaps;
+    if (r->length)
+        em_hist_add(r->lost ? bursts : gaps, r->length);
+}
+
+#endif	/* __HIST_H__ */
@@ -1,11 +1,23 @@
 #include "leaky_bucket_port.h"
-#define SIGNATURE   PJMEDIA_PORT_SIGNATURE('L', 'E', 'A', 'K')
+#include "em_log.h"
+#include "events.h"
+#include "batch.h"
+#define SIGNATURE   PJMEDIA_LEAKY_BUCKET_PORT_SIGNATURE
 #define THIS_FILE   "leaky_bucket_port.c"
 
-struct leaky_bucket_item
+/*
+ * The bucket never holds more than bucket_size audio frames, so they live in
+ * a ring of preallocated slots with inline payload. Empty frames (lost
+ * upstream or dropped here) carry no data, so only their number is kept:
+ * lost_before of the slot they precede, or lost_tail if they are queued
+ * after the last audio frame. Departed frames are passed downstream in
+ * arrays which refer to the slots, so a slot is not reused till the output
+ * referring to it is flushed.
+ */
+struct leaky_bucket_slot
 {
-    PJ_DECL_LIST_MEMBER(struct leaky_bucket_item);
-    pjmedia_frame frame;
+    pjmedia_frame      frame;       /* frame.buf points to slot payload       */
+    unsigned           lost_before; /* empty frames to be pushed before frame */
 };
 
 struct leaky_bucket_port
@@ -15,11 +27,16 @@ struct leaky_bucket_port
     pj_size_t          bucket_size;
     unsigned           sent_delay;        /* sent delay or bits per second:       */
     unsigned           bits_per_second;   /* only one of these option must be set */
-    struct leaky_bucket_item *first_item; /* first item to be pushed to dn_port   */
-    struct leaky_bucket_item *last_item;  /* last item to be pushed to dn_port    */
+    struct leaky_bucket_slot *slots;      /* ring of slot_count slots             */
+    pj_size_t          slot_count;
+    pj_size_t          max_frame_size;    /* payload size of one slot             */
+    pj_size_t          head;      /* first slot to be pushed to dn_port */
+    unsigned           lost_tail; /* empty frames after the last slot */
     pj_timestamp       last_ts;   /* timestamp when latest packet in the queue should be pushed */
     pj_size_t          items;     /* number of non-empty items in the bucket */
     unsigned           frames;    /* number of frames pass throught */
+    em_leaky_bucket_statistics stats;
+    em_batch           out;
     pj_pool_t         *pool;
 };
 
@@ -39,6 +56,8 @@ PJ_DEF(pj_status_t) pjmedia_leaky_bucket_port_create(
     const pj_str_t leaky_bucket = { "leaky", 5 };
     struct leaky_bucket_port *lb;
     pj_pool_t *pool;
+    pj_uint8_t *payload;
+    pj_size_t i;
     pj_status_t status;
 
     PJ_ASSERT_RETURN(pool_factory && dn_port && p_port, PJ_EINVAL);
@@ -55,12 +74,27 @@ PJ_DEF(pj_status_t) pjmedia_leaky_bucket_port_create(
 			   dn_port->info.bits_per_sample,
 			   dn_port->info.samples_per_frame);
 
-    /* we have an empty list */
-    lb->first_item = lb->last_item = NULL;
+    /* we have an empty bucket: the whole memory is allocated here, no more
+       allocations on the per-packet path */
+    lb->slot_count = bucket_size > 0 ? bucket_size : 1;
+    lb->max_frame_size = dn_port->info.bytes_per_frame;
+    lb->slots = (struct leaky_bucket_slot*)pj_pool_calloc(pool,
+            lb->slot_count, sizeof(struct leaky_bucket_slot));
+    payload = (pj_uint8_t*)pj_pool_alloc(pool,
+            lb->slot_count * lb->max_frame_size);
+    if (!lb->slots || !payload) {
+        pj_pool_release(pool);
+        return PJ_ENOMEM;
+    }
+    for (i=0; i<lb->slot_count; i++)
+        lb->slots[i].frame.buf = payload + i * lb->max_frame_size;
+    lb->head = 0;
+    lb->lost_tail = 0;
     lb->items = 0;
 
     /* More init */
     lb->dn_port = dn_port;
+    em_batch_init(&lb->out, dn_port);
     lb->base.get_frame = &lb_get_frame;
     lb->base.put_frame = &lb_put_frame;
     lb->base.on_destroy = &lb_on_destroy;
@@ -68,6 +102,8 @@ PJ_DEF(pj_status_t) pjmedia_leaky_bucket_port_create(
     lb->pool = pool;
     lb->last_ts.u64 = 0;
     lb->frames = 0;
+    em_hist_init(&lb->stats.depth, 1);
+    em_hist_init(&lb->stats.delay_ms, EM_LEAKY_DELAY_BIN_MS);
 
     /* get a sent rate */
     if (sent_delay > 0){
@@ -89,81 +125,133 @@ PJ_DEF(pj_status_t) pjmedia_leaky_bucket_port_create(
 }
 
 
-static pj_status_t lb_push_frame(struct leaky_bucket_port *lb)
+static pj_status_t lb_push_lost(struct leaky_bucket_port *lb,
+        unsigned *count)
 {
-    struct leaky_bucket_item *fst = lb->first_item;
     pj_status_t status;
-    if (fst == NULL){
-        return PJ_SUCCESS;
+    while (*count) {
+        EM_LOG(6, (THIS_FILE, "push empty frame to dn port"));
+        status = em_batch_add_none(&lb->out);
+        if (status != PJ_SUCCESS)
+            return status;
+        (*count)--;
     }
-    PJ_LOG(6, (THIS_FILE, "push frame to dn port: sz=%u, ts=%llu",
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t lb_push_frame(struct leaky_bucket_port *lb)
+{
+    struct leaky_bucket_slot *fst = &lb->slots[lb->head];
+    pj_status_t status;
+    EM_LOG(6, (THIS_FILE, "push frame to dn port: sz=%u, ts=%llu",
                 fst->frame.size/sizeof(pj_uint16_t), fst->frame.timestamp.u64));
-    status = pjmedia_port_put_frame(lb->dn_port, &fst->frame);
+    status = em_batch_add(&lb->out, &fst->frame);
     if (status != PJ_SUCCESS)
         return status;
-    if (fst->frame.type == PJMEDIA_FRAME_TYPE_AUDIO){
-        lb->items --;
-    } else {
-    }
-    if (fst->next == fst) {
-        lb->first_item = lb->last_item = NULL;
-    } else {
-        lb->first_item = fst->next;
-        pj_list_erase(fst);
-    }
+    lb->head = (lb->head + 1) % lb->slot_count;
+    lb->items --;
     return PJ_SUCCESS;
 }
 
 
 
 static pj_status_t lb_push_frames_till(struct leaky_bucket_port *lb,
-        pj_timestamp ts)
+        const pj_timestamp *ts)
 {
     pj_status_t status;
-    while (lb->first_item){
-        if (lb->first_item->frame.type == PJMEDIA_FRAME_TYPE_AUDIO &&
-                lb->first_item->frame.timestamp.u64 >= ts.u64)
-            break;
+    while (lb->items){
+        struct leaky_bucket_slot *fst = &lb->slots[lb->head];
+        status = lb_push_lost(lb, &fst->lost_before);
+        if (status != PJ_SUCCESS)
+            return status;
+        if (ts && fst->frame.timestamp.u64 >= ts->u64)
+            return PJ_SUCCESS;
         status = lb_push_frame(lb);
         if (status != PJ_SUCCESS)
             return status;
     };
+    return lb_push_lost(lb, &lb->lost_tail);
+}
+
+
+
+PJ_DEF(pj_status_t) pjmedia_leaky_bucket_port_push_till(pjmedia_port *port,
+        const pj_timestamp *ts)
+{
+    struct leaky_bucket_port *lb = (struct leaky_bucket_port*)port;
+    pj_status_t status;
+    PJ_ASSERT_RETURN(port && ts, PJ_EINVAL);
+    PJ_ASSERT_RETURN(port->info.signature == SIGNATURE, PJ_EINVAL);
+    status = lb_push_frames_till(lb, ts);
+    if (status != PJ_SUCCESS)
+        return status;
+    return em_batch_flush(&lb->out);
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_leaky_bucket_port_get_statistics(
+        const pjmedia_port *port, em_leaky_bucket_statistics *stats)
+{
+    const struct leaky_bucket_port *lb = (const struct leaky_bucket_port*)port;
+    PJ_ASSERT_RETURN(port && stats, PJ_EINVAL);
+    PJ_ASSERT_RETURN(port->info.signature == SIGNATURE, PJ_EINVAL);
+    pj_memcpy(stats, &lb->stats, sizeof(em_leaky_bucket_statistics));
     return PJ_SUCCESS;
 }
 
 
+PJ_DEF(pj_status_t) pjmedia_leaky_bucket_port_next_ts(
+        const pjmedia_port *port, pj_timestamp *ts)
+{
+    const struct leaky_bucket_port *lb = (const struct leaky_bucket_port*)port;
+    PJ_ASSERT_RETURN(port && ts, PJ_EINVAL);
+    PJ_ASSERT_RETURN(port->info.signature == SIGNATURE, PJ_EINVAL);
+    if (lb->items == 0)
+        return PJ_ENOTFOUND;
+    *ts = lb->slots[lb->head].frame.timestamp;
+    return PJ_SUCCESS;
+}
+
 
-static pj_status_t lb_put_frame( pjmedia_port *this_port,
-				 const pjmedia_frame *frame)
+static pj_status_t lb_process(struct leaky_bucket_port *lb,
+        const pjmedia_frame *frame)
 {
     pj_status_t status;
-    struct leaky_bucket_port *lb = (struct leaky_bucket_port*)this_port;
-    struct leaky_bucket_item *item = PJ_POOL_ZALLOC_T(lb->pool,
-            struct leaky_bucket_item);
-    PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
-    pj_memcpy(&item->frame, frame, sizeof(pjmedia_frame));
-    PJ_LOG(6, (THIS_FILE, "packet: sz=%d ts=%llu",
+    EM_LOG(6, (THIS_FILE, "packet: sz=%d ts=%llu",
                 frame->size/sizeof(pj_uint16_t), frame->timestamp.u64));
 
     /* if frame is not empty, push all previous frames into downstream port  */
     if (frame->type == PJMEDIA_FRAME_TYPE_AUDIO){
-        status = lb_push_frames_till(lb, frame->timestamp);
+        status = lb_push_frames_till(lb, &frame->timestamp);
         if (status != PJ_SUCCESS) return status;
     }
     /* update bucket and received packet states */
     if (frame->type == PJMEDIA_FRAME_TYPE_AUDIO ) {
+        lb->stats.packets++;
+        em_hist_add(&lb->stats.depth, lb->items);
         if (lb->bucket_size > lb->items){
+            struct leaky_bucket_slot *item;
             void *buf;
             unsigned sent_delay;
+            PJ_ASSERT_RETURN(frame->size <= lb->max_frame_size, PJ_ETOOBIG);
             if (lb->sent_delay) { /* sent delay or pps is set */
                 sent_delay = lb->sent_delay;
             } else { /* bps is set, compute sent delay on the fly */
                 int hdr_sz = 20 + 8 + 12;
                 sent_delay = 8.0 * (hdr_sz + frame->size) * \
                     lb->base.info.clock_rate / lb->bits_per_second;
-                PJ_LOG(6, (THIS_FILE, "Sent delay: %u. Pack sz: %u. Samples: %u",
+                EM_LOG(6, (THIS_FILE, "Sent delay: %u. Pack sz: %u. Samples: %u",
                             sent_delay, frame->size, lb->base.info.samples_per_frame));
             }
+            /* the slot may be still referred by the output */
+            if (lb->items + lb->out.count >= lb->slot_count) {
+                status = em_batch_flush(&lb->out);
+                if (status != PJ_SUCCESS) return status;
+            }
+            item = &lb->slots[(lb->head + lb->items) % lb->slot_count];
+            buf = item->frame.buf;
+            pj_memcpy(&item->frame, frame, sizeof(pjmedia_frame));
             /* update timestamps */
             if (lb->frames == 0){
                 lb->last_ts = item->frame.timestamp;
@@ -173,34 +261,59 @@ static pj_status_t lb_put_frame( pjmedia_port *this_port,
                 lb->last_ts.u64 += sent_delay;
                 item->frame.timestamp = lb->last_ts;
             }
-            buf = pj_pool_zalloc(lb->pool, frame->size);
+            em_event_add(EM_EV_LEAKY, EM_EV_QUEUE, item->frame.timestamp.u64,
+                    frame->size);
+            em_hist_add(&lb->stats.delay_ms, (item->frame.timestamp.u64 -
+                        frame->timestamp.u64) * 1000 /
+                    lb->base.info.clock_rate);
             pj_memcpy(buf, frame->buf, frame->size);
             item->frame.buf = buf;
-            PJ_LOG(6, (THIS_FILE, "packet in buf: sz=%d ts=%llu",
+            item->lost_before = lb->lost_tail;
+            lb->lost_tail = 0;
+            EM_LOG(6, (THIS_FILE, "packet in buf: sz=%d ts=%llu",
                 item->frame.size/sizeof(pj_uint16_t), item->frame.timestamp.u64));
             lb->items++;
         } else {
-            pj_bzero(item, sizeof(*item));
-            item->frame.type = PJMEDIA_FRAME_TYPE_NONE;
-            PJ_LOG(6, (THIS_FILE, "bucket size %u exhausted, packet dropped",
+            lb->lost_tail++;
+            lb->stats.dropped++;
+            em_event_add(EM_EV_LEAKY, EM_EV_DROP, frame->timestamp.u64,
+                    frame->size);
+            EM_LOG(6, (THIS_FILE, "bucket size %u exhausted, packet dropped",
                 lb->bucket_size));
         }
     } else {
-        PJ_LOG(6, (THIS_FILE, "received empty frame"));
-    }
-    /* put frame at the end of list or init an empty one */
-    if (lb->last_item == NULL){
-        pj_list_init(item);
-        lb->first_item = lb->last_item = item;
-    } else {
-        pj_list_insert_after(lb->last_item, item);
-        lb->last_item = item;
+        lb->lost_tail++;
+        EM_LOG(6, (THIS_FILE, "received empty frame"));
     }
     lb->frames++;
     return PJ_SUCCESS;
 }
 
 
+PJ_DEF(pj_status_t) pjmedia_leaky_bucket_port_put_frames(pjmedia_port *port,
+        const pjmedia_frame frames[], unsigned count)
+{
+    struct leaky_bucket_port *lb = (struct leaky_bucket_port*)port;
+    pj_status_t status;
+    unsigned i;
+    PJ_ASSERT_RETURN(port && (frames || !count), PJ_EINVAL);
+    PJ_ASSERT_RETURN(port->info.signature == SIGNATURE, PJ_EINVAL);
+    for (i=0; i<count; i++) {
+        status = lb_process(lb, &frames[i]);
+        if (status != PJ_SUCCESS)
+            return status;
+    }
+    return em_batch_flush(&lb->out);
+}
+
+
+static pj_status_t lb_put_frame( pjmedia_port *this_port,
+				 const pjmedia_frame *frame)
+{
+    return pjmedia_leaky_bucket_port_put_frames(this_port, frame, 1);
+}
+
+
 static pj_status_t lb_get_frame( pjmedia_port *this_port,
 				 pjmedia_frame *frame)
 {
@@ -216,10 +329,11 @@ static pj_status_t lb_on_destroy(pjmedia_port *this_port)
     pj_status_t status;
     struct leaky_bucket_port *lb = (struct leaky_bucket_port*)this_port;
     PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
-    while (lb->first_item){
-        status = lb_push_frame(lb);
-        if (status != PJ_SUCCESS)
-            return status;
-    };
+    status = lb_push_frames_till(lb, NULL);
+    if (status == PJ_SUCCESS)
+        status = em_batch_flush(&lb->out);
+    if (status != PJ_SUCCESS)
+        return status;
+    pj_pool_release(lb->pool);
     return PJ_SUCCESS;
 }
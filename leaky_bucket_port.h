@@ -1,9 +1,43 @@
+#ifndef __LEAKY_BUCKET_PORT_H__
+#define __LEAKY_BUCKET_PORT_H__
+
 #include <pjlib.h>
 #include <pjlib-util.h>
 #include <pjmedia.h>
+#include "hist.h"
+
+#define PJMEDIA_LEAKY_BUCKET_PORT_SIGNATURE \
+    PJMEDIA_PORT_SIGNATURE('L', 'E', 'A', 'K')
+#define EM_LEAKY_DELAY_BIN_MS   4
+
+typedef struct em_leaky_bucket_statistics {
+    pj_uint64_t       packets;    /* audio packets put into the bucket */
+    pj_uint64_t       dropped;    /* because the bucket was full */
+    em_hist           depth;      /* packets queued when one arrives */
+    em_hist           delay_ms;   /* queueing delay of packets sent */
+} em_leaky_bucket_statistics;
 
 PJ_DEF(pj_status_t) pjmedia_leaky_bucket_port_create(
         pj_pool_factory *pool_factory, pjmedia_port *dn_port,
         pj_size_t bucket_size, unsigned sent_delay, unsigned bits_per_second,
         unsigned packets_per_second, pjmedia_port **p_port);
 
+/* the frames one after another, departed ones are pushed downstream in
+   arrays, see em_port_put_frames */
+PJ_DECL(pj_status_t) pjmedia_leaky_bucket_port_put_frames(pjmedia_port *port,
+        const pjmedia_frame frames[], unsigned count);
+
+/* push downstream every queued frame which departure time is before ts:
+   lets a caller driven by the wall clock release frames without waiting
+   for the next packet */
+PJ_DECL(pj_status_t) pjmedia_leaky_bucket_port_push_till(pjmedia_port *port,
+        const pj_timestamp *ts);
+
+/* departure time of the first queued frame, PJ_ENOTFOUND if bucket is empty */
+PJ_DECL(pj_status_t) pjmedia_leaky_bucket_port_next_ts(
+        const pjmedia_port *port, pj_timestamp *ts);
+
+PJ_DECL(pj_status_t) pjmedia_leaky_bucket_port_get_statistics(
+        const pjmedia_port *port, em_leaky_bucket_statistics *stats);
+
+#endif	/* __LEAKY_BUCKET_PORT_H__ */
@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <math.h>
+#include "loss_model_port.h"
+#include "em_log.h"
+#include "em_rand.h"
+#define SIGNATURE   PJMEDIA_PORT_SIGNATURE('L', 'M', 'O', 'D')
+#define THIS_FILE   "loss_model_port.c"
+#define MAX_STATES  EM_LOSS_MODEL_MAX_STATES
+
+/*
+ * Every row of the transition matrix is turned into a Walker alias table,
+ * so choosing the next state costs one random value and one lookup
+ * whatever the number of states is.
+ */
+struct em_loss_model
+{
+    unsigned          count;
+    double           *prob;      /* count*count: alias table probabilities */
+    unsigned         *alias;     /* count*count: alias table states        */
+    double           *loss;      /* count: loss probability in the state   */
+};
+
+struct loss_model_port
+{
+    pjmedia_port	  base;
+    pjmedia_port	 *dn_port;
+    const em_loss_model *model;
+    unsigned          state;
+    em_rand           rand;
+    em_runs           runs;
+};
+
+
+static pj_status_t lm_put_frame(pjmedia_port *this_port,
+				const pjmedia_frame *frame);
+static pj_status_t lm_get_frame(pjmedia_port *this_port,
+				pjmedia_frame *frame);
+static pj_status_t lm_on_destroy(pjmedia_port *this_port);
+
+
+/* next number from the file skipping comments, 0 at the end of file */
+static int lm_read_number(FILE *fd, double *value)
+{
+    int ch;
+    for (;;) {
+        if (fscanf(fd, "%lf", value) == 1)
+            return 1;
+        ch = fgetc(fd);
+        if (ch == EOF)
+            return 0;
+        if (ch == '#') {
+            while ((ch = fgetc(fd)) != EOF && ch != '\n')
+                ;
+        } else if (ch != ' ' && ch != '\t' && ch != '\r' && ch != '\n' &&
+                ch != ',') {
+            return -1;
+        }
+    }
+}
+
+
+/* Vose's alias method for one row of probabilities which sum to 1 */
+static void lm_build_alias(unsigned n, const double *row, double *prob,
+        unsigned *alias)
+{
+    double scaled[MAX_STATES];
+    unsigned small[MAX_STATES], large[MAX_STATES];
+    unsigned ns = 0, nl = 0, i;
+
+    for (i=0; i<n; i++) {
+        scaled[i] = row[i] * n;
+        if (scaled[i] < 1.0)
+            small[ns++] = i;
+        else
+            large[nl++] = i;
+    }
+    while (ns && nl) {
+        unsigned s = small[--ns], l = large[--nl];
+        prob[s] = scaled[s];
+        alias[s] = l;
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0)
+            small[ns++] = l;
+        else
+            large[nl++] = l;
+    }
+    /* leftovers are 1.0 up to rounding errors */
+    while (nl) {
+        prob[large[--nl]] = 1.0;
+        alias[large[nl]] = large[nl];
+    }
+    while (ns) {
+        prob[small[--ns]] = 1.0;
+        alias[small[ns]] = small[ns];
+    }
+}
+
+
+PJ_DEF(pj_status_t) em_loss_model_load(pj_pool_t *pool, const char *filename,
+        em_loss_model **p_model)
+{
+    double row[MAX_STATES], value, sum;
+    em_loss_model *model;
+    unsigned i, j, n;
+    FILE *fd;
+
+    PJ_ASSERT_RETURN(pool && filename && p_model, PJ_EINVAL);
+
+    fd = fopen(filename, "r");
+    if (!fd) {
+        fprintf(stderr, "Can't open loss model file %s\n", filename);
+        return PJ_ENOTFOUND;
+    }
+    if (lm_read_number(fd, &value) != 1 || value < 1 || value > MAX_STATES) {
+        fprintf(stderr, "%s: number of states must be in [1..%d]\n",
+                filename, MAX_STATES);
+        goto err;
+    }
+    n = (unsigned)value;
+    model = PJ_POOL_ZALLOC_T(pool, em_loss_model);
+    model->count = n;
+    model->prob = (double*)pj_pool_calloc(pool, n*n, sizeof(double));
+    model->alias = (unsigned*)pj_pool_calloc(pool, n*n, sizeof(unsigned));
+    model->loss = (double*)pj_pool_calloc(pool, n, sizeof(double));
+
+    /* transition matrix in percent, row i lists probabilities to go from
+       state i to every state */
+    for (i=0; i<n; i++) {
+        sum = 0;
+        for (j=0; j<n; j++) {
+            if (lm_read_number(fd, &row[j]) != 1 || row[j] < 0 ||
+                    row[j] > 100) {
+                fprintf(stderr, "%s: transition probabilities must be "
+                        "in [0..100]\n", filename);
+                goto err;
+            }
+            sum += row[j];
+        }
+        if (fabs(sum - 100.0) > 0.01) {
+            fprintf(stderr, "%s: row %u of the transition matrix sums to "
+                    "%.4f instead of 100\n", filename, i+1, sum);
+            goto err;
+        }
+        for (j=0; j<n; j++)
+            row[j] /= sum;
+        lm_build_alias(n, row, &model->prob[i*n], &model->alias[i*n]);
+    }
+    /* loss probabilities in percent, one per state */
+    for (i=0; i<n; i++) {
+        if (lm_read_number(fd, &value) != 1 || value < 0 || value > 100) {
+            fprintf(stderr, "%s: loss probabilities must be in [0..100]\n",
+                    filename);
+            goto err;
+        }
+        model->loss[i] = value / 100.0;
+    }
+    fclose(fd);
+    PJ_LOG(5, (THIS_FILE, "loaded %u-state loss model from %s", n, filename));
+
+    *p_model = model;
+    return PJ_SUCCESS;
+
+err:
+    fclose(fd);
+    return PJ_EINVAL;
+}
+
+
+PJ_DEF(unsigned) em_loss_model_state_count(const em_loss_model *model)
+{
+    return model->count;
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_loss_model_port_create(pj_pool_t *pool,
+        pjmedia_port *dn_port, const em_loss_model *model, pj_uint64_t seed,
+        unsigned stream, pjmedia_port **p_port)
+{
+    const pj_str_t name = { "lossmodel", 9 };
+    struct loss_model_port *lm;
+
+    PJ_ASSERT_RETURN(pool && dn_port && model && p_port, PJ_EINVAL);
+
+    /* Create the port itself */
+    lm = PJ_POOL_ZALLOC_T(pool, struct loss_model_port);
+
+    pjmedia_port_info_init(&lm->base.info, &name, SIGNATURE,
+			   dn_port->info.clock_rate,
+			   dn_port->info.channel_count,
+			   dn_port->info.bits_per_sample,
+			   dn_port->info.samples_per_frame);
+
+    /* More init */
+    lm->dn_port = dn_port;
+    lm->model = model;
+    lm->state = 0;
+    em_rand_init(&lm->rand, seed, stream);
+    em_runs_init(&lm->runs);
+    lm->base.get_frame = &lm_get_frame;
+    lm->base.put_frame = &lm_put_frame;
+    lm->base.on_destroy = &lm_on_destroy;
+
+    /* Done */
+    *p_port = &lm->base;
+
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_loss_model_port_get_runs(
+        const pjmedia_port *port, em_hist *bursts, em_hist *gaps)
+{
+    const struct loss_model_port *lm = (const struct loss_model_port*)port;
+    PJ_ASSERT_RETURN(port->info.signature == SIGNATURE, PJ_EINVAL);
+    em_runs_get(&lm->runs, bursts, gaps);
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t lm_put_frame( pjmedia_port *this_port,
+				 const pjmedia_frame *frame)
+{
+    struct loss_model_port *lm = (struct loss_model_port*)this_port;
+    const em_loss_model *model = lm->model;
+    unsigned row = lm->state * model->count, col;
+    double u, loss;
+    PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
+    EM_LOG(6, (THIS_FILE, "packet: sz=%d ts=%llu",
+                frame->size/sizeof(pj_uint16_t), frame->timestamp.u64));
+    if (frame->type == PJMEDIA_FRAME_TYPE_NONE ) {
+	    return pjmedia_port_put_frame(lm->dn_port, frame);
+    }
+
+    /* integer part of u picks the column, fractional part the alias */
+    u = em_rand_uniform(&lm->rand) * model->count;
+    col = (unsigned)u;
+    lm->state = (u - col < model->prob[row + col]) ? col :
+        model->alias[row + col];
+
+    loss = model->loss[lm->state];
+    if (loss > 0 && (loss >= 1.0 || em_rand_uniform(&lm->rand) < loss)) {
+        pjmedia_frame tmp_frame;
+        em_runs_add(&lm->runs, PJ_TRUE);
+        pj_bzero(&tmp_frame, sizeof(tmp_frame));
+        tmp_frame.type = PJMEDIA_FRAME_TYPE_NONE;
+        return pjmedia_port_put_frame(lm->dn_port, &tmp_frame);
+    }
+    em_runs_add(&lm->runs, PJ_FALSE);
+    return pjmedia_port_put_frame(lm->dn_port, frame);
+}
+
+
+static pj_status_t lm_get_frame( pjmedia_port *this_port,
+				 pjmedia_frame *frame)
+{
+    PJ_UNUSED_ARG(this_port);
+    PJ_UNUSED_ARG(frame);
+    return PJ_EINVALIDOP;
+}
+
+
+
+static pj_status_t lm_on_destroy(pjmedia_port *this_port)
+{
+    PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
+    return PJ_SUCCESS;
+}
@@ -0,0 +1,28 @@
+#ifndef __LOSS_MODEL_PORT_H__
+#define __LOSS_MODEL_PORT_H__
+
+#include <pjlib.h>
+#include <pjlib-util.h>
+#include <pjmedia.h>
+#include "hist.h"
+
+#define EM_LOSS_MODEL_MAX_STATES 64
+
+/* N-state markov chain with per-state loss probability, e.g. 4-state
+   Gilbert-Elliott model. Read-only once loaded, may be shared by ports. */
+typedef struct em_loss_model em_loss_model;
+
+PJ_DECL(pj_status_t) em_loss_model_load(pj_pool_t *pool, const char *filename,
+        em_loss_model **p_model);
+
+PJ_DECL(unsigned) em_loss_model_state_count(const em_loss_model *model);
+
+PJ_DECL(pj_status_t) pjmedia_loss_model_port_create(pj_pool_t *pool,
+        pjmedia_port *dn_port, const em_loss_model *model, pj_uint64_t seed,
+        unsigned stream, pjmedia_port **p_port);
+
+/* channel loss bursts and gaps between them, in packets */
+PJ_DECL(pj_status_t) pjmedia_loss_model_port_get_runs(
+        const pjmedia_port *port, em_hist *bursts, em_hist *gaps);
+
+#endif	/* __LOSS_MODEL_PORT_H__ */
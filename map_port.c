@@ -0,0 +1,389 @@
+#define _GNU_SOURCE     /* fallocate, sync_file_range */
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "map_port.h"
+#include "wav.h"
+#define READER_SIGNATURE   PJMEDIA_PORT_SIGNATURE('M', 'A', 'P', 'R')
+#define WRITER_SIGNATURE   PJMEDIA_PORT_SIGNATURE('M', 'A', 'P', 'W')
+#define THIS_FILE       "map_port.c"
+#define GROW_SIZE       (16<<20)    /* the least the mapping grows by */
+#define WRITEBACK_SIZE  (8<<20)     /* started at once */
+
+struct map_reader
+{
+    pjmedia_port      base;
+    pj_uint8_t       *map;
+    pj_size_t         map_size;
+    const pj_uint8_t *data;
+    pj_uint64_t       data_size;
+    pj_uint64_t       pos;
+    pj_uint8_t       *last;       /* copy of the last frame, padded */
+    pj_timestamp      ts;
+};
+
+struct map_writer
+{
+    pjmedia_port      base;
+    int               fd;
+    pj_uint8_t       *map;
+    pj_uint64_t       capacity;   /* of the file and the mapping */
+    pj_uint64_t       len;        /* written, with the header */
+    pj_uint64_t       synced;     /* writeback is started up to, page aligned */
+    pj_uint64_t       page_size;
+};
+
+
+static pj_status_t mr_get_frame(pjmedia_port *this_port,
+				pjmedia_frame *frame);
+static pj_status_t mr_put_frame(pjmedia_port *this_port,
+				const pjmedia_frame *frame);
+static pj_status_t mr_on_destroy(pjmedia_port *this_port);
+static pj_status_t mw_get_frame(pjmedia_port *this_port,
+				pjmedia_frame *frame);
+static pj_status_t mw_put_frame(pjmedia_port *this_port,
+				const pjmedia_frame *frame);
+static pj_status_t mw_on_destroy(pjmedia_port *this_port);
+
+
+/* finds fmt and data chunks in the mapped file */
+static pj_status_t mr_parse(struct map_reader *mr, unsigned *clock_rate,
+        unsigned *channel_count)
+{
+    const pj_uint8_t *map = mr->map;
+    pj_size_t off = 12;
+    pj_bool_t fmt_found = PJ_FALSE;
+    pj_status_t status;
+
+    if (mr->map_size < 12 || memcmp(map, "RIFF", 4) != 0 ||
+            memcmp(map + 8, "WAVE", 4) != 0)
+        return PJMEDIA_ENOTVALIDWAVE;
+    while (off + 8 <= mr->map_size) {
+        pj_uint32_t size = em_le32(map + off + 4);
+        pj_size_t left = mr->map_size - off - 8;
+
+        if (memcmp(map + off, "data", 4) == 0) {
+            if (!fmt_found)
+                return PJMEDIA_ENOTVALIDWAVE;
+            mr->data = map + off + 8;
+            /* streaming writers don't know the length of data */
+            mr->data_size = (size == 0 || size == 0xffffffff ||
+                    size > left) ? left : size;
+            mr->data_size -= mr->data_size % (*channel_count * 2);
+            return PJ_SUCCESS;
+        }
+        if (memcmp(map + off, "fmt ", 4) == 0) {
+            if (size > left)
+                return PJMEDIA_ENOTVALIDWAVE;
+            status = em_wav_parse_fmt(map + off + 8, size, clock_rate,
+                    channel_count);
+            if (status != PJ_SUCCESS)
+                return status;
+            fmt_found = PJ_TRUE;
+        }
+        if ((pj_uint64_t)size + (size & 1) > left)
+            break;
+        off += 8 + size + (size & 1);
+    }
+    return PJMEDIA_ENOTVALIDWAVE;
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_map_reader_port_create(pj_pool_t *pool,
+        const char *filename, unsigned ptime, pjmedia_port **p_port)
+{
+    const pj_str_t name = { "map-reader", 10 };
+    struct map_reader *mr;
+    unsigned clock_rate = 0, channel_count = 0;
+    struct stat st;
+    pj_status_t status;
+    void *map;
+    int fd;
+
+    PJ_ASSERT_RETURN(pool && filename && ptime && p_port, PJ_EINVAL);
+#if PJ_IS_BIG_ENDIAN
+    /* views would need swapping */
+    return PJMEDIA_EWAVEUNSUPP;
+#endif
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return PJ_STATUS_FROM_OS(errno);
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        status = st.st_size == 0 ? PJMEDIA_ENOTVALIDWAVE :
+            PJ_STATUS_FROM_OS(errno);
+        close(fd);
+        return status;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return PJ_STATUS_FROM_OS(errno);
+    /* read ahead aggressively, drop pages behind */
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    /* Create the port itself */
+    mr = PJ_POOL_ZALLOC_T(pool, struct map_reader);
+    mr->map = (pj_uint8_t*)map;
+    mr->map_size = (pj_size_t)st.st_size;
+    status = mr_parse(mr, &clock_rate, &channel_count);
+    if (status != PJ_SUCCESS) {
+        munmap(map, mr->map_size);
+        return status;
+    }
+
+    pjmedia_port_info_init(&mr->base.info, &name, READER_SIGNATURE,
+			   clock_rate, channel_count, 16,
+			   clock_rate * ptime * channel_count / 1000);
+    mr->last = (pj_uint8_t*)pj_pool_alloc(pool,
+            mr->base.info.bytes_per_frame);
+    if (!mr->last) {
+        munmap(map, mr->map_size);
+        return PJ_ENOMEM;
+    }
+    PJ_LOG(5, (THIS_FILE, "%s mapped: %u Hz, %u channels, %llu bytes",
+                filename, clock_rate, channel_count,
+                (unsigned long long)mr->data_size));
+
+    /* More init */
+    mr->base.get_frame = &mr_get_frame;
+    mr->base.put_frame = &mr_put_frame;
+    mr->base.on_destroy = &mr_on_destroy;
+
+    /* Done */
+    *p_port = &mr->base;
+
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_bool_t) pjmedia_map_reader_port_check(const pjmedia_port *port)
+{
+    return port && port->info.signature == READER_SIGNATURE;
+}
+
+
+PJ_DEF(pj_uint64_t) pjmedia_map_reader_get_data_size(
+        const pjmedia_port *port)
+{
+    const struct map_reader *mr = (const struct map_reader*)port;
+    PJ_ASSERT_RETURN(port->info.signature == READER_SIGNATURE, 0);
+    return mr->data_size;
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_map_reader_get_view(pjmedia_port *port,
+        pjmedia_frame *frame)
+{
+    struct map_reader *mr = (struct map_reader*)port;
+    pj_size_t size = port->info.bytes_per_frame;
+    pj_uint64_t left;
+    PJ_ASSERT_RETURN(port->info.signature == READER_SIGNATURE, PJ_EINVAL);
+
+    left = mr->data_size - mr->pos;
+    if (left == 0) {
+        frame->type = PJMEDIA_FRAME_TYPE_NONE;
+        frame->size = 0;
+        return PJ_EEOF;
+    }
+    if (left >= size) {
+        frame->buf = (void*)(mr->data + mr->pos);
+        mr->pos += size;
+    } else {
+        /* the last frame is padded with silence */
+        pj_memcpy(mr->last, mr->data + mr->pos, (pj_size_t)left);
+        pj_bzero(mr->last + left, size - (pj_size_t)left);
+        frame->buf = mr->last;
+        mr->pos = mr->data_size;
+    }
+    frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+    frame->size = size;
+    frame->timestamp = mr->ts;
+    mr->ts.u64 += port->info.samples_per_frame;
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t mr_get_frame( pjmedia_port *this_port,
+				 pjmedia_frame *frame)
+{
+    void *buf = frame->buf;
+    pj_status_t status;
+    PJ_ASSERT_RETURN(this_port->info.signature == READER_SIGNATURE, PJ_EINVAL);
+    PJ_ASSERT_RETURN(frame->size >= this_port->info.bytes_per_frame,
+            PJ_ETOOSMALL);
+
+    status = pjmedia_map_reader_get_view(this_port, frame);
+    if (status == PJ_SUCCESS)
+        pj_memcpy(buf, frame->buf, frame->size);
+    frame->buf = buf;
+    return status;
+}
+
+
+static pj_status_t mr_put_frame( pjmedia_port *this_port,
+				 const pjmedia_frame *frame)
+{
+    PJ_UNUSED_ARG(this_port);
+    PJ_UNUSED_ARG(frame);
+    return PJ_EINVALIDOP;
+}
+
+
+static pj_status_t mr_on_destroy(pjmedia_port *this_port)
+{
+    struct map_reader *mr = (struct map_reader*)this_port;
+    PJ_ASSERT_RETURN(this_port->info.signature == READER_SIGNATURE, PJ_EINVAL);
+    munmap(mr->map, mr->map_size);
+    return PJ_SUCCESS;
+}
+
+
+/* file and mapping of at least need bytes */
+static pj_status_t mw_reserve(struct map_writer *mw, pj_uint64_t need)
+{
+    pj_uint64_t capacity = mw->capacity * 2;
+    void *map;
+
+    if (need <= mw->capacity)
+        return PJ_SUCCESS;
+    if (capacity < need)
+        capacity = need;
+    if (capacity < mw->capacity + GROW_SIZE)
+        capacity = mw->capacity + GROW_SIZE;
+    capacity = (capacity + mw->page_size - 1) & ~(mw->page_size - 1);
+
+    if (mw->map)
+        munmap(mw->map, (size_t)mw->capacity);
+    mw->map = NULL;
+    if (ftruncate(mw->fd, (off_t)capacity) != 0)
+        return PJ_STATUS_FROM_OS(errno);
+#if defined(__linux__)
+    /* real blocks instead of a sparse file, where supported */
+    fallocate(mw->fd, 0, (off_t)mw->capacity,
+            (off_t)(capacity - mw->capacity));
+#endif
+    map = mmap(NULL, (size_t)capacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+            mw->fd, 0);
+    if (map == MAP_FAILED)
+        return PJ_STATUS_FROM_OS(errno);
+    madvise(map, (size_t)capacity, MADV_SEQUENTIAL);
+    mw->map = (pj_uint8_t*)map;
+    mw->capacity = capacity;
+    return PJ_SUCCESS;
+}
+
+
+/* starts writeback of whole pages written since the last one */
+static void mw_writeback(struct map_writer *mw, pj_bool_t force)
+{
+    pj_uint64_t end = mw->len & ~(mw->page_size - 1);
+
+    if (end <= mw->synced || (!force && end - mw->synced < WRITEBACK_SIZE))
+        return;
+#if defined(__linux__)
+    sync_file_range(mw->fd, (off_t)mw->synced, (off_t)(end - mw->synced),
+            SYNC_FILE_RANGE_WRITE);
+#else
+    msync(mw->map + mw->synced, (size_t)(end - mw->synced), MS_ASYNC);
+#endif
+    mw->synced = end;
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_map_writer_port_create(pj_pool_t *pool,
+        const char *filename, unsigned clock_rate, unsigned channel_count,
+        unsigned samples_per_frame, unsigned bits_per_sample,
+        pj_uint64_t size_hint, pjmedia_port **p_port)
+{
+    const pj_str_t name = { "map-writer", 10 };
+    struct map_writer *mw;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(pool && filename && p_port, PJ_EINVAL);
+    PJ_ASSERT_RETURN(bits_per_sample == 16, PJ_EINVAL);
+
+    /* Create the port itself */
+    mw = PJ_POOL_ZALLOC_T(pool, struct map_writer);
+    mw->page_size = (pj_uint64_t)sysconf(_SC_PAGESIZE);
+    mw->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (mw->fd < 0)
+        return PJ_STATUS_FROM_OS(errno);
+    status = mw_reserve(mw, EM_WAV_HEADER + size_hint);
+    if (status != PJ_SUCCESS) {
+        close(mw->fd);
+        return status;
+    }
+
+    pjmedia_port_info_init(&mw->base.info, &name, WRITER_SIGNATURE,
+			   clock_rate, channel_count, bits_per_sample,
+			   samples_per_frame);
+
+    /* More init */
+    mw->base.get_frame = &mw_get_frame;
+    mw->base.put_frame = &mw_put_frame;
+    mw->base.on_destroy = &mw_on_destroy;
+    /* length is fixed on destroy */
+    em_wav_header(&mw->base.info, (pj_uint64_t)-1, mw->map);
+    mw->len = EM_WAV_HEADER;
+
+    /* Done */
+    *p_port = &mw->base;
+
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t mw_put_frame( pjmedia_port *this_port,
+				 const pjmedia_frame *frame)
+{
+    struct map_writer *mw = (struct map_writer*)this_port;
+    pj_status_t status;
+    PJ_ASSERT_RETURN(this_port->info.signature == WRITER_SIGNATURE, PJ_EINVAL);
+
+    if (frame->type != PJMEDIA_FRAME_TYPE_AUDIO || frame->size == 0)
+        return PJ_SUCCESS;
+    status = mw_reserve(mw, mw->len + frame->size);
+    if (status != PJ_SUCCESS)
+        return status;
+    pj_memcpy(mw->map + mw->len, frame->buf, frame->size);
+#if PJ_IS_BIG_ENDIAN
+    em_swap16(mw->map + mw->len, frame->size);
+#endif
+    mw->len += frame->size;
+    mw_writeback(mw, PJ_FALSE);
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t mw_get_frame( pjmedia_port *this_port,
+				 pjmedia_frame *frame)
+{
+    PJ_UNUSED_ARG(this_port);
+    PJ_UNUSED_ARG(frame);
+    return PJ_EINVALIDOP;
+}
+
+
+static pj_status_t mw_on_destroy(pjmedia_port *this_port)
+{
+    struct map_writer *mw = (struct map_writer*)this_port;
+    pj_status_t status = PJ_SUCCESS;
+    PJ_ASSERT_RETURN(this_port->info.signature == WRITER_SIGNATURE, PJ_EINVAL);
+
+    if (mw->map) {
+        em_wav_header(&mw->base.info, mw->len - EM_WAV_HEADER, mw->map);
+        mw_writeback(mw, PJ_TRUE);
+        munmap(mw->map, (size_t)mw->capacity);
+    }
+    /* preallocated tail is cut */
+    if (ftruncate(mw->fd, (off_t)mw->len) != 0) {
+        status = PJ_STATUS_FROM_OS(errno);
+        PJ_LOG(3, (THIS_FILE, "can't truncate output: %s", strerror(errno)));
+    }
+    close(mw->fd);
+    return status;
+}
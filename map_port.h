@@ -0,0 +1,41 @@
+#ifndef __MAP_PORT_H__
+#define __MAP_PORT_H__
+
+#include <pjlib.h>
+#include <pjlib-util.h>
+#include <pjmedia.h>
+
+/*
+ * Reads 16 bit PCM WAV file mapped into memory. Frames may be taken as
+ * views into the mapping instead of copies, the last one is padded with
+ * silence. Returns PJ_EEOF at the end of data. Formats other than 16 bit
+ * PCM (and big endian hosts) give PJMEDIA_EWAVEUNSUPP, so that the caller
+ * can fall back to pjmedia WAV player.
+ */
+PJ_DECL(pj_status_t) pjmedia_map_reader_port_create(pj_pool_t *pool,
+        const char *filename, unsigned ptime, pjmedia_port **p_port);
+
+PJ_DECL(pj_bool_t) pjmedia_map_reader_port_check(const pjmedia_port *port);
+
+/* bytes of PCM in the file */
+PJ_DECL(pj_uint64_t) pjmedia_map_reader_get_data_size(
+        const pjmedia_port *port);
+
+/*
+ * Like get_frame, but frame->buf is set to the next frame in the mapping,
+ * which is valid till the port is destroyed and must not be written.
+ */
+PJ_DECL(pj_status_t) pjmedia_map_reader_get_view(pjmedia_port *port,
+        pjmedia_frame *frame);
+
+/*
+ * Writes 16 bit PCM WAV file through a shared mapping. The file is
+ * preallocated for size_hint bytes of PCM (grown as needed), written back
+ * in large sequential ranges and cut to the real size on destroy.
+ */
+PJ_DECL(pj_status_t) pjmedia_map_writer_port_create(pj_pool_t *pool,
+        const char *filename, unsigned clock_rate, unsigned channel_count,
+        unsigned samples_per_frame, unsigned bits_per_sample,
+        pj_uint64_t size_hint, pjmedia_port **p_port);
+
+#endif	/* __MAP_PORT_H__ */
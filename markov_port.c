@@ -1,5 +1,9 @@
 #include "markov_port.h"
-#define SIGNATURE   PJMEDIA_PORT_SIGNATURE('M', 'A', 'R', 'K')
+#include "em_rand.h"
+#include "em_log.h"
+#include "events.h"
+#include "batch.h"
+#define SIGNATURE   PJMEDIA_MARKOV_PORT_SIGNATURE
 #define THIS_FILE   "markov_port.c"
 
 struct markov_port
@@ -9,6 +13,11 @@ struct markov_port
     double            p10;
     double            p00;
     pj_bool_t         packet_lost;
+    unsigned          options;
+    em_rand           rand;
+    pj_uint64_t       run_left;  /* packets left in the current run */
+    em_runs           runs;
+    em_batch          out;
 };
 
 
@@ -19,8 +28,18 @@ static pj_status_t mp_get_frame(pjmedia_port *this_port,
 static pj_status_t mp_on_destroy(pjmedia_port *this_port);
 
 
+/* packets to stay in the current state after the first one */
+static pj_uint64_t mp_run_length(struct markov_port *mp)
+{
+    /* stay probability is 1-p10 for received packets and p00 for lost */
+    double leave = mp->packet_lost ? 1.0 - mp->p00/100.0 : mp->p10/100.0;
+    return em_rand_geometric(&mp->rand, leave);
+}
+
+
 PJ_DEF(pj_status_t) pjmedia_markov_port_create(pj_pool_t *pool,
-        pjmedia_port *dn_port, double p10, double p00, pjmedia_port **p_port)
+        pjmedia_port *dn_port, double p10, double p00, pj_uint64_t seed,
+        unsigned stream, unsigned options, pjmedia_port **p_port)
 {
     const pj_str_t markov = { "markov", 6 };
     struct markov_port *mp;
@@ -41,12 +60,19 @@ PJ_DEF(pj_status_t) pjmedia_markov_port_create(pj_pool_t *pool,
 
     /* More init */
     mp->dn_port = dn_port;
+    em_batch_init(&mp->out, dn_port);
     mp->p10 = p10;
     mp->p00 = p00;
     mp->base.get_frame = &mp_get_frame;
     mp->base.put_frame = &mp_put_frame;
     mp->base.on_destroy = &mp_on_destroy;
     mp->packet_lost = PJ_FALSE;
+    mp->options = options;
+    em_rand_init(&mp->rand, seed, stream);
+    em_runs_init(&mp->runs);
+    /* initial state is "previous packet received" */
+    if (options & PJMEDIA_MARKOV_RUN_LENGTH)
+        mp->run_left = mp_run_length(mp);
 
     /* Done */
     *p_port = &mp->base;
@@ -55,29 +81,74 @@ PJ_DEF(pj_status_t) pjmedia_markov_port_create(pj_pool_t *pool,
 }
 
 
-static pj_status_t mp_put_frame( pjmedia_port *this_port,
-				 const pjmedia_frame *frame)
+PJ_DEF(pj_status_t) pjmedia_markov_port_get_runs(const pjmedia_port *port,
+        em_hist *bursts, em_hist *gaps)
 {
-    struct markov_port *mp = (struct markov_port*)this_port;
-    double lost_threshold = mp->packet_lost ? mp->p00 : mp->p10;
-    double rand;
-    PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
-    PJ_LOG(6, (THIS_FILE, "packet: sz=%d ts=%llu",
+    const struct markov_port *mp = (const struct markov_port*)port;
+    PJ_ASSERT_RETURN(port->info.signature == SIGNATURE, PJ_EINVAL);
+    em_runs_get(&mp->runs, bursts, gaps);
+    return PJ_SUCCESS;
+}
+
+
+/* decide the fate of the frame and queue the result downstream */
+static pj_status_t mp_process(struct markov_port *mp,
+        const pjmedia_frame *frame)
+{
+    pj_bool_t lost;
+    EM_LOG(6, (THIS_FILE, "packet: sz=%d ts=%llu",
                 frame->size/sizeof(pj_uint16_t), frame->timestamp.u64));
-    if (frame->type == PJMEDIA_FRAME_TYPE_NONE ) {
-	    return pjmedia_port_put_frame(mp->dn_port, frame);
+    if (frame->type == PJMEDIA_FRAME_TYPE_NONE )
+        return em_batch_add(&mp->out, frame);
+    if (mp->options & PJMEDIA_MARKOV_RUN_LENGTH) {
+        /* one draw per run: flip the state when the run is over */
+        while (mp->run_left == 0) {
+            mp->packet_lost = !mp->packet_lost;
+            mp->run_left = mp_run_length(mp);
+            if (mp->run_left != EM_RAND_INFINITE)
+                mp->run_left++;
+        }
+        if (mp->run_left != EM_RAND_INFINITE)
+            mp->run_left--;
+        lost = mp->packet_lost;
+    } else {
+        double lost_threshold = mp->packet_lost ? mp->p00 : mp->p10;
+        lost = em_rand_uniform(&mp->rand) * 100.0 < lost_threshold;
     }
-    rand = (double)(pj_rand() / ((double)RAND_MAX+1.0) * 100.0);
-    if (rand < lost_threshold) {
-        pjmedia_frame tmp_frame;
-        pj_bzero(&tmp_frame, sizeof(tmp_frame));
-        tmp_frame.type = PJMEDIA_FRAME_TYPE_NONE;
+    em_runs_add(&mp->runs, lost);
+    em_event_add(EM_EV_MARKOV, lost ? EM_EV_LOSE : EM_EV_PASS,
+            frame->timestamp.u64, lost ? 0 : frame->size);
+    if (lost) {
         mp->packet_lost = 1;
-        return pjmedia_port_put_frame(mp->dn_port, &tmp_frame);
+        return em_batch_add_none(&mp->out);
     } else {
         mp->packet_lost = 0;
-        return pjmedia_port_put_frame(mp->dn_port, frame);
+        return em_batch_add(&mp->out, frame);
+    }
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_markov_port_put_frames(pjmedia_port *port,
+        const pjmedia_frame frames[], unsigned count)
+{
+    struct markov_port *mp = (struct markov_port*)port;
+    pj_status_t status;
+    unsigned i;
+    PJ_ASSERT_RETURN(port && (frames || !count), PJ_EINVAL);
+    PJ_ASSERT_RETURN(port->info.signature == SIGNATURE, PJ_EINVAL);
+    for (i=0; i<count; i++) {
+        status = mp_process(mp, &frames[i]);
+        if (status != PJ_SUCCESS)
+            return status;
     }
+    return em_batch_flush(&mp->out);
+}
+
+
+static pj_status_t mp_put_frame( pjmedia_port *this_port,
+				 const pjmedia_frame *frame)
+{
+    return pjmedia_markov_port_put_frames(this_port, frame, 1);
 }
 
 
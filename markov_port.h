@@ -1,6 +1,32 @@
+#ifndef __MARKOV_PORT_H__
+#define __MARKOV_PORT_H__
+
 #include <pjlib.h>
 #include <pjlib-util.h>
 #include <pjmedia.h>
+#include "hist.h"
+
+#define PJMEDIA_MARKOV_PORT_SIGNATURE \
+    PJMEDIA_PORT_SIGNATURE('M', 'A', 'R', 'K')
+
+/* markov port options */
+enum {
+    /* sample whole loss and receive run lengths instead of drawing a random
+       value for every packet */
+    PJMEDIA_MARKOV_RUN_LENGTH = 1
+};
 
 PJ_DECL(pj_status_t) pjmedia_markov_port_create(pj_pool_t *pool,
-        pjmedia_port *dn_port, double p10, double p00, pjmedia_port **p_port);
+        pjmedia_port *dn_port, double p10, double p00, pj_uint64_t seed,
+        unsigned stream, unsigned options, pjmedia_port **p_port);
+
+/* the frames one after another, lost ones are passed downstream in one
+   array with the rest, see em_port_put_frames */
+PJ_DECL(pj_status_t) pjmedia_markov_port_put_frames(pjmedia_port *port,
+        const pjmedia_frame frames[], unsigned count);
+
+/* channel loss bursts and gaps between them, in packets */
+PJ_DECL(pj_status_t) pjmedia_markov_port_get_runs(const pjmedia_port *port,
+        em_hist *bursts, em_hist *gaps);
+
+#endif	/* __MARKOV_PORT_H__ */
@@ -0,0 +1,686 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "multicall.h"
+#include "map_port.h"
+#include "em_log.h"
+#include "markov_port.h"
+#include "silence_port.h"
+#include "workers.h"
+#include "batch.h"
+#define SIGNATURE   PJMEDIA_PORT_SIGNATURE('M', 'C', 'A', 'L')
+#define THIS_FILE   "multicall.c"
+#define HDR_SIZE    (20 + 8 + 12)       /* IP, UDP and RTP headers */
+#define INIT_PACKETS 1024
+#define LOST        ((pj_uint64_t)-1)   /* by the loss model of the call */
+#define DROPPED     ((pj_uint64_t)-2)   /* by the bottleneck */
+
+/*
+ * All calls send the same input with the same codec, so it is encoded only
+ * once and calls share the packets. Then
+ *  1. every call passes them through its own loss port, the sink behind
+ *     it only marks lost packets;
+ *  2. packets of all calls go through the bottleneck in order of arrival,
+ *     which gives departure time to every packet that is not dropped. It's
+ *     the only stage where calls interact, so it runs in one thread;
+ *  3. calls decode their packets with own codec, PLC and writer, in
+ *     parallel.
+ * Calls start evenly spread over one packet time, as independent phones
+ * would do, and the bottleneck works exactly as the leaky bucket port when
+ * there is one call only.
+ */
+struct mc_packet
+{
+    pj_size_t         offset;     /* in payload */
+    unsigned          size;
+};
+
+struct mc_call
+{
+    pjmedia_port      sink;       /* must be the first */
+    unsigned          index;
+    unsigned          offset;     /* start of the call, samples */
+    pj_uint64_t      *depart;     /* per packet: timestamp, LOST or DROPPED */
+    unsigned          cur;        /* packet in the loss port */
+    char             *output_file;
+    pj_status_t       status;
+    em_plc_statistics stats;
+    unsigned          lost;
+    unsigned          dropped;
+    double            delay_sum;  /* in the bottleneck, samples */
+    pj_uint64_t       delay_max;
+    unsigned         *queue;      /* fair schedule: ring of waiting packets */
+    unsigned          head;
+    unsigned          count;
+    unsigned          deficit;
+};
+
+struct multicall
+{
+    const em_context *ctx;
+    const em_scenario *sc;
+    em_schedule       schedule;
+    unsigned          call_count;
+    struct mc_call   *calls;
+    pj_pool_t        *pool;
+
+    struct mc_packet *packets;
+    unsigned          packet_count;
+    unsigned          packet_capacity;
+    pj_uint8_t       *payload;
+    pj_size_t         payload_size;
+    pj_size_t         payload_capacity;
+    unsigned          max_packet;
+    unsigned          clock_rate;     /* of the codec */
+    unsigned          channel_count;
+    unsigned          bits_per_sample;
+    unsigned          samples_per_frame; /* of one packet */
+    unsigned          file_clock_rate;   /* calls are written as the input */
+    unsigned          file_channel_count;
+    unsigned          file_samples_per_frame;
+    pj_uint64_t       file_data_size;    /* 0 if unknown */
+
+    /* bottleneck */
+    unsigned          bucket_size;
+    unsigned          sent_delay; /* sent delay or pps is set */
+    pj_uint64_t      *fifo;       /* fifo schedule: ring of call:packet */
+    unsigned          fifo_head;
+    unsigned          fifo_count;
+    unsigned          waiting;    /* in all queues */
+    pj_uint64_t      *sent;       /* ring of departures still in the future */
+    unsigned          sent_head;
+    unsigned          sent_count;
+    pj_uint64_t       last_ts;    /* departure of the latest packet */
+    pj_bool_t         started;
+    unsigned          turn;       /* fair schedule: call to be served */
+    pj_bool_t         turn_open;  /* quantum of the turn is given */
+};
+
+
+PJ_DEF(pj_status_t) em_parse_schedule(const char *value,
+        em_schedule *schedule)
+{
+    if (strcmp(value, "fifo") == 0)
+        *schedule = EM_SCHEDULE_FIFO;
+    else if (strcmp(value, "fair") == 0)
+        *schedule = EM_SCHEDULE_FAIR;
+    else
+        return PJ_EINVAL;
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t mc_add_packet(struct multicall *mc,
+        const pjmedia_frame *frame)
+{
+    struct mc_packet *pkt;
+
+    if (mc->packet_count == mc->packet_capacity) {
+        unsigned capacity = mc->packet_capacity ? mc->packet_capacity * 2 :
+            INIT_PACKETS;
+        struct mc_packet *packets = (struct mc_packet*)pj_pool_alloc(
+                mc->pool, capacity * sizeof(struct mc_packet));
+        if (!packets)
+            return PJ_ENOMEM;
+        if (mc->packet_count)
+            pj_memcpy(packets, mc->packets,
+                    mc->packet_count * sizeof(struct mc_packet));
+        mc->packets = packets;
+        mc->packet_capacity = capacity;
+    }
+    if (mc->payload_size + frame->size > mc->payload_capacity) {
+        pj_size_t capacity = mc->payload_capacity ? mc->payload_capacity * 2 :
+            INIT_PACKETS * frame->size;
+        pj_uint8_t *payload;
+        while (capacity < mc->payload_size + frame->size)
+            capacity *= 2;
+        payload = (pj_uint8_t*)pj_pool_alloc(mc->pool, capacity);
+        if (!payload)
+            return PJ_ENOMEM;
+        if (mc->payload_size)
+            pj_memcpy(payload, mc->payload, mc->payload_size);
+        mc->payload = payload;
+        mc->payload_capacity = capacity;
+    }
+    pkt = &mc->packets[mc->packet_count++];
+    pkt->offset = mc->payload_size;
+    pkt->size = (unsigned)frame->size;
+    pj_memcpy(mc->payload + mc->payload_size, frame->buf, frame->size);
+    mc->payload_size += frame->size;
+    if (pkt->size > mc->max_packet)
+        mc->max_packet = pkt->size;
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t mc_encode(struct multicall *mc)
+{
+    pj_pool_t *pool;
+    pjmedia_codec *codec;
+    pjmedia_codec_param codec_param;
+    pjmedia_port *file_port = NULL, *play_port = NULL;
+    pjmedia_frame pcm_frame, frame;
+    void *pcm_buf, *buf;
+    pj_size_t buf_size;
+    pj_bool_t views;
+    pj_status_t status;
+
+    pool = pj_pool_create(mc->ctx->pool_factory, "encoder", 4000, 4000, NULL);
+    status = em_alloc_codec(mc->ctx, mc->sc, pool, &codec, &codec_param);
+    if (status != PJ_SUCCESS) {
+        pj_pool_release(pool);
+        return status;
+    }
+    status = em_create_input_port(pool, mc->sc, &codec_param, &file_port,
+            &play_port);
+    if (status != PJ_SUCCESS)
+        goto on_return;
+    mc->file_clock_rate = file_port->info.clock_rate;
+    mc->file_channel_count = file_port->info.channel_count;
+    mc->file_samples_per_frame = file_port->info.samples_per_frame;
+    views = play_port == file_port && pjmedia_map_reader_port_check(file_port);
+    if (pjmedia_map_reader_port_check(file_port))
+        mc->file_data_size = pjmedia_map_reader_get_data_size(file_port);
+    mc->clock_rate = play_port->info.clock_rate;
+    mc->channel_count = play_port->info.channel_count;
+    mc->bits_per_sample = play_port->info.bits_per_sample;
+    mc->samples_per_frame = play_port->info.samples_per_frame;
+    buf_size = play_port->info.bytes_per_frame;
+    pcm_buf = pj_pool_zalloc(pool, buf_size);
+    buf = pj_pool_zalloc(pool, buf_size);
+    if (!pcm_buf || !buf) {
+        status = PJ_ENOMEM;
+        goto on_return;
+    }
+
+    for (;;) {
+        pcm_frame.buf = pcm_buf;
+        pcm_frame.size = buf_size;
+        if ((views ? pjmedia_map_reader_get_view(play_port, &pcm_frame) :
+                    pjmedia_port_get_frame(play_port, &pcm_frame)) !=
+                PJ_SUCCESS ||
+                pcm_frame.type == PJMEDIA_FRAME_TYPE_NONE)
+            break;
+        pcm_frame.timestamp.u64 = (pj_uint64_t)mc->packet_count *
+            mc->samples_per_frame;
+        frame.buf = buf;
+        frame.size = buf_size;
+        status = codec->op->encode(codec, &pcm_frame, buf_size, &frame);
+        if (status == PJ_SUCCESS)
+            status = mc_add_packet(mc, &frame);
+        if (status != PJ_SUCCESS)
+            goto on_return;
+    }
+    PJ_LOG(4, (THIS_FILE, "%u packets encoded, %lu bytes",
+                mc->packet_count, (unsigned long)mc->payload_size));
+
+on_return:
+    if (play_port)
+        pjmedia_port_destroy(play_port);
+    em_dealloc_codec(mc->ctx, codec);
+    pj_pool_release(pool);
+    return status;
+}
+
+
+static pj_status_t mc_sink_put_frame(pjmedia_port *this_port,
+        const pjmedia_frame *frame)
+{
+    struct mc_call *call = (struct mc_call*)this_port;
+    PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
+    if (frame->type == PJMEDIA_FRAME_TYPE_NONE) {
+        call->depart[call->cur] = LOST;
+        call->lost++;
+    }
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t mc_sink_get_frame(pjmedia_port *this_port,
+        pjmedia_frame *frame)
+{
+    PJ_UNUSED_ARG(this_port);
+    PJ_UNUSED_ARG(frame);
+    return PJ_EINVALIDOP;
+}
+
+
+static pj_status_t mc_sink_on_destroy(pjmedia_port *this_port)
+{
+    PJ_UNUSED_ARG(this_port);
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t mc_apply_loss(struct multicall *mc, struct mc_call *call)
+{
+    const pj_str_t name = { "call", 4 };
+    const em_scenario *sc = mc->sc;
+    pjmedia_port *loss_port;
+    pjmedia_frame frame;
+    pj_status_t status;
+    unsigned i;
+
+    pjmedia_port_info_init(&call->sink.info, &name, SIGNATURE,
+            mc->clock_rate, mc->channel_count, mc->bits_per_sample,
+            mc->samples_per_frame);
+    call->sink.put_frame = &mc_sink_put_frame;
+    call->sink.get_frame = &mc_sink_get_frame;
+    call->sink.on_destroy = &mc_sink_on_destroy;
+    if (sc->loss_model)
+        status = pjmedia_loss_model_port_create(mc->pool, &call->sink,
+                sc->loss_model, sc->seed, call->index, &loss_port);
+    else
+        status = pjmedia_markov_port_create(mc->pool, &call->sink,
+                sc->markov_p10, sc->markov_p00, sc->seed, call->index,
+                sc->markov_options, &loss_port);
+    if (status != PJ_SUCCESS)
+        return status;
+
+    pj_bzero(&frame, sizeof(frame));
+    frame.type = PJMEDIA_FRAME_TYPE_AUDIO;
+    for (i=0; i<mc->packet_count && status == PJ_SUCCESS; i++) {
+        call->cur = i;
+        frame.buf = mc->payload + mc->packets[i].offset;
+        frame.size = mc->packets[i].size;
+        frame.timestamp.u64 = (pj_uint64_t)i * mc->samples_per_frame +
+            call->offset;
+        status = pjmedia_port_put_frame(loss_port, &frame);
+    }
+    pjmedia_port_destroy(loss_port);
+    return status;
+}
+
+
+PJ_INLINE(pj_uint64_t) mc_arrival(const struct multicall *mc,
+        unsigned call, unsigned packet)
+{
+    return (pj_uint64_t)packet * mc->samples_per_frame +
+        mc->calls[call].offset;
+}
+
+
+static unsigned mc_sent_delay(const struct multicall *mc, unsigned packet)
+{
+    if (mc->sent_delay)
+        return mc->sent_delay;
+    if (mc->sc->bits_per_second > 0)
+        return (unsigned)(8.0 * (HDR_SIZE + mc->packets[packet].size) *
+                mc->clock_rate / (unsigned)mc->sc->bits_per_second);
+    return 0;
+}
+
+
+/* fair schedule: deficit round robin over calls with packets arrived by ts */
+static int mc_pick_fair(struct multicall *mc, pj_uint64_t ts)
+{
+    unsigned quantum = HDR_SIZE + mc->max_packet, i;
+
+    for (i=0; i<=mc->call_count; i++) {
+        struct mc_call *call = &mc->calls[mc->turn];
+        if (call->count) {
+            unsigned packet = call->queue[call->head];
+            unsigned cost = HDR_SIZE + mc->packets[packet].size;
+            if (mc_arrival(mc, mc->turn, packet) <= ts) {
+                if (!mc->turn_open) {
+                    call->deficit += quantum;
+                    mc->turn_open = PJ_TRUE;
+                }
+                if (call->deficit >= cost) {
+                    call->deficit -= cost;
+                    return (int)mc->turn;
+                }
+            }
+        } else {
+            call->deficit = 0;
+        }
+        mc->turn = (mc->turn + 1) % mc->call_count;
+        mc->turn_open = PJ_FALSE;
+    }
+    return -1;
+}
+
+
+/* take the next packet from the queues and give it the departure time */
+static void mc_send_next(struct multicall *mc)
+{
+    struct mc_call *call;
+    pj_uint64_t arrival, ts;
+    unsigned packet, sent_delay;
+
+    if (mc->schedule == EM_SCHEDULE_FIFO) {
+        pj_uint64_t item = mc->fifo[mc->fifo_head];
+        mc->fifo_head = (mc->fifo_head + 1) % mc->bucket_size;
+        mc->fifo_count--;
+        call = &mc->calls[item >> 32];
+        packet = (unsigned)item;
+    } else {
+        int idx = mc->started ? mc_pick_fair(mc, mc->last_ts) : -1;
+        if (idx < 0) {
+            /* link is idle: the earliest packet goes first */
+            pj_uint64_t first = ~(pj_uint64_t)0;
+            unsigned i;
+            for (i=0; i<mc->call_count; i++) {
+                const struct mc_call *c = &mc->calls[i];
+                if (c->count && mc_arrival(mc, i, c->queue[c->head]) < first)
+                    first = mc_arrival(mc, i, c->queue[c->head]);
+            }
+            idx = mc_pick_fair(mc, first);
+        }
+        call = &mc->calls[idx];
+        packet = call->queue[call->head];
+        call->head = (call->head + 1) % mc->bucket_size;
+        call->count--;
+    }
+    mc->waiting--;
+
+    /* the same rule as in the leaky bucket port */
+    arrival = mc_arrival(mc, call->index, packet);
+    sent_delay = mc_sent_delay(mc, packet);
+    if (!mc->started || mc->last_ts + sent_delay < arrival)
+        ts = arrival;
+    else
+        ts = mc->last_ts + sent_delay;
+    mc->started = PJ_TRUE;
+    mc->last_ts = ts;
+    call->depart[packet] = ts;
+    call->delay_sum += (double)(ts - arrival);
+    if (ts - arrival > call->delay_max)
+        call->delay_max = ts - arrival;
+    mc->sent[(mc->sent_head + mc->sent_count) % mc->bucket_size] = ts;
+    mc->sent_count++;
+}
+
+
+static void mc_drop(struct multicall *mc, struct mc_call *call,
+        unsigned packet)
+{
+    call->depart[packet] = DROPPED;
+    call->dropped++;
+    EM_LOG(6, (THIS_FILE, "bucket size %u exhausted, packet %u of call %u "
+                "dropped", mc->bucket_size, packet, call->index));
+}
+
+
+static void mc_arrive(struct multicall *mc, unsigned idx, unsigned packet)
+{
+    struct mc_call *call = &mc->calls[idx];
+    pj_uint64_t arrival = mc_arrival(mc, idx, packet);
+
+    /* the link chooses the next packet when the previous one is sent */
+    while (mc->waiting && (!mc->started || mc->last_ts < arrival))
+        mc_send_next(mc);
+    while (mc->sent_count && mc->sent[mc->sent_head] < arrival) {
+        mc->sent_head = (mc->sent_head + 1) % mc->bucket_size;
+        mc->sent_count--;
+    }
+
+    if (mc->waiting + mc->sent_count >= mc->bucket_size) {
+        struct mc_call *longest = call;
+        unsigned i;
+        if (mc->schedule == EM_SCHEDULE_FIFO) {
+            mc_drop(mc, call, packet);
+            return;
+        }
+        /* fair schedule drops from the longest queue */
+        for (i=0; i<mc->call_count; i++)
+            if (mc->calls[i].count > longest->count)
+                longest = &mc->calls[i];
+        if (longest == call || longest->count == 0) {
+            mc_drop(mc, call, packet);
+            return;
+        }
+        longest->count--;
+        mc->waiting--;
+        mc_drop(mc, longest, longest->queue[
+                (longest->head + longest->count) % mc->bucket_size]);
+    }
+
+    if (mc->schedule == EM_SCHEDULE_FIFO) {
+        mc->fifo[(mc->fifo_head + mc->fifo_count) % mc->bucket_size] =
+            ((pj_uint64_t)idx << 32) | packet;
+        mc->fifo_count++;
+    } else {
+        call->queue[(call->head + call->count) % mc->bucket_size] = packet;
+        call->count++;
+    }
+    mc->waiting++;
+}
+
+
+static pj_status_t mc_bottleneck(struct multicall *mc)
+{
+    unsigned i, packet;
+
+    mc->bucket_size = (unsigned)mc->sc->bucket_size;
+    if (mc->bucket_size == 0) {
+        /* nothing gets through, as with the leaky bucket port */
+        for (i=0; i<mc->call_count; i++)
+            for (packet=0; packet<mc->packet_count; packet++)
+                if (mc->calls[i].depart[packet] != LOST)
+                    mc_drop(mc, &mc->calls[i], packet);
+        return PJ_SUCCESS;
+    }
+    if (mc->sc->sent_delay > 0)
+        mc->sent_delay = mc->sc->sent_delay;
+    else if (mc->sc->packets_per_second > 0)
+        mc->sent_delay = (unsigned)((double)mc->clock_rate /
+                mc->sc->packets_per_second);
+    mc->sent = (pj_uint64_t*)pj_pool_calloc(mc->pool, mc->bucket_size,
+            sizeof(pj_uint64_t));
+    if (!mc->sent)
+        return PJ_ENOMEM;
+    if (mc->schedule == EM_SCHEDULE_FIFO) {
+        mc->fifo = (pj_uint64_t*)pj_pool_calloc(mc->pool, mc->bucket_size,
+                sizeof(pj_uint64_t));
+        if (!mc->fifo)
+            return PJ_ENOMEM;
+    } else {
+        for (i=0; i<mc->call_count; i++) {
+            mc->calls[i].queue = (unsigned*)pj_pool_calloc(mc->pool,
+                    mc->bucket_size, sizeof(unsigned));
+            if (!mc->calls[i].queue)
+                return PJ_ENOMEM;
+        }
+    }
+
+    /* calls start within the first packet time in order of index */
+    for (packet=0; packet<mc->packet_count; packet++)
+        for (i=0; i<mc->call_count; i++)
+            if (mc->calls[i].depart[packet] != LOST)
+                mc_arrive(mc, i, packet);
+    while (mc->waiting)
+        mc_send_next(mc);
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t mc_decode_job(void *arg, unsigned job_index)
+{
+    struct multicall *mc = (struct multicall*)arg;
+    struct mc_call *call = &mc->calls[job_index];
+    const em_scenario *sc = mc->sc;
+    pj_pool_t *pool;
+    pjmedia_codec *codec;
+    pjmedia_codec_param codec_param;
+    pjmedia_port *rec_file_port = NULL, *output_port = NULL,
+        *silence_port = NULL,
+        *plc_port = NULL, *delay_port = NULL, *first_port;
+    pjmedia_frame frames[EM_BATCH_MAX];
+    pj_status_t status;
+    unsigned i, pending = 0;
+
+    PJ_LOG(4, (THIS_FILE, "call %u: %s", job_index, call->output_file));
+    pool = pj_pool_create(mc->ctx->pool_factory, "call", 4000, 4000, NULL);
+    status = em_alloc_codec(mc->ctx, sc, pool, &codec, &codec_param);
+    if (status != PJ_SUCCESS) {
+        pj_pool_release(pool);
+        call->status = status;
+        /* one broken call must not stop the others */
+        return PJ_SUCCESS;
+    }
+
+    status = pjmedia_map_writer_port_create(pool, call->output_file,
+            mc->file_clock_rate, mc->file_channel_count,
+            mc->file_samples_per_frame / sc->fpp, mc->bits_per_sample,
+            mc->file_data_size, &rec_file_port);
+    if (status == PJ_SUCCESS)
+        status = em_convert_port(pool, rec_file_port, mc->clock_rate,
+                mc->channel_count, &output_port);
+    if (status == PJ_SUCCESS)
+        status = pjmedia_silence_port_create(pool, output_port, 0,
+                &silence_port);
+    if (status == PJ_SUCCESS)
+        status = pjmedia_plc_port_create(pool, silence_port, codec, sc->fpp,
+                sc->plc_mode, &plc_port);
+    if (status == PJ_SUCCESS && sc->delay_model)
+        status = pjmedia_delay_port_create(mc->ctx->pool_factory, plc_port,
+                sc->delay_model, sc->seed, call->index, &delay_port);
+    first_port = delay_port ? delay_port : plc_port;
+
+    for (i=0; i<mc->packet_count && status == PJ_SUCCESS; i++) {
+        pjmedia_frame *frame = &frames[pending++];
+        pj_bzero(frame, sizeof(*frame));
+        if (call->depart[i] == LOST || call->depart[i] == DROPPED) {
+            frame->type = PJMEDIA_FRAME_TYPE_NONE;
+        } else {
+            frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+            frame->buf = mc->payload + mc->packets[i].offset;
+            frame->size = mc->packets[i].size;
+            /* timeline of the call starts at zero as in single call mode */
+            frame->timestamp.u64 = call->depart[i] - call->offset;
+        }
+        if (pending == EM_BATCH_MAX || i + 1 == mc->packet_count) {
+            status = em_port_put_frames(first_port, frames, pending);
+            pending = 0;
+        }
+    }
+
+    if (delay_port)
+        pjmedia_port_destroy(delay_port);
+    if (plc_port) {
+        pjmedia_plc_port_get_statistics(plc_port, &call->stats);
+        pjmedia_port_destroy(plc_port);
+    }
+    if (silence_port)
+        pjmedia_port_destroy(silence_port);
+    if (output_port)
+        pjmedia_port_destroy(output_port);
+    else if (rec_file_port)
+        pjmedia_port_destroy(rec_file_port);
+    em_dealloc_codec(mc->ctx, codec);
+    pj_pool_release(pool);
+    call->status = status;
+    return PJ_SUCCESS;
+}
+
+
+static void mc_print_call(FILE *fd, const struct multicall *mc,
+        const struct mc_call *call)
+{
+    const em_plc_statistics *stats = &call->stats;
+    unsigned received = stats->received ? (unsigned)stats->received : 1;
+    fprintf(fd, "%u,%s,", call->index, call->output_file);
+    if (call->status != PJ_SUCCESS || stats->total == 0) {
+        fprintf(fd, "%d,,,,,,,\n", call->status);
+        return;
+    }
+    fprintf(fd, "0,%u,%u,%u,%u,%.2f,%.2f,%.2f\n",
+            (unsigned)stats->total, call->lost, call->dropped,
+            (unsigned)stats->received, 100.0 * stats->lost / stats->total,
+            call->delay_sum * 1000 / mc->clock_rate / received,
+            (double)call->delay_max * 1000 / mc->clock_rate);
+}
+
+
+PJ_DEF(pj_status_t) em_multicall_run(const em_context *ctx,
+        const em_scenario *sc, unsigned call_count, em_schedule schedule,
+        unsigned jobs, FILE *stats_fd)
+{
+    struct multicall mc;
+    pj_status_t status;
+    unsigned i, prefix_len, lost = 0, dropped = 0;
+    pj_size_t total = 0, received = 0;
+    double delay_sum = 0;
+    pj_uint64_t delay_max = 0;
+
+    PJ_ASSERT_RETURN(ctx && sc && call_count && stats_fd, PJ_EINVAL);
+
+    pj_bzero(&mc, sizeof(mc));
+    mc.ctx = ctx;
+    mc.sc = sc;
+    mc.schedule = schedule;
+    mc.call_count = call_count;
+    mc.pool = pj_pool_create(ctx->pool_factory, "multicall", 4000, 4000, NULL);
+
+    status = mc_encode(&mc);
+    if (status != PJ_SUCCESS)
+        goto on_return;
+
+    mc.calls = (struct mc_call*)pj_pool_calloc(mc.pool, call_count,
+            sizeof(struct mc_call));
+    if (!mc.calls) {
+        status = PJ_ENOMEM;
+        goto on_return;
+    }
+    /* out.wav -> out-0000.wav, out-0001.wav, ... */
+    prefix_len = strlen(sc->output_file);
+    if (prefix_len > 4 &&
+            strcasecmp(&sc->output_file[prefix_len-4], ".wav") == 0)
+        prefix_len -= 4;
+    for (i=0; i<call_count; i++) {
+        struct mc_call *call = &mc.calls[i];
+        call->index = i;
+        call->offset = (unsigned)((pj_uint64_t)i * mc.samples_per_frame /
+                call_count);
+        call->depart = (pj_uint64_t*)pj_pool_calloc(mc.pool,
+                mc.packet_count ? mc.packet_count : 1, sizeof(pj_uint64_t));
+        call->output_file = (char*)pj_pool_alloc(mc.pool, prefix_len + 16);
+        if (!call->depart || !call->output_file) {
+            status = PJ_ENOMEM;
+            goto on_return;
+        }
+        sprintf(call->output_file, "%.*s-%04u.wav", prefix_len,
+                sc->output_file, i);
+        status = mc_apply_loss(&mc, call);
+        if (status != PJ_SUCCESS)
+            goto on_return;
+    }
+
+    status = mc_bottleneck(&mc);
+    if (status != PJ_SUCCESS)
+        goto on_return;
+    PJ_LOG(4, (THIS_FILE, "%u calls through the bottleneck, decoding",
+                call_count));
+
+    status = em_workers_run(ctx->pool_factory, jobs, call_count,
+            &mc_decode_job, &mc);
+    if (status != PJ_SUCCESS)
+        goto on_return;
+
+    fprintf(stats_fd, "call,output,status,sent,lost,dropped,received,"
+            "loss_pct,delay_mean_ms,delay_max_ms\n");
+    for (i=0; i<call_count; i++) {
+        const struct mc_call *call = &mc.calls[i];
+        mc_print_call(stats_fd, &mc, call);
+        if (call->status != PJ_SUCCESS)
+            continue;
+        total += call->stats.total;
+        received += call->stats.received;
+        lost += call->lost;
+        dropped += call->dropped;
+        delay_sum += call->delay_sum;
+        if (call->delay_max > delay_max)
+            delay_max = call->delay_max;
+    }
+    if (total)
+        fprintf(stats_fd, "all,,0,%u,%u,%u,%u,%.2f,%.2f,%.2f\n",
+                (unsigned)total, lost, dropped, (unsigned)received,
+                100.0 * (total - received) / total,
+                received ? delay_sum * 1000 / mc.clock_rate / received : 0,
+                (double)delay_max * 1000 / mc.clock_rate);
+
+on_return:
+    pj_pool_release(mc.pool);
+    return status;
+}
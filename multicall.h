@@ -0,0 +1,28 @@
+#ifndef __MULTICALL_H__
+#define __MULTICALL_H__
+
+#include <stdio.h>
+#include "emulator.h"
+
+/* how the shared bottleneck chooses the next packet to send */
+typedef enum em_schedule {
+    EM_SCHEDULE_FIFO,       /* one queue, in order of arrival */
+    EM_SCHEDULE_FAIR        /* queue per call, deficit round robin */
+} em_schedule;
+
+PJ_DECL(pj_status_t) em_parse_schedule(const char *value,
+        em_schedule *schedule);
+
+/*
+ * Run call_count calls of the scenario at once. Every call has its own
+ * loss process (random stream = call index), codec instance and PLC, but
+ * all of them share one bottleneck: bucket_size packets of buffer drained
+ * at the bandwidth of the scenario. Call n is written to out-<n>.wav (see
+ * sweep), per-call statistics are printed to stats_fd as CSV. Decoders run
+ * on jobs threads (0 means one per CPU).
+ */
+PJ_DECL(pj_status_t) em_multicall_run(const em_context *ctx,
+        const em_scenario *sc, unsigned call_count, em_schedule schedule,
+        unsigned jobs, FILE *stats_fd);
+
+#endif	/* __MULTICALL_H__ */
@@ -0,0 +1,90 @@
+#include <errno.h>
+#include "pacer.h"
+#define THIS_FILE   "pacer.c"
+#define HIST_BIN_US 10
+
+
+static pj_int64_t ts_diff_us(const struct timespec *a, const struct timespec *b)
+{
+    return (pj_int64_t)(a->tv_sec - b->tv_sec) * 1000000 +
+        (a->tv_nsec - b->tv_nsec) / 1000;
+}
+
+
+PJ_DEF(void) em_pacer_init(em_pacer *pacer, unsigned period_us)
+{
+    pj_bzero(pacer, sizeof(*pacer));
+    pacer->period_ns = period_us * 1000;
+}
+
+
+PJ_DEF(void) em_pacer_wait(em_pacer *pacer)
+{
+    struct timespec now;
+    pj_int64_t late, busy = 0;
+    unsigned bin;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (pacer->frames == 0) {
+        pacer->deadline = now;
+    } else {
+        busy = ts_diff_us(&now, &pacer->wake);
+        pacer->busy_sum_us += busy;
+        if (busy > pacer->busy_max_us)
+            pacer->busy_max_us = (unsigned)busy;
+        pacer->deadline.tv_nsec += pacer->period_ns;
+        while (pacer->deadline.tv_nsec >= 1000000000) {
+            pacer->deadline.tv_nsec -= 1000000000;
+            pacer->deadline.tv_sec++;
+        }
+    }
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &pacer->deadline,
+                NULL) == EINTR)
+        ;
+    clock_gettime(CLOCK_MONOTONIC, &pacer->wake);
+
+    late = ts_diff_us(&pacer->wake, &pacer->deadline);
+    if (late < 0)
+        late = 0;
+    if (late * 1000 >= pacer->period_ns)
+        pacer->overruns++;
+    pacer->late_sum_us += late;
+    if (late > pacer->late_max_us)
+        pacer->late_max_us = (unsigned)late;
+    bin = (unsigned)(late / HIST_BIN_US);
+    pacer->late_hist[bin < EM_PACER_HIST_SIZE ? bin : EM_PACER_HIST_SIZE]++;
+    pacer->frames++;
+    PJ_LOG(5, (THIS_FILE, "frame %llu: late %lld us, previous busy %lld us%s",
+                (unsigned long long)pacer->frames, (long long)late,
+                (long long)busy,
+                late * 1000 >= pacer->period_ns ? ", overrun" : ""));
+}
+
+
+PJ_DEF(void) em_pacer_get_statistics(const em_pacer *pacer,
+        em_pacer_statistics *stats)
+{
+    pj_uint64_t count = 0, p99 = (pacer->frames * 99 + 99) / 100;
+    unsigned i;
+
+    pj_bzero(stats, sizeof(*stats));
+    stats->period_us = pacer->period_ns / 1000;
+    stats->frames = pacer->frames;
+    stats->overruns = pacer->overruns;
+    if (pacer->frames == 0)
+        return;
+    stats->late_mean_us = pacer->late_sum_us / pacer->frames;
+    stats->late_max_us = pacer->late_max_us;
+    /* busy time is known for every frame but the last one */
+    if (pacer->frames > 1)
+        stats->busy_mean_us = pacer->busy_sum_us / (pacer->frames - 1);
+    stats->busy_max_us = pacer->busy_max_us;
+    for (i=0; i<=EM_PACER_HIST_SIZE; i++) {
+        count += pacer->late_hist[i];
+        if (count >= p99)
+            break;
+    }
+    stats->late_p99_us = i < EM_PACER_HIST_SIZE ? (i + 1) * HIST_BIN_US :
+        pacer->late_max_us;
+}
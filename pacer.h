@@ -0,0 +1,47 @@
+#ifndef __PACER_H__
+#define __PACER_H__
+
+#include <time.h>
+#include <pjlib.h>
+
+#define EM_PACER_HIST_SIZE  1000    /* lateness histogram: 10us bins */
+
+typedef struct em_pacer_statistics {
+    pj_uint64_t       frames;
+    pj_uint64_t       overruns;       /* frames started a whole period late */
+    double            late_mean_us;   /* wake up after the deadline */
+    unsigned          late_p99_us;
+    unsigned          late_max_us;
+    double            busy_mean_us;   /* processing of one frame */
+    unsigned          busy_max_us;
+    unsigned          period_us;
+} em_pacer_statistics;
+
+/*
+ * Releases frames on the absolute schedule of the monotonic clock: n-th
+ * frame starts at start + n * period whatever time previous frames took,
+ * so errors never accumulate. Late frames are processed at once to catch
+ * up with the schedule.
+ */
+typedef struct em_pacer {
+    struct timespec   deadline;
+    struct timespec   wake;
+    unsigned          period_ns;
+    pj_uint64_t       frames;
+    pj_uint64_t       overruns;
+    double            late_sum_us;
+    double            busy_sum_us;
+    unsigned          late_max_us;
+    unsigned          busy_max_us;
+    pj_uint32_t       late_hist[EM_PACER_HIST_SIZE + 1];
+} em_pacer;
+
+PJ_DECL(void) em_pacer_init(em_pacer *pacer, unsigned period_us);
+
+/* sleep till the start of the next frame */
+PJ_DECL(void) em_pacer_wait(em_pacer *pacer);
+
+PJ_DECL(void) em_pacer_get_statistics(const em_pacer *pacer,
+        em_pacer_statistics *stats);
+
+#endif	/* __PACER_H__ */
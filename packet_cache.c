@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "packet_cache.h"
+#define THIS_FILE   "packet_cache.c"
+#define MAGIC       "EMPKC01"
+#define FNV_OFFSET  0xcbf29ce484222325ULL
+#define FNV_PRIME   0x100000001b3ULL
+#define WRITE_BUF   (1<<20)
+
+/*
+ * Cache file layout (host byte order, the cache is not meant to be
+ * shared between machines):
+ *
+ *   struct cache_header
+ *   packet_count * { pj_uint32_t size; payload; padding up to 4 bytes }
+ */
+struct cache_header
+{
+    char              magic[8];
+    pj_uint64_t       key_hash;
+    pj_uint32_t       samples_per_frame;
+    pj_uint32_t       reserved;
+    pj_uint64_t       packet_count;
+    pj_uint64_t       data_size;
+};
+
+struct em_packet_cache
+{
+    pj_bool_t         writing;
+    char             *path;
+    char             *tmp_path;       /* writer only: renamed to path on commit */
+    FILE             *fd;             /* writer only */
+    struct cache_header hdr;
+    pj_uint8_t       *map;            /* reader only */
+    pj_size_t         map_size;
+    pj_size_t         offset;         /* position of the next packet */
+    pj_uint64_t       packet_index;
+};
+
+
+static pj_uint64_t pc_fnv(pj_uint64_t hash, const void *data, pj_size_t len)
+{
+    const pj_uint8_t *p = (const pj_uint8_t*)data;
+    pj_size_t i;
+    for (i=0; i<len; i++) {
+        hash ^= p[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+
+PJ_DEF(pj_status_t) em_packet_cache_hash_file(const char *filename,
+        pj_uint64_t *hash)
+{
+    struct stat st;
+    const pj_uint64_t *words;
+    pj_uint64_t h = FNV_OFFSET;
+    pj_size_t i, nwords;
+    void *map;
+    int fd;
+
+    PJ_ASSERT_RETURN(filename && hash, PJ_EINVAL);
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return PJ_STATUS_FROM_OS(errno);
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return PJ_STATUS_FROM_OS(errno);
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        *hash = h;
+        return PJ_SUCCESS;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return PJ_STATUS_FROM_OS(errno);
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    /* FNV-1a over 64 bit words: files are large, bytes are slow */
+    words = (const pj_uint64_t*)map;
+    nwords = st.st_size / sizeof(pj_uint64_t);
+    for (i=0; i<nwords; i++) {
+        h ^= words[i];
+        h *= FNV_PRIME;
+    }
+    h = pc_fnv(h, (const pj_uint8_t*)map + nwords*sizeof(pj_uint64_t),
+            st.st_size % sizeof(pj_uint64_t));
+    munmap(map, st.st_size);
+    *hash = h;
+    return PJ_SUCCESS;
+}
+
+
+static pj_uint64_t pc_key_hash(const em_packet_cache_key *key)
+{
+    pj_uint64_t h = FNV_OFFSET;
+    h = pc_fnv(h, &key->input_hash, sizeof(key->input_hash));
+    h = pc_fnv(h, key->codec_name, strlen(key->codec_name) + 1);
+    h = pc_fnv(h, &key->codec_bitrate, sizeof(key->codec_bitrate));
+    if (strncmp(key->codec_name, "speex", 5) == 0)
+        h = pc_fnv(h, &key->speex_quality, sizeof(key->speex_quality));
+    h = pc_fnv(h, &key->fpp, sizeof(key->fpp));
+    return h;
+}
+
+
+static char *pc_path(pj_pool_t *pool, const char *dir, pj_uint64_t key_hash)
+{
+    pj_size_t len = strlen(dir) + 32;
+    char *path = (char*)pj_pool_alloc(pool, len);
+    snprintf(path, len, "%s/%016llx.pkc", dir, (unsigned long long)key_hash);
+    return path;
+}
+
+
+PJ_DEF(pj_status_t) em_packet_cache_open(pj_pool_t *pool, const char *dir,
+        const em_packet_cache_key *key, em_packet_cache **p_cache)
+{
+    em_packet_cache *cache;
+    struct stat st;
+    pj_uint64_t file_size;
+    void *map;
+    int fd;
+
+    PJ_ASSERT_RETURN(pool && dir && key && p_cache, PJ_EINVAL);
+
+    cache = PJ_POOL_ZALLOC_T(pool, em_packet_cache);
+    cache->path = pc_path(pool, dir, pc_key_hash(key));
+    fd = open(cache->path, O_RDONLY);
+    if (fd < 0)
+        return PJ_ENOTFOUND;
+    if (fstat(fd, &st) != 0 || st.st_size < 0) {
+        close(fd);
+        return PJ_ENOTFOUND;
+    }
+    file_size = (pj_uint64_t)st.st_size;
+    if (file_size < sizeof(struct cache_header)) {
+        close(fd);
+        return PJ_ENOTFOUND;
+    }
+    /* private writable mapping: codecs get non-const buffers in parse() */
+    map = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return PJ_STATUS_FROM_OS(errno);
+    pj_memcpy(&cache->hdr, map, sizeof(cache->hdr));
+    if (memcmp(cache->hdr.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+            cache->hdr.key_hash != pc_key_hash(key) ||
+            cache->hdr.data_size != file_size - sizeof(struct cache_header)) {
+        PJ_LOG(3, (THIS_FILE, "ignore broken packet cache %s", cache->path));
+        munmap(map, st.st_size);
+        return PJ_ENOTFOUND;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    cache->writing = PJ_FALSE;
+    cache->map = (pj_uint8_t*)map;
+    cache->map_size = st.st_size;
+    cache->offset = sizeof(struct cache_header);
+    cache->packet_index = 0;
+    PJ_LOG(4, (THIS_FILE, "packet cache hit: %s, %llu packets", cache->path,
+                (unsigned long long)cache->hdr.packet_count));
+
+    *p_cache = cache;
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) em_packet_cache_create(pj_pool_t *pool, const char *dir,
+        const em_packet_cache_key *key, unsigned samples_per_frame,
+        em_packet_cache **p_cache)
+{
+    static int counter;
+    em_packet_cache *cache;
+    pj_size_t len;
+
+    PJ_ASSERT_RETURN(pool && dir && key && p_cache, PJ_EINVAL);
+
+    cache = PJ_POOL_ZALLOC_T(pool, em_packet_cache);
+    cache->writing = PJ_TRUE;
+    cache->path = pc_path(pool, dir, pc_key_hash(key));
+
+    /* several scenarios may encode the same stream at once: every writer
+       gets its own temporary file, the last rename wins */
+    len = strlen(cache->path) + 32;
+    cache->tmp_path = (char*)pj_pool_alloc(pool, len);
+    snprintf(cache->tmp_path, len, "%s.%d.%d", cache->path, (int)getpid(),
+            __sync_fetch_and_add(&counter, 1));
+    cache->fd = fopen(cache->tmp_path, "wb");
+    if (!cache->fd)
+        return PJ_STATUS_FROM_OS(errno);
+    setvbuf(cache->fd, NULL, _IOFBF, WRITE_BUF);
+
+    pj_memcpy(cache->hdr.magic, MAGIC, sizeof(MAGIC));
+    cache->hdr.key_hash = pc_key_hash(key);
+    cache->hdr.samples_per_frame = samples_per_frame;
+    if (fwrite(&cache->hdr, sizeof(cache->hdr), 1, cache->fd) != 1) {
+        em_packet_cache_close(cache, PJ_FALSE);
+        return PJ_EUNKNOWN;
+    }
+
+    *p_cache = cache;
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(unsigned) em_packet_cache_samples_per_frame(
+        const em_packet_cache *cache)
+{
+    return cache->hdr.samples_per_frame;
+}
+
+
+PJ_DEF(pj_status_t) em_packet_cache_read(em_packet_cache *cache,
+        pjmedia_frame *frame)
+{
+    pj_uint32_t size;
+    PJ_ASSERT_RETURN(cache && frame && !cache->writing, PJ_EINVAL);
+    if (cache->packet_index == cache->hdr.packet_count)
+        return PJ_EEOF;
+    if (cache->offset + sizeof(size) > cache->map_size)
+        return PJ_EEOF;
+    pj_memcpy(&size, cache->map + cache->offset, sizeof(size));
+    if (cache->offset + sizeof(size) + size > cache->map_size)
+        return PJ_EEOF;
+    frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+    frame->buf = cache->map + cache->offset + sizeof(size);
+    frame->size = size;
+    cache->offset += sizeof(size) + ((size + 3) & ~3);
+    cache->packet_index++;
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) em_packet_cache_write(em_packet_cache *cache,
+        const pjmedia_frame *frame)
+{
+    static const pj_uint8_t padding[4];
+    pj_uint32_t size = frame->size;
+    PJ_ASSERT_RETURN(cache && frame && cache->writing, PJ_EINVAL);
+    if (fwrite(&size, sizeof(size), 1, cache->fd) != 1 ||
+            fwrite(frame->buf, 1, size, cache->fd) != size ||
+            fwrite(padding, 1, ((size + 3) & ~3) - size, cache->fd) !=
+                ((size + 3) & ~3) - size)
+        return PJ_STATUS_FROM_OS(errno);
+    cache->hdr.packet_count++;
+    cache->hdr.data_size += sizeof(size) + ((size + 3) & ~3);
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) em_packet_cache_close(em_packet_cache *cache,
+        pj_bool_t commit)
+{
+    pj_status_t status = PJ_SUCCESS;
+    PJ_ASSERT_RETURN(cache, PJ_EINVAL);
+    if (!cache->writing) {
+        munmap(cache->map, cache->map_size);
+        return PJ_SUCCESS;
+    }
+    if (commit) {
+        /* header goes last, so a crashed writer never leaves a valid file */
+        if (fseek(cache->fd, 0, SEEK_SET) != 0 ||
+                fwrite(&cache->hdr, sizeof(cache->hdr), 1, cache->fd) != 1)
+            status = PJ_STATUS_FROM_OS(errno);
+    }
+    if (fclose(cache->fd) != 0 && status == PJ_SUCCESS)
+        status = PJ_STATUS_FROM_OS(errno);
+    if (commit && status == PJ_SUCCESS) {
+        if (rename(cache->tmp_path, cache->path) != 0)
+            status = PJ_STATUS_FROM_OS(errno);
+        else
+            PJ_LOG(4, (THIS_FILE, "packet cache stored: %s, %llu packets",
+                        cache->path,
+                        (unsigned long long)cache->hdr.packet_count));
+    }
+    if (!commit || status != PJ_SUCCESS)
+        unlink(cache->tmp_path);
+    return status;
+}
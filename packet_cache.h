@@ -0,0 +1,40 @@
+#ifndef __PACKET_CACHE_H__
+#define __PACKET_CACHE_H__
+
+#include <pjlib.h>
+#include <pjmedia.h>
+
+/* everything the encoded stream depends on */
+typedef struct em_packet_cache_key {
+    pj_uint64_t       input_hash;    /* em_packet_cache_hash_file() */
+    const char       *codec_name;
+    unsigned          codec_bitrate;
+    double            speex_quality; /* ignored for non-speex codecs */
+    unsigned          fpp;
+} em_packet_cache_key;
+
+typedef struct em_packet_cache em_packet_cache;
+
+PJ_DECL(pj_status_t) em_packet_cache_hash_file(const char *filename,
+        pj_uint64_t *hash);
+
+PJ_DECL(pj_status_t) em_packet_cache_open(pj_pool_t *pool, const char *dir,
+        const em_packet_cache_key *key, em_packet_cache **p_cache);
+
+PJ_DECL(pj_status_t) em_packet_cache_create(pj_pool_t *pool, const char *dir,
+        const em_packet_cache_key *key, unsigned samples_per_frame,
+        em_packet_cache **p_cache);
+
+PJ_DECL(unsigned) em_packet_cache_samples_per_frame(
+        const em_packet_cache *cache);
+
+PJ_DECL(pj_status_t) em_packet_cache_read(em_packet_cache *cache,
+        pjmedia_frame *frame);
+
+PJ_DECL(pj_status_t) em_packet_cache_write(em_packet_cache *cache,
+        const pjmedia_frame *frame);
+
+PJ_DECL(pj_status_t) em_packet_cache_close(em_packet_cache *cache,
+        pj_bool_t commit);
+
+#endif	/* __PACKET_CACHE_H__ */
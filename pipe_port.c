@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include "pipe_port.h"
+#include "wav.h"
+#define READER_SIGNATURE   PJMEDIA_PORT_SIGNATURE('P', 'I', 'P', 'R')
+#define WRITER_SIGNATURE   PJMEDIA_PORT_SIGNATURE('P', 'I', 'P', 'W')
+#define THIS_FILE   "pipe_port.c"
+#define BUF_SIZE    (1<<18)     /* one read or write syscall per 256KB */
+#define FLUSH_MS    100         /* max time output waits in the buffer */
+#define UNBOUNDED   ((pj_uint64_t)-1)
+
+struct pipe_reader
+{
+    pjmedia_port	  base;
+    int               fd;
+    pj_uint8_t       *buf;
+    pj_size_t         pos;        /* first unread byte */
+    pj_size_t         len;        /* end of data in buffer */
+    pj_bool_t         eof;
+    pj_uint64_t       data_left;  /* bytes of the WAV data chunk */
+    pj_timestamp      ts;
+};
+
+struct pipe_writer
+{
+    pjmedia_port	  base;
+    int               fd;
+    unsigned          options;
+    pj_uint8_t       *buf;
+    pj_size_t         len;
+    pj_uint64_t       data_size;
+    off_t             start;      /* offset of the header, -1 for pipes */
+    pj_uint64_t       last_flush_ms;
+};
+
+
+static pj_status_t pr_get_frame(pjmedia_port *this_port,
+				pjmedia_frame *frame);
+static pj_status_t pr_put_frame(pjmedia_port *this_port,
+				const pjmedia_frame *frame);
+static pj_status_t pr_on_destroy(pjmedia_port *this_port);
+static pj_status_t pw_get_frame(pjmedia_port *this_port,
+				pjmedia_frame *frame);
+static pj_status_t pw_put_frame(pjmedia_port *this_port,
+				const pjmedia_frame *frame);
+static pj_status_t pw_on_destroy(pjmedia_port *this_port);
+
+
+/* make at least need bytes available in the buffer unless stream ends */
+static pj_status_t pr_fill(struct pipe_reader *pr, pj_size_t need)
+{
+    while (pr->len - pr->pos < need && !pr->eof) {
+        ssize_t n;
+        if (pr->pos + need > BUF_SIZE) {
+            pj_memmove(pr->buf, pr->buf + pr->pos, pr->len - pr->pos);
+            pr->len -= pr->pos;
+            pr->pos = 0;
+        }
+        /* takes whatever is ready, so live input isn't held back */
+        n = read(pr->fd, pr->buf + pr->len, BUF_SIZE - pr->len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return PJ_STATUS_FROM_OS(errno);
+        if (n == 0)
+            pr->eof = PJ_TRUE;
+        pr->len += n;
+    }
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t pr_skip(struct pipe_reader *pr, pj_uint64_t size)
+{
+    pj_status_t status;
+    while (size) {
+        pj_size_t n;
+        status = pr_fill(pr, 1);
+        if (status != PJ_SUCCESS)
+            return status;
+        if (pr->len == pr->pos)
+            return PJ_EEOF;
+        n = pr->len - pr->pos;
+        if (n > size)
+            n = (pj_size_t)size;
+        pr->pos += n;
+        size -= n;
+    }
+    return PJ_SUCCESS;
+}
+
+
+/* parse RIFF chunks up to the data chunk */
+static pj_status_t pr_read_wav_header(struct pipe_reader *pr,
+        unsigned *clock_rate, unsigned *channel_count)
+{
+    pj_bool_t fmt_found = PJ_FALSE;
+    pj_status_t status;
+
+    pr->pos += 12;
+    for (;;) {
+        const pj_uint8_t *chunk;
+        pj_uint32_t size;
+
+        status = pr_fill(pr, 8);
+        if (status != PJ_SUCCESS)
+            return status;
+        if (pr->len - pr->pos < 8)
+            return PJMEDIA_ENOTVALIDWAVE;
+        chunk = pr->buf + pr->pos;
+        size = em_le32(chunk + 4);
+        pr->pos += 8;
+
+        if (memcmp(chunk, "data", 4) == 0) {
+            if (!fmt_found)
+                return PJMEDIA_ENOTVALIDWAVE;
+            /* streaming writers don't know the length of data */
+            pr->data_left = (size == 0 || size == 0xffffffff) ? UNBOUNDED :
+                size;
+            return PJ_SUCCESS;
+        }
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            if (size > 256)
+                return PJMEDIA_ENOTVALIDWAVE;
+            status = pr_fill(pr, size);
+            if (status != PJ_SUCCESS)
+                return status;
+            if (pr->len - pr->pos < size)
+                return PJMEDIA_ENOTVALIDWAVE;
+            status = em_wav_parse_fmt(pr->buf + pr->pos, size, clock_rate,
+                    channel_count);
+            if (status == PJMEDIA_EWAVEUNSUPP)
+                PJ_LOG(2, (THIS_FILE, "only 16 bit PCM WAV input is "
+                            "supported"));
+            if (status != PJ_SUCCESS)
+                return status;
+            fmt_found = PJ_TRUE;
+        }
+        status = pr_skip(pr, size + (size & 1));
+        if (status != PJ_SUCCESS)
+            return status == PJ_EEOF ? PJMEDIA_ENOTVALIDWAVE : status;
+    }
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_pipe_reader_port_create(pj_pool_t *pool, int fd,
+        unsigned ptime, unsigned raw_clock_rate, pjmedia_port **p_port)
+{
+    const pj_str_t name = { "pipe-reader", 11 };
+    struct pipe_reader *pr;
+    unsigned clock_rate = raw_clock_rate, channel_count = 1;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(pool && fd >= 0 && ptime && p_port, PJ_EINVAL);
+
+    /* Create the port itself */
+    pr = PJ_POOL_ZALLOC_T(pool, struct pipe_reader);
+    pr->buf = (pj_uint8_t*)pj_pool_alloc(pool, BUF_SIZE);
+    if (!pr->buf)
+        return PJ_ENOMEM;
+    pr->fd = fd;
+    pr->data_left = UNBOUNDED;
+#ifdef F_SETPIPE_SZ
+    /* the bigger pipe, the fewer context switches with the writer */
+    fcntl(fd, F_SETPIPE_SZ, BUF_SIZE);
+#endif
+
+    status = pr_fill(pr, 12);
+    if (status != PJ_SUCCESS)
+        return status;
+    if (pr->len >= 12 && memcmp(pr->buf, "RIFF", 4) == 0 &&
+            memcmp(pr->buf + 8, "WAVE", 4) == 0) {
+        status = pr_read_wav_header(pr, &clock_rate, &channel_count);
+        if (status != PJ_SUCCESS)
+            return status;
+        PJ_LOG(5, (THIS_FILE, "WAV stream: %u Hz, %u channels", clock_rate,
+                    channel_count));
+    } else {
+        PJ_LOG(5, (THIS_FILE, "raw PCM stream: %u Hz", clock_rate));
+    }
+
+    pjmedia_port_info_init(&pr->base.info, &name, READER_SIGNATURE,
+			   clock_rate, channel_count, 16,
+			   clock_rate * ptime * channel_count / 1000);
+
+    /* More init */
+    pr->base.get_frame = &pr_get_frame;
+    pr->base.put_frame = &pr_put_frame;
+    pr->base.on_destroy = &pr_on_destroy;
+
+    /* Done */
+    *p_port = &pr->base;
+
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t pr_get_frame( pjmedia_port *this_port,
+				 pjmedia_frame *frame)
+{
+    struct pipe_reader *pr = (struct pipe_reader*)this_port;
+    pj_size_t size = this_port->info.bytes_per_frame, got;
+    pj_status_t status;
+    PJ_ASSERT_RETURN(this_port->info.signature == READER_SIGNATURE, PJ_EINVAL);
+    PJ_ASSERT_RETURN(frame->size >= size, PJ_ETOOSMALL);
+
+    if (size > pr->data_left)
+        size = (pj_size_t)pr->data_left;
+    status = pr_fill(pr, size);
+    if (status != PJ_SUCCESS)
+        return status;
+    got = pr->len - pr->pos;
+    if (got > size)
+        got = size;
+    if (got == 0) {
+        frame->type = PJMEDIA_FRAME_TYPE_NONE;
+        frame->size = 0;
+        return PJ_EEOF;
+    }
+    pj_memcpy(frame->buf, pr->buf + pr->pos, got);
+    pr->pos += got;
+    if (pr->data_left != UNBOUNDED)
+        pr->data_left -= got;
+#if PJ_IS_BIG_ENDIAN
+    em_swap16((pj_uint8_t*)frame->buf, got);
+#endif
+    /* the last frame is padded with silence */
+    if (got < this_port->info.bytes_per_frame)
+        pj_bzero((pj_uint8_t*)frame->buf + got,
+                this_port->info.bytes_per_frame - got);
+
+    frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+    frame->size = this_port->info.bytes_per_frame;
+    frame->timestamp = pr->ts;
+    pr->ts.u64 += this_port->info.samples_per_frame;
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t pr_put_frame( pjmedia_port *this_port,
+				 const pjmedia_frame *frame)
+{
+    PJ_UNUSED_ARG(this_port);
+    PJ_UNUSED_ARG(frame);
+    return PJ_EINVALIDOP;
+}
+
+
+static pj_status_t pr_on_destroy(pjmedia_port *this_port)
+{
+    PJ_ASSERT_RETURN(this_port->info.signature == READER_SIGNATURE, PJ_EINVAL);
+    return PJ_SUCCESS;
+}
+
+
+static pj_uint64_t pw_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (pj_uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+static pj_status_t pw_write(int fd, const pj_uint8_t *data, pj_size_t size)
+{
+    while (size) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return PJ_STATUS_FROM_OS(errno);
+        data += n;
+        size -= n;
+    }
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t pw_flush(struct pipe_writer *pw)
+{
+    pj_status_t status = pw_write(pw->fd, pw->buf, pw->len);
+    pw->len = 0;
+    pw->last_flush_ms = pw_now_ms();
+    return status;
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_pipe_writer_port_create(pj_pool_t *pool, int fd,
+        unsigned clock_rate, unsigned channel_count,
+        unsigned samples_per_frame, unsigned bits_per_sample,
+        unsigned options, pjmedia_port **p_port)
+{
+    const pj_str_t name = { "pipe-writer", 11 };
+    struct pipe_writer *pw;
+
+    PJ_ASSERT_RETURN(pool && fd >= 0 && p_port, PJ_EINVAL);
+    PJ_ASSERT_RETURN(bits_per_sample == 16, PJ_EINVAL);
+
+    /* Create the port itself */
+    pw = PJ_POOL_ZALLOC_T(pool, struct pipe_writer);
+    pw->buf = (pj_uint8_t*)pj_pool_alloc(pool, BUF_SIZE);
+    if (!pw->buf)
+        return PJ_ENOMEM;
+
+    pjmedia_port_info_init(&pw->base.info, &name, WRITER_SIGNATURE,
+			   clock_rate, channel_count, bits_per_sample,
+			   samples_per_frame);
+
+    /* More init */
+    pw->fd = fd;
+    pw->options = options;
+    pw->base.get_frame = &pw_get_frame;
+    pw->base.put_frame = &pw_put_frame;
+    pw->base.on_destroy = &pw_on_destroy;
+    pw->last_flush_ms = pw_now_ms();
+    pw->start = lseek(fd, 0, SEEK_CUR);
+
+    /* length is unknown yet: maximal one is what streaming readers expect */
+    if (!(options & PJMEDIA_PIPE_RAW)) {
+        em_wav_header(&pw->base.info, UNBOUNDED, pw->buf);
+        pw->len = EM_WAV_HEADER;
+    }
+
+    /* Done */
+    *p_port = &pw->base;
+
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t pw_put_frame( pjmedia_port *this_port,
+				 const pjmedia_frame *frame)
+{
+    struct pipe_writer *pw = (struct pipe_writer*)this_port;
+    pj_status_t status;
+    PJ_ASSERT_RETURN(this_port->info.signature == WRITER_SIGNATURE, PJ_EINVAL);
+
+    if (frame->type != PJMEDIA_FRAME_TYPE_AUDIO || frame->size == 0)
+        return PJ_SUCCESS;
+    if (pw->len + frame->size > BUF_SIZE) {
+        status = pw_flush(pw);
+        if (status != PJ_SUCCESS)
+            return status;
+    }
+    PJ_ASSERT_RETURN(frame->size <= BUF_SIZE, PJ_ETOOBIG);
+    pj_memcpy(pw->buf + pw->len, frame->buf, frame->size);
+#if PJ_IS_BIG_ENDIAN
+    em_swap16(pw->buf + pw->len, frame->size);
+#endif
+    pw->len += frame->size;
+    pw->data_size += frame->size;
+
+    /* slow (live) input must not leave the output waiting in the buffer */
+    if ((pw->options & PJMEDIA_PIPE_FLUSH) ||
+            pw_now_ms() - pw->last_flush_ms >= FLUSH_MS)
+        return pw_flush(pw);
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t pw_get_frame( pjmedia_port *this_port,
+				 pjmedia_frame *frame)
+{
+    PJ_UNUSED_ARG(this_port);
+    PJ_UNUSED_ARG(frame);
+    return PJ_EINVALIDOP;
+}
+
+
+static pj_status_t pw_on_destroy(pjmedia_port *this_port)
+{
+    struct pipe_writer *pw = (struct pipe_writer*)this_port;
+    pj_status_t status;
+    pj_uint8_t hdr[EM_WAV_HEADER];
+    PJ_ASSERT_RETURN(this_port->info.signature == WRITER_SIGNATURE, PJ_EINVAL);
+
+    status = pw_flush(pw);
+    if (status != PJ_SUCCESS)
+        return status;
+    /* stdout redirected to a regular file: put the real length there */
+    if (!(pw->options & PJMEDIA_PIPE_RAW) && pw->start >= 0) {
+        em_wav_header(&pw->base.info, pw->data_size, hdr);
+        if (pwrite(pw->fd, hdr, EM_WAV_HEADER, pw->start) != EM_WAV_HEADER)
+            PJ_LOG(3, (THIS_FILE, "can't update WAV header: %s",
+                        strerror(errno)));
+    }
+    return PJ_SUCCESS;
+}
@@ -0,0 +1,35 @@
+#ifndef __PIPE_PORT_H__
+#define __PIPE_PORT_H__
+
+#include <pjlib.h>
+#include <pjlib-util.h>
+#include <pjmedia.h>
+
+/* pipe writer options */
+enum {
+    /* write headerless PCM instead of WAV */
+    PJMEDIA_PIPE_RAW = 1,
+    /* write every frame at once, for real-time consumers */
+    PJMEDIA_PIPE_FLUSH = 2
+};
+
+/*
+ * Reads 16 bit PCM from a pipe (or any other file descriptor) which can't
+ * be seeked nor mapped, i.e. standard input. Stream starting with RIFF
+ * header is read as WAV, anything else as raw mono PCM sampled at
+ * raw_clock_rate. The stream may be endless: every frame is returned as
+ * soon as it's read. Returns PJ_EEOF at the end of the stream.
+ */
+PJ_DECL(pj_status_t) pjmedia_pipe_reader_port_create(pj_pool_t *pool, int fd,
+        unsigned ptime, unsigned raw_clock_rate, pjmedia_port **p_port);
+
+/*
+ * Writes 16 bit PCM to a pipe as WAV with unknown length (the header is
+ * fixed on destroy if the descriptor happens to be seekable) or as raw PCM.
+ */
+PJ_DECL(pj_status_t) pjmedia_pipe_writer_port_create(pj_pool_t *pool, int fd,
+        unsigned clock_rate, unsigned channel_count,
+        unsigned samples_per_frame, unsigned bits_per_sample,
+        unsigned options, pjmedia_port **p_port);
+
+#endif	/* __PIPE_PORT_H__ */
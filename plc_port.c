@@ -1,8 +1,17 @@
 #include "plc_port.h"
-#define SIGNATURE   PJMEDIA_PORT_SIGNATURE('P', 'L', 'C', 'P')
+#include "em_log.h"
+#include "events.h"
+#include "cng.h"
+#include "wsola.h"
+#include "batch.h"
+#define SIGNATURE   PJMEDIA_PLC_PORT_SIGNATURE
 #define THIS_FILE   "plc_port.c"
-#define BUF_SIZE    1024
 #define MAX_FPP     10
+#define CNG_SEED    0x454D4E47  /* noise doesn't depend on --seed */
+
+static const char *plc_names[EM_PLC_MODE_COUNT] = {
+    "empty", "repeat", "noise", "smart"
+};
 
 struct plc_port
 {
@@ -11,9 +20,14 @@ struct plc_port
     pjmedia_codec    *codec;
     unsigned          fpp;
     em_plc_mode       plc_mode;
-    pjmedia_frame     frame;
-    void             *frame_buf;
+    em_batch          out;        /* frame i is decoded into payload i */
+    pj_uint8_t       *payload;    /* EM_BATCH_MAX frames of buf_size */
+    pjmedia_frame    *last;       /* the latest frame put, NULL till any */
+    unsigned          buf_size;   /* a decoded frame, as dn_port takes */
     em_plc_statistics stats;
+    em_cng            cng;        /* EM_PLC_NOISE only */
+    em_wsola         *wsola;      /* EM_PLC_SMART, when codec can't recover */
+    pj_bool_t         codec_plc;  /* EM_PLC_SMART, recover() still works */
 };
 
 
@@ -36,7 +50,11 @@ PJ_DECL(pj_status_t) pjmedia_plc_port_create(pj_pool_t *pool,
 
     /* Create the port itself */
     plcp = PJ_POOL_ZALLOC_T(pool, struct plc_port);
-    plcp->frame_buf = pj_pool_zalloc(pool, BUF_SIZE);
+    plcp->buf_size = dn_port->info.bytes_per_frame;
+    plcp->payload = (pj_uint8_t*)pj_pool_zalloc(pool,
+            EM_BATCH_MAX * plcp->buf_size);
+    if (!plcp->payload)
+        return PJ_ENOMEM;
 
     pjmedia_port_info_init(&plcp->base.info, &plc, SIGNATURE,
 			   dn_port->info.clock_rate,
@@ -46,17 +64,29 @@ PJ_DECL(pj_status_t) pjmedia_plc_port_create(pj_pool_t *pool,
 
     /* More init */
     plcp->dn_port = dn_port;
+    em_batch_init(&plcp->out, dn_port);
+    plcp->last = NULL;
     plcp->codec = codec;
     plcp->fpp = fpp;
     plcp->plc_mode = plc_mode;
     plcp->base.get_frame = &plc_get_frame;
     plcp->base.put_frame = &plc_put_frame;
     plcp->base.on_destroy = &plc_on_destroy;
-    plcp->frame.type = PJMEDIA_FRAME_TYPE_NONE;
-    plcp->frame.buf = plcp->frame_buf;
     plcp->stats.received = 0;
     plcp->stats.lost = 0;
     plcp->stats.total = 0;
+    if (plc_mode == EM_PLC_NOISE)
+        em_cng_init(&plcp->cng, CNG_SEED);
+    if (plc_mode == EM_PLC_SMART) {
+        /* recover() may fail even if it's there, e.g. PLC is disabled */
+        status = em_wsola_create(pool, dn_port->info.clock_rate,
+                dn_port->info.channel_count, &plcp->wsola);
+        if (status != PJ_SUCCESS)
+            return status;
+        plcp->codec_plc = codec && codec->op->recover;
+        if (!plcp->codec_plc)
+            PJ_LOG(4, (THIS_FILE, "codec has no PLC, WSOLA is used"));
+    }
 
     /* Done */
     *p_port = &plcp->base;
@@ -76,77 +106,148 @@ PJ_DEF(pj_status_t) pjmedia_plc_port_get_statistics(const pjmedia_port *port,
 }
 
 
-static pj_status_t plc_put_frame( pjmedia_port *this_port,
-				 const pjmedia_frame *frame)
+PJ_DEF(const char*) em_plc_mode_name(em_plc_mode mode)
+{
+    PJ_ASSERT_RETURN((unsigned)mode < EM_PLC_MODE_COUNT, "unknown");
+    return plc_names[mode];
+}
+
+
+/* next output frame, its buffer is of buf_size */
+static pj_status_t plc_next_frame(struct plc_port *plcp,
+        pjmedia_frame **p_frame)
+{
+    pjmedia_frame *f;
+    pj_status_t status = em_batch_next(&plcp->out, &f);
+    if (status != PJ_SUCCESS)
+        return status;
+    f->buf = plcp->payload + (f - plcp->out.frames) * plcp->buf_size;
+    f->timestamp.u64 = 0;
+    *p_frame = f;
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t plc_conceal(struct plc_port *plcp)
 {
+    unsigned samples_per_frame = plcp->dn_port->info.samples_per_frame;
+    pjmedia_frame *f;
     pj_status_t status;
-    int i;
-    struct plc_port *plcp = (struct plc_port*)this_port;
-    PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
-    PJ_LOG(6, (THIS_FILE, "packet: sz=%d ts=%llu",
-                frame->size/sizeof(pj_uint16_t), frame->timestamp.u64));
+    em_plc_mode mode = plcp->last ? plcp->plc_mode : EM_PLC_EMPTY;
+    unsigned i;
 
-    if (frame->type == PJMEDIA_FRAME_TYPE_NONE ) {
-        em_plc_mode mode = plcp->frame.type == PJMEDIA_FRAME_TYPE_NONE ? \
-            EM_PLC_EMPTY : plcp->plc_mode;
+    plcp->stats.concealed[mode]++;
+    em_event_add(EM_EV_PLC, EM_EV_CONCEAL, 0, mode);
+    for (i=0; i<plcp->fpp; i++){
+        status = plc_next_frame(plcp, &f);
+        if (status != PJ_SUCCESS) return status;
+        f->size = plcp->buf_size;
+        f->type = PJMEDIA_FRAME_TYPE_AUDIO;
         switch (mode) {
             case EM_PLC_SMART:
-            for (i=0; i<plcp->fpp; i++){
-                status = plcp->codec->op->recover(plcp->codec, BUF_SIZE, &plcp->frame);
-                plcp->frame.timestamp.u64 = 0;
-                if (status != PJ_SUCCESS) return status;
-                status = pjmedia_port_put_frame(plcp->dn_port, &plcp->frame);
-                if (status != PJ_SUCCESS) return status;
+            if (plcp->codec_plc) {
+                status = plcp->codec->op->recover(plcp->codec,
+                        plcp->buf_size, f);
+                if (status == PJ_SUCCESS) {
+                    f->timestamp.u64 = 0;
+                    /* the history goes on for the case recover() fails */
+                    em_wsola_save(plcp->wsola, (pj_int16_t*)f->buf,
+                            f->size / sizeof(pj_int16_t));
+                    break;
+                }
+                PJ_LOG(4, (THIS_FILE, "codec can't recover (%d), WSOLA "
+                            "is used", status));
+                plcp->codec_plc = PJ_FALSE;
+                f->size = plcp->buf_size;
+                f->type = PJMEDIA_FRAME_TYPE_AUDIO;
             }
+            em_wsola_generate(plcp->wsola, (pj_int16_t*)f->buf,
+                    samples_per_frame);
             break;
             case EM_PLC_REPEAT:
-            for (i=0; i<plcp->fpp; i++){
-                plcp->frame.timestamp.u64 = 0;
-                status = pjmedia_port_put_frame(plcp->dn_port, &plcp->frame);
-                if (status != PJ_SUCCESS) return status;
-            }
+            f->size = plcp->last->size;
+            f->type = plcp->last->type;
+            if (f != plcp->last)
+                pj_memcpy(f->buf, plcp->last->buf, f->size);
             break;
             case EM_PLC_NOISE:
-            for (i=0; i<plcp->fpp; i++){
-                int j=0;
-                plcp->frame.size = plcp->dn_port->info.bytes_per_frame;
-                plcp->frame.type = PJMEDIA_FRAME_TYPE_AUDIO;
-                plcp->frame.timestamp.u64 = 0;
-                for  (j=0; j<plcp->frame.size; j++)
-                    ((char*)plcp->frame.buf)[j] = ((char)pj_rand()) >> 5;
-                status = pjmedia_port_put_frame(plcp->dn_port, &plcp->frame);
-                if (status != PJ_SUCCESS) return status;
-            }
+            em_cng_generate(&plcp->cng, (pj_int16_t*)f->buf,
+                    samples_per_frame);
+            break;
             default:
-            for (i=0; i<plcp->fpp; i++){
-                plcp->frame.size = plcp->dn_port->info.bytes_per_frame;
-                plcp->frame.type = PJMEDIA_FRAME_TYPE_AUDIO;
-                plcp->frame.timestamp.u64 = 0;
-                pj_bzero(plcp->frame.buf, plcp->frame.size);
-                status = pjmedia_port_put_frame(plcp->dn_port, &plcp->frame);
-            }
+            pj_bzero(f->buf, f->size);
         }
-        plcp->stats.lost++;
-    } else {
-        unsigned cnt = MAX_FPP;
-        pjmedia_frame out_frames[MAX_FPP];
-        status = plcp->codec->op->parse(plcp->codec, frame->buf, frame->size,
-                &frame->timestamp, &cnt, out_frames);
-        for (i=0; i<cnt; i++){
-            status = plcp->codec->op->decode(plcp->codec, &out_frames[i], BUF_SIZE,
-                    &plcp->frame);
-            if (status != PJ_SUCCESS) return status;
-            plcp->frame.timestamp = out_frames[i].timestamp;
-            status = pjmedia_port_put_frame(plcp->dn_port, &plcp->frame);
-            if (status != PJ_SUCCESS) return status;
-        }
-        plcp->stats.received++;
+        plcp->last = f;
     }
-    plcp->stats.total++;
+    plcp->stats.lost++;
     return PJ_SUCCESS;
 }
 
 
+static pj_status_t plc_decode(struct plc_port *plcp,
+        const pjmedia_frame *frame)
+{
+    unsigned cnt = MAX_FPP;
+    pjmedia_frame out_frames[MAX_FPP];
+    pjmedia_frame *f;
+    pj_status_t status;
+    unsigned i;
+
+    em_event_add(EM_EV_PLC, EM_EV_DECODE, frame->timestamp.u64,
+            frame->size);
+    status = plcp->codec->op->parse(plcp->codec, frame->buf, frame->size,
+            &frame->timestamp, &cnt, out_frames);
+    for (i=0; i<cnt; i++){
+        status = plc_next_frame(plcp, &f);
+        if (status != PJ_SUCCESS) return status;
+        status = plcp->codec->op->decode(plcp->codec, &out_frames[i],
+                plcp->buf_size, f);
+        if (status != PJ_SUCCESS) return status;
+        f->timestamp = out_frames[i].timestamp;
+        if (plcp->wsola)
+            em_wsola_save(plcp->wsola, (pj_int16_t*)f->buf,
+                    f->size / sizeof(pj_int16_t));
+        else if (plcp->plc_mode == EM_PLC_NOISE)
+            em_cng_update(&plcp->cng, (const pj_int16_t*)f->buf,
+                    f->size / sizeof(pj_int16_t));
+        plcp->last = f;
+    }
+    plcp->stats.received++;
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_plc_port_put_frames(pjmedia_port *port,
+        const pjmedia_frame frames[], unsigned count)
+{
+    struct plc_port *plcp = (struct plc_port*)port;
+    pj_status_t status;
+    unsigned i;
+    PJ_ASSERT_RETURN(port && (frames || !count), PJ_EINVAL);
+    PJ_ASSERT_RETURN(port->info.signature == SIGNATURE, PJ_EINVAL);
+    for (i=0; i<count; i++) {
+        EM_LOG(6, (THIS_FILE, "packet: sz=%d ts=%llu",
+                    frames[i].size/sizeof(pj_uint16_t),
+                    frames[i].timestamp.u64));
+        if (frames[i].type == PJMEDIA_FRAME_TYPE_NONE)
+            status = plc_conceal(plcp);
+        else
+            status = plc_decode(plcp, &frames[i]);
+        if (status != PJ_SUCCESS)
+            return status;
+        plcp->stats.total++;
+    }
+    return em_batch_flush(&plcp->out);
+}
+
+
+static pj_status_t plc_put_frame( pjmedia_port *this_port,
+				 const pjmedia_frame *frame)
+{
+    return pjmedia_plc_port_put_frames(this_port, frame, 1);
+}
+
+
 static pj_status_t plc_get_frame( pjmedia_port *this_port,
 				 pjmedia_frame *frame)
 {
@@ -1,6 +1,12 @@
+#ifndef __PLC_PORT_H__
+#define __PLC_PORT_H__
+
 #include <pjlib.h>
 #include <pjlib-util.h>
 #include <pjmedia.h>
+
+#define PJMEDIA_PLC_PORT_SIGNATURE  PJMEDIA_PORT_SIGNATURE('P', 'L', 'C', 'P')
+
 typedef enum {
     EM_PLC_EMPTY,
     EM_PLC_REPEAT,
@@ -8,17 +14,29 @@ typedef enum {
     EM_PLC_SMART
 } em_plc_mode;
 
+#define EM_PLC_MODE_COUNT   4
+
+/* lower case name of the mode as in options and statistics */
+PJ_DECL(const char*) em_plc_mode_name(em_plc_mode mode);
 
 typedef struct em_plc_statistics {
-    pj_size_t received;
-    pj_size_t lost;
-    pj_size_t total;
+    pj_uint64_t received;
+    pj_uint64_t lost;
+    pj_uint64_t total;
+    /* lost packets by mode really used: it's empty till the first packet */
+    pj_uint64_t concealed[EM_PLC_MODE_COUNT];
 } em_plc_statistics;
 
 PJ_DECL(pj_status_t) pjmedia_plc_port_create(pj_pool_t *pool,
         pjmedia_port *dn_port, pjmedia_codec *codec, unsigned fpp,
         em_plc_mode plc_mode, pjmedia_port **p_port);
 
+/* the packets one after another, decoded and concealed frames are passed
+   downstream in arrays, see em_port_put_frames */
+PJ_DECL(pj_status_t) pjmedia_plc_port_put_frames(pjmedia_port *port,
+        const pjmedia_frame frames[], unsigned count);
 
 PJ_DECL(pj_status_t) pjmedia_plc_port_get_statistics(const pjmedia_port *port,
         em_plc_statistics *stats);
+
+#endif	/* __PLC_PORT_H__ */
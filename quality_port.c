@@ -0,0 +1,579 @@
+#include <math.h>
+#include "quality_port.h"
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#define SIGNATURE   PJMEDIA_PORT_SIGNATURE('Q', 'U', 'A', 'L')
+#define THIS_FILE   "quality_port.c"
+#define PI          3.14159265358979323846
+#define SEGMENT_MS  20
+#define ALIGN_MS    2000    /* of degraded signal used to find the delay */
+#define MAX_DELAY_MS 1000
+#define SILENCE_POWER 10737.0   /* -50 dBFS, quieter segments are skipped */
+#define SEGSNR_MIN  -10.0
+#define SEGSNR_MAX  35.0
+#define LSD_RANGE   1e-6    /* spectrum floor relative to its peak, -60 dB */
+
+/*
+ * Both signals are kept in linear buffers, data[offset] is the sample
+ * number start of the stream. Degraded samples are compared and dropped
+ * segment by segment, the reference is kept from the sample matching the
+ * first degraded one, so buffers stay short unless the delay is long.
+ */
+struct qp_buffer
+{
+    pj_int16_t       *data;
+    unsigned          offset;
+    unsigned          len;
+    unsigned          capacity;
+    pj_uint64_t       start;
+};
+
+struct quality_port
+{
+    pjmedia_port      base;
+    pjmedia_port     *dn_port;
+    pj_pool_t        *pool;
+    pj_mutex_t       *mutex;      /* reference and degraded signals may come
+                                     from different threads */
+    struct qp_buffer  ref;
+    struct qp_buffer  deg;
+    unsigned          segment;    /* samples */
+    unsigned          align;      /* samples */
+    unsigned          max_delay;  /* samples */
+    pj_bool_t         aligned;
+    unsigned          delay;      /* samples */
+    unsigned          fft_size;   /* segment with zero padding */
+    float            *window;     /* Hann, segment samples */
+    float            *ref_re, *ref_im, *ref_pow;
+    float            *deg_re, *deg_im, *deg_pow;
+    double            ref_energy;
+    double            err_energy;
+    double            segsnr_sum;
+    double            lsd_sum;
+    unsigned          segments;
+    pj_uint64_t       compared;   /* samples */
+};
+
+
+static pj_status_t qp_put_frame(pjmedia_port *this_port,
+				const pjmedia_frame *frame);
+static pj_status_t qp_get_frame(pjmedia_port *this_port,
+				pjmedia_frame *frame);
+static pj_status_t qp_on_destroy(pjmedia_port *this_port);
+
+
+/*
+ * Kernels. AVX2 ones are used if the compiler is allowed to (i.e. with
+ * -mavx2), SSE2 ones on any x86-64, plain C elsewhere and for the tails.
+ */
+
+/* sum of squares of the reference and of the difference */
+static void qp_energy(const pj_int16_t *ref, const pj_int16_t *deg,
+        unsigned n, double *e_ref, double *e_err)
+{
+    double sr = 0, se = 0;
+    unsigned i = 0;
+#if defined(__AVX2__)
+    __m256 acc_r = _mm256_setzero_ps(), acc_e = _mm256_setzero_ps();
+    float lanes[8];
+    unsigned k;
+    for (; i + 8 <= n; i += 8) {
+        __m256 r = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(
+                    _mm_loadu_si128((const __m128i*)(ref + i))));
+        __m256 d = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(
+                    _mm_loadu_si128((const __m128i*)(deg + i))));
+        __m256 e = _mm256_sub_ps(r, d);
+        acc_r = _mm256_add_ps(acc_r, _mm256_mul_ps(r, r));
+        acc_e = _mm256_add_ps(acc_e, _mm256_mul_ps(e, e));
+    }
+    _mm256_storeu_ps(lanes, acc_r);
+    for (k=0; k<8; k++)
+        sr += lanes[k];
+    _mm256_storeu_ps(lanes, acc_e);
+    for (k=0; k<8; k++)
+        se += lanes[k];
+#elif defined(__SSE2__)
+    __m128 acc_r = _mm_setzero_ps(), acc_e = _mm_setzero_ps();
+    float lanes[4];
+    unsigned k;
+    for (; i + 8 <= n; i += 8) {
+        __m128i r16 = _mm_loadu_si128((const __m128i*)(ref + i));
+        __m128i d16 = _mm_loadu_si128((const __m128i*)(deg + i));
+        /* sign extension: duplicate to the high half and shift back */
+        __m128 rl = _mm_cvtepi32_ps(_mm_srai_epi32(
+                    _mm_unpacklo_epi16(r16, r16), 16));
+        __m128 rh = _mm_cvtepi32_ps(_mm_srai_epi32(
+                    _mm_unpackhi_epi16(r16, r16), 16));
+        __m128 el = _mm_sub_ps(rl, _mm_cvtepi32_ps(_mm_srai_epi32(
+                        _mm_unpacklo_epi16(d16, d16), 16)));
+        __m128 eh = _mm_sub_ps(rh, _mm_cvtepi32_ps(_mm_srai_epi32(
+                        _mm_unpackhi_epi16(d16, d16), 16)));
+        acc_r = _mm_add_ps(acc_r, _mm_add_ps(_mm_mul_ps(rl, rl),
+                    _mm_mul_ps(rh, rh)));
+        acc_e = _mm_add_ps(acc_e, _mm_add_ps(_mm_mul_ps(el, el),
+                    _mm_mul_ps(eh, eh)));
+    }
+    _mm_storeu_ps(lanes, acc_r);
+    for (k=0; k<4; k++)
+        sr += lanes[k];
+    _mm_storeu_ps(lanes, acc_e);
+    for (k=0; k<4; k++)
+        se += lanes[k];
+#endif
+    for (; i<n; i++) {
+        double e = (double)ref[i] - deg[i];
+        sr += (double)ref[i] * ref[i];
+        se += e * e;
+    }
+    *e_ref = sr;
+    *e_err = se;
+}
+
+
+/* dst = src * window */
+static void qp_apply_window(const pj_int16_t *src, const float *window,
+        float *dst, unsigned n)
+{
+    unsigned i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= n; i += 8) {
+        __m256 s = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(
+                    _mm_loadu_si128((const __m128i*)(src + i))));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(s,
+                    _mm256_loadu_ps(window + i)));
+    }
+#elif defined(__SSE2__)
+    for (; i + 8 <= n; i += 8) {
+        __m128i s16 = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128 sl = _mm_cvtepi32_ps(_mm_srai_epi32(
+                    _mm_unpacklo_epi16(s16, s16), 16));
+        __m128 sh = _mm_cvtepi32_ps(_mm_srai_epi32(
+                    _mm_unpackhi_epi16(s16, s16), 16));
+        _mm_storeu_ps(dst + i, _mm_mul_ps(sl, _mm_loadu_ps(window + i)));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(sh,
+                    _mm_loadu_ps(window + i + 4)));
+    }
+#endif
+    for (; i<n; i++)
+        dst[i] = src[i] * window[i];
+}
+
+
+/* power spectrum, returns its peak */
+static float qp_power(const float *re, const float *im, float *pow,
+        unsigned n)
+{
+    float peak = 0;
+    unsigned i = 0;
+#if defined(__AVX2__)
+    __m256 acc = _mm256_setzero_ps();
+    float lanes[8];
+    unsigned k;
+    for (; i + 8 <= n; i += 8) {
+        __m256 r = _mm256_loadu_ps(re + i), m = _mm256_loadu_ps(im + i);
+        __m256 p = _mm256_add_ps(_mm256_mul_ps(r, r), _mm256_mul_ps(m, m));
+        _mm256_storeu_ps(pow + i, p);
+        acc = _mm256_max_ps(acc, p);
+    }
+    _mm256_storeu_ps(lanes, acc);
+    for (k=0; k<8; k++)
+        if (lanes[k] > peak)
+            peak = lanes[k];
+#elif defined(__SSE2__)
+    __m128 acc = _mm_setzero_ps();
+    float lanes[4];
+    unsigned k;
+    for (; i + 4 <= n; i += 4) {
+        __m128 r = _mm_loadu_ps(re + i), m = _mm_loadu_ps(im + i);
+        __m128 p = _mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(m, m));
+        _mm_storeu_ps(pow + i, p);
+        acc = _mm_max_ps(acc, p);
+    }
+    _mm_storeu_ps(lanes, acc);
+    for (k=0; k<4; k++)
+        if (lanes[k] > peak)
+            peak = lanes[k];
+#endif
+    for (; i<n; i++) {
+        pow[i] = re[i] * re[i] + im[i] * im[i];
+        if (pow[i] > peak)
+            peak = pow[i];
+    }
+    return peak;
+}
+
+
+/* in-place radix-2 FFT, n is a power of two */
+static void qp_fft(float *re, float *im, unsigned n, pj_bool_t inverse)
+{
+    unsigned i, j, len;
+
+    for (i=1, j=0; i<n; i++) {
+        unsigned bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            float t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    for (len=2; len<=n; len<<=1) {
+        double angle = (inverse ? 2 : -2) * PI / len;
+        double w_re = cos(angle), w_im = sin(angle);
+        for (i=0; i<n; i+=len) {
+            double c_re = 1, c_im = 0, t;
+            for (j=0; j<len/2; j++) {
+                unsigned a = i + j, b = i + j + len/2;
+                float t_re = (float)(re[b] * c_re - im[b] * c_im);
+                float t_im = (float)(re[b] * c_im + im[b] * c_re);
+                re[b] = re[a] - t_re;
+                im[b] = im[a] - t_im;
+                re[a] += t_re;
+                im[a] += t_im;
+                t = c_re * w_re - c_im * w_im;
+                c_im = c_re * w_im + c_im * w_re;
+                c_re = t;
+            }
+        }
+    }
+}
+
+
+static pj_status_t qp_append(pj_pool_t *pool, struct qp_buffer *buf,
+        const pj_int16_t *samples, unsigned count)
+{
+    if (buf->offset + buf->len + count > buf->capacity) {
+        if (buf->len + count <= buf->capacity) {
+            pj_memmove(buf->data, buf->data + buf->offset,
+                    buf->len * sizeof(pj_int16_t));
+        } else {
+            unsigned capacity = buf->capacity * 2;
+            pj_int16_t *data;
+            while (capacity < buf->len + count)
+                capacity *= 2;
+            data = (pj_int16_t*)pj_pool_alloc(pool,
+                    capacity * sizeof(pj_int16_t));
+            if (!data)
+                return PJ_ENOMEM;
+            pj_memcpy(data, buf->data + buf->offset,
+                    buf->len * sizeof(pj_int16_t));
+            buf->data = data;
+            buf->capacity = capacity;
+        }
+        buf->offset = 0;
+    }
+    pj_memcpy(buf->data + buf->offset + buf->len, samples,
+            count * sizeof(pj_int16_t));
+    buf->len += count;
+    return PJ_SUCCESS;
+}
+
+
+static void qp_consume(struct qp_buffer *buf, unsigned count)
+{
+    if (count > buf->len)
+        count = buf->len;
+    buf->offset += count;
+    buf->len -= count;
+    buf->start += count;
+}
+
+
+/* normalized cross-correlation of the beginnings of both signals */
+static pj_status_t qp_align(struct quality_port *qp)
+{
+    const pj_int16_t *ref = qp->ref.data + qp->ref.offset;
+    const pj_int16_t *deg = qp->deg.data + qp->deg.offset;
+    unsigned n_ref = PJ_MIN(qp->ref.len, qp->align);
+    unsigned n_deg = PJ_MIN(qp->deg.len, qp->align);
+    unsigned max_lag, size, i, k;
+    float *x_re, *x_im, *y_re, *y_im;
+    double e_ref = 0, e_deg = 0, best = 0;
+    int lag;
+
+    qp->aligned = PJ_TRUE;
+    qp->delay = 0;
+    if (n_ref == 0 || n_deg == 0)
+        return PJ_SUCCESS;
+    max_lag = PJ_MIN(qp->max_delay, n_deg - 1);
+    for (size=1; size < n_ref + max_lag || size < n_deg; size <<= 1)
+        ;
+    x_re = (float*)pj_pool_calloc(qp->pool, size, sizeof(float));
+    x_im = (float*)pj_pool_calloc(qp->pool, size, sizeof(float));
+    y_re = (float*)pj_pool_calloc(qp->pool, size, sizeof(float));
+    y_im = (float*)pj_pool_calloc(qp->pool, size, sizeof(float));
+    if (!x_re || !x_im || !y_re || !y_im)
+        return PJ_ENOMEM;
+    for (i=0; i<n_ref; i++)
+        x_re[i] = ref[i];
+    for (i=0; i<n_deg; i++)
+        y_re[i] = deg[i];
+    qp_fft(x_re, x_im, size, PJ_FALSE);
+    qp_fft(y_re, y_im, size, PJ_FALSE);
+    for (i=0; i<size; i++) {
+        float re = y_re[i] * x_re[i] + y_im[i] * x_im[i];
+        float im = y_im[i] * x_re[i] - y_re[i] * x_im[i];
+        y_re[i] = re;
+        y_im[i] = im;
+    }
+    qp_fft(y_re, y_im, size, PJ_TRUE);
+
+    /* y_re[lag] = sum deg[n] * ref[n - lag], normalized by the energies of
+       the overlapping parts; lags go down so the shortest one wins a tie */
+    k = PJ_MIN(n_deg - max_lag, n_ref);
+    for (i=0; i<k; i++)
+        e_ref += (double)ref[i] * ref[i];
+    for (i=max_lag; i<n_deg; i++)
+        e_deg += (double)deg[i] * deg[i];
+    for (lag=(int)max_lag; lag>=0; lag--) {
+        double score;
+        if (lag < (int)max_lag) {
+            e_deg += (double)deg[lag] * deg[lag];
+            if (n_deg - lag <= n_ref) {
+                k = n_deg - lag - 1;
+                e_ref += (double)ref[k] * ref[k];
+            }
+        }
+        if (e_ref <= 0 || e_deg <= 0)
+            continue;
+        score = y_re[lag] / size / sqrt(e_ref * e_deg);
+        if (score >= best) {
+            best = score;
+            qp->delay = lag;
+        }
+    }
+    PJ_LOG(4, (THIS_FILE, "degraded signal is delayed by %u samples, "
+                "correlation %.3f", qp->delay, best));
+    return PJ_SUCCESS;
+}
+
+
+static void qp_compare(struct quality_port *qp, const pj_int16_t *ref,
+        const pj_int16_t *deg, unsigned n)
+{
+    double e_ref, e_err, segsnr, lsd = 0;
+    unsigned bins = qp->fft_size / 2 + 1, i;
+    float min_pow;
+
+    qp_energy(ref, deg, n, &e_ref, &e_err);
+    qp->ref_energy += e_ref;
+    qp->err_energy += e_err;
+    qp->compared += n;
+    /* silent and incomplete segments don't count */
+    if (n < qp->segment || e_ref < SILENCE_POWER * n)
+        return;
+
+    segsnr = e_err > 0 ? 10 * log10(e_ref / e_err) : SEGSNR_MAX;
+    if (segsnr < SEGSNR_MIN)
+        segsnr = SEGSNR_MIN;
+    if (segsnr > SEGSNR_MAX)
+        segsnr = SEGSNR_MAX;
+    qp->segsnr_sum += segsnr;
+
+    qp_apply_window(ref, qp->window, qp->ref_re, n);
+    qp_apply_window(deg, qp->window, qp->deg_re, n);
+    for (i=n; i<qp->fft_size; i++)
+        qp->ref_re[i] = qp->deg_re[i] = 0;
+    pj_bzero(qp->ref_im, qp->fft_size * sizeof(float));
+    pj_bzero(qp->deg_im, qp->fft_size * sizeof(float));
+    qp_fft(qp->ref_re, qp->ref_im, qp->fft_size, PJ_FALSE);
+    qp_fft(qp->deg_re, qp->deg_im, qp->fft_size, PJ_FALSE);
+    min_pow = qp_power(qp->ref_re, qp->ref_im, qp->ref_pow, bins) *
+        LSD_RANGE;
+    qp_power(qp->deg_re, qp->deg_im, qp->deg_pow, bins);
+    for (i=0; i<bins; i++) {
+        double d = 10 * log10((qp->ref_pow[i] + min_pow) /
+                (qp->deg_pow[i] + min_pow));
+        lsd += d * d;
+    }
+    qp->lsd_sum += sqrt(lsd / bins);
+    qp->segments++;
+}
+
+
+static pj_status_t qp_process(struct quality_port *qp, pj_bool_t final)
+{
+    pj_status_t status;
+
+    if (!qp->aligned) {
+        if (!final && (qp->deg.len < qp->align || qp->ref.len < qp->align))
+            return PJ_SUCCESS;
+        status = qp_align(qp);
+        if (status != PJ_SUCCESS)
+            return status;
+    }
+
+    /* degraded samples before the delay have no reference */
+    if (qp->deg.start < qp->delay)
+        qp_consume(&qp->deg, (unsigned)(qp->delay - qp->deg.start));
+    while (qp->deg.len) {
+        pj_uint64_t pos = qp->deg.start - qp->delay;
+        unsigned n = PJ_MIN(qp->deg.len, qp->segment);
+        if (pos + n > qp->ref.start + qp->ref.len) {
+            /* reference is over, or will be put later */
+            if (!final || pos >= qp->ref.start + qp->ref.len)
+                break;
+            n = (unsigned)(qp->ref.start + qp->ref.len - pos);
+        }
+        if (n < qp->segment && !final)
+            break;
+        qp_compare(qp, qp->ref.data + qp->ref.offset +
+                (unsigned)(pos - qp->ref.start),
+                qp->deg.data + qp->deg.offset, n);
+        qp_consume(&qp->deg, n);
+        qp_consume(&qp->ref, (unsigned)(qp->deg.start - qp->delay -
+                    qp->ref.start));
+    }
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_quality_port_create(pj_pool_t *pool,
+        pjmedia_port *dn_port, unsigned clock_rate, unsigned channel_count,
+        unsigned samples_per_frame, unsigned bits_per_sample,
+        pjmedia_port **p_port)
+{
+    const pj_str_t name = { "quality", 7 };
+    struct quality_port *qp;
+    unsigned rate, i;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(pool && clock_rate && channel_count && p_port,
+            PJ_EINVAL);
+    PJ_ASSERT_RETURN(bits_per_sample == 16, PJ_EINVAL);
+
+    qp = PJ_POOL_ZALLOC_T(pool, struct quality_port);
+    pjmedia_port_info_init(&qp->base.info, &name, SIGNATURE, clock_rate,
+            channel_count, bits_per_sample, samples_per_frame);
+    qp->dn_port = dn_port;
+    qp->pool = pool;
+
+    rate = clock_rate * channel_count;
+    qp->segment = rate * SEGMENT_MS / 1000;
+    qp->align = rate * (ALIGN_MS / 1000);
+    qp->max_delay = rate * (MAX_DELAY_MS / 1000);
+    for (qp->fft_size=1; qp->fft_size<qp->segment; qp->fft_size<<=1)
+        ;
+    qp->ref.capacity = qp->deg.capacity = qp->align + samples_per_frame;
+    qp->ref.data = (pj_int16_t*)pj_pool_alloc(pool,
+            qp->ref.capacity * sizeof(pj_int16_t));
+    qp->deg.data = (pj_int16_t*)pj_pool_alloc(pool,
+            qp->deg.capacity * sizeof(pj_int16_t));
+    qp->window = (float*)pj_pool_alloc(pool, qp->segment * sizeof(float));
+    qp->ref_re = (float*)pj_pool_alloc(pool, qp->fft_size * sizeof(float));
+    qp->ref_im = (float*)pj_pool_alloc(pool, qp->fft_size * sizeof(float));
+    qp->ref_pow = (float*)pj_pool_alloc(pool, qp->fft_size * sizeof(float));
+    qp->deg_re = (float*)pj_pool_alloc(pool, qp->fft_size * sizeof(float));
+    qp->deg_im = (float*)pj_pool_alloc(pool, qp->fft_size * sizeof(float));
+    qp->deg_pow = (float*)pj_pool_alloc(pool, qp->fft_size * sizeof(float));
+    if (!qp->ref.data || !qp->deg.data || !qp->window || !qp->ref_re ||
+            !qp->ref_im || !qp->ref_pow || !qp->deg_re || !qp->deg_im ||
+            !qp->deg_pow)
+        return PJ_ENOMEM;
+    for (i=0; i<qp->segment; i++)
+        qp->window[i] = (float)(0.5 - 0.5 * cos(2 * PI * i / qp->segment));
+
+    status = pj_mutex_create_simple(pool, "quality", &qp->mutex);
+    if (status != PJ_SUCCESS)
+        return status;
+
+    qp->base.get_frame = &qp_get_frame;
+    qp->base.put_frame = &qp_put_frame;
+    qp->base.on_destroy = &qp_on_destroy;
+
+    /* Done */
+    *p_port = &qp->base;
+
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_quality_port_put_reference(pjmedia_port *port,
+        const pjmedia_frame *frame)
+{
+    struct quality_port *qp = (struct quality_port*)port;
+    pj_status_t status;
+    PJ_ASSERT_RETURN(port && frame, PJ_EINVAL);
+    PJ_ASSERT_RETURN(port->info.signature == SIGNATURE, PJ_EINVAL);
+    if (frame->type != PJMEDIA_FRAME_TYPE_AUDIO)
+        return PJ_SUCCESS;
+    pj_mutex_lock(qp->mutex);
+    status = qp_append(qp->pool, &qp->ref, (const pj_int16_t*)frame->buf,
+            frame->size / sizeof(pj_int16_t));
+    if (status == PJ_SUCCESS)
+        status = qp_process(qp, PJ_FALSE);
+    pj_mutex_unlock(qp->mutex);
+    return status;
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_quality_port_get_statistics(pjmedia_port *port,
+        em_quality_statistics *stats)
+{
+    struct quality_port *qp = (struct quality_port*)port;
+    unsigned rate;
+    pj_status_t status;
+    PJ_ASSERT_RETURN(port && stats, PJ_EINVAL);
+    PJ_ASSERT_RETURN(port->info.signature == SIGNATURE, PJ_EINVAL);
+
+    pj_mutex_lock(qp->mutex);
+    status = qp_process(qp, PJ_TRUE);
+    pj_mutex_unlock(qp->mutex);
+    if (status != PJ_SUCCESS)
+        return status;
+    rate = port->info.clock_rate * port->info.channel_count;
+    pj_bzero(stats, sizeof(*stats));
+    if (qp->ref_energy > 0)
+        stats->snr_db = qp->err_energy > 0 ?
+            10 * log10(qp->ref_energy / qp->err_energy) : SEGSNR_MAX;
+    if (qp->segments) {
+        stats->segsnr_db = qp->segsnr_sum / qp->segments;
+        stats->lsd_db = qp->lsd_sum / qp->segments;
+    }
+    stats->delay_ms = 1000.0 * qp->delay / rate;
+    stats->length = (double)qp->compared / rate;
+    stats->segments = qp->segments;
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t qp_put_frame( pjmedia_port *this_port,
+				 const pjmedia_frame *frame)
+{
+    struct quality_port *qp = (struct quality_port*)this_port;
+    pj_status_t status;
+    PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
+    if (frame->type == PJMEDIA_FRAME_TYPE_AUDIO) {
+        pj_mutex_lock(qp->mutex);
+        status = qp_append(qp->pool, &qp->deg, (const pj_int16_t*)frame->buf,
+                frame->size / sizeof(pj_int16_t));
+        if (status == PJ_SUCCESS)
+            status = qp_process(qp, PJ_FALSE);
+        pj_mutex_unlock(qp->mutex);
+        if (status != PJ_SUCCESS)
+            return status;
+    }
+    if (!qp->dn_port)
+        return PJ_SUCCESS;
+    return pjmedia_port_put_frame(qp->dn_port, frame);
+}
+
+
+static pj_status_t qp_get_frame( pjmedia_port *this_port,
+				 pjmedia_frame *frame)
+{
+    PJ_UNUSED_ARG(this_port);
+    PJ_UNUSED_ARG(frame);
+    return PJ_EINVALIDOP;
+}
+
+
+static pj_status_t qp_on_destroy(pjmedia_port *this_port)
+{
+    struct quality_port *qp = (struct quality_port*)this_port;
+    PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
+    pj_mutex_destroy(qp->mutex);
+    return PJ_SUCCESS;
+}
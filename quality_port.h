@@ -0,0 +1,37 @@
+#ifndef __QUALITY_PORT_H__
+#define __QUALITY_PORT_H__
+
+#include <pjlib.h>
+#include <pjlib-util.h>
+#include <pjmedia.h>
+
+typedef struct em_quality_statistics {
+    double            snr_db;
+    double            segsnr_db;      /* mean over active segments */
+    double            lsd_db;         /* mean log-spectral distance */
+    double            delay_ms;       /* of the degraded signal */
+    double            length;         /* compared, seconds */
+    unsigned          segments;       /* active (not silent) segments */
+} em_quality_statistics;
+
+/*
+ * Compares the degraded signal passing through the port with the reference
+ * one, in streaming fashion: the delay of the degraded signal is found by
+ * cross-correlation of the first seconds, then every 20 ms segment is
+ * compared as soon as both signals are known. Frames are passed to dn_port
+ * as is, dn_port may be NULL if the degraded signal is not needed.
+ */
+PJ_DECL(pj_status_t) pjmedia_quality_port_create(pj_pool_t *pool,
+        pjmedia_port *dn_port, unsigned clock_rate, unsigned channel_count,
+        unsigned samples_per_frame, unsigned bits_per_sample,
+        pjmedia_port **p_port);
+
+/* reference frames must be put before the degraded ones made of them */
+PJ_DECL(pj_status_t) pjmedia_quality_port_put_reference(pjmedia_port *port,
+        const pjmedia_frame *frame);
+
+/* compares whatever is left, call it when the degraded signal is over */
+PJ_DECL(pj_status_t) pjmedia_quality_port_get_statistics(pjmedia_port *port,
+        em_quality_statistics *stats);
+
+#endif	/* __QUALITY_PORT_H__ */
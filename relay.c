@@ -0,0 +1,670 @@
+#define _GNU_SOURCE     /* recvmmsg, sendmmsg */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include "relay.h"
+#include "markov_port.h"
+#include "leaky_bucket_port.h"
+#include "workers.h"
+#define SIGNATURE   PJMEDIA_PORT_SIGNATURE('R', 'L', 'A', 'Y')
+#define THIS_FILE   "relay.c"
+#define BATCH       64          /* packets per recvmmsg/sendmmsg call */
+#define MAX_BATCHES 16          /* received in a row before timers run */
+#define MAX_PACKET  1500
+#define CLOCK_RATE  8000        /* channel time unit, as in file mode */
+#define MAX_FLOWS   16384       /* per thread */
+#define HASH_SIZE   (MAX_FLOWS * 2)
+#define IDLE_MS     30000       /* silent flows are forgotten after that */
+#define TICK_MS     100
+#define NO_FLOW     ((unsigned)-1)
+
+/*
+ * Every thread has its own socket bound with SO_REUSEPORT, so the kernel
+ * spreads flows between threads and no state is shared. A flow is a chain
+ * loss port -> leaky bucket -> sink, the sink puts packets which survived
+ * into the send batch. Leaky bucket keeps packets till their departure
+ * time, a timer heap releases them when no packet of the flow arrives.
+ */
+struct relay_thread;
+
+struct relay_flow
+{
+    pjmedia_port      sink;       /* must be the first */
+    struct relay_thread *rt;
+    pj_bool_t         in_use;
+    unsigned          next;       /* hash chain or free list */
+    struct sockaddr_storage addr;
+    socklen_t         addr_len;
+    pj_uint32_t       ssrc;
+    pj_uint64_t       last_seen_ms;
+    pj_uint64_t       timer_ts;   /* scheduled release, 0 if none */
+    pj_pool_t        *pool;
+    pjmedia_port     *loss_port;
+    pjmedia_port     *lb_port;
+};
+
+struct relay_timer
+{
+    pj_uint64_t       ts;
+    unsigned          flow;
+};
+
+struct relay;
+
+struct relay_thread
+{
+    struct relay     *relay;
+    unsigned          index;
+    int               sock;
+    int               epfd;
+    pj_pool_t        *pool;
+    struct relay_flow *flows;
+    unsigned         *hash;
+    unsigned          free_flow;
+    unsigned          flow_seq;
+    struct relay_timer *timers;   /* min-heap by ts */
+    unsigned          timer_count;
+    unsigned          timer_capacity;
+    pj_uint64_t       now_ts;
+    pj_uint64_t       now_ms;
+
+    struct mmsghdr    rx_msgs[BATCH];
+    struct iovec      rx_iov[BATCH];
+    struct sockaddr_storage rx_addr[BATCH];
+    pj_uint8_t        rx_buf[BATCH][MAX_PACKET];
+
+    struct mmsghdr    tx_msgs[BATCH];
+    struct iovec      tx_iov[BATCH];
+    pj_uint8_t        tx_buf[BATCH][MAX_PACKET];
+    unsigned          tx_count;
+
+    em_relay_statistics stats;
+};
+
+struct relay
+{
+    const em_context *ctx;
+    const em_scenario *sc;
+    struct sockaddr_storage listen_addr;
+    socklen_t         listen_len;
+    struct sockaddr_storage dest_addr;
+    socklen_t         dest_len;
+    struct relay_thread **threads;
+};
+
+static volatile sig_atomic_t relay_stop;
+
+
+static pj_status_t rl_sink_put_frame(pjmedia_port *this_port,
+				const pjmedia_frame *frame);
+static pj_status_t rl_sink_get_frame(pjmedia_port *this_port,
+				pjmedia_frame *frame);
+static pj_status_t rl_sink_on_destroy(pjmedia_port *this_port);
+
+
+static void rl_on_signal(int sig)
+{
+    PJ_UNUSED_ARG(sig);
+    relay_stop = 1;
+}
+
+
+/* "host:port", "[v6 host]:port" or just "port" */
+static pj_status_t rl_parse_addr(const char *str, pj_bool_t passive,
+        struct sockaddr_storage *addr, socklen_t *addr_len)
+{
+    char host[256];
+    const char *port, *colon;
+    struct addrinfo hints, *res;
+    int err;
+
+    host[0] = '\0';
+    if (str[0] == '[') {
+        const char *end = strchr(str, ']');
+        if (!end || end[1] != ':' || end - str - 1 >= (int)sizeof(host))
+            return PJ_EINVAL;
+        pj_memcpy(host, str + 1, end - str - 1);
+        host[end - str - 1] = '\0';
+        port = end + 2;
+    } else if ((colon = strrchr(str, ':')) != NULL) {
+        if (colon - str >= (int)sizeof(host))
+            return PJ_EINVAL;
+        pj_memcpy(host, str, colon - str);
+        host[colon - str] = '\0';
+        port = colon + 1;
+    } else {
+        port = str;
+    }
+    if (!host[0] && !passive)
+        return PJ_EINVAL;
+
+    pj_bzero(&hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    err = getaddrinfo(host[0] ? host : NULL, port, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "Can't resolve %s: %s\n", str, gai_strerror(err));
+        return PJ_EINVAL;
+    }
+    pj_memcpy(addr, res->ai_addr, res->ai_addrlen);
+    *addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return PJ_SUCCESS;
+}
+
+
+static void rl_clock(struct relay_thread *rt)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    rt->now_ms = (pj_uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    rt->now_ts = (pj_uint64_t)ts.tv_sec * CLOCK_RATE +
+        (pj_uint64_t)ts.tv_nsec * CLOCK_RATE / 1000000000;
+}
+
+
+static void rl_tx_flush(struct relay_thread *rt)
+{
+    unsigned sent = 0;
+    while (sent < rt->tx_count) {
+        int n = sendmmsg(rt->sock, rt->tx_msgs + sent, rt->tx_count - sent, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            PJ_LOG(4, (THIS_FILE, "sendmmsg: %s", strerror(errno)));
+            rt->stats.send_errors += rt->tx_count - sent;
+            break;
+        }
+        sent += n;
+    }
+    rt->tx_count = 0;
+}
+
+
+static void rl_tx_push(struct relay_thread *rt, const void *buf, pj_size_t size)
+{
+    if (rt->tx_count == BATCH)
+        rl_tx_flush(rt);
+    pj_memcpy(rt->tx_buf[rt->tx_count], buf, size);
+    rt->tx_iov[rt->tx_count].iov_len = size;
+    rt->tx_count++;
+}
+
+
+static pj_status_t rl_sink_put_frame( pjmedia_port *this_port,
+				 const pjmedia_frame *frame)
+{
+    struct relay_flow *flow = (struct relay_flow*)this_port;
+    PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
+    if (frame->type == PJMEDIA_FRAME_TYPE_NONE) {
+        flow->rt->stats.lost++;
+        return PJ_SUCCESS;
+    }
+    PJ_ASSERT_RETURN(frame->size <= MAX_PACKET, PJ_ETOOBIG);
+    rl_tx_push(flow->rt, frame->buf, frame->size);
+    flow->rt->stats.forwarded++;
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t rl_sink_get_frame( pjmedia_port *this_port,
+				 pjmedia_frame *frame)
+{
+    PJ_UNUSED_ARG(this_port);
+    PJ_UNUSED_ARG(frame);
+    return PJ_EINVALIDOP;
+}
+
+
+static pj_status_t rl_sink_on_destroy(pjmedia_port *this_port)
+{
+    PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
+    return PJ_SUCCESS;
+}
+
+
+static void rl_timer_push(struct relay_thread *rt, pj_uint64_t ts,
+        unsigned flow)
+{
+    unsigned i;
+    if (rt->timer_count == rt->timer_capacity) {
+        struct relay_timer *timers = (struct relay_timer*)pj_pool_alloc(
+                rt->pool, 2 * rt->timer_capacity * sizeof(struct relay_timer));
+        pj_memcpy(timers, rt->timers,
+                rt->timer_count * sizeof(struct relay_timer));
+        rt->timers = timers;
+        rt->timer_capacity *= 2;
+    }
+    i = rt->timer_count++;
+    while (i > 0 && rt->timers[(i - 1) / 2].ts > ts) {
+        rt->timers[i] = rt->timers[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    rt->timers[i].ts = ts;
+    rt->timers[i].flow = flow;
+}
+
+
+static void rl_timer_pop(struct relay_thread *rt)
+{
+    struct relay_timer last = rt->timers[--rt->timer_count];
+    unsigned i = 0;
+    for (;;) {
+        unsigned child = 2*i + 1;
+        if (child >= rt->timer_count)
+            break;
+        if (child + 1 < rt->timer_count &&
+                rt->timers[child + 1].ts < rt->timers[child].ts)
+            child++;
+        if (last.ts <= rt->timers[child].ts)
+            break;
+        rt->timers[i] = rt->timers[child];
+        i = child;
+    }
+    if (rt->timer_count)
+        rt->timers[i] = last;
+}
+
+
+/* make sure the flow is woken up when its first queued packet departs */
+static void rl_schedule(struct relay_thread *rt, unsigned idx)
+{
+    struct relay_flow *flow = &rt->flows[idx];
+    pj_timestamp ts;
+    if (pjmedia_leaky_bucket_port_next_ts(flow->lb_port, &ts) != PJ_SUCCESS)
+        return;
+    if (flow->timer_ts == 0 || ts.u64 < flow->timer_ts) {
+        flow->timer_ts = ts.u64;
+        rl_timer_push(rt, ts.u64, idx);
+    }
+}
+
+
+static void rl_run_timers(struct relay_thread *rt)
+{
+    pj_timestamp till;
+    till.u64 = rt->now_ts + 1;
+    while (rt->timer_count && rt->timers[0].ts <= rt->now_ts) {
+        struct relay_timer timer = rt->timers[0];
+        struct relay_flow *flow = &rt->flows[timer.flow];
+        rl_timer_pop(rt);
+        /* flow was destroyed or rescheduled since */
+        if (!flow->in_use || flow->timer_ts != timer.ts)
+            continue;
+        flow->timer_ts = 0;
+        pjmedia_leaky_bucket_port_push_till(flow->lb_port, &till);
+        rl_schedule(rt, timer.flow);
+    }
+}
+
+
+static unsigned rl_hash(const struct sockaddr_storage *addr,
+        socklen_t addr_len, pj_uint32_t ssrc)
+{
+    const pj_uint8_t *p = (const pj_uint8_t*)addr;
+    pj_uint32_t h = 2166136261u ^ ssrc;
+    socklen_t i;
+    for (i=0; i<addr_len; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h % HASH_SIZE;
+}
+
+
+static void rl_flow_destroy(struct relay_thread *rt, unsigned idx)
+{
+    struct relay_flow *flow = &rt->flows[idx];
+    unsigned *link = &rt->hash[rl_hash(&flow->addr, flow->addr_len,
+            flow->ssrc)];
+    while (*link != idx)
+        link = &rt->flows[*link].next;
+    *link = flow->next;
+
+    /* bucket pushes what is left in it to the sink */
+    pjmedia_port_destroy(flow->loss_port);
+    pjmedia_port_destroy(flow->lb_port);
+    pj_pool_release(flow->pool);
+    flow->in_use = PJ_FALSE;
+    flow->next = rt->free_flow;
+    rt->free_flow = idx;
+}
+
+
+static pj_status_t rl_flow_create(struct relay_thread *rt,
+        const struct sockaddr_storage *addr, socklen_t addr_len,
+        pj_uint32_t ssrc, unsigned bucket, unsigned *p_idx)
+{
+    const pj_str_t name = { "relay", 5 };
+    const em_scenario *sc = rt->relay->sc;
+    struct relay_flow *flow;
+    unsigned idx, stream;
+    pj_status_t status;
+
+    if (rt->free_flow == NO_FLOW)
+        return PJ_ETOOMANY;
+    idx = rt->free_flow;
+    flow = &rt->flows[idx];
+
+    flow->pool = pj_pool_create(rt->relay->ctx->pool_factory, "flow",
+            1000, 1000, NULL);
+    pjmedia_port_info_init(&flow->sink.info, &name, SIGNATURE, CLOCK_RATE,
+            1, 16, MAX_PACKET / 2);
+    flow->sink.put_frame = &rl_sink_put_frame;
+    flow->sink.get_frame = &rl_sink_get_frame;
+    flow->sink.on_destroy = &rl_sink_on_destroy;
+    flow->rt = rt;
+
+    status = pjmedia_leaky_bucket_port_create(rt->relay->ctx->pool_factory,
+            &flow->sink, sc->bucket_size, sc->sent_delay,
+            (unsigned)sc->bits_per_second, (unsigned)sc->packets_per_second,
+            &flow->lb_port);
+    if (status != PJ_SUCCESS) {
+        pj_pool_release(flow->pool);
+        return status;
+    }
+    /* flows of all threads draw from different random streams */
+    stream = (rt->index << 24) | (rt->flow_seq++ & 0xffffff);
+    if (sc->loss_model)
+        status = pjmedia_loss_model_port_create(flow->pool, flow->lb_port,
+                sc->loss_model, sc->seed, stream, &flow->loss_port);
+    else
+        status = pjmedia_markov_port_create(flow->pool, flow->lb_port,
+                sc->markov_p10, sc->markov_p00, sc->seed, stream,
+                sc->markov_options, &flow->loss_port);
+    if (status != PJ_SUCCESS) {
+        pjmedia_port_destroy(flow->lb_port);
+        pj_pool_release(flow->pool);
+        return status;
+    }
+
+    rt->free_flow = flow->next;
+    pj_memcpy(&flow->addr, addr, addr_len);
+    flow->addr_len = addr_len;
+    flow->ssrc = ssrc;
+    flow->timer_ts = 0;
+    flow->in_use = PJ_TRUE;
+    flow->next = rt->hash[bucket];
+    rt->hash[bucket] = idx;
+    rt->stats.flows++;
+    PJ_LOG(4, (THIS_FILE, "thread %u: new flow ssrc=0x%08x", rt->index, ssrc));
+
+    *p_idx = idx;
+    return PJ_SUCCESS;
+}
+
+
+static void rl_evict_idle(struct relay_thread *rt)
+{
+    unsigned i;
+    for (i=0; i<MAX_FLOWS; i++) {
+        if (rt->flows[i].in_use &&
+                rt->now_ms - rt->flows[i].last_seen_ms > IDLE_MS) {
+            PJ_LOG(4, (THIS_FILE, "thread %u: flow ssrc=0x%08x is idle",
+                        rt->index, rt->flows[i].ssrc));
+            rl_flow_destroy(rt, i);
+        }
+    }
+}
+
+
+static void rl_packet(struct relay_thread *rt, unsigned m)
+{
+    const pj_uint8_t *pkt = rt->rx_buf[m];
+    unsigned len = rt->rx_msgs[m].msg_len;
+    socklen_t addr_len = rt->rx_msgs[m].msg_hdr.msg_namelen;
+    pjmedia_frame frame;
+    pj_uint32_t ssrc;
+    unsigned bucket, idx;
+
+    /* truncated datagrams are longer than the buffer, the tail is lost */
+    if (len < 12 || (pkt[0] >> 6) != 2 ||
+            (rt->rx_msgs[m].msg_hdr.msg_flags & MSG_TRUNC)) {
+        rt->stats.ignored++;
+        return;
+    }
+    /* RTCP shares the port with RTP sometimes, it's passed as is */
+    if (pkt[1] >= 200 && pkt[1] <= 204) {
+        rl_tx_push(rt, pkt, len);
+        rt->stats.rtcp++;
+        return;
+    }
+    rt->stats.received++;
+    ssrc = ((pj_uint32_t)pkt[8] << 24) | (pkt[9] << 16) | (pkt[10] << 8) |
+        pkt[11];
+    bucket = rl_hash(&rt->rx_addr[m], addr_len, ssrc);
+    for (idx = rt->hash[bucket]; idx != NO_FLOW; idx = rt->flows[idx].next) {
+        struct relay_flow *flow = &rt->flows[idx];
+        if (flow->ssrc == ssrc && flow->addr_len == addr_len &&
+                memcmp(&flow->addr, &rt->rx_addr[m], addr_len) == 0)
+            break;
+    }
+    if (idx == NO_FLOW && rl_flow_create(rt, &rt->rx_addr[m], addr_len, ssrc,
+                bucket, &idx) != PJ_SUCCESS) {
+        rt->stats.ignored++;
+        return;
+    }
+
+    rt->flows[idx].last_seen_ms = rt->now_ms;
+    pj_bzero(&frame, sizeof(frame));
+    frame.type = PJMEDIA_FRAME_TYPE_AUDIO;
+    frame.buf = (void*)pkt;
+    frame.size = len;
+    frame.timestamp.u64 = rt->now_ts;
+    pjmedia_port_put_frame(rt->flows[idx].loss_port, &frame);
+    rl_schedule(rt, idx);
+}
+
+
+static void rl_receive(struct relay_thread *rt)
+{
+    unsigned batches, i;
+    for (batches=0; batches<MAX_BATCHES; batches++) {
+        int n;
+        for (i=0; i<BATCH; i++)
+            rt->rx_msgs[i].msg_hdr.msg_namelen = sizeof(rt->rx_addr[i]);
+        n = recvmmsg(rt->sock, rt->rx_msgs, BATCH, MSG_DONTWAIT, NULL);
+        if (n <= 0)
+            break;
+        rl_clock(rt);
+        for (i=0; i<(unsigned)n; i++)
+            rl_packet(rt, i);
+        rl_tx_flush(rt);
+        if (n < BATCH)
+            break;
+    }
+}
+
+
+static pj_status_t rl_thread_init(struct relay *relay, unsigned index,
+        struct relay_thread **p_rt)
+{
+    struct relay_thread *rt;
+    struct epoll_event ev;
+    pj_pool_t *pool;
+    pj_status_t status;
+    int one = 1;
+    unsigned i;
+
+    pool = pj_pool_create(relay->ctx->pool_factory, "relay", 4000, 4000, NULL);
+    rt = PJ_POOL_ZALLOC_T(pool, struct relay_thread);
+    rt->pool = pool;
+    rt->relay = relay;
+    rt->sock = rt->epfd = -1;
+    rt->index = index;
+    rt->flows = (struct relay_flow*)pj_pool_calloc(pool, MAX_FLOWS,
+            sizeof(struct relay_flow));
+    rt->hash = (unsigned*)pj_pool_alloc(pool, HASH_SIZE * sizeof(unsigned));
+    rt->timer_capacity = 1024;
+    rt->timers = (struct relay_timer*)pj_pool_alloc(pool,
+            rt->timer_capacity * sizeof(struct relay_timer));
+    if (!rt->flows || !rt->hash || !rt->timers) {
+        pj_pool_release(pool);
+        return PJ_ENOMEM;
+    }
+    for (i=0; i<HASH_SIZE; i++)
+        rt->hash[i] = NO_FLOW;
+    for (i=0; i<MAX_FLOWS; i++)
+        rt->flows[i].next = i + 1 < MAX_FLOWS ? i + 1 : NO_FLOW;
+    rt->free_flow = 0;
+
+    /* every packet of a batch has its own buffer and source address, all
+       of the sent ones go to the same destination */
+    for (i=0; i<BATCH; i++) {
+        rt->rx_iov[i].iov_base = rt->rx_buf[i];
+        rt->rx_iov[i].iov_len = MAX_PACKET;
+        rt->rx_msgs[i].msg_hdr.msg_iov = &rt->rx_iov[i];
+        rt->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+        rt->rx_msgs[i].msg_hdr.msg_name = &rt->rx_addr[i];
+        rt->tx_iov[i].iov_base = rt->tx_buf[i];
+        rt->tx_msgs[i].msg_hdr.msg_iov = &rt->tx_iov[i];
+        rt->tx_msgs[i].msg_hdr.msg_iovlen = 1;
+        rt->tx_msgs[i].msg_hdr.msg_name = &relay->dest_addr;
+        rt->tx_msgs[i].msg_hdr.msg_namelen = relay->dest_len;
+    }
+
+    rt->sock = socket(relay->listen_addr.ss_family, SOCK_DGRAM, 0);
+    if (rt->sock < 0)
+        goto err;
+#ifdef SO_REUSEPORT
+    setsockopt(rt->sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+#endif
+    if (bind(rt->sock, (struct sockaddr*)&relay->listen_addr,
+                relay->listen_len) != 0)
+        goto err;
+    rt->epfd = epoll_create1(0);
+    if (rt->epfd < 0)
+        goto err;
+    pj_bzero(&ev, sizeof(ev));
+    ev.events = EPOLLIN;
+    if (epoll_ctl(rt->epfd, EPOLL_CTL_ADD, rt->sock, &ev) != 0)
+        goto err;
+
+    *p_rt = rt;
+    return PJ_SUCCESS;
+
+err:
+    status = PJ_STATUS_FROM_OS(errno);
+    fprintf(stderr, "Can't set up relay socket: %s\n", strerror(errno));
+    if (rt->epfd >= 0)
+        close(rt->epfd);
+    if (rt->sock >= 0)
+        close(rt->sock);
+    pj_pool_release(pool);
+    return status;
+}
+
+
+static pj_status_t rl_thread_run(void *arg, unsigned index)
+{
+    struct relay *relay = (struct relay*)arg;
+    struct relay_thread *rt = relay->threads[index];
+    pj_uint64_t last_scan;
+    struct epoll_event ev;
+    unsigned i;
+
+    rl_clock(rt);
+    last_scan = rt->now_ms;
+    while (!relay_stop) {
+        int timeout = TICK_MS;
+        if (rt->timer_count) {
+            pj_uint64_t wait = rt->timers[0].ts > rt->now_ts ?
+                ((rt->timers[0].ts - rt->now_ts) * 1000 + CLOCK_RATE - 1) /
+                CLOCK_RATE : 0;
+            if (wait < (pj_uint64_t)timeout)
+                timeout = (int)wait;
+        }
+        if (epoll_wait(rt->epfd, &ev, 1, timeout) > 0)
+            rl_receive(rt);
+        rl_clock(rt);
+        rl_run_timers(rt);
+        rl_tx_flush(rt);
+        if (rt->now_ms - last_scan >= 1000) {
+            rl_evict_idle(rt);
+            rl_tx_flush(rt);
+            last_scan = rt->now_ms;
+        }
+    }
+
+    for (i=0; i<MAX_FLOWS; i++)
+        if (rt->flows[i].in_use)
+            rl_flow_destroy(rt, i);
+    rl_tx_flush(rt);
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) em_relay_run(const em_context *ctx,
+        const em_scenario *sc, const char *listen, const char *dest,
+        unsigned thread_count, em_relay_statistics *stats)
+{
+    struct relay relay;
+    struct sigaction sa;
+    pj_pool_t *pool;
+    pj_status_t status;
+    unsigned i, started;
+
+    PJ_ASSERT_RETURN(ctx && sc && listen && dest && stats, PJ_EINVAL);
+
+    pj_bzero(&relay, sizeof(relay));
+    relay.ctx = ctx;
+    relay.sc = sc;
+    if (rl_parse_addr(listen, PJ_TRUE, &relay.listen_addr,
+                &relay.listen_len) != PJ_SUCCESS ||
+            rl_parse_addr(dest, PJ_FALSE, &relay.dest_addr,
+                &relay.dest_len) != PJ_SUCCESS) {
+        fprintf(stderr, "Relay addresses must be [host:]port and "
+                "host:port\n");
+        return PJ_EINVAL;
+    }
+    if (thread_count == 0)
+        thread_count = em_workers_default_count();
+#ifndef SO_REUSEPORT
+    thread_count = 1;
+#endif
+
+    pool = pj_pool_create(ctx->pool_factory, "relay", 1000, 1000, NULL);
+    relay.threads = (struct relay_thread**)pj_pool_calloc(pool, thread_count,
+            sizeof(struct relay_thread*));
+    status = PJ_SUCCESS;
+    for (started=0; started<thread_count && status==PJ_SUCCESS; started++)
+        status = rl_thread_init(&relay, started, &relay.threads[started]);
+    if (status == PJ_SUCCESS) {
+        relay_stop = 0;
+        pj_bzero(&sa, sizeof(sa));
+        sa.sa_handler = &rl_on_signal;
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+        PJ_LOG(3, (THIS_FILE, "relaying %s -> %s on %u threads", listen,
+                    dest, thread_count));
+        status = em_workers_run(ctx->pool_factory, thread_count,
+                thread_count, &rl_thread_run, &relay);
+    } else {
+        started--;
+    }
+
+    pj_bzero(stats, sizeof(*stats));
+    for (i=0; i<started; i++) {
+        struct relay_thread *rt = relay.threads[i];
+        stats->flows += rt->stats.flows;
+        stats->received += rt->stats.received;
+        stats->forwarded += rt->stats.forwarded;
+        stats->lost += rt->stats.lost;
+        stats->rtcp += rt->stats.rtcp;
+        stats->ignored += rt->stats.ignored;
+        stats->send_errors += rt->stats.send_errors;
+        close(rt->epfd);
+        close(rt->sock);
+        pj_pool_release(rt->pool);
+    }
+    pj_pool_release(pool);
+    return status;
+}
@@ -0,0 +1,27 @@
+#ifndef __RELAY_H__
+#define __RELAY_H__
+
+#include "emulator.h"
+
+typedef struct em_relay_statistics {
+    pj_uint64_t       flows;          /* RTP flows seen */
+    pj_uint64_t       received;       /* RTP packets received */
+    pj_uint64_t       forwarded;      /* RTP packets sent to the destination */
+    pj_uint64_t       lost;           /* RTP packets lost in the channel */
+    pj_uint64_t       rtcp;           /* RTCP packets passed as is */
+    pj_uint64_t       ignored;        /* not RTP, truncated or no free flow */
+    pj_uint64_t       send_errors;
+} em_relay_statistics;
+
+/*
+ * Receive RTP on listen address ("[host:]port") and forward it to dest
+ * address ("host:port"). Every RTP flow (source address and SSRC) has its
+ * own channel: the loss model and the leaky bucket of the scenario. Runs
+ * on thread_count threads (0 means one per CPU), each with own socket and
+ * flows, until SIGINT or SIGTERM.
+ */
+PJ_DECL(pj_status_t) em_relay_run(const em_context *ctx,
+        const em_scenario *sc, const char *listen, const char *dest,
+        unsigned thread_count, em_relay_statistics *stats);
+
+#endif	/* __RELAY_H__ */
@@ -0,0 +1,255 @@
+#include <math.h>
+#include "repeat.h"
+#include "workers.h"
+#define THIS_FILE   "repeat.c"
+#define MIN_REPEAT  3   /* the interval of fewer repetitions means nothing */
+
+/* aggregated values of a repetition */
+enum {
+    M_TOTAL,
+    M_LOST,
+    M_RECEIVED,
+    M_LOSS_PCT,
+    M_CONCEALED,        /* EM_PLC_MODE_COUNT values, one per mode */
+    M_SNR = M_CONCEALED + EM_PLC_MODE_COUNT,
+    M_SEGSNR,
+    M_LSD,
+    M_DELAY,
+    M_COUNT
+};
+
+/* the first quality metric */
+#define M_SCORED    M_SNR
+
+static const char *metric_names[M_COUNT] = {
+    "total", "lost", "received", "loss_pct",
+    "concealed_empty", "concealed_repeat", "concealed_noise",
+    "concealed_smart",
+    "snr_db", "segsnr_db", "lsd_db", "delay_ms"
+};
+
+static const char *metric_labels[M_COUNT] = {
+    "packets sent", "packets lost", "packets received", "loss percent",
+    "concealed empty", "concealed repeat", "concealed noise",
+    "concealed smart",
+    "SNR, dB", "segmental SNR, dB", "log-spectral distance, dB",
+    "output delay, ms"
+};
+
+/* two-sided 95% quantiles of Student's t for 1..30 degrees of freedom */
+static const double t_975[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+struct rp_run
+{
+    pj_status_t       status;
+    double            value[M_COUNT];
+};
+
+struct repeat
+{
+    const em_context *ctx;
+    const em_scenario *sc;
+    struct rp_run    *runs;
+    unsigned          first;      /* repetition of the first job */
+};
+
+/* mean and variance by Welford's method, repetitions are added in order */
+struct rp_summary
+{
+    unsigned          n;
+    double            mean[M_COUNT];
+    double            m2[M_COUNT];
+};
+
+
+static double rp_t_975(unsigned df)
+{
+    const double z = 1.959964;
+    if (df <= PJ_ARRAY_SIZE(t_975))
+        return t_975[df - 1];
+    /* Cornish-Fisher expansion, error is below 1e-4 beyond 30 */
+    return z + (z*z*z + z) / (4.0 * df) +
+        (5*pow(z, 5) + 16*z*z*z + 3*z) / (96.0 * df * df);
+}
+
+
+static void rp_add(struct rp_summary *s, const struct rp_run *run)
+{
+    unsigned i;
+    s->n++;
+    for (i=0; i<M_COUNT; i++) {
+        double delta = run->value[i] - s->mean[i];
+        s->mean[i] += delta / s->n;
+        s->m2[i] += delta * (run->value[i] - s->mean[i]);
+    }
+}
+
+
+static double rp_sd(const struct rp_summary *s, unsigned i)
+{
+    return s->n > 1 ? sqrt(s->m2[i] / (s->n - 1)) : 0.0;
+}
+
+
+/* half width of the 95% confidence interval of the mean */
+static double rp_half(const struct rp_summary *s, unsigned i)
+{
+    if (s->n < 2)
+        return HUGE_VAL;
+    return rp_t_975(s->n - 1) * rp_sd(s, i) / sqrt((double)s->n);
+}
+
+
+static pj_status_t rp_job(void *arg, unsigned job_index)
+{
+    struct repeat *rp = (struct repeat*)arg;
+    unsigned index = rp->first + job_index;
+    struct rp_run *run = &rp->runs[index];
+    const em_plc_statistics *stats;
+    em_scenario sc = *rp->sc;
+    em_result res;
+    unsigned i;
+
+    sc.stream = rp->sc->stream + index;
+    sc.output_file = NULL;
+    PJ_LOG(4, (THIS_FILE, "repetition %u", index));
+    run->status = em_run_scenario(rp->ctx, &sc, &res);
+    if (run->status != PJ_SUCCESS)
+        return run->status;
+    stats = &res.stats;
+    run->value[M_TOTAL] = (double)stats->total;
+    run->value[M_LOST] = (double)stats->lost;
+    run->value[M_RECEIVED] = (double)stats->received;
+    run->value[M_LOSS_PCT] = stats->total ?
+        100.0 * stats->lost / stats->total : 0.0;
+    for (i=0; i<EM_PLC_MODE_COUNT; i++)
+        run->value[M_CONCEALED + i] = (double)stats->concealed[i];
+    if (res.scored) {
+        run->value[M_SNR] = res.quality.snr_db;
+        run->value[M_SEGSNR] = res.quality.segsnr_db;
+        run->value[M_LSD] = res.quality.lsd_db;
+        run->value[M_DELAY] = res.quality.delay_ms;
+    }
+    return PJ_SUCCESS;
+}
+
+
+static void rp_print(FILE *fd, em_stats_format format,
+        const em_scenario *sc, const struct rp_summary *s, unsigned count,
+        double ci_width, unsigned target, pj_bool_t stopped)
+{
+    unsigned metrics = sc->quality ? M_COUNT : M_SCORED;
+    unsigned i;
+
+    if (format == EM_STATS_JSON) {
+        fprintf(fd, "{\"repetitions\":%u,\"requested\":%u,\"seed\":%llu,"
+                "\"target\":\"%s\",\"ci_width\":%.4f,\"stopped\":%s,"
+                "\"metrics\":{", s->n, count,
+                (unsigned long long)sc->seed, metric_names[target],
+                ci_width, stopped ? "true" : "false");
+        /* the interval is undefined for a single repetition */
+        for (i=0; i<metrics; i++) {
+            fprintf(fd, "%s\"%s\":{\"mean\":%.4f,\"sd\":%.4f,\"ci95\":",
+                    i ? "," : "", metric_names[i], s->mean[i], rp_sd(s, i));
+            if (s->n < 2)
+                fputs("null}", fd);
+            else
+                fprintf(fd, "[%.4f,%.4f]}", s->mean[i] - rp_half(s, i),
+                        s->mean[i] + rp_half(s, i));
+        }
+        fputs("}}\n", fd);
+    } else if (format == EM_STATS_CSV) {
+        fputs("metric,repetitions,mean,sd,ci95_low,ci95_high\n", fd);
+        for (i=0; i<metrics; i++) {
+            fprintf(fd, "%s,%u,%.4f,%.4f,", metric_names[i], s->n,
+                    s->mean[i], rp_sd(s, i));
+            if (s->n < 2)
+                fputs(",\n", fd);
+            else
+                fprintf(fd, "%.4f,%.4f\n", s->mean[i] - rp_half(s, i),
+                        s->mean[i] + rp_half(s, i));
+        }
+    } else {
+        fprintf(fd,
+                "Repetition statistics\n"
+                "                  repetitions: %u of %u%s\n"
+                "                  random seed: %llu\n",
+                s->n, count, stopped ? " (interval is narrow enough)" : "",
+                (unsigned long long)sc->seed);
+        for (i=0; i<metrics; i++) {
+            fprintf(fd, "%29s: mean %.2f, sd %.2f, 95%% CI ",
+                    metric_labels[i], s->mean[i], rp_sd(s, i));
+            if (s->n < 2)
+                fputs("n/a\n", fd);
+            else
+                fprintf(fd, "[%.2f, %.2f]\n", s->mean[i] - rp_half(s, i),
+                        s->mean[i] + rp_half(s, i));
+        }
+    }
+}
+
+
+PJ_DEF(pj_status_t) em_repeat_run(const em_context *ctx,
+        const em_scenario *sc, unsigned count, double ci_width,
+        unsigned jobs, em_stats_format format, FILE *stats_fd)
+{
+    struct repeat rp;
+    struct rp_summary summary;
+    unsigned target = sc->quality ? M_SEGSNR : M_LOSS_PCT;
+    unsigned threads = jobs ? jobs : em_workers_default_count();
+    pj_bool_t stopped = PJ_FALSE;
+    pj_pool_t *pool;
+    pj_status_t status = PJ_SUCCESS;
+
+    PJ_ASSERT_RETURN(ctx && sc && count && stats_fd, PJ_EINVAL);
+
+    pool = pj_pool_create(ctx->pool_factory, "repeat", 4000, 4000, NULL);
+    rp.ctx = ctx;
+    rp.sc = sc;
+    rp.runs = (struct rp_run*)pj_pool_calloc(pool, count,
+            sizeof(struct rp_run));
+    rp.first = 0;
+    pj_bzero(&summary, sizeof(summary));
+
+    /*
+     * Repetitions are run by rounds of one per thread, without target
+     * width all of them at once. They are added to the summary in order and
+     * the interval is checked after each, so early stop happens at the same
+     * repetition whatever the number of threads; the rest of the round is
+     * thrown away. With packet cache the first repetition runs alone to
+     * encode the stream for the others.
+     */
+    while (rp.first < count && !stopped) {
+        unsigned round = ci_width > 0 ? threads : count;
+        unsigned end;
+        if (rp.first == 0 && ctx->packet_cache_dir)
+            round = 1;
+        if (round > count - rp.first)
+            round = count - rp.first;
+        status = em_workers_run(ctx->pool_factory, jobs, round, &rp_job,
+                &rp);
+        if (status != PJ_SUCCESS)
+            goto on_return;
+        for (end = rp.first + round; rp.first < end; rp.first++) {
+            rp_add(&summary, &rp.runs[rp.first]);
+            if (ci_width > 0 && summary.n >= MIN_REPEAT &&
+                    2 * rp_half(&summary, target) < ci_width) {
+                stopped = PJ_TRUE;
+                break;
+            }
+        }
+    }
+    PJ_LOG(4, (THIS_FILE, "%u of %u repetitions, %s interval is %.4f wide",
+                summary.n, count, metric_names[target],
+                2 * rp_half(&summary, target)));
+    rp_print(stats_fd, format, sc, &summary, count, ci_width, target,
+            stopped);
+
+on_return:
+    pj_pool_release(pool);
+    return status;
+}
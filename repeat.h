@@ -0,0 +1,22 @@
+#ifndef __REPEAT_H__
+#define __REPEAT_H__
+
+#include <stdio.h>
+#include "emulator.h"
+#include "stats.h"
+
+/*
+ * Monte Carlo runs of one scenario: up to count independent realizations
+ * of the channel, repetition n uses random stream n of the seed and writes
+ * no output file. Packet counts, PLC modes and quality metrics of the
+ * repetitions are printed to stats_fd as mean, standard deviation and 95%
+ * confidence interval. If ci_width is positive, repetitions stop as soon as
+ * the interval of segmental SNR (loss percent if the scenario isn't scored)
+ * gets narrower than ci_width. Repetitions run on jobs threads (0 means one
+ * per CPU), the result doesn't depend on their number.
+ */
+PJ_DECL(pj_status_t) em_repeat_run(const em_context *ctx,
+        const em_scenario *sc, unsigned count, double ci_width,
+        unsigned jobs, em_stats_format format, FILE *stats_fd);
+
+#endif	/* __REPEAT_H__ */
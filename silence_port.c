@@ -1,5 +1,8 @@
 #include "silence_port.h"
-#define SIGNATURE   PJMEDIA_PORT_SIGNATURE('S', 'I', 'L', 'E')
+#include "em_log.h"
+#include "events.h"
+#include "batch.h"
+#define SIGNATURE   PJMEDIA_SILENCE_PORT_SIGNATURE
 #define THIS_FILE   "silence_port.c"
 
 struct silence_port
@@ -8,7 +11,12 @@ struct silence_port
     pjmedia_port	 *dn_port;
     pj_timestamp      last_ts;
     unsigned          frames;
-    pjmedia_circ_buf *buf;
+    pjmedia_circ_buf *buf;      /* used only while output is misaligned */
+    pj_int16_t       *zero_buf;   /* always zero, frame_capacity samples */
+    pj_int16_t       *tmp_buf;    /* frame_capacity samples */
+    unsigned          frame_capacity;
+    em_silence_statistics stats;
+    em_batch          out;      /* frames put and zero frames */
 };
 
 
@@ -39,6 +47,7 @@ PJ_DEF(pj_status_t) pjmedia_silence_port_create(pj_pool_t *pool,
 
     /* More init */
     sp->dn_port = dn_port;
+    em_batch_init(&sp->out, dn_port);
     sp->base.get_frame = &sp_get_frame;
     sp->base.put_frame = &sp_put_frame;
     sp->base.on_destroy = &sp_on_destroy;
@@ -50,6 +59,11 @@ PJ_DEF(pj_status_t) pjmedia_silence_port_create(pj_pool_t *pool,
         buffer_size = dn_port->info.bits_per_sample * \
                       dn_port->info.samples_per_frame * 16;
     pjmedia_circ_buf_create (pool, buffer_size, &sp->buf);
+    sp->frame_capacity = dn_port->info.bytes_per_frame / sizeof(pj_int16_t);
+    sp->zero_buf = (pj_int16_t*)pj_pool_zalloc(pool,
+            sp->frame_capacity * sizeof(pj_int16_t));
+    sp->tmp_buf = (pj_int16_t*)pj_pool_alloc(pool,
+            sp->frame_capacity * sizeof(pj_int16_t));
 
     /* Done */
     *p_port = &sp->base;
@@ -58,25 +72,87 @@ PJ_DEF(pj_status_t) pjmedia_silence_port_create(pj_pool_t *pool,
 }
 
 
-static pj_status_t sp_put_frame( pjmedia_port *this_port,
-				 const pjmedia_frame *frame)
+PJ_DEF(pj_status_t) pjmedia_silence_port_get_statistics(
+        const pjmedia_port *port, em_silence_statistics *stats)
+{
+    const struct silence_port *sp = (const struct silence_port*)port;
+    PJ_ASSERT_RETURN(port->info.signature == SIGNATURE, PJ_EINVAL);
+    pj_memcpy(stats, &sp->stats, sizeof(em_silence_statistics));
+    return PJ_SUCCESS;
+}
+
+
+/* put every complete frame saved in the circular buffer downstream: they
+   are read one by one into tmp_buf, so they don't go to the batch */
+static pj_status_t sp_flush(struct silence_port *sp, pjmedia_frame *tmp_frame,
+        unsigned frame_size)
+{
+    pj_status_t status;
+    tmp_frame->buf = (void*)sp->tmp_buf;
+    while (pjmedia_circ_buf_get_len(sp->buf) >= frame_size){
+        status = em_batch_flush(&sp->out);
+        if (status != PJ_SUCCESS)
+            return status;
+        pjmedia_circ_buf_read(sp->buf, sp->tmp_buf, frame_size);
+        EM_LOG(6, (THIS_FILE, "read from circ buf %u bytes", frame_size));
+        status = pjmedia_port_put_frame(sp->dn_port, tmp_frame);
+        if (status != PJ_SUCCESS)
+            return status;
+    }
+    return PJ_SUCCESS;
+}
+
+
+/* put count zero samples downstream: whole frames are taken directly from
+   the zero buffer, only the unaligned rest goes to the circular buffer */
+static pj_status_t sp_put_zeros(struct silence_port *sp,
+        pjmedia_frame *tmp_frame, unsigned frame_size, unsigned count)
+{
+    pj_status_t status;
+    while (count) {
+        unsigned buffered = pjmedia_circ_buf_get_len(sp->buf);
+        unsigned n;
+        if (buffered == 0 && count >= frame_size) {
+            tmp_frame->buf = (void*)sp->zero_buf;
+            status = em_batch_add(&sp->out, tmp_frame);
+            if (status != PJ_SUCCESS)
+                return status;
+            count -= frame_size;
+            continue;
+        }
+        n = frame_size - buffered;
+        if (n > count)
+            n = count;
+        pjmedia_circ_buf_write(sp->buf, sp->zero_buf, n);
+        EM_LOG(6, (THIS_FILE, "write in circ buf %u zeros", n));
+        count -= n;
+        status = sp_flush(sp, tmp_frame, frame_size);
+        if (status != PJ_SUCCESS)
+            return status;
+    }
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t sp_process(struct silence_port *sp,
+        const pjmedia_frame *frame)
 {
-    struct silence_port *sp = (struct silence_port*)this_port;
     unsigned frame_size = frame->size / sizeof(pj_uint16_t);
     unsigned samples_per_frame = sp->base.info.samples_per_frame;
-    pj_int16_t tmp_buf[frame_size];
+    unsigned zero_padding_count = 0;
     pjmedia_frame tmp_frame;
     pj_status_t status;
-    PJ_LOG(6, (THIS_FILE, "packet: sz=%d ts=%llu",
+    EM_LOG(6, (THIS_FILE, "packet: sz=%d ts=%llu",
                 frame->size/sizeof(pj_uint16_t), frame->timestamp.u64));
-    PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
     if (frame->type == PJMEDIA_FRAME_TYPE_NONE ) {
-        PJ_LOG(5, (THIS_FILE, "empty frame passed"));
-	    return pjmedia_port_put_frame(sp->dn_port, frame);
+        EM_LOG(5, (THIS_FILE, "empty frame passed"));
+        return em_batch_add(&sp->out, frame);
     }
+    PJ_ASSERT_RETURN(frame_size > 0 && frame_size <= sp->frame_capacity,
+            PJ_ETOOBIG);
 
     if (sp->frames == 0) {
-        PJ_LOG(5, (THIS_FILE, "%u: this is first received frame,  "
+        EM_LOG(5, (THIS_FILE, "%u: this is first received frame,  "
                     "so just update last timestamp with its "
                     "timestamp + size: %llu + %d",
                     sp->frames,
@@ -84,50 +160,74 @@ static pj_status_t sp_put_frame( pjmedia_port *this_port,
                     samples_per_frame));
         sp->last_ts.u64 = frame->timestamp.u64 + samples_per_frame;
     } else if (frame->timestamp.u64 == 0){
-        PJ_LOG(5, (THIS_FILE, "%u: frame timestamp is unknown, so increment "
+        EM_LOG(5, (THIS_FILE, "%u: frame timestamp is unknown, so increment "
                     "by %d (samples per frame)", sp->frames, samples_per_frame));
         sp->last_ts.u64 += samples_per_frame;
     } else if (frame->timestamp.u64 < sp->last_ts.u64 ){
-        PJ_LOG(5, (THIS_FILE, "%u: received frame timestamp is lesser than "
+        EM_LOG(5, (THIS_FILE, "%u: received frame timestamp is lesser than "
                     "latest timestamp (%llu < %llu)", sp->frames,
                     frame->timestamp.u64, sp->last_ts.u64));
         sp->last_ts.u64 = frame->timestamp.u64 + samples_per_frame;
     } else if (frame->timestamp.u64 > sp->last_ts.u64){
-        unsigned zero_padding_count = frame->timestamp.u64 - sp->last_ts.u64;
-        pj_int16_t zero_buf[zero_padding_count];
-        PJ_LOG(5, (THIS_FILE, "%u: received frame timestamp is greater than "
+        zero_padding_count = frame->timestamp.u64 - sp->last_ts.u64;
+        EM_LOG(5, (THIS_FILE, "%u: received frame timestamp is greater than "
                 "latest timestamp (%llu > %llu), fill output buffer with %d "
                 "empty frames",
                 sp->frames,
                 frame->timestamp.u64,
                 sp->last_ts.u64,
                 zero_padding_count));
-        pj_bzero(zero_buf, sizeof(zero_buf));
-        pjmedia_circ_buf_write(sp->buf, zero_buf, zero_padding_count);
-        PJ_LOG(6, (THIS_FILE, "write in circ buf %u zeros",
-                    zero_padding_count));
         sp->last_ts.u64 = frame->timestamp.u64 + samples_per_frame;
     } else {
         sp->last_ts.u64 += samples_per_frame;
     }
-    pjmedia_circ_buf_write(sp->buf, (pj_uint16_t*)frame->buf, frame_size);
-    PJ_LOG(6, (THIS_FILE, "write in circ buf %u bytes", frame_size));
-    pj_memcpy(&tmp_frame, frame, sizeof(pjmedia_frame));
-    tmp_frame.buf = (void*)tmp_buf;
     sp->frames ++;
+    sp->stats.frames++;
 
-    /* put everything saved into buffer
-    FIXME: wrong timestamps. Fortunately, wav writer don't care about
-    timestamps
-    */
-    while (pjmedia_circ_buf_get_len(sp->buf) >= frame_size){
-        pjmedia_circ_buf_read(sp->buf, tmp_buf, frame_size);
-        PJ_LOG(6, (THIS_FILE, "read from circ buf %u bytes", frame_size));
-        status = pjmedia_port_put_frame(sp->dn_port, &tmp_frame);
+    /* FIXME: wrong timestamps. Fortunately, wav writer don't care about
+       timestamps */
+    pj_memcpy(&tmp_frame, frame, sizeof(pjmedia_frame));
+    if (zero_padding_count) {
+        sp->stats.paddings++;
+        sp->stats.padding_samples += zero_padding_count;
+        em_event_add(EM_EV_SILENCE, EM_EV_PAD, frame->timestamp.u64,
+                zero_padding_count);
+        status = sp_put_zeros(sp, &tmp_frame, frame_size, zero_padding_count);
         if (status != PJ_SUCCESS)
             return status;
     }
-    return PJ_SUCCESS;
+
+    /* output is aligned: pass the frame as is, without any copying */
+    if (pjmedia_circ_buf_get_len(sp->buf) == 0)
+        return em_batch_add(&sp->out, frame);
+
+    pjmedia_circ_buf_write(sp->buf, (pj_int16_t*)frame->buf, frame_size);
+    EM_LOG(6, (THIS_FILE, "write in circ buf %u bytes", frame_size));
+    return sp_flush(sp, &tmp_frame, frame_size);
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_silence_port_put_frames(pjmedia_port *port,
+        const pjmedia_frame frames[], unsigned count)
+{
+    struct silence_port *sp = (struct silence_port*)port;
+    pj_status_t status;
+    unsigned i;
+    PJ_ASSERT_RETURN(port && (frames || !count), PJ_EINVAL);
+    PJ_ASSERT_RETURN(port->info.signature == SIGNATURE, PJ_EINVAL);
+    for (i=0; i<count; i++) {
+        status = sp_process(sp, &frames[i]);
+        if (status != PJ_SUCCESS)
+            return status;
+    }
+    return em_batch_flush(&sp->out);
+}
+
+
+static pj_status_t sp_put_frame( pjmedia_port *this_port,
+				 const pjmedia_frame *frame)
+{
+    return pjmedia_silence_port_put_frames(this_port, frame, 1);
 }
 
 
@@ -1,6 +1,28 @@
+#ifndef __SILENCE_PORT_H__
+#define __SILENCE_PORT_H__
+
 #include <pjlib.h>
 #include <pjlib-util.h>
 #include <pjmedia.h>
 
+#define PJMEDIA_SILENCE_PORT_SIGNATURE  \
+    PJMEDIA_PORT_SIGNATURE('S', 'I', 'L', 'E')
+
+typedef struct em_silence_statistics {
+    pj_uint64_t       frames;           /* audio frames put */
+    pj_uint64_t       paddings;         /* gaps filled with silence */
+    pj_uint64_t       padding_samples;  /* zero samples inserted */
+} em_silence_statistics;
+
 PJ_DECL(pj_status_t) pjmedia_silence_port_create(pj_pool_t *pool,
         pjmedia_port *dn_port, unsigned buffer_size, pjmedia_port **p_port);
+
+/* the frames one after another, output is passed downstream in arrays,
+   see em_port_put_frames */
+PJ_DECL(pj_status_t) pjmedia_silence_port_put_frames(pjmedia_port *port,
+        const pjmedia_frame frames[], unsigned count);
+
+PJ_DECL(pj_status_t) pjmedia_silence_port_get_statistics(
+        const pjmedia_port *port, em_silence_statistics *stats);
+
+#endif	/* __SILENCE_PORT_H__ */
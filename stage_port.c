@@ -0,0 +1,232 @@
+#include <sched.h>
+#include <unistd.h>
+#include "stage_port.h"
+#include "batch.h"
+#include "em_log.h"
+#define SIGNATURE   PJMEDIA_STAGE_PORT_SIGNATURE
+#define THIS_FILE   "stage_port.c"
+#define CACHE_LINE  64
+#define SPIN_COUNT  64      /* busy waits before yielding the CPU */
+#define YIELD_COUNT 64      /* yields before sleeping */
+#define SLEEP_US    50
+
+/*
+ * head is written by the consumer only and tail by the producer only, each
+ * side keeps a copy of the other's counter and reloads it only when the
+ * ring looks full or empty. Counters grow forever, slot is counter & mask.
+ * Release stores of a counter publish the slots before it.
+ */
+struct stage_port
+{
+    pjmedia_port      base;
+    pjmedia_port     *dn_port;
+    pjmedia_frame    *frames;     /* capacity headers, buf is the slot's */
+    pj_uint8_t       *payload;    /* capacity * slot_size */
+    unsigned          slot_size;
+    pj_uint64_t       mask;
+    pj_thread_t      *thread;
+    pj_status_t       status;     /* first error of dn_port, set by consumer */
+
+    /* pool gives no cache line alignment, so the sides are kept a whole
+       line apart: they never share one wherever the port is */
+    char              pad0[CACHE_LINE];
+
+    /* producer side */
+    pj_uint64_t       tail;
+    pj_uint64_t       head_cache;
+    pj_bool_t         stop;       /* no more frames */
+    char              pad1[CACHE_LINE];
+
+    /* consumer side */
+    pj_uint64_t       head;
+    pj_uint64_t       tail_cache;
+    char              pad2[CACHE_LINE];
+};
+
+
+static pj_status_t stp_put_frame(pjmedia_port *this_port,
+				const pjmedia_frame *frame);
+static pj_status_t stp_get_frame(pjmedia_port *this_port,
+				pjmedia_frame *frame);
+static pj_status_t stp_on_destroy(pjmedia_port *this_port);
+static int stp_thread_proc(void *arg);
+
+
+/* waiting side spins first, the other one is likely to be busy right now */
+static void stp_wait(unsigned *spins)
+{
+    if (*spins < SPIN_COUNT) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    } else if (*spins < SPIN_COUNT + YIELD_COUNT) {
+        sched_yield();
+    } else {
+        usleep(SLEEP_US);
+    }
+    (*spins)++;
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_stage_port_create(pj_pool_t *pool,
+        pjmedia_port *dn_port, unsigned capacity, pjmedia_port **p_port)
+{
+    const pj_str_t stage = { "stage", 5 };
+    struct stage_port *stp;
+    pj_uint64_t size = 1;
+    pj_uint64_t i;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(pool && dn_port && capacity && p_port, PJ_EINVAL);
+
+    /* Create the port itself */
+    stp = PJ_POOL_ZALLOC_T(pool, struct stage_port);
+    pjmedia_port_info_init(&stp->base.info, &stage, SIGNATURE,
+			   dn_port->info.clock_rate,
+			   dn_port->info.channel_count,
+			   dn_port->info.bits_per_sample,
+			   dn_port->info.samples_per_frame);
+
+    /* the whole ring is allocated here */
+    while (size < capacity)
+        size <<= 1;
+    stp->mask = size - 1;
+    stp->slot_size = dn_port->info.bytes_per_frame;
+    stp->frames = (pjmedia_frame*)pj_pool_calloc(pool, (pj_size_t)size,
+            sizeof(pjmedia_frame));
+    stp->payload = (pj_uint8_t*)pj_pool_alloc(pool,
+            (pj_size_t)size * stp->slot_size);
+    if (!stp->frames || !stp->payload)
+        return PJ_ENOMEM;
+    for (i=0; i<size; i++)
+        stp->frames[i].buf = stp->payload + i * stp->slot_size;
+
+    /* More init */
+    stp->dn_port = dn_port;
+    stp->base.get_frame = &stp_get_frame;
+    stp->base.put_frame = &stp_put_frame;
+    stp->base.on_destroy = &stp_on_destroy;
+    stp->status = PJ_SUCCESS;
+    status = pj_thread_create(pool, "stage", &stp_thread_proc, stp, 0, 0,
+            &stp->thread);
+    if (status != PJ_SUCCESS)
+        return status;
+    PJ_LOG(5, (THIS_FILE, "stage port created: %u frames of %u bytes",
+                (unsigned)size, stp->slot_size));
+
+    /* Done */
+    *p_port = &stp->base;
+
+    return PJ_SUCCESS;
+}
+
+
+static int stp_thread_proc(void *arg)
+{
+    struct stage_port *stp = (struct stage_port*)arg;
+    unsigned spins = 0;
+
+    for (;;) {
+        pj_uint64_t head = stp->head;
+        pj_uint64_t first, count;
+        if (head == stp->tail_cache) {
+            /* stop is read before tail: frames put before it are seen */
+            pj_bool_t stop = __atomic_load_n(&stp->stop, __ATOMIC_ACQUIRE);
+            stp->tail_cache = __atomic_load_n(&stp->tail, __ATOMIC_ACQUIRE);
+            if (head == stp->tail_cache) {
+                if (stop)
+                    break;
+                stp_wait(&spins);
+                continue;
+            }
+        }
+        spins = 0;
+        /* frames up to the end of the ring go in one array */
+        first = head & stp->mask;
+        count = stp->tail_cache - head;
+        if (count > stp->mask + 1 - first)
+            count = stp->mask + 1 - first;
+        if (count > EM_BATCH_MAX)
+            count = EM_BATCH_MAX;
+        if (stp->status == PJ_SUCCESS) {
+            pj_status_t status = em_port_put_frames(stp->dn_port,
+                    &stp->frames[first], (unsigned)count);
+            if (status != PJ_SUCCESS) {
+                PJ_LOG(3, (THIS_FILE, "downstream port failed: %d",
+                            status));
+                __atomic_store_n(&stp->status, status, __ATOMIC_RELEASE);
+            }
+        }
+        __atomic_store_n(&stp->head, head + count, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_stage_port_put_frames(pjmedia_port *port,
+        const pjmedia_frame frames[], unsigned count)
+{
+    struct stage_port *stp = (struct stage_port*)port;
+    pj_status_t status;
+    unsigned i;
+
+    PJ_ASSERT_RETURN(port && (frames || !count), PJ_EINVAL);
+    PJ_ASSERT_RETURN(port->info.signature == SIGNATURE, PJ_EINVAL);
+    for (i=0; i<count; i++) {
+        const pjmedia_frame *frame = &frames[i];
+        pjmedia_frame *slot;
+        pj_uint64_t tail = stp->tail;
+        unsigned spins = 0;
+        void *buf;
+
+        status = __atomic_load_n(&stp->status, __ATOMIC_ACQUIRE);
+        if (status != PJ_SUCCESS)
+            return status;
+        PJ_ASSERT_RETURN(frame->type != PJMEDIA_FRAME_TYPE_AUDIO ||
+                frame->size <= stp->slot_size, PJ_ETOOBIG);
+        /* backpressure: wait for a free slot */
+        while (tail - stp->head_cache > stp->mask) {
+            stp->head_cache = __atomic_load_n(&stp->head, __ATOMIC_ACQUIRE);
+            if (tail - stp->head_cache > stp->mask)
+                stp_wait(&spins);
+        }
+        slot = &stp->frames[tail & stp->mask];
+        buf = slot->buf;
+        *slot = *frame;
+        slot->buf = buf;
+        if (frame->type == PJMEDIA_FRAME_TYPE_AUDIO)
+            pj_memcpy(buf, frame->buf, frame->size);
+        else
+            slot->size = 0;
+        __atomic_store_n(&stp->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t stp_put_frame( pjmedia_port *this_port,
+				 const pjmedia_frame *frame)
+{
+    return pjmedia_stage_port_put_frames(this_port, frame, 1);
+}
+
+
+static pj_status_t stp_get_frame( pjmedia_port *this_port,
+				 pjmedia_frame *frame)
+{
+    PJ_UNUSED_ARG(this_port);
+    PJ_UNUSED_ARG(frame);
+    return PJ_EINVALIDOP;
+}
+
+
+static pj_status_t stp_on_destroy(pjmedia_port *this_port)
+{
+    struct stage_port *stp = (struct stage_port*)this_port;
+    PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
+    /* the thread passes the rest of the ring and exits */
+    __atomic_store_n(&stp->stop, PJ_TRUE, __ATOMIC_RELEASE);
+    pj_thread_join(stp->thread);
+    pj_thread_destroy(stp->thread);
+    return stp->status;
+}
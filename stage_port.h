@@ -0,0 +1,34 @@
+#ifndef __STAGE_PORT_H__
+#define __STAGE_PORT_H__
+
+#include <pjlib.h>
+#include <pjlib-util.h>
+#include <pjmedia.h>
+
+#define PJMEDIA_STAGE_PORT_SIGNATURE \
+    PJMEDIA_PORT_SIGNATURE('S', 'T', 'G', 'P')
+
+/* frames of the ring between two stages by default */
+#define EM_STAGE_FRAMES     256
+
+/*
+ * Boundary of pipeline stages. put_frame copies the frame into a ring of
+ * capacity preallocated frames (rounded up to a power of 2, payload of
+ * dn_port's bytes_per_frame) and returns at once, the thread of the port
+ * takes frames out in order and puts them into dn_port, in arrays where
+ * possible. The ring has one producer and one consumer and needs no lock;
+ * a full ring makes put_frame wait for the consumer. The first error of
+ * dn_port is returned by the next put_frame, later frames are discarded.
+ *
+ * Ports downstream run on the thread of the stage, so they must not be
+ * touched by anyone else till the stage port is destroyed: it waits till
+ * every frame is passed and stops the thread, but doesn't destroy dn_port.
+ */
+PJ_DECL(pj_status_t) pjmedia_stage_port_create(pj_pool_t *pool,
+        pjmedia_port *dn_port, unsigned capacity, pjmedia_port **p_port);
+
+/* the frames one after another, see em_port_put_frames */
+PJ_DECL(pj_status_t) pjmedia_stage_port_put_frames(pjmedia_port *port,
+        const pjmedia_frame frames[], unsigned count);
+
+#endif	/* __STAGE_PORT_H__ */
@@ -0,0 +1,207 @@
+#include <string.h>
+#include "stats.h"
+
+#define THIS_FILE   "stats.c"
+
+PJ_DEF(pj_status_t) em_parse_stats_format(const char *value,
+        em_stats_format *format)
+{
+    if (strcmp(value, "text") == 0)
+        *format = EM_STATS_TEXT;
+    else if (strcmp(value, "json") == 0)
+        *format = EM_STATS_JSON;
+    else if (strcmp(value, "csv") == 0)
+        *format = EM_STATS_CSV;
+    else
+        return PJ_EINVAL;
+    return PJ_SUCCESS;
+}
+
+
+/* file names are the only strings which may need escaping */
+static void st_string(FILE *fd, const char *value)
+{
+    if (!value) {
+        fputs("null", fd);
+        return;
+    }
+    fputc('"', fd);
+    for (; *value; value++) {
+        if (*value == '"' || *value == '\\')
+            fprintf(fd, "\\%c", *value);
+        else if ((unsigned char)*value < 0x20)
+            fprintf(fd, "\\u%04x", (unsigned char)*value);
+        else
+            fputc(*value, fd);
+    }
+    fputc('"', fd);
+}
+
+
+/* bins are [lower bound, count] pairs, empty bins are skipped */
+static void st_hist(FILE *fd, const char *name, const em_hist *h)
+{
+    unsigned i;
+    pj_bool_t first = PJ_TRUE;
+    fprintf(fd, "\"%s\":{\"count\":%llu,\"mean\":%.3f,\"max\":%llu,"
+            "\"p50\":%llu,\"p95\":%llu,\"p99\":%llu,\"bin_width\":%u,"
+            "\"bins\":[", name,
+            (unsigned long long)h->count, em_hist_mean(h),
+            (unsigned long long)h->max,
+            (unsigned long long)em_hist_percentile(h, 50),
+            (unsigned long long)em_hist_percentile(h, 95),
+            (unsigned long long)em_hist_percentile(h, 99),
+            h->bin_width);
+    for (i=0; i<EM_HIST_SIZE; i++) {
+        if (!h->bins[i])
+            continue;
+        fprintf(fd, "%s[%llu,%llu]", first ? "" : ",",
+                (unsigned long long)i * h->bin_width,
+                (unsigned long long)h->bins[i]);
+        first = PJ_FALSE;
+    }
+    fputs("]}", fd);
+}
+
+
+PJ_DEF(void) em_stats_print_json(FILE *fd, int point, const em_scenario *sc,
+        const em_result *res)
+{
+    const em_plc_statistics *stats = &res->stats;
+    unsigned i;
+
+    fputc('{', fd);
+    if (point >= 0)
+        fprintf(fd, "\"point\":%d,", point);
+    fputs("\"input\":", fd);
+    st_string(fd, sc->input_file);
+    fputs(",\"output\":", fd);
+    st_string(fd, sc->output_file);
+    fputs(",\"codec\":", fd);
+    st_string(fd, sc->codec_name);
+    fprintf(fd, ",\"bitrate\":%u,\"fpp\":%u,\"plc\":\"%s\",\"p00\":%.4f,"
+            "\"p10\":%.4f,\"bucket_size\":%llu,\"bandwidth_bps\":%.0f,"
+            "\"bandwidth_pps\":%.0f,\"seed\":%llu,\"stream\":%u,"
+            "\"length\":%.3f,",
+            sc->codec_bitrate, sc->fpp, em_plc_mode_name(sc->plc_mode),
+            sc->markov_p00, sc->markov_p10,
+            (unsigned long long)sc->bucket_size, sc->bits_per_second,
+            sc->packets_per_second, (unsigned long long)res->seed,
+            sc->stream, res->sample_length);
+    fprintf(fd, "\"packets\":{\"total\":%llu,\"lost\":%llu,"
+            "\"received\":%llu},\"bytes\":%llu,",
+            (unsigned long long)stats->total,
+            (unsigned long long)stats->lost,
+            (unsigned long long)stats->received,
+            (unsigned long long)res->total_bytes);
+    if (stats->total && res->sample_length > 0)
+        fprintf(fd, "\"bps\":%.2f,\"loss_pct\":%.4f,",
+                res->total_bytes * 8 / res->sample_length,
+                100.0 * stats->lost / stats->total);
+    else
+        fputs("\"bps\":null,\"loss_pct\":null,", fd);
+
+    fputs("\"channel\":{", fd);
+    st_hist(fd, "bursts", &res->loss_bursts);
+    fputc(',', fd);
+    st_hist(fd, "gaps", &res->loss_gaps);
+    fprintf(fd, "},\"bucket\":{\"packets\":%llu,\"dropped\":%llu,",
+            (unsigned long long)res->bucket.packets,
+            (unsigned long long)res->bucket.dropped);
+    st_hist(fd, "depth", &res->bucket.depth);
+    fputc(',', fd);
+    st_hist(fd, "delay_ms", &res->bucket.delay_ms);
+    fprintf(fd, "},\"silence\":{\"frames\":%llu,\"paddings\":%llu,"
+            "\"padding_samples\":%llu},\"plc\":{",
+            (unsigned long long)res->silence.frames,
+            (unsigned long long)res->silence.paddings,
+            (unsigned long long)res->silence.padding_samples);
+    for (i=0; i<EM_PLC_MODE_COUNT; i++)
+        fprintf(fd, "%s\"%s\":%llu", i ? "," : "",
+                em_plc_mode_name((em_plc_mode)i),
+                (unsigned long long)stats->concealed[i]);
+    fputc('}', fd);
+
+    if (res->realtime)
+        fprintf(fd, ",\"pacing\":{\"period_us\":%u,\"late_mean_us\":%.1f,"
+                "\"late_p99_us\":%u,\"late_max_us\":%u,"
+                "\"busy_mean_us\":%.1f,\"busy_max_us\":%u,"
+                "\"overruns\":%llu,\"frames\":%llu}",
+                res->pacing.period_us, res->pacing.late_mean_us,
+                res->pacing.late_p99_us, res->pacing.late_max_us,
+                res->pacing.busy_mean_us, res->pacing.busy_max_us,
+                (unsigned long long)res->pacing.overruns,
+                (unsigned long long)res->pacing.frames);
+    if (res->scored)
+        fprintf(fd, ",\"quality\":{\"snr_db\":%.3f,\"segsnr_db\":%.3f,"
+                "\"lsd_db\":%.3f,\"delay_ms\":%.3f,\"length\":%.3f,"
+                "\"segments\":%u}",
+                res->quality.snr_db, res->quality.segsnr_db,
+                res->quality.lsd_db, res->quality.delay_ms,
+                res->quality.length, res->quality.segments);
+    fputs("}\n", fd);
+}
+
+
+PJ_DEF(void) em_stats_print_csv_header(FILE *fd)
+{
+    fprintf(fd, "codec,fpp,plc,seed,length,total,lost,received,bytes,bps,"
+            "loss_pct,burst_mean,burst_p95,burst_max,gap_mean,gap_max,"
+            "bucket_dropped,depth_mean,depth_max,delay_p50_ms,delay_p95_ms,"
+            "delay_p99_ms,delay_max_ms,paddings,padding_samples,"
+            "plc_empty,plc_repeat,plc_noise,plc_smart,snr,segsnr,lsd,"
+            "delay_ms\n");
+}
+
+
+PJ_DEF(void) em_stats_print_csv(FILE *fd, const em_scenario *sc,
+        const em_result *res)
+{
+    const em_plc_statistics *stats = &res->stats;
+    const em_hist *delay = &res->bucket.delay_ms;
+    unsigned i;
+
+    fprintf(fd, "%s,%u,%s,%llu,%.3f,%llu,%llu,%llu,%llu,",
+            sc->codec_name, sc->fpp, em_plc_mode_name(sc->plc_mode),
+            (unsigned long long)res->seed, res->sample_length,
+            (unsigned long long)stats->total,
+            (unsigned long long)stats->lost,
+            (unsigned long long)stats->received,
+            (unsigned long long)res->total_bytes);
+    if (stats->total && res->sample_length > 0)
+        fprintf(fd, "%.2f,%.4f,", res->total_bytes * 8 / res->sample_length,
+                100.0 * stats->lost / stats->total);
+    else
+        fputs(",,", fd);
+    fprintf(fd, "%.3f,%llu,%llu,%.3f,%llu,%llu,%.3f,%llu,"
+            "%llu,%llu,%llu,%llu,%llu,%llu",
+            em_hist_mean(&res->loss_bursts),
+            (unsigned long long)em_hist_percentile(&res->loss_bursts, 95),
+            (unsigned long long)res->loss_bursts.max,
+            em_hist_mean(&res->loss_gaps),
+            (unsigned long long)res->loss_gaps.max,
+            (unsigned long long)res->bucket.dropped,
+            em_hist_mean(&res->bucket.depth),
+            (unsigned long long)res->bucket.depth.max,
+            (unsigned long long)em_hist_percentile(delay, 50),
+            (unsigned long long)em_hist_percentile(delay, 95),
+            (unsigned long long)em_hist_percentile(delay, 99),
+            (unsigned long long)delay->max,
+            (unsigned long long)res->silence.paddings,
+            (unsigned long long)res->silence.padding_samples);
+    for (i=0; i<EM_PLC_MODE_COUNT; i++)
+        fprintf(fd, ",%llu", (unsigned long long)stats->concealed[i]);
+    if (res->scored)
+        fprintf(fd, ",%.2f,%.2f,%.2f,%.2f\n",
+                res->quality.snr_db, res->quality.segsnr_db,
+                res->quality.lsd_db, res->quality.delay_ms);
+    else
+        fputs(",,,,\n", fd);
+}
+
+
+PJ_DEF(void) em_stats_print_csv_failed(FILE *fd, const em_scenario *sc)
+{
+    fprintf(fd, "%s,%u,%s,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,\n",
+            sc->codec_name, sc->fpp, em_plc_mode_name(sc->plc_mode));
+}
@@ -0,0 +1,33 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdio.h>
+#include "emulator.h"
+
+typedef enum em_stats_format {
+    EM_STATS_TEXT,
+    EM_STATS_JSON,
+    EM_STATS_CSV
+} em_stats_format;
+
+PJ_DECL(pj_status_t) em_parse_stats_format(const char *value,
+        em_stats_format *format);
+
+/*
+ * Statistics of the run as one JSON object on a single line, so that runs
+ * may be appended to one file (JSON lines). point is the index of sweep
+ * point, negative for single runs.
+ */
+PJ_DECL(void) em_stats_print_json(FILE *fd, int point, const em_scenario *sc,
+        const em_result *res);
+
+/* the same as flat CSV: header line and one row per run */
+PJ_DECL(void) em_stats_print_csv_header(FILE *fd);
+
+PJ_DECL(void) em_stats_print_csv(FILE *fd, const em_scenario *sc,
+        const em_result *res);
+
+/* row of a failed run: scenario columns only, the rest are empty */
+PJ_DECL(void) em_stats_print_csv_failed(FILE *fd, const em_scenario *sc);
+
+#endif	/* __STATS_H__ */
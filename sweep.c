@@ -0,0 +1,401 @@
+#include <ctype.h>
+#include "sweep.h"
+#include "workers.h"
+#define THIS_FILE   "sweep.c"
+#define MAX_LINE    1024
+#define MAX_VALUES  64
+#define MAX_GRID_SIZE   (64<<20)    /* bytes of sweep_point array */
+
+/* grid axes, in the order they are enumerated (last one changes fastest) */
+enum {
+    AX_CODEC,
+    AX_FPP,
+    AX_PLC,
+    AX_LOSS,
+    AX_BURST_RATIO,
+    AX_BANDWIDTH,
+    AX_BUCKET_SIZE,
+    AX_COUNT
+};
+
+static const char *axis_names[AX_COUNT] = {
+    "codec", "fpp", "plc", "loss", "burst-ratio", "bandwidth", "bucket-size"
+};
+
+struct sweep_axis
+{
+    unsigned          count;
+    char             *values[MAX_VALUES];
+};
+
+/* result of a point which is running or waits for the previous ones */
+struct sweep_slot
+{
+    struct sweep_slot *next;          /* in the free list */
+    em_result          res;
+};
+
+struct sweep_point
+{
+    em_scenario       sc;
+    const char       *loss;
+    const char       *burst_ratio;
+    const char       *bandwidth;
+    pj_status_t       status;
+    pj_bool_t         done;
+    struct sweep_slot *slot;          /* NULL unless running or done */
+};
+
+struct sweep
+{
+    const em_context   *ctx;
+    struct sweep_point *points;
+    unsigned            count;
+    em_stats_format     format;
+    FILE               *stats_fd;
+    pj_mutex_t         *mutex;        /* guards everything below */
+    pj_pool_t          *pool;
+    struct sweep_slot  *free_slots;
+    unsigned            next_print;   /* points before it are printed */
+};
+
+
+static char *sw_strdup(pj_pool_t *pool, const char *str, int len)
+{
+    char *dup = (char*)pj_pool_alloc(pool, len + 1);
+    pj_memcpy(dup, str, len);
+    dup[len] = '\0';
+    return dup;
+}
+
+
+static char *sw_trim(char *str)
+{
+    char *end;
+    while (isspace((unsigned char)*str))
+        str++;
+    end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1]))
+        *--end = '\0';
+    return str;
+}
+
+
+static pj_status_t sw_parse_grid(pj_pool_t *pool, const char *grid_file,
+        struct sweep_axis axes[AX_COUNT])
+{
+    char line[MAX_LINE];
+    unsigned lineno = 0;
+    FILE *fd = fopen(grid_file, "r");
+    if (!fd) {
+        fprintf(stderr, "Can't open sweep grid file %s\n", grid_file);
+        return PJ_ENOTFOUND;
+    }
+    while (fgets(line, sizeof(line), fd)) {
+        char *key, *value, *tok, *eq;
+        int ax;
+        lineno++;
+        if ((tok = strchr(line, '#')) != NULL)
+            *tok = '\0';
+        key = sw_trim(line);
+        if (*key == '\0')
+            continue;
+        eq = strchr(key, '=');
+        if (!eq)
+            goto err;
+        *eq = '\0';
+        key = sw_trim(key);
+        value = eq + 1;
+        for (ax=0; ax<AX_COUNT; ax++)
+            if (strcmp(key, axis_names[ax]) == 0)
+                break;
+        if (ax == AX_COUNT)
+            goto err;
+        for (tok = strtok(value, ", \t\r\n"); tok;
+                tok = strtok(NULL, ", \t\r\n")) {
+            if (axes[ax].count == MAX_VALUES) {
+                fprintf(stderr, "%s:%u: too many values for %s\n",
+                        grid_file, lineno, key);
+                fclose(fd);
+                return PJ_ETOOMANY;
+            }
+            axes[ax].values[axes[ax].count++] = sw_strdup(pool, tok,
+                    strlen(tok));
+        }
+    }
+    fclose(fd);
+    return PJ_SUCCESS;
+
+err:
+    fprintf(stderr, "%s:%u: expected \"<axis> = <value>, <value>...\" "
+            "where axis is one of codec, fpp, plc, loss, burst-ratio, "
+            "bandwidth, bucket-size\n", grid_file, lineno);
+    fclose(fd);
+    return PJ_EINVAL;
+}
+
+
+/* fill point with the defaults overridden by the grid values */
+static pj_status_t sw_make_point(pj_pool_t *pool, const em_scenario *defaults,
+        struct sweep_axis axes[AX_COUNT], unsigned index,
+        struct sweep_point *pt)
+{
+    const char *value[AX_COUNT];
+    unsigned rest = index;
+    int ax, prefix_len;
+
+    for (ax=AX_COUNT-1; ax>=0; ax--) {
+        if (axes[ax].count == 0) {
+            value[ax] = NULL;
+            continue;
+        }
+        value[ax] = axes[ax].values[rest % axes[ax].count];
+        rest /= axes[ax].count;
+    }
+
+    pt->sc = *defaults;
+    pt->loss = value[AX_LOSS];
+    pt->burst_ratio = value[AX_BURST_RATIO];
+    pt->bandwidth = value[AX_BANDWIDTH];
+    pt->status = PJ_SUCCESS;
+    pt->done = PJ_FALSE;
+    pt->slot = NULL;
+
+    if (value[AX_CODEC])
+        pt->sc.codec_name = value[AX_CODEC];
+    if (!pt->sc.codec_name) {
+        fprintf(stderr, "codec is set neither in command line nor in grid\n");
+        return PJ_EINVAL;
+    }
+    if (value[AX_FPP]) {
+        pt->sc.fpp = atoi(value[AX_FPP]);
+        if (pt->sc.fpp < 1 || pt->sc.fpp > MAX_FPP) {
+            fprintf(stderr, "fpp must be between 1 and %d\n", MAX_FPP);
+            return PJ_EINVAL;
+        }
+    }
+    if (value[AX_PLC] &&
+            em_parse_plc_mode(value[AX_PLC], &pt->sc.plc_mode) != PJ_SUCCESS) {
+        fprintf(stderr, "Unknown argument for PLC: %s\n", value[AX_PLC]);
+        return PJ_EINVAL;
+    }
+    if ((value[AX_LOSS] || value[AX_BURST_RATIO]) &&
+            (pt->sc.loss_model || pt->sc.trace_file)) {
+        fprintf(stderr, "loss axes can't be used along with loss model "
+                "or trace\n");
+        return PJ_EINVAL;
+    }
+    if (value[AX_LOSS] || value[AX_BURST_RATIO]) {
+        double loss = value[AX_LOSS] ? atof(value[AX_LOSS]) : -1;
+        double burst = value[AX_BURST_RATIO] ? atof(value[AX_BURST_RATIO]) : -1;
+        if (loss < 0 || loss > 100 || (value[AX_BURST_RATIO] && burst <= 0) ||
+                em_markov_params(-1, -1, loss, burst, &pt->sc.markov_p00,
+                    &pt->sc.markov_p10) != PJ_SUCCESS) {
+            fprintf(stderr, "wrong loss/burst-ratio combination in grid\n");
+            return PJ_EINVAL;
+        }
+    }
+    if (value[AX_BANDWIDTH]) {
+        if (em_parse_bandwidth(value[AX_BANDWIDTH], &pt->sc.bits_per_second,
+                    &pt->sc.packets_per_second) != PJ_SUCCESS) {
+            fprintf(stderr, "Bandwidth value must ends with "
+                    "\"bps\" or \"pps\" \n");
+            return PJ_EINVAL;
+        }
+        pt->sc.sent_delay = 0;
+    }
+    if (value[AX_BUCKET_SIZE])
+        pt->sc.bucket_size = atoi(value[AX_BUCKET_SIZE]);
+
+    /* out.wav -> out-0000.wav, out-0001.wav, ... */
+    if (!defaults->output_file)
+        return PJ_SUCCESS;
+    prefix_len = strlen(defaults->output_file);
+    if (prefix_len > 4 &&
+            strcasecmp(&defaults->output_file[prefix_len-4], ".wav") == 0)
+        prefix_len -= 4;
+    pt->sc.output_file = pj_pool_alloc(pool, prefix_len + 16);
+    sprintf((char*)pt->sc.output_file, "%.*s-%04u.wav", prefix_len,
+            defaults->output_file, index);
+    return PJ_SUCCESS;
+}
+
+
+static void sw_print_header(const struct sweep *sw)
+{
+    if (sw->format == EM_STATS_JSON)
+        return;
+    if (sw->format == EM_STATS_CSV) {
+        /* axes of the grid before the columns of a single run */
+        fprintf(sw->stats_fd, "point,loss,burst_ratio,p00,p10,bandwidth,"
+                "bucket_size,output,status,");
+        em_stats_print_csv_header(sw->stats_fd);
+        return;
+    }
+    fprintf(sw->stats_fd, "point,codec,fpp,plc,loss,burst_ratio,p00,p10,"
+            "bandwidth,bucket_size,output,status,length,sent,lost,received,"
+            "real_bps,loss_pct,snr,segsnr,lsd,delay_ms\n");
+}
+
+
+/* res is NULL if the point failed */
+static void sw_print_row(FILE *fd, unsigned index,
+        const struct sweep_point *pt, const em_result *res)
+{
+    const em_plc_statistics *stats;
+    fprintf(fd, "%u,%s,%u,%s,%s,%s,%.4f,%.4f,%s,%u,%s,",
+            index, pt->sc.codec_name, pt->sc.fpp,
+            em_plc_mode_name(pt->sc.plc_mode),
+            pt->loss ? pt->loss : "", pt->burst_ratio ? pt->burst_ratio : "",
+            pt->sc.markov_p00, pt->sc.markov_p10,
+            pt->bandwidth ? pt->bandwidth : "", (unsigned)pt->sc.bucket_size,
+            pt->sc.output_file ? pt->sc.output_file : "");
+    if (!res || res->stats.total == 0) {
+        fprintf(fd, "%d,,,,,,,,,,\n", pt->status);
+        return;
+    }
+    stats = &res->stats;
+    fprintf(fd, "0,%.2f,%llu,%llu,%llu,%.2f,%.2f,",
+            res->sample_length,
+            (unsigned long long)stats->total, (unsigned long long)stats->lost,
+            (unsigned long long)stats->received,
+            res->total_bytes * 8 / res->sample_length,
+            100.0 * stats->lost/stats->total);
+    if (res->scored)
+        fprintf(fd, "%.2f,%.2f,%.2f,%.2f\n",
+                res->quality.snr_db, res->quality.segsnr_db,
+                res->quality.lsd_db, res->quality.delay_ms);
+    else
+        fprintf(fd, ",,,\n");
+}
+
+
+static void sw_print_point(const struct sweep *sw, unsigned index)
+{
+    const struct sweep_point *pt = &sw->points[index];
+    const em_result *res = pt->status == PJ_SUCCESS ? &pt->slot->res : NULL;
+
+    if (sw->format == EM_STATS_JSON) {
+        /* one line per point, failed ones have status only */
+        if (res)
+            em_stats_print_json(sw->stats_fd, index, &pt->sc, res);
+        else
+            fprintf(sw->stats_fd, "{\"point\":%u,\"status\":%d}\n", index,
+                    pt->status);
+    } else if (sw->format == EM_STATS_CSV) {
+        fprintf(sw->stats_fd, "%u,%s,%s,%.4f,%.4f,%s,%u,%s,%d,", index,
+                pt->loss ? pt->loss : "",
+                pt->burst_ratio ? pt->burst_ratio : "",
+                pt->sc.markov_p00, pt->sc.markov_p10,
+                pt->bandwidth ? pt->bandwidth : "",
+                (unsigned)pt->sc.bucket_size,
+                pt->sc.output_file ? pt->sc.output_file : "",
+                pt->status);
+        if (res)
+            em_stats_print_csv(sw->stats_fd, &pt->sc, res);
+        else
+            em_stats_print_csv_failed(sw->stats_fd, &pt->sc);
+    } else {
+        sw_print_row(sw->stats_fd, index, pt, res);
+    }
+}
+
+
+static pj_status_t sw_job(void *arg, unsigned job_index)
+{
+    struct sweep *sw = (struct sweep*)arg;
+    struct sweep_point *pt = &sw->points[job_index];
+    struct sweep_slot *slot;
+    pj_status_t status;
+
+    /* slots are reused, so only points which run or wait for the previous
+       ones to be printed keep their results */
+    pj_mutex_lock(sw->mutex);
+    slot = sw->free_slots;
+    if (slot)
+        sw->free_slots = slot->next;
+    else
+        slot = PJ_POOL_ALLOC_T(sw->pool, struct sweep_slot);
+    pj_mutex_unlock(sw->mutex);
+
+    PJ_LOG(4, (THIS_FILE, "point %u: %s", job_index,
+                pt->sc.output_file ? pt->sc.output_file : "no output"));
+    status = em_run_scenario(sw->ctx, &pt->sc, &slot->res);
+
+    pj_mutex_lock(sw->mutex);
+    pt->status = status;
+    pt->slot = slot;
+    pt->done = PJ_TRUE;
+    while (sw->next_print < sw->count &&
+            sw->points[sw->next_print].done) {
+        pt = &sw->points[sw->next_print];
+        sw_print_point(sw, sw->next_print);
+        pt->slot->next = sw->free_slots;
+        sw->free_slots = pt->slot;
+        pt->slot = NULL;
+        sw->next_print++;
+    }
+    pj_mutex_unlock(sw->mutex);
+    /* one broken point must not stop the whole sweep */
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) em_sweep_run(const em_context *ctx,
+        const em_scenario *defaults, const char *grid_file, unsigned jobs,
+        em_stats_format format, FILE *stats_fd)
+{
+    struct sweep_axis axes[AX_COUNT];
+    struct sweep sw;
+    pj_pool_t *pool;
+    pj_status_t status;
+    unsigned i;
+    int ax;
+
+    PJ_ASSERT_RETURN(ctx && defaults && grid_file && stats_fd, PJ_EINVAL);
+
+    pool = pj_pool_create(ctx->pool_factory, "sweep", 4000, 4000, NULL);
+    pj_bzero(&sw, sizeof(sw));
+    pj_bzero(axes, sizeof(axes));
+    status = sw_parse_grid(pool, grid_file, axes);
+    if (status != PJ_SUCCESS)
+        goto on_return;
+
+    sw.ctx = ctx;
+    sw.format = format;
+    sw.stats_fd = stats_fd;
+    sw.pool = pool;
+    sw.count = 1;
+    for (ax=0; ax<AX_COUNT; ax++) {
+        if (axes[ax].count == 0)
+            continue;
+        if (sw.count > MAX_GRID_SIZE / sizeof(struct sweep_point) /
+                axes[ax].count) {
+            fprintf(stderr, "sweep grid is too large\n");
+            status = PJ_ETOOMANY;
+            goto on_return;
+        }
+        sw.count *= axes[ax].count;
+    }
+    sw.points = (struct sweep_point*)pj_pool_calloc(pool, sw.count,
+            sizeof(struct sweep_point));
+    for (i=0; i<sw.count; i++) {
+        status = sw_make_point(pool, defaults, axes, i, &sw.points[i]);
+        if (status != PJ_SUCCESS)
+            goto on_return;
+    }
+    PJ_LOG(4, (THIS_FILE, "sweep of %u points", sw.count));
+
+    status = pj_mutex_create_simple(pool, "sweep", &sw.mutex);
+    if (status != PJ_SUCCESS)
+        goto on_return;
+    /* rows are printed in order of points as soon as they are done */
+    sw_print_header(&sw);
+    status = em_workers_run(ctx->pool_factory, jobs, sw.count, &sw_job, &sw);
+
+on_return:
+    if (sw.mutex)
+        pj_mutex_destroy(sw.mutex);
+    pj_pool_release(pool);
+    return status;
+}
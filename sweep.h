@@ -0,0 +1,12 @@
+#ifndef __SWEEP_H__
+#define __SWEEP_H__
+
+#include <stdio.h>
+#include "emulator.h"
+#include "stats.h"
+
+PJ_DECL(pj_status_t) em_sweep_run(const em_context *ctx,
+        const em_scenario *defaults, const char *grid_file, unsigned jobs,
+        em_stats_format format, FILE *stats_fd);
+
+#endif	/* __SWEEP_H__ */
@@ -0,0 +1,570 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trace_port.h"
+#include "em_log.h"
+#define SIGNATURE   PJMEDIA_PORT_SIGNATURE('T', 'R', 'C', 'E')
+#define THIS_FILE   "trace_port.c"
+#define WINDOW      1024        /* sequence numbers kept around the current one */
+#define REORDER     64          /* how far to read ahead before deciding */
+#define RELEASE     (64<<20)    /* drop pages of the capture every 64MB */
+#define EXT_SEQ_BASE (1LL<<32)  /* keeps extended sequence numbers positive */
+#define EXT_TS_BASE (1LL<<32)   /* the same for RTP timestamps */
+
+enum trace_format {
+    TRACE_PCAP,
+    TRACE_RTPDUMP
+};
+
+struct trace_slot
+{
+    pj_bool_t         present;
+    pj_int64_t        arrival_us;
+    pj_int64_t        rtp_ts;     /* extended */
+};
+
+struct trace_port
+{
+    pjmedia_port	  base;
+    pjmedia_port	 *dn_port;
+
+    /* capture file */
+    const pj_uint8_t *map;
+    pj_size_t         map_size;
+    pj_size_t         offset;     /* next record */
+    pj_size_t         released;   /* pages before this offset are dropped */
+    enum trace_format format;
+    pj_bool_t         swapped;    /* pcap written on other endianness */
+    pj_bool_t         nsec;       /* pcap timestamps in nanoseconds */
+    pj_uint32_t       linktype;
+    pj_int64_t        start_us;   /* rtpdump: start of the recording */
+    pj_bool_t         eof;
+
+    /* selected stream */
+    pj_bool_t         ssrc_set;
+    pj_uint32_t       ssrc;
+    pj_bool_t         started;
+    pj_int64_t        highest;    /* highest extended sequence number read */
+    pj_int64_t        highest_ts; /* highest extended RTP timestamp read */
+    unsigned          rtp_clock;  /* of the timestamps, Hz */
+    pj_int64_t        target;     /* sequence number of the next packet */
+    struct trace_slot slots[WINDOW];
+    pj_bool_t         has_pending;/* packet too far ahead to fit the window */
+    pj_int64_t        pending_seq;
+    struct trace_slot pending;
+
+    /* lateness */
+    pj_int64_t        late_us;
+    pj_bool_t         transit_set;
+    pj_int64_t        min_transit;
+
+    em_trace_statistics stats;
+    em_runs           runs;
+};
+
+
+static pj_status_t tp_put_frame(pjmedia_port *this_port,
+				const pjmedia_frame *frame);
+static pj_status_t tp_get_frame(pjmedia_port *this_port,
+				pjmedia_frame *frame);
+static pj_status_t tp_on_destroy(pjmedia_port *this_port);
+
+
+static pj_uint16_t rd16(const pj_uint8_t *p)
+{
+    return (pj_uint16_t)((p[0] << 8) | p[1]);
+}
+
+static pj_uint32_t rd32(const pj_uint8_t *p)
+{
+    return ((pj_uint32_t)p[0] << 24) | ((pj_uint32_t)p[1] << 16) |
+        ((pj_uint32_t)p[2] << 8) | p[3];
+}
+
+static pj_uint32_t pcap32(const struct trace_port *tp, const pj_uint8_t *p)
+{
+    pj_uint32_t v;
+    pj_memcpy(&v, p, sizeof(v));
+    if (tp->swapped)
+        v = ((v & 0xff) << 24) | ((v & 0xff00) << 8) |
+            ((v >> 8) & 0xff00) | (v >> 24);
+    return v;
+}
+
+
+/* strip link, IP and UDP headers, return UDP payload length or -1 */
+static int tp_udp_payload(const struct trace_port *tp, const pj_uint8_t *pkt,
+        pj_size_t len, const pj_uint8_t **payload)
+{
+    pj_size_t hdr = 0, udp_len;
+    unsigned proto = 0;
+
+    switch (tp->linktype) {
+        case 0:   /* BSD loopback: 4 bytes of host order address family */
+            if (len < 5)
+                return -1;
+            hdr = 4;
+            proto = (pkt[4] >> 4) == 6 ? 0x86dd : 0x0800;
+            break;
+        case 1:   /* ethernet with optional VLAN tags */
+            if (len < 14)
+                return -1;
+            hdr = 12;
+            proto = rd16(pkt + hdr);
+            while ((proto == 0x8100 || proto == 0x88a8) && len >= hdr + 6) {
+                hdr += 4;
+                proto = rd16(pkt + hdr);
+            }
+            hdr += 2;
+            break;
+        case 113: /* linux cooked capture */
+            if (len < 16)
+                return -1;
+            hdr = 16;
+            proto = rd16(pkt + 14);
+            break;
+        case 276: /* linux cooked capture v2 */
+            if (len < 20)
+                return -1;
+            hdr = 20;
+            proto = rd16(pkt);
+            break;
+        case 12:
+        case 14:
+        case 101: /* raw IP */
+            if (len < 1)
+                return -1;
+            proto = (pkt[0] >> 4) == 6 ? 0x86dd : 0x0800;
+            break;
+        default:
+            return -1;
+    }
+    pkt += hdr;
+    len = len > hdr ? len - hdr : 0;
+
+    if (proto == 0x0800) {
+        pj_size_t total;
+        if (len < 20 || (pkt[0] >> 4) != 4 || pkt[9] != 17)
+            return -1;
+        /* fragments, the first one included, have no whole datagram */
+        if (rd16(pkt + 6) & 0x3fff)
+            return -1;
+        hdr = (pkt[0] & 0x0f) * 4;
+        total = rd16(pkt + 2);
+        if (hdr < 20 || total < hdr)
+            return -1;
+        /* ethernet pads short frames, it's not a part of the datagram */
+        if (len > total)
+            len = total;
+    } else if (proto == 0x86dd) {
+        unsigned next;
+        if (len < 40 || (pkt[0] >> 4) != 6)
+            return -1;
+        if (len > 40 + (pj_size_t)rd16(pkt + 4))
+            len = 40 + rd16(pkt + 4);
+        next = pkt[6];
+        hdr = 40;
+        /* extension headers before UDP */
+        while (next != 17) {
+            if (len < hdr + 8)
+                return -1;
+            switch (next) {
+                case 0:     /* hop-by-hop options */
+                case 43:    /* routing */
+                case 60:    /* destination options */
+                    next = pkt[hdr];
+                    hdr += (pkt[hdr + 1] + 1) * 8;
+                    break;
+                case 44:    /* fragment, only an atomic one is whole */
+                    if (rd16(pkt + hdr + 2) & 0xfff9)
+                        return -1;
+                    next = pkt[hdr];
+                    hdr += 8;
+                    break;
+                case 51:    /* authentication header */
+                    next = pkt[hdr];
+                    hdr += (pkt[hdr + 1] + 2) * 4;
+                    break;
+                default:
+                    return -1;
+            }
+        }
+    } else {
+        return -1;
+    }
+    if (len < hdr + 8)
+        return -1;
+    /* UDP length bounds the payload, a datagram cut by snaplen is skipped */
+    udp_len = rd16(pkt + hdr + 4);
+    if (udp_len < 8 || len < hdr + udp_len)
+        return -1;
+    *payload = pkt + hdr + 8;
+    return (int)(udp_len - 8);
+}
+
+
+/* next RTP packet of the capture, PJ_FALSE at the end of file */
+static pj_bool_t tp_next_rtp(struct trace_port *tp, const pj_uint8_t **rtp,
+        int *rtp_len, pj_int64_t *arrival_us)
+{
+    while (!tp->eof) {
+        const pj_uint8_t *rec = tp->map + tp->offset;
+        pj_size_t left = tp->map_size - tp->offset;
+
+        if (tp->format == TRACE_PCAP) {
+            pj_uint32_t incl;
+            pj_int64_t sec, frac;
+            if (left < 16) {
+                tp->eof = PJ_TRUE;
+                break;
+            }
+            incl = pcap32(tp, rec + 8);
+            if (incl > left - 16) {
+                tp->eof = PJ_TRUE;
+                break;
+            }
+            sec = pcap32(tp, rec);
+            frac = pcap32(tp, rec + 4);
+            *arrival_us = sec * 1000000 + (tp->nsec ? frac / 1000 : frac);
+            tp->offset += 16 + incl;
+            *rtp_len = tp_udp_payload(tp, rec + 16, incl, rtp);
+        } else {
+            pj_uint16_t length, plen;
+            if (left < 8) {
+                tp->eof = PJ_TRUE;
+                break;
+            }
+            length = rd16(rec);
+            plen = rd16(rec + 2);
+            if (length < 8 || length > left) {
+                tp->eof = PJ_TRUE;
+                break;
+            }
+            *arrival_us = tp->start_us + (pj_int64_t)rd32(rec + 4) * 1000;
+            tp->offset += length;
+            *rtp = rec + 8;
+            /* zero plen marks RTCP packets */
+            *rtp_len = plen ? length - 8 : -1;
+        }
+
+        /* give the pages we have passed back to the system */
+        if (tp->offset - tp->released >= RELEASE) {
+            pj_size_t page = sysconf(_SC_PAGESIZE);
+            pj_size_t upto = tp->offset & ~(page - 1);
+            madvise((void*)(tp->map + tp->released), upto - tp->released,
+                    MADV_DONTNEED);
+            tp->released = upto;
+        }
+
+        if (*rtp_len < 12 || ((*rtp)[0] >> 6) != 2)
+            continue;
+        /* RTCP packets share the port with RTP sometimes */
+        if ((*rtp)[1] >= 200 && (*rtp)[1] <= 204)
+            continue;
+        return PJ_TRUE;
+    }
+    return PJ_FALSE;
+}
+
+
+/* RTP clock of static payload types (RFC 3551), 0 for dynamic ones */
+static unsigned tp_payload_clock(unsigned pt)
+{
+    switch (pt) {
+        case 6:  return 16000;
+        case 10:
+        case 11: return 44100;
+        case 14: return 90000;
+        case 16: return 11025;
+        case 17: return 22050;
+        default: return pt <= 18 ? 8000 : 0;
+    }
+}
+
+
+static void tp_store(struct trace_port *tp, pj_int64_t seq,
+        const struct trace_slot *slot)
+{
+    if (seq < tp->target)
+        return;     /* duplicate or too late to matter */
+    tp->slots[seq % WINDOW] = *slot;
+}
+
+
+/* read the capture until the fate of the target packet is known */
+static void tp_fill(struct trace_port *tp)
+{
+    const pj_uint8_t *rtp;
+    int rtp_len;
+    pj_int64_t arrival_us;
+
+    if (tp->has_pending && tp->pending_seq < tp->target + WINDOW) {
+        tp_store(tp, tp->pending_seq, &tp->pending);
+        tp->has_pending = PJ_FALSE;
+    }
+    while (!tp->has_pending &&
+            (!tp->started || tp->highest < tp->target + REORDER) &&
+            tp_next_rtp(tp, &rtp, &rtp_len, &arrival_us)) {
+        struct trace_slot slot;
+        pj_uint32_t ssrc = rd32(rtp + 8);
+        pj_uint16_t seq16 = rd16(rtp + 2);
+        pj_uint32_t ts32 = rd32(rtp + 4);
+        pj_int64_t seq, ts;
+
+        if (!tp->ssrc_set) {
+            tp->ssrc = ssrc;
+            tp->ssrc_set = PJ_TRUE;
+            PJ_LOG(4, (THIS_FILE, "using RTP stream with SSRC 0x%08x", ssrc));
+        } else if (ssrc != tp->ssrc) {
+            continue;
+        }
+
+        /* extend sequence number to the one closest to the highest */
+        if (!tp->started) {
+            seq = EXT_SEQ_BASE + seq16;
+            tp->started = PJ_TRUE;
+            tp->highest = seq;
+            tp->target = seq;
+            tp->highest_ts = EXT_TS_BASE + ts32;
+            if (!tp->rtp_clock)
+                tp->rtp_clock = tp_payload_clock(rtp[1] & 0x7f);
+            if (!tp->rtp_clock) {
+                tp->rtp_clock = tp->base.info.clock_rate;
+                PJ_LOG(3, (THIS_FILE, "dynamic payload type %u, RTP clock "
+                            "is taken to be %u Hz", (unsigned)(rtp[1] & 0x7f),
+                            tp->rtp_clock));
+            }
+        } else {
+            seq = (tp->highest & ~(pj_int64_t)0xffff) | seq16;
+            if (seq < tp->highest - 0x8000)
+                seq += 0x10000;
+            else if (seq > tp->highest + 0x8000)
+                seq -= 0x10000;
+            if (seq > tp->highest)
+                tp->highest = seq;
+        }
+
+        /* timestamps start at random and may wrap in a long capture */
+        ts = (tp->highest_ts & ~(pj_int64_t)0xffffffff) | ts32;
+        if (ts < tp->highest_ts - 0x80000000LL)
+            ts += 0x100000000LL;
+        else if (ts > tp->highest_ts + 0x80000000LL)
+            ts -= 0x100000000LL;
+        if (ts > tp->highest_ts)
+            tp->highest_ts = ts;
+
+        slot.present = PJ_TRUE;
+        slot.arrival_us = arrival_us;
+        slot.rtp_ts = ts;
+        if (seq >= tp->target + WINDOW) {
+            tp->has_pending = PJ_TRUE;
+            tp->pending_seq = seq;
+            tp->pending = slot;
+        } else {
+            tp_store(tp, seq, &slot);
+        }
+    }
+}
+
+
+static pj_status_t tp_open(struct trace_port *tp, const char *filename)
+{
+    struct stat st;
+    pj_uint32_t magic;
+    void *map;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return PJ_STATUS_FROM_OS(errno);
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return PJ_STATUS_FROM_OS(errno);
+    }
+    if (st.st_size < 24) {
+        close(fd);
+        return PJ_ETOOSMALL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return PJ_STATUS_FROM_OS(errno);
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    tp->map = (const pj_uint8_t*)map;
+    tp->map_size = st.st_size;
+
+    pj_memcpy(&magic, tp->map, sizeof(magic));
+    if (magic == 0xa1b2c3d4 || magic == 0xd4c3b2a1 ||
+            magic == 0xa1b23c4d || magic == 0x4d3cb2a1) {
+        tp->format = TRACE_PCAP;
+        tp->swapped = (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1);
+        tp->nsec = (magic == 0xa1b23c4d || magic == 0x4d3cb2a1);
+        tp->linktype = pcap32(tp, tp->map + 20) & 0x0fffffff;
+        tp->offset = 24;
+    } else if (memcmp(tp->map, "#!rtpplay1.0 ", 13) == 0) {
+        const pj_uint8_t *eol = memchr(tp->map, '\n', tp->map_size);
+        if (!eol || eol + 1 + 16 > tp->map + tp->map_size)
+            goto unsupported;
+        tp->format = TRACE_RTPDUMP;
+        tp->start_us = (pj_int64_t)rd32(eol + 1) * 1000000 + rd32(eol + 5);
+        tp->offset = eol + 1 + 16 - tp->map;
+    } else {
+        goto unsupported;
+    }
+    PJ_LOG(5, (THIS_FILE, "opened %s capture %s, %llu bytes",
+                tp->format == TRACE_PCAP ? "pcap" : "rtpdump", filename,
+                (unsigned long long)tp->map_size));
+    return PJ_SUCCESS;
+
+unsupported:
+    PJ_LOG(2, (THIS_FILE, "%s is neither pcap nor rtpdump file", filename));
+    munmap((void*)tp->map, tp->map_size);
+    return PJ_ENOTSUP;
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_trace_port_create(pj_pool_t *pool,
+        pjmedia_port *dn_port, const char *filename, const pj_uint32_t *ssrc,
+        unsigned late_ms, unsigned rtp_clock, pjmedia_port **p_port)
+{
+    const pj_str_t trace = { "trace", 5 };
+    struct trace_port *tp;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(pool && dn_port && filename && p_port, PJ_EINVAL);
+
+    /* Create the port itself */
+    tp = PJ_POOL_ZALLOC_T(pool, struct trace_port);
+    em_runs_init(&tp->runs);
+    status = tp_open(tp, filename);
+    if (status != PJ_SUCCESS)
+        return status;
+
+    pjmedia_port_info_init(&tp->base.info, &trace, SIGNATURE,
+			   dn_port->info.clock_rate,
+			   dn_port->info.channel_count,
+			   dn_port->info.bits_per_sample,
+			   dn_port->info.samples_per_frame);
+
+    /* More init */
+    tp->dn_port = dn_port;
+    tp->ssrc_set = ssrc != NULL;
+    tp->ssrc = ssrc ? *ssrc : 0;
+    tp->late_us = (pj_int64_t)late_ms * 1000;
+    tp->rtp_clock = rtp_clock;
+    tp->base.get_frame = &tp_get_frame;
+    tp->base.put_frame = &tp_put_frame;
+    tp->base.on_destroy = &tp_on_destroy;
+
+    /* Done */
+    *p_port = &tp->base;
+
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_trace_port_get_statistics(
+        const pjmedia_port *port, em_trace_statistics *stats)
+{
+    struct trace_port *tp = (struct trace_port*)port;
+    PJ_ASSERT_RETURN(port->info.signature == SIGNATURE, PJ_EINVAL);
+    pj_memcpy(stats, &tp->stats, sizeof(em_trace_statistics));
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_trace_port_get_runs(const pjmedia_port *port,
+        em_hist *bursts, em_hist *gaps)
+{
+    const struct trace_port *tp = (const struct trace_port*)port;
+    PJ_ASSERT_RETURN(port->info.signature == SIGNATURE, PJ_EINVAL);
+    em_runs_get(&tp->runs, bursts, gaps);
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t tp_put_frame( pjmedia_port *this_port,
+				 const pjmedia_frame *frame)
+{
+    struct trace_port *tp = (struct trace_port*)this_port;
+    struct trace_slot *slot;
+    pj_bool_t lost = PJ_FALSE;
+    PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
+    EM_LOG(6, (THIS_FILE, "packet: sz=%d ts=%llu",
+                frame->size/sizeof(pj_uint16_t), frame->timestamp.u64));
+    if (frame->type == PJMEDIA_FRAME_TYPE_NONE ) {
+	    return pjmedia_port_put_frame(tp->dn_port, frame);
+    }
+
+    tp_fill(tp);
+    if (!tp->started || (tp->eof && !tp->has_pending &&
+                tp->target > tp->highest)) {
+        if (tp->stats.beyond == 0)
+            PJ_LOG(3, (THIS_FILE, "capture is shorter than the input, "
+                        "the rest of packets is not lost"));
+        tp->stats.beyond++;
+        em_runs_add(&tp->runs, PJ_FALSE);
+        return pjmedia_port_put_frame(tp->dn_port, frame);
+    }
+
+    slot = &tp->slots[tp->target % WINDOW];
+    if (!slot->present) {
+        tp->stats.lost++;
+        lost = PJ_TRUE;
+    } else {
+        /* transit time up to a constant: arrival minus the sending time */
+        pj_int64_t transit = slot->arrival_us -
+            slot->rtp_ts * 1000000 / tp->rtp_clock;
+        if (!tp->transit_set || transit < tp->min_transit) {
+            tp->min_transit = transit;
+            tp->transit_set = PJ_TRUE;
+        }
+        if (tp->late_us && transit - tp->min_transit > tp->late_us) {
+            EM_LOG(6, (THIS_FILE, "packet is late for %lld us",
+                        (long long)(transit - tp->min_transit)));
+            tp->stats.late++;
+            lost = PJ_TRUE;
+        } else {
+            tp->stats.received++;
+        }
+    }
+    slot->present = PJ_FALSE;
+    tp->target++;
+
+    em_runs_add(&tp->runs, lost);
+    if (lost) {
+        pjmedia_frame tmp_frame;
+        pj_bzero(&tmp_frame, sizeof(tmp_frame));
+        tmp_frame.type = PJMEDIA_FRAME_TYPE_NONE;
+        return pjmedia_port_put_frame(tp->dn_port, &tmp_frame);
+    }
+    return pjmedia_port_put_frame(tp->dn_port, frame);
+}
+
+
+static pj_status_t tp_get_frame( pjmedia_port *this_port,
+				 pjmedia_frame *frame)
+{
+    PJ_UNUSED_ARG(this_port);
+    PJ_UNUSED_ARG(frame);
+    return PJ_EINVALIDOP;
+}
+
+
+
+static pj_status_t tp_on_destroy(pjmedia_port *this_port)
+{
+    struct trace_port *tp = (struct trace_port*)this_port;
+    PJ_ASSERT_RETURN(this_port->info.signature == SIGNATURE, PJ_EINVAL);
+    PJ_LOG(5, (THIS_FILE, "trace statistics: received=%llu lost=%llu "
+                "late=%llu beyond=%llu",
+                (unsigned long long)tp->stats.received,
+                (unsigned long long)tp->stats.lost,
+                (unsigned long long)tp->stats.late,
+                (unsigned long long)tp->stats.beyond));
+    munmap((void*)tp->map, tp->map_size);
+    return PJ_SUCCESS;
+}
@@ -0,0 +1,38 @@
+#ifndef __TRACE_PORT_H__
+#define __TRACE_PORT_H__
+
+#include <pjlib.h>
+#include <pjlib-util.h>
+#include <pjmedia.h>
+#include "hist.h"
+
+typedef struct em_trace_statistics {
+    pj_uint64_t       received;
+    pj_uint64_t       lost;       /* missing in the trace */
+    pj_uint64_t       late;       /* arrived later than the jitter buffer allows */
+    pj_uint64_t       beyond;     /* emulated after the end of the trace */
+} em_trace_statistics;
+
+/*
+ * Channel driven by a packet capture (pcap or rtpdump file). The n-th
+ * packet put into the port shares the fate of the n-th RTP packet of the
+ * selected stream: it's lost if there is no such sequence number in the
+ * capture, or if it has arrived more than late_ms milliseconds later than
+ * the fastest packet of the stream (late_ms is 0 means "never late").
+ * If ssrc is NULL the first RTP stream found in the capture is used.
+ * rtp_clock is the clock rate of RTP timestamps of the capture, 0 means
+ * the one of its static payload type or, for dynamic ones, the clock
+ * rate of dn_port.
+ */
+PJ_DECL(pj_status_t) pjmedia_trace_port_create(pj_pool_t *pool,
+        pjmedia_port *dn_port, const char *filename, const pj_uint32_t *ssrc,
+        unsigned late_ms, unsigned rtp_clock, pjmedia_port **p_port);
+
+PJ_DECL(pj_status_t) pjmedia_trace_port_get_statistics(
+        const pjmedia_port *port, em_trace_statistics *stats);
+
+/* channel loss bursts and gaps between them, in packets */
+PJ_DECL(pj_status_t) pjmedia_trace_port_get_runs(const pjmedia_port *port,
+        em_hist *bursts, em_hist *gaps);
+
+#endif	/* __TRACE_PORT_H__ */
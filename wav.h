@@ -0,0 +1,85 @@
+#ifndef __WAV_H__
+#define __WAV_H__
+
+#include <string.h>
+#include <pjlib.h>
+#include <pjmedia.h>
+
+/* RIFF WAV helpers shared by the pipe and mapped file ports */
+
+#define EM_WAV_HEADER   44      /* of a plain PCM file, as written */
+
+PJ_INLINE(pj_uint16_t) em_le16(const pj_uint8_t *p)
+{
+    return (pj_uint16_t)(p[0] | (p[1] << 8));
+}
+
+PJ_INLINE(pj_uint32_t) em_le32(const pj_uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((pj_uint32_t)p[3] << 24);
+}
+
+PJ_INLINE(void) em_put_le16(pj_uint8_t *p, pj_uint16_t v)
+{
+    p[0] = (pj_uint8_t)v;
+    p[1] = (pj_uint8_t)(v >> 8);
+}
+
+PJ_INLINE(void) em_put_le32(pj_uint8_t *p, pj_uint32_t v)
+{
+    em_put_le16(p, (pj_uint16_t)v);
+    em_put_le16(p + 2, (pj_uint16_t)(v >> 16));
+}
+
+#if PJ_IS_BIG_ENDIAN
+PJ_INLINE(void) em_swap16(pj_uint8_t *p, pj_size_t size)
+{
+    pj_size_t i;
+    for (i=0; i+1<size; i+=2) {
+        pj_uint8_t tmp = p[i];
+        p[i] = p[i+1];
+        p[i+1] = tmp;
+    }
+}
+#endif
+
+/* "fmt " chunk of 16 bit PCM, the only supported one */
+PJ_INLINE(pj_status_t) em_wav_parse_fmt(const pj_uint8_t *fmt,
+        pj_uint32_t size, unsigned *clock_rate, unsigned *channel_count)
+{
+    pj_uint16_t tag;
+    if (size < 16)
+        return PJMEDIA_ENOTVALIDWAVE;
+    tag = em_le16(fmt);
+    *channel_count = em_le16(fmt + 2);
+    *clock_rate = em_le32(fmt + 4);
+    /* 0xfffe is WAVE_FORMAT_EXTENSIBLE */
+    if ((tag != 1 && tag != 0xfffe) || em_le16(fmt + 14) != 16 ||
+            *channel_count == 0 || *clock_rate == 0)
+        return PJMEDIA_EWAVEUNSUPP;
+    return PJ_SUCCESS;
+}
+
+/* header of data_size bytes of PCM, sizes are clipped to 32 bits */
+PJ_INLINE(void) em_wav_header(const pjmedia_port_info *info,
+        pj_uint64_t data_size, pj_uint8_t *hdr)
+{
+    pj_uint32_t size = data_size > 0xffffffff - 36 ? 0xffffffff - 36 :
+        (pj_uint32_t)data_size;
+    unsigned block_align = info->channel_count * info->bits_per_sample / 8;
+
+    memcpy(hdr, "RIFF", 4);
+    em_put_le32(hdr + 4, 36 + size);
+    memcpy(hdr + 8, "WAVEfmt ", 8);
+    em_put_le32(hdr + 16, 16);
+    em_put_le16(hdr + 20, 1);
+    em_put_le16(hdr + 22, (pj_uint16_t)info->channel_count);
+    em_put_le32(hdr + 24, info->clock_rate);
+    em_put_le32(hdr + 28, info->clock_rate * block_align);
+    em_put_le16(hdr + 32, (pj_uint16_t)block_align);
+    em_put_le16(hdr + 34, (pj_uint16_t)info->bits_per_sample);
+    memcpy(hdr + 36, "data", 4);
+    em_put_le32(hdr + 40, size);
+}
+
+#endif	/* __WAV_H__ */
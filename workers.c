@@ -0,0 +1,118 @@
+#include <unistd.h>
+#include "workers.h"
+#define THIS_FILE   "workers.c"
+#define MAX_THREADS 256
+
+struct workers
+{
+    pj_mutex_t       *mutex;
+    unsigned          next_job;   /* next job index to be taken by a thread */
+    unsigned          job_count;
+    em_job_func       func;
+    void             *arg;
+    pj_status_t       status;     /* first failure, if any */
+};
+
+
+static pj_bool_t wk_take_job(struct workers *wk, unsigned *job_index)
+{
+    pj_bool_t taken = PJ_FALSE;
+    pj_mutex_lock(wk->mutex);
+    /* do not start new jobs after the first failure */
+    if (wk->status == PJ_SUCCESS && wk->next_job < wk->job_count) {
+        *job_index = wk->next_job++;
+        taken = PJ_TRUE;
+    }
+    pj_mutex_unlock(wk->mutex);
+    return taken;
+}
+
+
+static int wk_thread_proc(void *arg)
+{
+    struct workers *wk = (struct workers*)arg;
+    unsigned job_index;
+    pj_status_t status;
+    while (wk_take_job(wk, &job_index)) {
+        status = wk->func(wk->arg, job_index);
+        if (status != PJ_SUCCESS) {
+            PJ_LOG(3, (THIS_FILE, "job %u failed with status %d",
+                        job_index, status));
+            pj_mutex_lock(wk->mutex);
+            if (wk->status == PJ_SUCCESS)
+                wk->status = status;
+            pj_mutex_unlock(wk->mutex);
+        }
+    }
+    return 0;
+}
+
+
+PJ_DEF(unsigned) em_workers_default_count(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        return 1;
+    if (cpus > MAX_THREADS)
+        return MAX_THREADS;
+    return (unsigned)cpus;
+}
+
+
+PJ_DEF(pj_status_t) em_workers_run(pj_pool_factory *pool_factory,
+        unsigned thread_count, unsigned job_count, em_job_func func,
+        void *arg)
+{
+    struct workers wk;
+    pj_thread_t *threads[MAX_THREADS];
+    pj_pool_t *pool;
+    pj_status_t status;
+    unsigned i, started = 0;
+
+    PJ_ASSERT_RETURN(pool_factory && func, PJ_EINVAL);
+    if (thread_count == 0)
+        thread_count = em_workers_default_count();
+    if (thread_count > MAX_THREADS)
+        thread_count = MAX_THREADS;
+    if (thread_count > job_count)
+        thread_count = job_count;
+    if (job_count == 0)
+        return PJ_SUCCESS;
+
+    pool = pj_pool_create(pool_factory, "workers", 1000, 1000, NULL);
+    wk.next_job = 0;
+    wk.job_count = job_count;
+    wk.func = func;
+    wk.arg = arg;
+    wk.status = PJ_SUCCESS;
+    status = pj_mutex_create_simple(pool, "workers", &wk.mutex);
+    if (status != PJ_SUCCESS) {
+        pj_pool_release(pool);
+        return status;
+    }
+    PJ_LOG(5, (THIS_FILE, "running %u jobs on %u threads", job_count,
+                thread_count));
+
+    /* the calling thread is busy waiting anyway, so with one thread
+       there is no reason to spawn anything */
+    if (thread_count == 1) {
+        wk_thread_proc(&wk);
+    } else {
+        for (i=0; i<thread_count; i++) {
+            status = pj_thread_create(pool, "worker", &wk_thread_proc, &wk,
+                    0, 0, &threads[i]);
+            if (status != PJ_SUCCESS)
+                break;
+            started++;
+        }
+        if (started == 0)
+            wk.status = status;
+        for (i=0; i<started; i++) {
+            pj_thread_join(threads[i]);
+            pj_thread_destroy(threads[i]);
+        }
+    }
+    pj_mutex_destroy(wk.mutex);
+    pj_pool_release(pool);
+    return wk.status;
+}
@@ -0,0 +1,15 @@
+#ifndef __WORKERS_H__
+#define __WORKERS_H__
+
+#include <pjlib.h>
+
+/* job callback: called once for every index in [0, job_count) */
+typedef pj_status_t (*em_job_func)(void *arg, unsigned job_index);
+
+PJ_DECL(unsigned) em_workers_default_count(void);
+
+PJ_DECL(pj_status_t) em_workers_run(pj_pool_factory *pool_factory,
+        unsigned thread_count, unsigned job_count, em_job_func func,
+        void *arg);
+
+#endif	/* __WORKERS_H__ */
@@ -0,0 +1,248 @@
+#include "wsola.h"
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#define THIS_FILE   "wsola.c"
+#define MIN_PITCH_MS    2.5     /* 400 Hz */
+#define MAX_PITCH_MS    15      /* 66 Hz */
+#define WINDOW_MS       5       /* matched before the end of history */
+#define PERIOD_MS       10      /* a period more is repeated every 10 ms */
+#define MAX_PERIODS     3
+#define ATTENUATE_MS    10      /* full level */
+#define MUTE_MS         60      /* then 20% less each 10 ms */
+#define FADE_IN_MS      4       /* of a frame after a loss, 4 ms more each */
+#define MAX_FADE_IN_MS  10      /* 10 ms of it */
+
+/* lengths are of interleaved samples, lags are multiples of channel_count */
+struct em_wsola
+{
+    unsigned          channel_count;
+    unsigned          min_lag;
+    unsigned          max_lag;
+    unsigned          window;
+    unsigned          fade_in;    /* samples, as many more per 10 ms lost */
+    unsigned          fade_max;
+    unsigned          period;     /* samples between period increments */
+    unsigned          attenuate;  /* samples */
+    float             step;       /* attenuation per sample */
+    unsigned          hist_len;
+    float            *hist;       /* the latest received samples at the end */
+    float            *pattern;    /* periods repeated */
+    float            *tail;       /* synthesis to fade a frame in */
+    unsigned          lag;
+    unsigned          periods;
+    unsigned          len;        /* of pattern */
+    unsigned          pos;        /* in pattern */
+    unsigned          lost;       /* samples made in this loss */
+    float             gain;
+};
+
+
+/* sum of a[i]*b[i], AVX2 with -mavx2, SSE2 on x86-64, plain C elsewhere */
+static float dot(const float *a, const float *b, unsigned n)
+{
+    float sum = 0;
+    unsigned i = 0;
+#if defined(__AVX2__)
+    __m256 acc = _mm256_setzero_ps();
+    float lanes[8];
+    unsigned k;
+    for (; i + 8 <= n; i += 8)
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(a + i),
+                    _mm256_loadu_ps(b + i)));
+    _mm256_storeu_ps(lanes, acc);
+    for (k=0; k<8; k++)
+        sum += lanes[k];
+#elif defined(__SSE2__)
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    float lanes[4];
+    unsigned k;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i),
+                    _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4),
+                    _mm_loadu_ps(b + i + 4)));
+    }
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    for (k=0; k<4; k++)
+        sum += lanes[k];
+#endif
+    for (; i<n; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+
+PJ_DEF(pj_status_t) em_wsola_create(pj_pool_t *pool, unsigned clock_rate,
+        unsigned channel_count, em_wsola **p_wsola)
+{
+    em_wsola *w;
+
+    PJ_ASSERT_RETURN(pool && clock_rate && channel_count && p_wsola,
+            PJ_EINVAL);
+    w = PJ_POOL_ZALLOC_T(pool, em_wsola);
+    w->channel_count = channel_count;
+    w->min_lag = (unsigned)(clock_rate * MIN_PITCH_MS / 1000) * channel_count;
+    w->max_lag = clock_rate * MAX_PITCH_MS / 1000 * channel_count;
+    w->window = clock_rate * WINDOW_MS / 1000 * channel_count;
+    if (w->min_lag < 2 * channel_count || !w->window)
+        return PJ_EINVAL;
+    w->fade_in = clock_rate * FADE_IN_MS / 1000 * channel_count;
+    w->fade_max = clock_rate * MAX_FADE_IN_MS / 1000 * channel_count;
+    w->period = clock_rate * PERIOD_MS / 1000 * channel_count;
+    w->attenuate = clock_rate * ATTENUATE_MS / 1000 * channel_count;
+    w->step = 1.0f / (clock_rate * (MUTE_MS - ATTENUATE_MS) / 1000 *
+            channel_count);
+    /* the longest pattern is preceded by a period to fade into */
+    w->hist_len = w->max_lag * (MAX_PERIODS + 1);
+    w->hist = (float*)pj_pool_calloc(pool, w->hist_len, sizeof(float));
+    w->pattern = (float*)pj_pool_calloc(pool, w->max_lag * MAX_PERIODS,
+            sizeof(float));
+    w->tail = (float*)pj_pool_calloc(pool, w->fade_max, sizeof(float));
+    if (!w->hist || !w->pattern || !w->tail)
+        return PJ_ENOMEM;
+    em_wsola_reset(w);
+    *p_wsola = w;
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(void) em_wsola_reset(em_wsola *w)
+{
+    pj_bzero(w->hist, w->hist_len * sizeof(float));
+    w->lost = 0;
+    w->gain = 1.0f;
+}
+
+
+/* the lag maximizing the normalized correlation of the window before the
+   end of history with an earlier one */
+static unsigned find_lag(const em_wsola *w)
+{
+    const float *tpl = w->hist + w->hist_len - w->window;
+    const float *seg = tpl - w->min_lag;
+    float energy = dot(seg, seg, w->window);
+    float best_score = -1;
+    unsigned ch = w->channel_count;
+    unsigned lag, best = w->max_lag, k;
+
+    for (lag=w->min_lag; lag<=w->max_lag; lag+=ch, seg-=ch) {
+        float c = dot(tpl, seg, w->window);
+        if (c > 0 && energy > 0 && c * c / energy > best_score) {
+            best_score = c * c / energy;
+            best = lag;
+        }
+        /* the segment slides a sample of every channel back */
+        for (k=1; k<=ch; k++)
+            energy += seg[-(int)k] * seg[-(int)k] -
+                seg[w->window - k] * seg[w->window - k];
+    }
+    return best;
+}
+
+
+/* last periods of history, the end fades into what precedes the start so
+   that the pattern repeats smoothly */
+static void build_pattern(em_wsola *w)
+{
+    const float *end = w->hist + w->hist_len;
+    unsigned ola = w->lag / 4, i;
+
+    w->len = w->lag * w->periods;
+    pj_memcpy(w->pattern, end - w->len, w->len * sizeof(float));
+    if (!ola)
+        return;
+    for (i=0; i<ola; i++) {
+        unsigned j = w->len - ola + i;
+        float in = (i + 0.5f) / ola;
+        w->pattern[j] = w->pattern[j] * (1 - in) +
+            end[(int)j - (int)w->len - (int)w->lag] * in;
+    }
+}
+
+
+static void synthesize(em_wsola *w, float *dst, unsigned count)
+{
+    unsigned i;
+
+    if (!w->lost) {
+        w->lag = find_lag(w);
+        w->periods = 1;
+        w->pos = 0;
+        w->gain = 1.0f;
+        build_pattern(w);
+    }
+    for (i=0; i<count; i++, w->lost++) {
+        /* pattern is extended at its start, where the joint is smooth */
+        if (w->pos == 0 && w->periods < MAX_PERIODS &&
+                w->lost >= w->period * w->periods) {
+            w->periods++;
+            build_pattern(w);
+        }
+        if (w->lost >= w->attenuate && w->gain > 0) {
+            w->gain -= w->step;
+            if (w->gain < 0)
+                w->gain = 0;
+        }
+        dst[i] = w->pattern[w->pos] * w->gain;
+        if (++w->pos == w->len)
+            w->pos = 0;
+    }
+}
+
+
+static pj_int16_t clip(float s)
+{
+    if (s >= 32767.0f)
+        return 32767;
+    if (s <= -32768.0f)
+        return -32768;
+    return (pj_int16_t)(s < 0 ? s - 0.5f : s + 0.5f);
+}
+
+
+PJ_DEF(void) em_wsola_save(em_wsola *w, pj_int16_t *samples, unsigned count)
+{
+    unsigned i, keep;
+
+    if (w->lost) {
+        unsigned fade = w->fade_in * (1 + w->lost / w->period);
+        if (fade > w->fade_max)
+            fade = w->fade_max;
+        if (fade > count)
+            fade = count;
+        synthesize(w, w->tail, fade);
+        for (i=0; i<fade; i++) {
+            float in = (i + 0.5f) / fade;
+            samples[i] = clip(samples[i] * in + w->tail[i] * (1 - in));
+        }
+        w->lost = 0;
+    }
+
+    /* shift the history by count samples */
+    if (count >= w->hist_len) {
+        samples += count - w->hist_len;
+        count = w->hist_len;
+    }
+    keep = w->hist_len - count;
+    pj_memmove(w->hist, w->hist + count, keep * sizeof(float));
+    for (i=0; i<count; i++)
+        w->hist[keep + i] = samples[i];
+}
+
+
+PJ_DEF(void) em_wsola_generate(em_wsola *w, pj_int16_t *samples,
+        unsigned count)
+{
+    float buf[64];
+    unsigned done = 0, i;
+
+    while (done < count) {
+        unsigned n = count - done < PJ_ARRAY_SIZE(buf) ?
+            count - done : PJ_ARRAY_SIZE(buf);
+        synthesize(w, buf, n);
+        for (i=0; i<n; i++)
+            samples[done + i] = clip(buf[i]);
+        done += n;
+    }
+}
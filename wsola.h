@@ -0,0 +1,32 @@
+#ifndef __WSOLA_H__
+#define __WSOLA_H__
+
+#include <pjlib.h>
+
+/*
+ * Codec independent concealment of 16 bit PCM, after ITU-T G.711
+ * Appendix I: the pitch is found by normalized cross-correlation over the
+ * history, lost frames are made by repeating the last one, two and then
+ * three pitch periods with overlap-add at the joints, attenuated after
+ * 10 ms and muted after 60 ms. The first frame after a loss is cross-faded
+ * with the continued synthesis. All the buffers are allocated on create,
+ * the cost of a lost frame is bounded by the pitch search.
+ */
+typedef struct em_wsola em_wsola;
+
+/* samples of channel_count channels are interleaved */
+PJ_DECL(pj_status_t) em_wsola_create(pj_pool_t *pool, unsigned clock_rate,
+        unsigned channel_count, em_wsola **p_wsola);
+
+/* forgets the history, to reuse the state for another stream */
+PJ_DECL(void) em_wsola_reset(em_wsola *wsola);
+
+/* takes a received frame into the history, fades it in after a loss */
+PJ_DECL(void) em_wsola_save(em_wsola *wsola, pj_int16_t *samples,
+        unsigned count);
+
+/* makes a lost frame */
+PJ_DECL(void) em_wsola_generate(em_wsola *wsola, pj_int16_t *samples,
+        unsigned count);
+
+#endif	/* __WSOLA_H__ */